@@ -0,0 +1,286 @@
+//
+//  Base64.cpp
+//  Encoder Demo
+//
+//  The vector loops follow the well-known shuffle/multiply approach
+//  (see Wojciech Mula and Alfred Klomp's work): reshuffle each 3-byte
+//  group into four 6-bit indices, then map indices to ASCII with a
+//  table lookup, and the reverse for decoding.
+//
+
+#include "Base64.h"
+#include <string.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define BASE64_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define BASE64_SSSE3 1
+#endif
+
+static const char encode_table[64 + 1] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0xff for characters outside the alphabet
+static const BYTE decode_table[256] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// --- vector loops ----------------------------------------------
+// each returns the number of input bytes (or chars) it consumed,
+// and leaves the tail for the scalar code
+
+#if BASE64_NEON
+
+static int encode_block(const BYTE* src, int cBytes, char* dst)
+{
+    const uint8x16x4_t table = vld1q_u8_x4((const uint8_t*)encode_table);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+    int done = 0;
+    while ((cBytes - done) >= 48)
+    {
+        // de-interleave 16 groups of three bytes
+        uint8x16x3_t in = vld3q_u8(src + done);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(in.val[0], 2);
+        idx.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[1], 4), vshlq_n_u8(in.val[0], 4)), mask);
+        idx.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[2], 6), vshlq_n_u8(in.val[1], 2)), mask);
+        idx.val[3] = vandq_u8(in.val[2], mask);
+
+        uint8x16x4_t out;
+        out.val[0] = vqtbl4q_u8(table, idx.val[0]);
+        out.val[1] = vqtbl4q_u8(table, idx.val[1]);
+        out.val[2] = vqtbl4q_u8(table, idx.val[2]);
+        out.val[3] = vqtbl4q_u8(table, idx.val[3]);
+        vst4q_u8((uint8_t*)dst + ((done / 3) * 4), out);
+        done += 48;
+    }
+    return done;
+}
+
+static inline uint8x16_t decode_lookup(uint8x16_t c, const uint8x16x4_t& lo, const uint8x16x4_t& hi)
+{
+    // out-of-range indices give 0, so each half only answers for its own range
+    return vorrq_u8(vqtbl4q_u8(lo, c), vqtbl4q_u8(hi, vsubq_u8(c, vdupq_n_u8(64))));
+}
+
+static int decode_block(const char* src, int cChars, BYTE* dst)
+{
+    const uint8x16x4_t lo = vld1q_u8_x4(decode_table);
+    const uint8x16x4_t hi = vld1q_u8_x4(decode_table + 64);
+    int done = 0;
+
+    // stop short of the final group, which may carry padding
+    while ((cChars - done) > 64)
+    {
+        uint8x16x4_t in = vld4q_u8((const uint8_t*)src + done);
+        uint8x16_t any = vorrq_u8(vorrq_u8(in.val[0], in.val[1]), vorrq_u8(in.val[2], in.val[3]));
+        if (vmaxvq_u8(any) >= 0x80)
+        {
+            break;
+        }
+        uint8x16_t d0 = decode_lookup(in.val[0], lo, hi);
+        uint8x16_t d1 = decode_lookup(in.val[1], lo, hi);
+        uint8x16_t d2 = decode_lookup(in.val[2], lo, hi);
+        uint8x16_t d3 = decode_lookup(in.val[3], lo, hi);
+        uint8x16_t bad = vorrq_u8(vorrq_u8(d0, d1), vorrq_u8(d2, d3));
+        if (vmaxvq_u8(bad) > 63)
+        {
+            break;
+        }
+        uint8x16x3_t out;
+        out.val[0] = vorrq_u8(vshlq_n_u8(d0, 2), vshrq_n_u8(d1, 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(d1, 4), vshrq_n_u8(d2, 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(d2, 6), d3);
+        vst3q_u8(dst + ((done / 4) * 3), out);
+        done += 64;
+    }
+    return done;
+}
+
+#elif BASE64_SSSE3
+
+static int encode_block(const BYTE* src, int cBytes, char* dst)
+{
+    const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    int done = 0;
+
+    // each step loads 16 bytes but uses only 12 of them
+    while ((cBytes - done) >= 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + done));
+
+        // put each group's 24 bits into a 32-bit lane as two 16-bit
+        // halves, then move the four 6-bit fields into separate bytes
+        in = _mm_shuffle_epi8(in, shuf);
+        __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(t1, t3);
+
+        // 0..25 -> 'A', 26..51 -> 'a', 52..61 -> '0', 62 -> '+', 63 -> '/'
+        __m128i range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        range = _mm_sub_epi8(range, _mm_cmpgt_epi8(idx, _mm_set1_epi8(25)));
+        __m128i out = _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, range));
+
+        _mm_storeu_si128((__m128i*)(dst + ((done / 3) * 4)), out);
+        done += 12;
+    }
+    return done;
+}
+
+static int decode_block(const char* src, int cChars, BYTE* dst)
+{
+    // classify by nibble: a character is invalid if its high- and
+    // low-nibble class bits overlap
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int done = 0;
+
+    // each step stores 16 bytes of which 12 are valid, so keep well
+    // clear of the end of the output (and of any padding)
+    while ((cChars - done) >= 24)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + done));
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+        __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+        if (_mm_movemask_epi8(bad) != 0xffff)
+        {
+            break;
+        }
+
+        // ASCII to 6-bit values
+        __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+        __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+        __m128i vals = _mm_add_epi8(in, roll);
+
+        // merge four 6-bit values into 24 bits per lane, then pack
+        __m128i merged = _mm_maddubs_epi16(vals, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        merged = _mm_shuffle_epi8(merged, pack);
+        _mm_storeu_si128((__m128i*)(dst + ((done / 4) * 3)), merged);
+        done += 16;
+    }
+    return done;
+}
+
+#else
+
+static int encode_block(const BYTE*, int, char*)
+{
+    return 0;
+}
+
+static int decode_block(const char*, int, BYTE*)
+{
+    return 0;
+}
+
+#endif
+
+// --- scalar ----------------------------------------------------
+
+int Base64Encode(const BYTE* src, int cBytes, char* dst)
+{
+    int done = encode_block(src, cBytes, dst);
+    const BYTE* p = src + done;
+    char* out = dst + ((done / 3) * 4);
+    int cRemain = cBytes - done;
+
+    while (cRemain >= 3)
+    {
+        unsigned long val = (p[0] << 16) | (p[1] << 8) | p[2];
+        out[0] = encode_table[(val >> 18) & 0x3f];
+        out[1] = encode_table[(val >> 12) & 0x3f];
+        out[2] = encode_table[(val >> 6) & 0x3f];
+        out[3] = encode_table[val & 0x3f];
+        p += 3;
+        out += 4;
+        cRemain -= 3;
+    }
+    if (cRemain > 0)
+    {
+        unsigned long val = p[0] << 16;
+        if (cRemain == 2)
+        {
+            val |= p[1] << 8;
+        }
+        out[0] = encode_table[(val >> 18) & 0x3f];
+        out[1] = encode_table[(val >> 12) & 0x3f];
+        out[2] = (cRemain == 2) ? encode_table[(val >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    return (int)(out - dst);
+}
+
+int Base64Decode(const char* src, int cChars, BYTE* dst)
+{
+    if ((cChars % 4) != 0)
+    {
+        return -1;
+    }
+    int done = decode_block(src, cChars, dst);
+    const BYTE* p = (const BYTE*)src + done;
+    BYTE* out = dst + ((done / 4) * 3);
+
+    for (int i = done; i < cChars; i += 4, p += 4)
+    {
+        BYTE a = decode_table[p[0]];
+        BYTE b = decode_table[p[1]];
+        BYTE c = decode_table[p[2]];
+        BYTE d = decode_table[p[3]];
+        bool bLast = ((i + 4) == cChars);
+        if ((a | b) > 63)
+        {
+            return -1;
+        }
+        *out++ = (a << 2) | (b >> 4);
+        if (bLast && (p[2] == '=') && (p[3] == '='))
+        {
+            break;
+        }
+        if (c > 63)
+        {
+            return -1;
+        }
+        *out++ = (b << 4) | (c >> 2);
+        if (bLast && (p[3] == '='))
+        {
+            break;
+        }
+        if (d > 63)
+        {
+            return -1;
+        }
+        *out++ = (c << 6) | d;
+    }
+    return (int)(out - dst);
+}
@@ -0,0 +1,31 @@
+//
+//  Base64.h
+//  Encoder Demo
+//
+//  RFC 4648 base64 (standard alphabet, with padding). Uses NEON on
+//  arm64 and SSSE3 on x86 for the bulk of the data, and a table-driven
+//  scalar loop for the rest and for other targets.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+
+// characters produced for cBytes of input (no terminating null)
+inline int Base64EncodedLength(int cBytes)
+{
+    return ((cBytes + 2) / 3) * 4;
+}
+
+// upper bound on bytes produced for cChars of input
+inline int Base64DecodedMaxLength(int cChars)
+{
+    return (cChars / 4) * 3;
+}
+
+// returns the number of characters written to dst
+int Base64Encode(const BYTE* src, int cBytes, char* dst);
+
+// returns the number of bytes written to dst, or -1 if src is not
+// valid padded base64
+int Base64Decode(const char* src, int cChars, BYTE* dst);
@@ -18,6 +18,9 @@
 
 + (CameraServer*) server;
 - (void) startup;
+
+// serve a recorded capture (see CaptureReplay) instead of the camera
+- (void) startupWithCapture:(NSString*) path speed:(double) speed;
 - (void) shutdown;
 - (NSString*) getURL;
 - (AVCaptureVideoPreviewLayer*) getPreviewLayer;
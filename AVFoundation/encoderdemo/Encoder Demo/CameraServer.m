@@ -9,6 +9,7 @@
 #import "CameraServer.h"
 #import "AVEncoder.h"
 #import "RTSPServer.h"
+#import "CaptureReplay.h"
 
 static CameraServer* theServer;
 
@@ -20,6 +21,7 @@ static CameraServer* theServer;
     dispatch_queue_t _captureQueue;
     
     AVEncoder* _encoder;
+    CaptureReplay* _replay;
     
     RTSPServer* _rtsp;
 }
@@ -87,6 +89,26 @@ static CameraServer* theServer;
     }
 }
 
+- (void) startupWithCapture:(NSString*) path speed:(double) speed
+{
+    if ((_session == nil) && (_replay == nil))
+    {
+        NSLog(@"Starting up server from capture %@", path);
+        _replay = [CaptureReplay replayWithFile:path speed:speed];
+        [_replay encodeWithBlock:^int(NSArray* data, double pts) {
+            if (_rtsp != nil)
+            {
+                _rtsp.bitrate = _replay.bitspersecond;
+                [_rtsp onVideoData:data time:pts];
+            }
+            return 0;
+        } onParams:^int(NSData *data) {
+            _rtsp = [RTSPServer setupListener:data];
+            return 0;
+        }];
+    }
+}
+
 - (void) captureOutput:(AVCaptureOutput *)captureOutput didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer fromConnection:(AVCaptureConnection *)connection
 {
     // pass frame to encoder
@@ -109,6 +131,11 @@ static CameraServer* theServer;
     {
         [ _encoder shutdown];
     }
+    if (_replay)
+    {
+        [_replay shutdown];
+        _replay = nil;
+    }
 }
 
 - (NSString*) getURL
@@ -0,0 +1,801 @@
+//
+//  CaptureReader.cpp
+//  Encoder Demo
+//
+//  pcap/pcapng walking and H.264 depacketization.
+//
+
+#include "CaptureReader.h"
+#include "Base64.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+// interleaved data that never resolves into frames is dropped beyond this
+static const int max_stream_buffer = 1024 * 1024;
+static const int max_text_line = 4096;
+
+// network byte order, whatever the capture file's order
+static uint16_t be16(const BYTE* p)
+{
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+static uint32_t be32(const BYTE* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static bool IsRTP(const BYTE* p, int cBytes)
+{
+    // RTCP packet types 200-204 look like payload types 72-76 with the marker set
+    return (cBytes >= 12) && ((p[0] & 0xc0) == 0x80) && ((p[1] < 200) || (p[1] > 204));
+}
+
+// --- capture file ------------------------------------------------
+
+CaptureReader::CaptureReader()
+: m_fd(-1),
+  m_pFile(NULL),
+  m_cFile(0),
+  m_pos(0),
+  m_bNG(false),
+  m_bSwapped(false),
+  m_port(0),
+  m_linkType(0),
+  m_tickSeconds(1e-6),
+  m_pPending(NULL),
+  m_lastTime(0),
+  m_cRecords(0),
+  m_cSkipped(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    Close();
+}
+
+bool
+CaptureReader::Open(const char* path)
+{
+    Close();
+    m_fd = open(path, O_RDONLY);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    struct stat s;
+    if ((fstat(m_fd, &s) != 0) || (s.st_size < 24))
+    {
+        Close();
+        return false;
+    }
+    void* pMap = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (pMap == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+    // one pass from front to back: let the kernel read well ahead
+    madvise(pMap, s.st_size, MADV_SEQUENTIAL);
+    m_pFile = (const BYTE*)pMap;
+    m_cFile = s.st_size;
+
+    const BYTE* p = m_pFile;
+    if ((p[0] == 0x0a) && (p[1] == 0x0d) && (p[2] == 0x0d) && (p[3] == 0x0a))
+    {
+        // pcapng: the section header is read as the first block
+        m_bNG = true;
+        m_pos = 0;
+        return true;
+    }
+
+    // classic pcap: the magic number gives byte order and time resolution
+    uint32_t magic = be32(p);
+    if ((magic == 0xa1b2c3d4) || (magic == 0xa1b23c4d))
+    {
+        m_bSwapped = true;
+    }
+    else if ((magic == 0xd4c3b2a1) || (magic == 0x4d3cb2a1))
+    {
+        m_bSwapped = false;
+    }
+    else
+    {
+        Close();
+        return false;
+    }
+    m_tickSeconds = ((magic == 0xa1b23c4d) || (magic == 0x4d3cb2a1)) ? 1e-9 : 1e-6;
+    m_linkType = Read32(p + 20) & 0xffff;
+    m_pos = 24;
+    return true;
+}
+
+void
+CaptureReader::Close()
+{
+    if (m_pFile != NULL)
+    {
+        munmap((void*)m_pFile, m_cFile);
+        m_pFile = NULL;
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_cFile = 0;
+    m_pos = 0;
+    m_bNG = false;
+    m_interfaces.clear();
+    m_streams.clear();
+    m_pPending = NULL;
+    m_paramSets.clear();
+    m_cRecords = 0;
+    m_cSkipped = 0;
+}
+
+uint16_t
+CaptureReader::Read16(const BYTE* p)
+{
+    // m_bSwapped: the file was written big-endian
+    return m_bSwapped ? be16(p) : uint16_t(p[0] | (p[1] << 8));
+}
+
+uint32_t
+CaptureReader::Read32(const BYTE* p)
+{
+    return m_bSwapped ? be32(p) : (uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24));
+}
+
+bool
+CaptureReader::Next(CapturedRTP* pPacket)
+{
+    if ((m_pPending != NULL) && NextInterleaved(pPacket))
+    {
+        return true;
+    }
+    m_pPending = NULL;
+
+    double time;
+    const BYTE* p;
+    int cBytes;
+    int linkType;
+    while (m_bNG ? NextBlock(&time, &p, &cBytes, &linkType) : NextRecord(&time, &p, &cBytes, &linkType))
+    {
+        m_cRecords++;
+        if (OnFrame(time, p, cBytes, linkType, pPacket))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+CaptureReader::NextRecord(double* pTime, const BYTE** pp, int* pcBytes, int* pLinkType)
+{
+    if ((m_pos + 16) > m_cFile)
+    {
+        return false;
+    }
+    const BYTE* p = m_pFile + m_pos;
+    uint32_t cCaptured = Read32(p + 8);
+    if ((m_pos + 16 + int64_t(cCaptured)) > m_cFile)
+    {
+        // truncated by the capture being stopped
+        return false;
+    }
+    *pTime = Read32(p) + (Read32(p + 4) * m_tickSeconds);
+    *pp = p + 16;
+    *pcBytes = (int)cCaptured;
+    *pLinkType = m_linkType;
+    m_pos += 16 + cCaptured;
+    return true;
+}
+
+bool
+CaptureReader::NextBlock(double* pTime, const BYTE** pp, int* pcBytes, int* pLinkType)
+{
+    while ((m_pos + 12) <= m_cFile)
+    {
+        const BYTE* p = m_pFile + m_pos;
+        uint32_t type = be32(p);
+        if (type == 0x0a0d0d0a)
+        {
+            // section header: byte order is set from its magic, and the
+            // interfaces described before it no longer apply
+            m_bSwapped = (be32(p + 8) == 0x1a2b3c4d);
+            m_interfaces.clear();
+        }
+        else
+        {
+            type = Read32(p);
+        }
+        uint32_t cBlock = Read32(p + 4);
+        if ((cBlock < 12) || ((m_pos + int64_t(cBlock)) > m_cFile))
+        {
+            return false;
+        }
+        m_pos += cBlock;
+
+        if ((type == 1) && (cBlock >= 20))
+        {
+            // interface description; if_tsresol may change the default microseconds
+            Interface iface;
+            iface.linkType = Read16(p + 8);
+            iface.tickSeconds = 1e-6;
+            const BYTE* opt = p + 16;
+            const BYTE* end = p + cBlock - 4;
+            while ((opt + 4) <= end)
+            {
+                int code = Read16(opt);
+                int cOpt = Read16(opt + 2);
+                if ((code == 0) || ((opt + 4 + cOpt) > end))
+                {
+                    break;
+                }
+                if ((code == 9) && (cOpt >= 1))
+                {
+                    int resolution = opt[4];
+                    iface.tickSeconds = (resolution & 0x80) ? pow(2.0, -(resolution & 0x7f)) : pow(10.0, -resolution);
+                }
+                opt += 4 + ((cOpt + 3) & ~3);
+            }
+            m_interfaces.push_back(iface);
+        }
+        else if ((type == 6) && (cBlock >= 32))
+        {
+            // enhanced packet
+            uint32_t idx = Read32(p + 8);
+            uint32_t cCaptured = Read32(p + 20);
+            if ((idx >= m_interfaces.size()) || (cCaptured > (cBlock - 32)))
+            {
+                m_cSkipped++;
+                continue;
+            }
+            uint64_t ticks = (uint64_t(Read32(p + 12)) << 32) | Read32(p + 16);
+            m_lastTime = ticks * m_interfaces[idx].tickSeconds;
+            *pTime = m_lastTime;
+            *pp = p + 28;
+            *pcBytes = (int)cCaptured;
+            *pLinkType = m_interfaces[idx].linkType;
+            return true;
+        }
+        else if ((type == 3) && (cBlock >= 16) && !m_interfaces.empty())
+        {
+            // simple packet: always interface 0, and no timestamp
+            uint32_t cOriginal = Read32(p + 8);
+            *pTime = m_lastTime;
+            *pp = p + 12;
+            *pcBytes = (int)((cOriginal < (cBlock - 16)) ? cOriginal : (cBlock - 16));
+            *pLinkType = m_interfaces[0].linkType;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+CaptureReader::OnFrame(double time, const BYTE* p, int cBytes, int linkType, CapturedRTP* pPacket)
+{
+    // link layer, to an ethertype
+    int ethertype = 0;
+    int cHeader = 0;
+    switch (linkType)
+    {
+    case 1:     // Ethernet, possibly VLAN tagged
+        if (cBytes < 14)
+        {
+            break;
+        }
+        ethertype = be16(p + 12);
+        cHeader = 14;
+        while (((ethertype == 0x8100) || (ethertype == 0x88a8)) && ((cHeader + 4) <= cBytes))
+        {
+            ethertype = be16(p + cHeader + 2);
+            cHeader += 4;
+        }
+        break;
+
+    case 113:   // Linux cooked
+        if (cBytes >= 16)
+        {
+            ethertype = be16(p + 14);
+            cHeader = 16;
+        }
+        break;
+
+    case 276:   // Linux cooked v2
+        if (cBytes >= 20)
+        {
+            ethertype = be16(p);
+            cHeader = 20;
+        }
+        break;
+
+    case 0:     // BSD loopback: address family in the capturing host's order
+    case 108:
+        if (cBytes >= 4)
+        {
+            int family = (p[0] != 0) ? p[0] : p[3];
+            ethertype = (family == 2) ? 0x0800 : (((family == 24) || (family == 28) || (family == 30)) ? 0x86dd : 0);
+            cHeader = 4;
+        }
+        break;
+
+    case 12:    // raw IP
+    case 14:
+    case 101:
+    case 228:
+    case 229:
+        if (cBytes >= 1)
+        {
+            ethertype = ((p[0] >> 4) == 6) ? 0x86dd : 0x0800;
+        }
+        break;
+    }
+    p += cHeader;
+    cBytes -= cHeader;
+
+    // network layer, to a transport protocol and a flow key
+    int protocol = 0;
+    std::vector<BYTE> flow;
+    if ((ethertype == 0x0800) && (cBytes >= 20) && ((p[0] >> 4) == 4))
+    {
+        int cIP = (p[0] & 0x0f) * 4;
+        int cTotal = be16(p + 2);
+        if ((be16(p + 6) & 0x3fff) != 0)
+        {
+            // fragments: RTP here fits in one datagram, so these are not ours
+            m_cSkipped++;
+            return false;
+        }
+        if ((cTotal < cBytes) && (cTotal >= cIP))
+        {
+            // Ethernet padding on short frames
+            cBytes = cTotal;
+        }
+        protocol = p[9];
+        flow.assign(p + 12, p + 20);
+        p += cIP;
+        cBytes -= cIP;
+    }
+    else if ((ethertype == 0x86dd) && (cBytes >= 40))
+    {
+        int cPayload = be16(p + 4);
+        protocol = p[6];
+        flow.assign(p + 8, p + 40);
+        p += 40;
+        cBytes -= 40;
+        if (cPayload < cBytes)
+        {
+            cBytes = cPayload;
+        }
+        // hop-by-hop, routing and destination options
+        while (((protocol == 0) || (protocol == 43) || (protocol == 60)) && (cBytes >= 8))
+        {
+            int cExt = (p[1] + 1) * 8;
+            if (cExt > cBytes)
+            {
+                break;
+            }
+            protocol = p[0];
+            p += cExt;
+            cBytes -= cExt;
+        }
+    }
+    else
+    {
+        m_cSkipped++;
+        return false;
+    }
+
+    if ((protocol == 17) && (cBytes >= 8))
+    {
+        int portSrc = be16(p);
+        int portDst = be16(p + 2);
+        int cUDP = be16(p + 4);
+        if ((cUDP >= 8) && (cUDP < cBytes))
+        {
+            cBytes = cUDP;
+        }
+        if ((m_port != 0) && (portSrc != m_port) && (portDst != m_port))
+        {
+            return false;
+        }
+        if (!IsRTP(p + 8, cBytes - 8))
+        {
+            return false;
+        }
+        pPacket->time = time;
+        pPacket->p = p + 8;
+        pPacket->cBytes = cBytes - 8;
+        pPacket->bInterleaved = false;
+        return true;
+    }
+    else if ((protocol == 6) && (cBytes >= 20))
+    {
+        int cTCP = (p[12] >> 4) * 4;
+        if ((cTCP < 20) || (cTCP > cBytes))
+        {
+            m_cSkipped++;
+            return false;
+        }
+        flow.insert(flow.end(), p, p + 4);
+        return OnTCP(time, flow, be32(p + 4), p + cTCP, cBytes - cTCP, pPacket);
+    }
+    m_cSkipped++;
+    return false;
+}
+
+bool
+CaptureReader::OnTCP(double time, const std::vector<BYTE>& flow, uint32_t seq, const BYTE* p, int cBytes, CapturedRTP* pPacket)
+{
+    if (cBytes <= 0)
+    {
+        return false;
+    }
+    Stream& s = m_streams[flow];
+    if (!s.bInit)
+    {
+        s.bInit = true;
+        s.nextSeq = seq;
+        s.cUsed = 0;
+    }
+
+    // frames handed out from the last segment are finished with now
+    if (s.cUsed > 0)
+    {
+        s.data.erase(s.data.begin(), s.data.begin() + s.cUsed);
+        s.cUsed = 0;
+    }
+
+    int32_t offset = int32_t(seq - s.nextSeq);
+    if (offset < 0)
+    {
+        // retransmission, perhaps overlapping new data
+        if ((cBytes + offset) <= 0)
+        {
+            return false;
+        }
+        p -= offset;
+        cBytes += offset;
+    }
+    else if (offset > 0)
+    {
+        // a hole we cannot fill: start again at the next '$'
+        s.data.clear();
+    }
+    s.data.insert(s.data.end(), p, p + cBytes);
+    s.nextSeq = seq + ((offset < 0) ? -offset : 0) + cBytes;
+    s.time = time;
+    if ((int)s.data.size() > max_stream_buffer)
+    {
+        s.data.clear();
+        m_cSkipped++;
+        return false;
+    }
+    m_pPending = &s;
+    return NextInterleaved(pPacket);
+}
+
+bool
+CaptureReader::NextInterleaved(CapturedRTP* pPacket)
+{
+    Stream& s = *m_pPending;
+    for (;;)
+    {
+        int cAvail = (int)s.data.size() - s.cUsed;
+        const BYTE* p = s.data.empty() ? NULL : &s.data[s.cUsed];
+        if (cAvail < 5)
+        {
+            return false;
+        }
+        if (p[0] != '$')
+        {
+            // RTSP text, or we joined mid-frame: find the next frame
+            // header that is followed by an RTP or RTCP version byte
+            int idx = 1;
+            while ((idx < cAvail) && !((p[idx] == '$') && (((idx + 4) >= cAvail) || ((p[idx + 4] & 0xc0) == 0x80))))
+            {
+                idx++;
+            }
+            if (idx == cAvail)
+            {
+                // text to the end: a line split across segments is kept
+                // until the rest of it arrives
+                int cLines = cAvail;
+                while ((cLines > 0) && (p[cLines - 1] != '\n'))
+                {
+                    cLines--;
+                }
+                if (cLines > 0)
+                {
+                    idx = cLines;
+                }
+                else if (cAvail < max_text_line)
+                {
+                    return false;
+                }
+            }
+            OnText(p, idx);
+            s.cUsed += idx;
+            continue;
+        }
+        int cFrame = be16(p + 2);
+        if (cAvail < (cFrame + 4))
+        {
+            return false;
+        }
+        s.cUsed += cFrame + 4;
+        if (IsRTP(p + 4, cFrame))
+        {
+            pPacket->time = s.time;
+            pPacket->p = p + 4;
+            pPacket->cBytes = cFrame;
+            pPacket->bInterleaved = true;
+            return true;
+        }
+    }
+}
+
+void
+CaptureReader::OnText(const BYTE* p, int cBytes)
+{
+    // the SDP in a DESCRIBE response: the parameter sets are usually
+    // sent only there, and not in the RTP stream
+    static const char key[] = "sprop-parameter-sets=";
+    const BYTE* end = p + cBytes;
+    const BYTE* found = (const BYTE*)memmem(p, cBytes, key, sizeof(key) - 1);
+    if ((found == NULL) || !m_paramSets.empty())
+    {
+        return;
+    }
+    const BYTE* q = found + sizeof(key) - 1;
+    while (q < end)
+    {
+        const BYTE* item = q;
+        while ((q < end) && (*q != ',') && (*q != ';') && (*q != '\r') && (*q != '\n') && (*q != ' '))
+        {
+            q++;
+        }
+        int cChars = (int)(q - item);
+        if (cChars > 0)
+        {
+            std::vector<BYTE> nalu(Base64DecodedMaxLength(cChars));
+            int cNALU = Base64Decode((const char*)item, cChars, &nalu[0]);
+            if (cNALU > 0)
+            {
+                nalu.resize(cNALU);
+                m_paramSets.push_back(nalu);
+            }
+        }
+        if ((q >= end) || (*q != ','))
+        {
+            break;
+        }
+        q++;
+    }
+}
+
+// --- depacketizer ------------------------------------------------
+
+H264Depacketizer::H264Depacketizer(access_unit_t fn, void* ctx, int payloadType)
+: m_fn(fn),
+  m_ctx(ctx),
+  m_payloadType(payloadType),
+  m_bInit(false),
+  m_ssrc(0),
+  m_nextSeq(0),
+  m_tsLast(0),
+  m_tsPrev(0),
+  m_bFragment(false),
+  m_fragmentStart(0),
+  m_bOpen(false),
+  m_bLostFrame(false),
+  m_cFrames(0),
+  m_cLost(0)
+{
+}
+
+void
+H264Depacketizer::Add(const CapturedRTP& packet)
+{
+    const BYTE* p = packet.p;
+    int cBytes = packet.cBytes;
+    int pt = p[1] & 0x7f;
+    if (m_payloadType < 0)
+    {
+        if (pt < 96)
+        {
+            return;
+        }
+        m_payloadType = pt;
+    }
+    if (pt != m_payloadType)
+    {
+        return;
+    }
+
+    // the first stream seen with our payload type is the one we follow
+    uint16_t seq = be16(p + 2);
+    uint32_t ts = be32(p + 4);
+    uint32_t ssrc = be32(p + 8);
+    bool bGap = false;
+    if (!m_bInit)
+    {
+        m_bInit = true;
+        m_ssrc = ssrc;
+        m_tsPrev = ts;
+    }
+    else if (ssrc != m_ssrc)
+    {
+        return;
+    }
+    else if (seq != m_nextSeq)
+    {
+        int16_t diff = int16_t(seq - m_nextSeq);
+        if (diff < 0)
+        {
+            // late or duplicated
+            return;
+        }
+        m_cLost += diff;
+        bGap = true;
+    }
+    m_nextSeq = seq + 1;
+    m_tsLast += int32_t(ts - m_tsPrev);
+    m_tsPrev = ts;
+
+    int cHeader = 12 + ((p[0] & 0x0f) * 4);
+    if ((p[0] & 0x10) && ((cHeader + 4) <= cBytes))
+    {
+        cHeader += 4 + (be16(p + cHeader + 2) * 4);
+    }
+    if ((p[0] & 0x20) && (cBytes > cHeader))
+    {
+        cBytes -= p[cBytes - 1];
+    }
+
+    if (m_bOpen && bGap)
+    {
+        // the loss could be in either frame, so both are marked
+        if (m_bFragment)
+        {
+            m_buffer.resize(m_fragmentStart);
+            m_bFragment = false;
+        }
+        m_au.bDamaged = true;
+    }
+    if (m_bOpen && (ts != m_au.rtpTime))
+    {
+        // its marker was lost, or the sender does not set it
+        Emit();
+    }
+    if (!m_bOpen)
+    {
+        m_bOpen = true;
+        m_bFragment = false;
+        m_buffer.clear();
+        m_au.offsets.clear();
+        m_au.lengths.clear();
+        m_au.rtpTime = ts;
+        m_au.pts = m_tsLast / 90000.0;
+        m_au.bIDR = false;
+        m_au.bDamaged = bGap || m_bLostFrame;
+        m_bLostFrame = false;
+    }
+    m_au.arrival = packet.time;
+
+    if (cHeader < cBytes)
+    {
+        const BYTE* q = p + cHeader;
+        int cPayload = cBytes - cHeader;
+        int type = q[0] & 0x1f;
+        if ((type >= 1) && (type <= 23))
+        {
+            OnNALU(q, cPayload);
+        }
+        else if (type == 24)
+        {
+            // STAP-A: 16-bit length before each NALU
+            int idx = 1;
+            while ((idx + 2) <= cPayload)
+            {
+                int cNALU = be16(q + idx);
+                idx += 2;
+                if ((cNALU == 0) || ((idx + cNALU) > cPayload))
+                {
+                    m_au.bDamaged = true;
+                    break;
+                }
+                OnNALU(q + idx, cNALU);
+                idx += cNALU;
+            }
+        }
+        else if ((type == 28) && (cPayload >= 2))
+        {
+            BYTE fu = q[1];
+            if (fu & 0x80)
+            {
+                if (m_bFragment)
+                {
+                    m_buffer.resize(m_fragmentStart);
+                    m_au.bDamaged = true;
+                }
+                m_bFragment = true;
+                m_fragmentStart = (int)m_buffer.size();
+                m_buffer.push_back((q[0] & 0xe0) | (fu & 0x1f));
+            }
+            if (m_bFragment)
+            {
+                m_buffer.insert(m_buffer.end(), q + 2, q + cPayload);
+                if (fu & 0x40)
+                {
+                    m_bFragment = false;
+                    m_au.offsets.push_back(m_fragmentStart);
+                    m_au.lengths.push_back((int)m_buffer.size() - m_fragmentStart);
+                    if ((fu & 0x1f) == NALUnit::NAL_IDR_Slice)
+                    {
+                        m_au.bIDR = true;
+                    }
+                }
+            }
+        }
+    }
+
+    if (p[1] & 0x80)
+    {
+        Emit();
+    }
+}
+
+void
+H264Depacketizer::OnNALU(const BYTE* p, int cBytes)
+{
+    m_au.offsets.push_back((int)m_buffer.size());
+    m_au.lengths.push_back(cBytes);
+    m_buffer.insert(m_buffer.end(), p, p + cBytes);
+    if ((p[0] & 0x1f) == NALUnit::NAL_IDR_Slice)
+    {
+        m_au.bIDR = true;
+    }
+}
+
+void
+H264Depacketizer::Flush()
+{
+    Emit();
+}
+
+void
+H264Depacketizer::Emit()
+{
+    if (!m_bOpen)
+    {
+        return;
+    }
+    m_bOpen = false;
+    if (m_bFragment)
+    {
+        m_buffer.resize(m_fragmentStart);
+        m_bFragment = false;
+        m_au.bDamaged = true;
+    }
+    if (m_au.Count() > 0)
+    {
+        m_au.pData = &m_buffer[0];
+        m_cFrames++;
+        m_fn(m_ctx, m_au);
+    }
+    else if (m_au.bDamaged)
+    {
+        // nothing of it survived: flag the next frame, which is where a decoder will notice
+        m_bLostFrame = true;
+    }
+}
@@ -0,0 +1,162 @@
+//
+//  CaptureReader.h
+//  Encoder Demo
+//
+//  RTP from packet captures, for reproducing field problems. CaptureReader
+//  maps a pcap or pcapng file and walks it in place: link, IP and UDP
+//  headers are stepped over without copying, and RTP sent interleaved
+//  on an RTSP connection is unframed from the TCP stream. H264Depacketizer
+//  rebuilds the access units from FU-A, STAP-A and single NALU packets.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+struct CapturedRTP
+{
+    double time;        // capture time, seconds
+    const BYTE* p;      // RTP header onwards
+    int cBytes;
+    bool bInterleaved;
+};
+
+class CaptureReader
+{
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    bool Open(const char* path);
+    void Close();
+
+    // only UDP RTP to or from this port (0, the default, takes any port)
+    void SetPort(int port)  { m_port = port; }
+
+    // the next packet that looks like RTP (not RTCP). The data is valid
+    // until the next call: it points into the mapped file for UDP, or
+    // into a reassembly buffer for interleaved RTP.
+    bool Next(CapturedRTP* pPacket);
+
+    // SPS and PPS from an RTSP DESCRIBE response in the capture, if any
+    const std::vector<std::vector<BYTE> >& ParameterSets()  { return m_paramSets; }
+
+    long Records()          { return m_cRecords; }
+    long Skipped()          { return m_cSkipped; }
+    int64_t FileSize()      { return m_cFile; }
+
+private:
+    bool NextRecord(double* pTime, const BYTE** pp, int* pcBytes, int* pLinkType);
+    bool NextBlock(double* pTime, const BYTE** pp, int* pcBytes, int* pLinkType);
+    bool OnFrame(double time, const BYTE* p, int cBytes, int linkType, CapturedRTP* pPacket);
+    bool OnTCP(double time, const std::vector<BYTE>& flow, uint32_t seq, const BYTE* p, int cBytes, CapturedRTP* pPacket);
+    bool NextInterleaved(CapturedRTP* pPacket);
+    void OnText(const BYTE* p, int cBytes);
+
+    uint16_t Read16(const BYTE* p);
+    uint32_t Read32(const BYTE* p);
+
+private:
+    int m_fd;
+    const BYTE* m_pFile;
+    int64_t m_cFile;
+    int64_t m_pos;
+    bool m_bNG;
+    bool m_bSwapped;
+    int m_port;
+
+    // classic pcap
+    int m_linkType;
+    double m_tickSeconds;
+
+    // pcapng: per interface, in the order of the description blocks
+    struct Interface
+    {
+        int linkType;
+        double tickSeconds;
+    };
+    std::vector<Interface> m_interfaces;
+
+    // interleaved RTP: per TCP direction, in-order data only
+    struct Stream
+    {
+        bool bInit;
+        uint32_t nextSeq;
+        std::vector<BYTE> data;
+        int cUsed;
+        double time;
+    };
+    std::map<std::vector<BYTE>, Stream> m_streams;
+    Stream* m_pPending;
+    double m_lastTime;
+    std::vector<std::vector<BYTE> > m_paramSets;
+
+    long m_cRecords;
+    long m_cSkipped;
+};
+
+// one frame's NALUs, without start codes or length prefixes
+struct AccessUnit
+{
+    uint32_t rtpTime;
+    double pts;         // seconds from the first frame
+    double arrival;     // capture time of its last packet
+    bool bIDR;
+    bool bDamaged;      // packets were missing
+
+    int Count() const   { return (int)lengths.size(); }
+    const BYTE* NALU(int i) const   { return pData + offsets[i]; }
+    int Length(int i) const         { return lengths[i]; }
+
+    const BYTE* pData;
+    std::vector<int> offsets;
+    std::vector<int> lengths;
+};
+
+typedef void (*access_unit_t)(void* ctx, const AccessUnit& au);
+
+class H264Depacketizer
+{
+public:
+    // payloadType < 0 takes the first dynamic payload type seen
+    H264Depacketizer(access_unit_t fn, void* ctx, int payloadType = 96);
+
+    // packets in capture order. A frame is passed on at its marker bit,
+    // or when a packet with a later timestamp shows that it has ended.
+    void Add(const CapturedRTP& packet);
+
+    // the last frame, if its marker was never seen
+    void Flush();
+
+    long Frames()       { return m_cFrames; }
+    long Lost()         { return m_cLost; }
+    uint32_t SSRC()     { return m_ssrc; }
+
+private:
+    void OnNALU(const BYTE* p, int cBytes);
+    void Emit();
+
+private:
+    access_unit_t m_fn;
+    void* m_ctx;
+    int m_payloadType;
+    bool m_bInit;
+    uint32_t m_ssrc;
+    uint16_t m_nextSeq;
+    int64_t m_tsLast;
+    uint32_t m_tsPrev;
+
+    bool m_bFragment;
+    int m_fragmentStart;
+
+    AccessUnit m_au;
+    std::vector<BYTE> m_buffer;
+    bool m_bOpen;
+    bool m_bLostFrame;
+
+    long m_cFrames;
+    long m_cLost;
+};
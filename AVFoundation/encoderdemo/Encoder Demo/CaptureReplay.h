@@ -0,0 +1,26 @@
+//
+//  CaptureReplay.h
+//  Encoder Demo
+//
+//  Plays the H.264 stream from a pcap or pcapng capture in place of the
+//  camera and encoder. It has AVEncoder's output interface, so the
+//  server sees the captured stream exactly as it would a live one: the
+//  parameter sets once, then each frame with its time, at the timing
+//  the packets were captured with (or a multiple of it).
+//
+
+#import <Foundation/Foundation.h>
+#import "AVEncoder.h"
+
+@interface CaptureReplay : NSObject
+
+// speed 1 is the capture's own timing; 0 is as fast as it can be read
++ (CaptureReplay*) replayWithFile:(NSString*) path speed:(double) speed;
+
+// as for AVEncoder. Frames are delivered on a private serial queue.
+- (void) encodeWithBlock:(encoder_handler_t) block onParams:(param_handler_t) paramsHandler;
+- (void) shutdown;
+
+@property (readonly, atomic) int bitspersecond;
+
+@end
@@ -0,0 +1,206 @@
+//
+//  CaptureReplay.mm
+//  Encoder Demo
+//
+
+#import "CaptureReplay.h"
+#import "CaptureReader.h"
+#import <unistd.h>
+
+@interface CaptureReplay ()
+{
+    NSString* _path;
+    double _speed;
+    CaptureReader* _reader;
+    dispatch_queue_t _queue;
+    BOOL _bStop;
+    
+    encoder_handler_t _outputBlock;
+    param_handler_t _paramsBlock;
+    
+    // nothing is delivered until the parameter sets have been seen
+    NSData* _sps;
+    NSData* _pps;
+    BOOL _bSentParams;
+    
+    // maps capture time onto ours
+    BOOL _bStarted;
+    double _firstArrival;
+    NSDate* _clockBase;
+    
+    // estimate bitrate over first second, as AVEncoder does
+    int _bitspersecond;
+    double _firstpts;
+}
+
+- (CaptureReplay*) initWithFile:(NSString*) path speed:(double) speed;
+- (void) run;
+- (void) onAccessUnit:(const AccessUnit&) au;
+
+@end
+
+static void onAccessUnit(void* ctx, const AccessUnit& au)
+{
+    CaptureReplay* replay = (__bridge CaptureReplay*)ctx;
+    [replay onAccessUnit:au];
+}
+
+@implementation CaptureReplay
+
+@synthesize bitspersecond = _bitspersecond;
+
++ (CaptureReplay*) replayWithFile:(NSString*) path speed:(double) speed
+{
+    return [[CaptureReplay alloc] initWithFile:path speed:speed];
+}
+
+- (CaptureReplay*) initWithFile:(NSString*) path speed:(double) speed
+{
+    self = [super init];
+    _path = path;
+    _speed = speed;
+    _queue = dispatch_queue_create("uk.co.gdcl.avencoder.replay", DISPATCH_QUEUE_SERIAL);
+    return self;
+}
+
+- (void) encodeWithBlock:(encoder_handler_t) block onParams:(param_handler_t) paramsHandler
+{
+    _outputBlock = block;
+    _paramsBlock = paramsHandler;
+    _firstpts = -1;
+    dispatch_async(_queue, ^{
+        [self run];
+    });
+}
+
+- (void) shutdown
+{
+    @synchronized(self)
+    {
+        _bStop = YES;
+    }
+}
+
+- (void) run
+{
+    CaptureReader reader;
+    if (!reader.Open([_path fileSystemRepresentation]))
+    {
+        NSLog(@"Cannot read capture %@", _path);
+        return;
+    }
+    _reader = &reader;
+    H264Depacketizer depacketizer(onAccessUnit, (__bridge void*)self, -1);
+    CapturedRTP packet;
+    while (reader.Next(&packet))
+    {
+        @synchronized(self)
+        {
+            if (_bStop)
+            {
+                _reader = NULL;
+                return;
+            }
+        }
+        depacketizer.Add(packet);
+    }
+    depacketizer.Flush();
+    _reader = NULL;
+    NSLog(@"Capture replay finished: %ld frames, %ld packets lost", depacketizer.Frames(), depacketizer.Lost());
+}
+
+- (void) onAccessUnit:(const AccessUnit&) au
+{
+    // the first SPS and PPS make the avcC record the server is set up with
+    if (!_bSentParams)
+    {
+        for (int i = 0; i < au.Count(); i++)
+        {
+            int type = au.NALU(i)[0] & 0x1f;
+            if ((type == NALUnit::NAL_Sequence_Params) && (_sps == nil) && (au.Length(i) >= 4))
+            {
+                _sps = [NSData dataWithBytes:au.NALU(i) length:au.Length(i)];
+            }
+            else if ((type == NALUnit::NAL_Picture_Params) && (_pps == nil))
+            {
+                _pps = [NSData dataWithBytes:au.NALU(i) length:au.Length(i)];
+            }
+        }
+        // a stream from this server has them only in the SDP
+        const std::vector<std::vector<BYTE> >& params = _reader->ParameterSets();
+        for (size_t i = 0; i < params.size(); i++)
+        {
+            int type = params[i][0] & 0x1f;
+            if ((type == NALUnit::NAL_Sequence_Params) && (_sps == nil) && (params[i].size() >= 4))
+            {
+                _sps = [NSData dataWithBytes:&params[i][0] length:params[i].size()];
+            }
+            else if ((type == NALUnit::NAL_Picture_Params) && (_pps == nil))
+            {
+                _pps = [NSData dataWithBytes:&params[i][0] length:params[i].size()];
+            }
+        }
+        if ((_sps == nil) || (_pps == nil) || !au.bIDR)
+        {
+            return;
+        }
+        const BYTE* sps = (const BYTE*)[_sps bytes];
+        NSMutableData* avcC = [NSMutableData dataWithCapacity:([_sps length] + [_pps length] + 11)];
+        BYTE header[] = { 1, sps[1], sps[2], sps[3], 0xff, 0xe1 };
+        [avcC appendBytes:header length:sizeof(header)];
+        BYTE len[2] = { (BYTE)([_sps length] >> 8), (BYTE)[_sps length] };
+        [avcC appendBytes:len length:2];
+        [avcC appendData:_sps];
+        BYTE cPPS = 1;
+        [avcC appendBytes:&cPPS length:1];
+        len[0] = (BYTE)([_pps length] >> 8);
+        len[1] = (BYTE)[_pps length];
+        [avcC appendBytes:len length:2];
+        [avcC appendData:_pps];
+        _bSentParams = YES;
+        if (_paramsBlock != nil)
+        {
+            _paramsBlock(avcC);
+        }
+    }
+    
+    // frames go when their packets were captured, so that gaps in
+    // the capture are reproduced along with the stream
+    if (!_bStarted)
+    {
+        _bStarted = YES;
+        _firstArrival = au.arrival;
+        _clockBase = [NSDate date];
+    }
+    if (_speed > 0)
+    {
+        double wait = ((au.arrival - _firstArrival) / _speed) - [[NSDate date] timeIntervalSinceDate:_clockBase];
+        if (wait > 0)
+        {
+            usleep((useconds_t)(wait * 1e6));
+        }
+    }
+    
+    NSMutableArray* frame = [NSMutableArray arrayWithCapacity:au.Count()];
+    int bytes = 0;
+    for (int i = 0; i < au.Count(); i++)
+    {
+        [frame addObject:[NSData dataWithBytes:au.NALU(i) length:au.Length(i)]];
+        bytes += au.Length(i);
+    }
+    double pts = au.pts;
+    if (_firstpts < 0)
+    {
+        _firstpts = pts;
+    }
+    if ((pts - _firstpts) < 1)
+    {
+        _bitspersecond += (bytes * 8);
+    }
+    if (_outputBlock != nil)
+    {
+        _outputBlock(frame, pts);
+    }
+}
+
+@end
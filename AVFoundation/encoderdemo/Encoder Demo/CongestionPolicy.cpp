@@ -0,0 +1,102 @@
+//
+//  CongestionPolicy.cpp
+//  Encoder Demo
+//
+//  Frame shedding under congestion.
+//
+
+#include "CongestionPolicy.h"
+
+// queue depth, in seconds of stream, at which each level starts
+static const double queue_drop_nonref = 0.2;
+static const double queue_drop_to_idr = 0.5;
+
+// reported loss at which each level starts
+static const double loss_drop_nonref = 0.05;
+static const double loss_drop_to_idr = 0.15;
+
+// frames the signals must stay below a level before we step down from it,
+// so that a queue hovering around a threshold does not make us flap
+static const int recovery_frames = 30;
+
+CongestionPolicy::CongestionPolicy()
+{
+    Reset();
+}
+
+void
+CongestionPolicy::Reset()
+{
+    m_level = SendAll;
+    m_cClear = 0;
+    m_bBroken = false;
+    m_dropped = 0;
+    m_lost = 0;
+}
+
+CongestionPolicy::Level
+CongestionPolicy::Target(double queueSeconds, double fractionLost)
+{
+    if ((queueSeconds >= queue_drop_to_idr) || (fractionLost >= loss_drop_to_idr))
+    {
+        return DropToIDR;
+    }
+    if ((queueSeconds >= queue_drop_nonref) || (fractionLost >= loss_drop_nonref))
+    {
+        return DropNonReference;
+    }
+    return SendAll;
+}
+
+void
+CongestionPolicy::OnLost(int cFrames, bool bReference)
+{
+    m_lost += cFrames;
+    if (bReference)
+    {
+        m_bBroken = true;
+    }
+}
+
+bool
+CongestionPolicy::ShouldSend(bool bIDR, bool bReference, double queueSeconds, double fractionLost)
+{
+    Level target = Target(queueSeconds, fractionLost);
+    if (target >= m_level)
+    {
+        // go up straight away
+        m_level = target;
+        m_cClear = 0;
+    }
+    else if (++m_cClear >= recovery_frames)
+    {
+        m_level = Level(m_level - 1);
+        m_cClear = 0;
+    }
+
+    if (bIDR)
+    {
+        // a fresh start: whatever was dropped no longer matters
+        m_bBroken = false;
+        return true;
+    }
+    bool bSend;
+    if (m_bBroken)
+    {
+        bSend = false;
+    }
+    else if (bReference)
+    {
+        bSend = (m_level < DropToIDR);
+        m_bBroken = !bSend;
+    }
+    else
+    {
+        bSend = (m_level < DropNonReference);
+    }
+    if (!bSend)
+    {
+        m_dropped++;
+    }
+    return bSend;
+}
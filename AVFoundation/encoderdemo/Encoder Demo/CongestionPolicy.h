@@ -0,0 +1,51 @@
+//
+//  CongestionPolicy.h
+//  Encoder Demo
+//
+//  Decides, frame by frame, what a congested session can do without.
+//  Non-reference frames go first, since nothing is predicted from
+//  them. If that is not enough, reference frames go too, and once one
+//  has gone everything up to the next IDR must follow it. IDRs are
+//  always sent. Driven by how long the session's send queue would take
+//  to drain, and by the loss the client reports over RTCP.
+//
+
+#pragma once
+
+class CongestionPolicy
+{
+public:
+    enum Level
+    {
+        SendAll             = 0,
+        DropNonReference    = 1,
+        DropToIDR           = 2,
+    };
+
+    CongestionPolicy();
+
+    void Reset();
+
+    // queueSeconds: time for the queue to drain at the stream bitrate.
+    // fractionLost: from a recent receiver report, or < 0 if there is none.
+    bool ShouldSend(bool bIDR, bool bReference, double queueSeconds, double fractionLost);
+
+    // frames that never reached the session, lost in a full queue on the
+    // way to it. If any was an IDR or reference frame, everything up to
+    // the next IDR is shed, as if we had dropped it ourselves.
+    void OnLost(int cFrames, bool bReference);
+
+    Level CurrentLevel()    { return m_level; }
+    long Dropped()          { return m_dropped; }
+    long Lost()             { return m_lost; }
+
+private:
+    Level Target(double queueSeconds, double fractionLost);
+
+private:
+    Level m_level;
+    int m_cClear;           // consecutive frames below the current level
+    bool m_bBroken;         // a reference frame has been dropped since the last IDR
+    long m_dropped;
+    long m_lost;
+};
@@ -0,0 +1,417 @@
+//
+//  FEC.cpp
+//  Encoder Demo
+//
+//  Row/column XOR parity for RTP.
+//
+
+#include "FEC.h"
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define XOR_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define XOR_SSE2 1
+#endif
+
+static uint16_t from_net_short(const BYTE* p)
+{
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+static uint32_t from_net_long(const BYTE* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void to_net_short(BYTE* p, uint16_t s)
+{
+    p[0] = (s >> 8) & 0xff;
+    p[1] = s & 0xff;
+}
+
+static void to_net_long(BYTE* p, uint32_t l)
+{
+    p[0] = (l >> 24) & 0xff;
+    p[1] = (l >> 16) & 0xff;
+    p[2] = (l >> 8) & 0xff;
+    p[3] = l & 0xff;
+}
+
+void XORBytes(BYTE* dst, const BYTE* src, int cBytes)
+{
+    int i = 0;
+#if XOR_NEON
+    for (; (i + 16) <= cBytes; i += 16)
+    {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    }
+#elif XOR_SSE2
+    for (; (i + 64) <= cBytes; i += 64)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(dst + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i*)(dst + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i*)(dst + i + 48));
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*)(src + i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i*)(src + i + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i*)(src + i + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i*)(src + i + 48)));
+        _mm_storeu_si128((__m128i*)(dst + i), a0);
+        _mm_storeu_si128((__m128i*)(dst + i + 16), a1);
+        _mm_storeu_si128((__m128i*)(dst + i + 32), a2);
+        _mm_storeu_si128((__m128i*)(dst + i + 48), a3);
+    }
+    for (; (i + 16) <= cBytes; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(src + i))));
+    }
+#endif
+    // word at a time for the rest (memcpy keeps this alignment-safe)
+    for (; (i + 8) <= cBytes; i += 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < cBytes; i++)
+    {
+        dst[i] ^= src[i];
+    }
+}
+
+// --- encoder ---------------------------------------------------
+
+FECEncoder::FECEncoder(int cMaxPacket)
+: m_cMaxPacket(cMaxPacket),
+  m_columns(0),
+  m_rows(0),
+  m_ssrcMedia(0),
+  m_ssrcFEC(0),
+  m_payloadType(0),
+  m_seq(0),
+  m_index(0),
+  m_cRepair(0)
+{
+    m_row.payload.resize(m_cMaxPacket);
+}
+
+void
+FECEncoder::Configure(int columns, int rows)
+{
+    if ((columns == m_columns) && (rows == m_rows))
+    {
+        return;
+    }
+    // a sequence number only has 16 bits, and L and D 8 each
+    m_columns = (columns > 255) ? 255 : columns;
+    m_rows = (rows > 255) ? 255 : rows;
+    m_cols.resize(m_rows > 0 ? m_columns : 0);
+    for (size_t i = 0; i < m_cols.size(); i++)
+    {
+        m_cols[i].payload.resize(m_cMaxPacket);
+    }
+    m_index = 0;
+}
+
+void
+FECEncoder::Reset(uint32_t ssrcMedia, uint32_t ssrcFEC, int payloadType)
+{
+    m_ssrcMedia = ssrcMedia;
+    m_ssrcFEC = ssrcFEC;
+    m_payloadType = payloadType;
+    m_seq = 0;
+    m_index = 0;
+    m_cRepair = 0;
+}
+
+void
+FECEncoder::Begin(Parity& parity, uint16_t base)
+{
+    parity.base = base;
+    parity.count = 0;
+    parity.byte0 = 0;
+    parity.byte1 = 0;
+    parity.length = 0;
+    parity.ts = 0;
+    parity.cMax = 0;
+}
+
+void
+FECEncoder::Accumulate(Parity& parity, const BYTE* packet, int cBytes)
+{
+    int cPayload = cBytes - 12;
+    if (parity.count == 0)
+    {
+        // first packet: copy rather than xor into stale data
+        memcpy(&parity.payload[0], packet + 12, cPayload);
+    }
+    else
+    {
+        if (cPayload > parity.cMax)
+        {
+            // shorter packets are treated as zero-padded
+            memset(&parity.payload[parity.cMax], 0, cPayload - parity.cMax);
+        }
+        XORBytes(&parity.payload[0], packet + 12, cPayload);
+    }
+    if (cPayload > parity.cMax)
+    {
+        parity.cMax = cPayload;
+    }
+    parity.byte0 ^= packet[0];
+    parity.byte1 ^= packet[1];
+    parity.length ^= uint16_t(cPayload);
+    parity.ts ^= from_net_long(packet + 4);
+    parity.count++;
+}
+
+void
+FECEncoder::Emit(Parity& parity, int columns, int rows, uint32_t ts, std::vector<std::vector<BYTE> >* pRepair)
+{
+    pRepair->push_back(std::vector<BYTE>(fec_header_size + parity.cMax));
+    BYTE* p = &pRepair->back()[0];
+
+    // RTP header of the repair stream
+    p[0] = 0x80;
+    p[1] = BYTE(m_payloadType);
+    to_net_short(p + 2, m_seq++);
+    to_net_long(p + 4, ts);
+    to_net_long(p + 8, m_ssrcFEC);
+
+    // FlexFEC header, R=0 F=1
+    BYTE* h = p + 12;
+    h[0] = 0x40 | (parity.byte0 & 0x3f);
+    h[1] = parity.byte1;
+    to_net_short(h + 2, parity.length);
+    to_net_long(h + 4, parity.ts);
+    h[8] = 1;       // SSRCCount
+    h[9] = h[10] = h[11] = 0;
+    to_net_long(h + 12, m_ssrcMedia);
+    to_net_short(h + 16, parity.base);
+    h[18] = BYTE(columns);
+    h[19] = BYTE(rows);
+
+    memcpy(p + fec_header_size, &parity.payload[0], parity.cMax);
+    m_cRepair++;
+}
+
+void
+FECEncoder::Add(const BYTE* packet, int cBytes, std::vector<std::vector<BYTE> >* pRepair)
+{
+    if (!Enabled() || (cBytes < 12) || (cBytes > m_cMaxPacket))
+    {
+        return;
+    }
+    uint16_t seq = from_net_short(packet + 2);
+    uint32_t ts = from_net_long(packet + 4);
+    int col = int(m_index % m_columns);
+    int row = int(m_index / m_columns);
+
+    if (col == 0)
+    {
+        Begin(m_row, seq);
+    }
+    Accumulate(m_row, packet, cBytes);
+    if (col == (m_columns - 1))
+    {
+        Emit(m_row, m_columns, 0, ts, pRepair);
+    }
+
+    if (m_rows > 0)
+    {
+        Parity& parity = m_cols[col];
+        if (row == 0)
+        {
+            Begin(parity, seq);
+        }
+        Accumulate(parity, packet, cBytes);
+        if (row == (m_rows - 1))
+        {
+            // sent as soon as each column is complete, which spreads
+            // the column parity over the last row of the block
+            Emit(parity, m_columns, m_rows, ts, pRepair);
+        }
+    }
+
+    m_index++;
+    long cBlock = (m_rows > 0) ? (long(m_columns) * m_rows) : m_columns;
+    if (m_index >= cBlock)
+    {
+        m_index = 0;
+    }
+}
+
+// --- decoder ---------------------------------------------------
+
+// repairs still waiting for a second loss to be filled in
+static const size_t max_pending_repairs = 256;
+
+FECDecoder::FECDecoder(int cSlots, int cMaxPacket)
+: m_cMaxPacket(cMaxPacket),
+  m_mask(cSlots - 1),
+  m_slots(cSlots),
+  m_data(cSlots * cMaxPacket),
+  m_cRecovered(0)
+{
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        m_slots[i].seq = 0;
+        m_slots[i].cBytes = 0;
+    }
+}
+
+bool
+FECDecoder::Has(uint16_t seq)
+{
+    const Slot& slot = m_slots[seq & m_mask];
+    return (slot.cBytes > 0) && (slot.seq == seq);
+}
+
+void
+FECDecoder::Store(const BYTE* packet, int cBytes)
+{
+    if ((cBytes < 12) || (cBytes > m_cMaxPacket))
+    {
+        return;
+    }
+    uint16_t seq = from_net_short(packet + 2);
+    int idx = seq & m_mask;
+    m_slots[idx].seq = seq;
+    m_slots[idx].cBytes = cBytes;
+    memcpy(&m_data[idx * m_cMaxPacket], packet, cBytes);
+}
+
+void
+FECDecoder::AddMedia(const BYTE* packet, int cBytes)
+{
+    Store(packet, cBytes);
+}
+
+void
+FECDecoder::AddRepair(const BYTE* packet, int cBytes, std::vector<std::vector<BYTE> >* pRecovered)
+{
+    if ((cBytes < fec_header_size) || ((packet[12] & 0xc0) != 0x40))
+    {
+        return;
+    }
+    Repair repair;
+    repair.data.assign(packet, packet + cBytes);
+    repair.base = from_net_short(packet + 12 + 16);
+    repair.columns = packet[12 + 18];
+    repair.rows = packet[12 + 19];
+    if (repair.columns == 0)
+    {
+        return;
+    }
+    if (m_pending.size() >= max_pending_repairs)
+    {
+        m_pending.erase(m_pending.begin());
+    }
+    m_pending.push_back(repair);
+    Recover(pRecovered);
+}
+
+void
+FECDecoder::Recover(std::vector<std::vector<BYTE> >* pRecovered)
+{
+    // one recovery can complete another repair (a row fix that leaves a
+    // column with a single loss), so go round until nothing changes
+    bool bProgress = true;
+    while (bProgress)
+    {
+        bProgress = false;
+        for (size_t i = 0; i < m_pending.size(); )
+        {
+            bool bDone = false;
+            if (TryRecover(m_pending[i], pRecovered, &bDone))
+            {
+                bProgress = true;
+            }
+            if (bDone)
+            {
+                m_pending.erase(m_pending.begin() + i);
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+}
+
+bool
+FECDecoder::TryRecover(const Repair& repair, std::vector<std::vector<BYTE> >* pRecovered, bool* pDone)
+{
+    int count = (repair.rows > 0) ? repair.rows : repair.columns;
+    int step = (repair.rows > 0) ? repair.columns : 1;
+    int cMissing = 0;
+    uint16_t missing = 0;
+    for (int k = 0; k < count; k++)
+    {
+        uint16_t seq = uint16_t(repair.base + (k * step));
+        if (!Has(seq))
+        {
+            cMissing++;
+            missing = seq;
+        }
+    }
+    if (cMissing != 1)
+    {
+        // nothing to do, or too much lost for this parity alone
+        *pDone = (cMissing == 0);
+        return false;
+    }
+
+    const BYTE* h = &repair.data[12];
+    int cParity = (int)repair.data.size() - fec_header_size;
+    BYTE byte0 = h[0] & 0x3f;
+    BYTE byte1 = h[1];
+    uint16_t length = from_net_short(h + 2);
+    uint32_t ts = from_net_long(h + 4);
+    uint32_t ssrc = from_net_long(h + 12);
+    std::vector<BYTE> payload(repair.data.begin() + fec_header_size, repair.data.end());
+
+    for (int k = 0; k < count; k++)
+    {
+        uint16_t seq = uint16_t(repair.base + (k * step));
+        if (seq == missing)
+        {
+            continue;
+        }
+        const Slot& slot = m_slots[seq & m_mask];
+        const BYTE* p = &m_data[(seq & m_mask) * m_cMaxPacket];
+        int cPayload = slot.cBytes - 12;
+        if (cPayload > cParity)
+        {
+            return false;
+        }
+        byte0 ^= p[0] & 0x3f;
+        byte1 ^= p[1];
+        length ^= uint16_t(cPayload);
+        ts ^= from_net_long(p + 4);
+        XORBytes(&payload[0], p + 12, cPayload);
+    }
+    if (length > cParity)
+    {
+        return false;
+    }
+
+    pRecovered->push_back(std::vector<BYTE>(12 + length));
+    BYTE* out = &pRecovered->back()[0];
+    out[0] = 0x80 | byte0;
+    out[1] = byte1;
+    to_net_short(out + 2, missing);
+    to_net_long(out + 4, ts);
+    to_net_long(out + 8, ssrc);
+    memcpy(out + 12, &payload[0], length);
+    Store(out, 12 + length);
+    m_cRecovered++;
+    *pDone = true;
+    return true;
+}
@@ -0,0 +1,115 @@
+//
+//  FEC.h
+//  Encoder Demo
+//
+//  Row/column XOR forward error correction for RTP, in the fixed
+//  block layout of FlexFEC (RFC 8627, F=1). Media packets are laid out
+//  row by row in a block of L columns and D rows. Each row gets a
+//  parity packet over its L packets, and each column one over its D,
+//  so any single loss in a row or column can be rebuilt without a
+//  round trip. D == 0 gives row parity only.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include <stdint.h>
+#include <vector>
+
+// dst ^= src over cBytes, vectorized where the target allows
+void XORBytes(BYTE* dst, const BYTE* src, int cBytes);
+
+// RTP header plus the F=1 FlexFEC header with a single SSRC
+const int fec_header_size = 12 + 20;
+
+class FECEncoder
+{
+public:
+    FECEncoder(int cMaxPacket);
+
+    // columns == 0 turns FEC off
+    void Configure(int columns, int rows);
+    bool Enabled()  { return m_columns > 0; }
+
+    void Reset(uint32_t ssrcMedia, uint32_t ssrcFEC, int payloadType);
+
+    // each media packet, in sequence order. Any parity packets that
+    // it completes are appended to pRepair, ready to send.
+    void Add(const BYTE* packet, int cBytes, std::vector<std::vector<BYTE> >* pRepair);
+
+    long RepairPackets()    { return m_cRepair; }
+
+private:
+    struct Parity
+    {
+        uint16_t base;
+        int count;
+        BYTE byte0;
+        BYTE byte1;
+        uint16_t length;
+        uint32_t ts;
+        int cMax;
+        std::vector<BYTE> payload;
+    };
+
+    void Begin(Parity& parity, uint16_t base);
+    void Accumulate(Parity& parity, const BYTE* packet, int cBytes);
+    void Emit(Parity& parity, int columns, int rows, uint32_t ts, std::vector<std::vector<BYTE> >* pRepair);
+
+private:
+    int m_cMaxPacket;
+    int m_columns;
+    int m_rows;
+    uint32_t m_ssrcMedia;
+    uint32_t m_ssrcFEC;
+    int m_payloadType;
+    uint16_t m_seq;
+    long m_index;       // position in the current block
+    long m_cRepair;
+
+    Parity m_row;
+    std::vector<Parity> m_cols;
+};
+
+// receive side: rebuilds lost media packets from the parity stream
+class FECDecoder
+{
+public:
+    // cSlots (a power of two) bounds how far back losses can be repaired
+    FECDecoder(int cSlots, int cMaxPacket);
+
+    void AddMedia(const BYTE* packet, int cBytes);
+
+    // packets rebuilt as a result are appended to pRecovered (and also
+    // count as received for later repairs)
+    void AddRepair(const BYTE* packet, int cBytes, std::vector<std::vector<BYTE> >* pRecovered);
+
+    long Recovered()    { return m_cRecovered; }
+
+private:
+    struct Slot
+    {
+        uint16_t seq;
+        int cBytes;
+    };
+    struct Repair
+    {
+        std::vector<BYTE> data;
+        uint16_t base;
+        int columns;
+        int rows;
+    };
+
+    bool Has(uint16_t seq);
+    void Store(const BYTE* packet, int cBytes);
+    bool TryRecover(const Repair& repair, std::vector<std::vector<BYTE> >* pRecovered, bool* pDone);
+    void Recover(std::vector<std::vector<BYTE> >* pRecovered);
+
+private:
+    int m_cMaxPacket;
+    int m_mask;
+    std::vector<Slot> m_slots;
+    std::vector<BYTE> m_data;
+    std::vector<Repair> m_pending;
+    long m_cRecovered;
+};
@@ -0,0 +1,330 @@
+//
+//  FMP4Writer.cpp
+//  Encoder Demo
+//
+//  Fragmented MP4 boxes for the HLS output.
+//
+
+#include "FMP4Writer.h"
+#include <string.h>
+
+// sample_flags (14496-12 8.8.3.1): sync samples depend on nothing;
+// others depend on earlier samples and are not sync points
+static const uint32_t sample_flags_sync = 0x02000000;
+static const uint32_t sample_flags_other = 0x01010000;
+
+// box builder over a growing buffer: sizes are patched in at the end
+class BoxWriter
+{
+public:
+    BoxWriter(std::vector<BYTE>* pOut)
+    : m_pOut(pOut)
+    {
+    }
+
+    size_t Begin(const char* type)
+    {
+        size_t start = m_pOut->size();
+        Put32(0);
+        PutBytes((const BYTE*)type, 4);
+        return start;
+    }
+
+    size_t BeginFull(const char* type, int version, uint32_t flags)
+    {
+        size_t start = Begin(type);
+        Put32((uint32_t(version) << 24) | (flags & 0xffffff));
+        return start;
+    }
+
+    void End(size_t start)
+    {
+        Patch32(start, uint32_t(m_pOut->size() - start));
+    }
+
+    void Put8(BYTE b)
+    {
+        m_pOut->push_back(b);
+    }
+
+    void Put16(uint16_t s)
+    {
+        Put8(s >> 8);
+        Put8(s & 0xff);
+    }
+
+    void Put32(uint32_t l)
+    {
+        Put16(l >> 16);
+        Put16(l & 0xffff);
+    }
+
+    void Put64(uint64_t ll)
+    {
+        Put32(uint32_t(ll >> 32));
+        Put32(uint32_t(ll));
+    }
+
+    void PutBytes(const BYTE* p, int cBytes)
+    {
+        m_pOut->insert(m_pOut->end(), p, p + cBytes);
+    }
+
+    void PutZeros(int cBytes)
+    {
+        m_pOut->insert(m_pOut->end(), cBytes, 0);
+    }
+
+    void PutMatrix()
+    {
+        static const uint32_t unity[] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+        for (int i = 0; i < 9; i++)
+        {
+            Put32(unity[i]);
+        }
+    }
+
+    void Patch32(size_t offset, uint32_t l)
+    {
+        BYTE* p = &(*m_pOut)[offset];
+        p[0] = l >> 24;
+        p[1] = (l >> 16) & 0xff;
+        p[2] = (l >> 8) & 0xff;
+        p[3] = l & 0xff;
+    }
+
+    size_t Size()
+    {
+        return m_pOut->size();
+    }
+
+private:
+    std::vector<BYTE>* m_pOut;
+};
+
+FMP4Writer::FMP4Writer(const BYTE* avcC, int cBytes)
+: m_avcC(avcC, avcC + cBytes),
+  m_width(0),
+  m_height(0),
+  m_sequence(0),
+  m_baseDecodeTime(0),
+  m_cSample(0)
+{
+    avcCHeader header(avcC, cBytes);
+    SeqParamSet seqParams;
+    if (seqParams.Parse(header.sps()))
+    {
+        m_width = (int)seqParams.EncodedWidth();
+        m_height = (int)seqParams.EncodedHeight();
+    }
+}
+
+void
+FMP4Writer::InitSegment(std::vector<BYTE>* pOut)
+{
+    BoxWriter w(pOut);
+
+    size_t ftyp = w.Begin("ftyp");
+    w.PutBytes((const BYTE*)"iso6", 4);
+    w.Put32(0);
+    w.PutBytes((const BYTE*)"iso6cmfcmp41", 12);
+    w.End(ftyp);
+
+    size_t moov = w.Begin("moov");
+    {
+        size_t mvhd = w.BeginFull("mvhd", 0, 0);
+        w.Put32(0);                 // creation and modification time
+        w.Put32(0);
+        w.Put32(1000);              // timescale
+        w.Put32(0);                 // duration: unknown, as for any live stream
+        w.Put32(0x00010000);        // rate
+        w.Put16(0x0100);            // volume
+        w.PutZeros(10);
+        w.PutMatrix();
+        w.PutZeros(24);
+        w.Put32(2);                 // next track ID
+        w.End(mvhd);
+
+        size_t trak = w.Begin("trak");
+        {
+            size_t tkhd = w.BeginFull("tkhd", 0, 3);    // enabled, in movie
+            w.Put32(0);
+            w.Put32(0);
+            w.Put32(1);             // track ID
+            w.Put32(0);
+            w.Put32(0);             // duration
+            w.PutZeros(8);
+            w.Put16(0);             // layer
+            w.Put16(0);             // alternate group
+            w.Put16(0);             // volume: not audio
+            w.Put16(0);
+            w.PutMatrix();
+            w.Put32(uint32_t(m_width) << 16);
+            w.Put32(uint32_t(m_height) << 16);
+            w.End(tkhd);
+
+            size_t mdia = w.Begin("mdia");
+            {
+                size_t mdhd = w.BeginFull("mdhd", 0, 0);
+                w.Put32(0);
+                w.Put32(0);
+                w.Put32(fmp4_timescale);
+                w.Put32(0);
+                w.Put16(0x55c4);    // 'und'
+                w.Put16(0);
+                w.End(mdhd);
+
+                size_t hdlr = w.BeginFull("hdlr", 0, 0);
+                w.Put32(0);
+                w.PutBytes((const BYTE*)"vide", 4);
+                w.PutZeros(12);
+                w.PutBytes((const BYTE*)"VideoHandler", 13);
+                w.End(hdlr);
+
+                size_t minf = w.Begin("minf");
+                {
+                    size_t vmhd = w.BeginFull("vmhd", 0, 1);
+                    w.PutZeros(8);
+                    w.End(vmhd);
+
+                    size_t dinf = w.Begin("dinf");
+                    size_t dref = w.BeginFull("dref", 0, 0);
+                    w.Put32(1);
+                    size_t url = w.BeginFull("url ", 0, 1);     // media is in this file
+                    w.End(url);
+                    w.End(dref);
+                    w.End(dinf);
+
+                    size_t stbl = w.Begin("stbl");
+                    {
+                        size_t stsd = w.BeginFull("stsd", 0, 0);
+                        w.Put32(1);
+                        size_t avc1 = w.Begin("avc1");
+                        w.PutZeros(6);
+                        w.Put16(1);         // data reference index
+                        w.PutZeros(16);
+                        w.Put16(m_width);
+                        w.Put16(m_height);
+                        w.Put32(0x00480000);    // 72 dpi
+                        w.Put32(0x00480000);
+                        w.Put32(0);
+                        w.Put16(1);         // frames per sample
+                        w.PutZeros(32);     // compressor name
+                        w.Put16(0x0018);    // depth
+                        w.Put16(0xffff);
+                        size_t avcC = w.Begin("avcC");
+                        w.PutBytes(&m_avcC[0], (int)m_avcC.size());
+                        w.End(avcC);
+                        w.End(avc1);
+                        w.End(stsd);
+
+                        // the samples are all in the fragments
+                        const char* empty[] = { "stts", "stsc", "stco" };
+                        for (int i = 0; i < 3; i++)
+                        {
+                            size_t box = w.BeginFull(empty[i], 0, 0);
+                            w.Put32(0);
+                            w.End(box);
+                        }
+                        size_t stsz = w.BeginFull("stsz", 0, 0);
+                        w.Put32(0);
+                        w.Put32(0);
+                        w.End(stsz);
+                    }
+                    w.End(stbl);
+                }
+                w.End(minf);
+            }
+            w.End(mdia);
+        }
+        w.End(trak);
+
+        size_t mvex = w.Begin("mvex");
+        size_t trex = w.BeginFull("trex", 0, 0);
+        w.Put32(1);                 // track ID
+        w.Put32(1);                 // sample description index
+        w.Put32(0);
+        w.Put32(0);
+        w.Put32(0);
+        w.End(trex);
+        w.End(mvex);
+    }
+    w.End(moov);
+}
+
+void
+FMP4Writer::BeginFragment(uint64_t baseDecodeTime)
+{
+    m_baseDecodeTime = baseDecodeTime;
+    m_samples.clear();
+    m_mdat.clear();
+    m_cSample = 0;
+}
+
+void
+FMP4Writer::AddNALU(const BYTE* p, int cBytes)
+{
+    BYTE length[4] = { BYTE(cBytes >> 24), BYTE((cBytes >> 16) & 0xff), BYTE((cBytes >> 8) & 0xff), BYTE(cBytes & 0xff) };
+    m_mdat.insert(m_mdat.end(), length, length + 4);
+    m_mdat.insert(m_mdat.end(), p, p + cBytes);
+    m_cSample += cBytes + 4;
+}
+
+void
+FMP4Writer::EndSample(uint32_t duration, bool bSync)
+{
+    Sample s;
+    s.size = m_cSample;
+    s.duration = duration;
+    s.bSync = bSync;
+    m_samples.push_back(s);
+    m_cSample = 0;
+}
+
+void
+FMP4Writer::WriteFragment(std::vector<BYTE>* pOut)
+{
+    BoxWriter w(pOut);
+    size_t moof = w.Begin("moof");
+    size_t dataOffset;
+    {
+        size_t mfhd = w.BeginFull("mfhd", 0, 0);
+        w.Put32(++m_sequence);
+        w.End(mfhd);
+
+        size_t traf = w.Begin("traf");
+        {
+            size_t tfhd = w.BeginFull("tfhd", 0, 0x020000);    // default-base-is-moof
+            w.Put32(1);
+            w.End(tfhd);
+
+            size_t tfdt = w.BeginFull("tfdt", 1, 0);
+            w.Put64(m_baseDecodeTime);
+            w.End(tfdt);
+
+            // data offset, and per-sample duration, size and flags
+            size_t trun = w.BeginFull("trun", 0, 0x000701);
+            w.Put32((uint32_t)m_samples.size());
+            dataOffset = w.Size();
+            w.Put32(0);
+            for (size_t i = 0; i < m_samples.size(); i++)
+            {
+                w.Put32(m_samples[i].duration);
+                w.Put32(m_samples[i].size);
+                w.Put32(m_samples[i].bSync ? sample_flags_sync : sample_flags_other);
+            }
+            w.End(trun);
+        }
+        w.End(traf);
+    }
+    w.End(moof);
+
+    // the data starts just past the mdat header
+    w.Patch32(dataOffset, uint32_t(w.Size() - moof + 8));
+    w.Put32(uint32_t(m_mdat.size() + 8));
+    w.PutBytes((const BYTE*)"mdat", 4);
+    if (!m_mdat.empty())
+    {
+        w.PutBytes(&m_mdat[0], (int)m_mdat.size());
+    }
+}
@@ -0,0 +1,56 @@
+//
+//  FMP4Writer.h
+//  Encoder Demo
+//
+//  Fragmented MP4 (ISO/IEC 14496-12, CMAF-style) for a single H.264
+//  track: an initialization segment with the avcC config, and then
+//  moof/mdat fragments. The caller adds each frame's NALUs as they
+//  come from the encoder; they are written into the mdat with length
+//  prefixes, and the fragment is then ready to serve as it is.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include <stdint.h>
+#include <vector>
+
+// media timescale: the same 90kHz clock as the RTP output
+const int fmp4_timescale = 90000;
+
+class FMP4Writer
+{
+public:
+    FMP4Writer(const BYTE* avcC, int cBytes);
+
+    // ftyp and moov
+    void InitSegment(std::vector<BYTE>* pOut);
+
+    // a fragment is built up a sample at a time, and then written out
+    // whole. The data for each sample is appended with AddNALU.
+    void BeginFragment(uint64_t baseDecodeTime);
+    void AddNALU(const BYTE* p, int cBytes);
+    void EndSample(uint32_t duration, bool bSync);
+    int Samples()       { return (int)m_samples.size(); }
+
+    // moof and mdat for the samples so far
+    void WriteFragment(std::vector<BYTE>* pOut);
+
+private:
+    struct Sample
+    {
+        uint32_t size;
+        uint32_t duration;
+        bool bSync;
+    };
+
+    std::vector<BYTE> m_avcC;
+    int m_width;
+    int m_height;
+
+    uint32_t m_sequence;
+    uint64_t m_baseDecodeTime;
+    std::vector<Sample> m_samples;
+    uint32_t m_cSample;         // bytes of the sample in progress
+    std::vector<BYTE> m_mdat;
+};
@@ -0,0 +1,27 @@
+//
+//  GOPCache.h
+//  Encoder Demo
+//
+//  The most recent group of pictures, from the last IDR onwards, so
+//  that a new viewer can start decoding straight away instead of
+//  waiting for the next IDR. The frames, packetized, are shared (not
+//  copied) between the cache and every session replaying them.
+//
+
+#import <Foundation/Foundation.h>
+#import "RTPFrame.h"
+
+@interface GOPCache : NSObject
+
+// if a GOP grows beyond either limit, nothing is cached until the next IDR
++ (GOPCache*) cacheWithConfig:(NSData*) avcC maxBytes:(int) maxBytes maxFrames:(int) maxFrames;
+
+- (void) addFrame:(RTPFrame*) frame;
+
+// RTPFrame objects starting at an IDR (with SPS and PPS in front of
+// it), or nil if there is no usable GOP
+- (NSArray*) frames;
+
+@property (readonly) int bytes;
+
+@end
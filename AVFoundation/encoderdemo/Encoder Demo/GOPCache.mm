@@ -0,0 +1,98 @@
+//
+//  GOPCache.mm
+//  Encoder Demo
+//
+
+#import "GOPCache.h"
+#import "NALUnit.h"
+
+@interface GOPCache ()
+{
+    NSData* _sps;
+    NSData* _pps;
+    int _maxBytes;
+    int _maxFrames;
+    
+    NSMutableArray* _frames;
+    int _bytes;
+    BOOL _valid;
+}
+
+- (GOPCache*) initWithConfig:(NSData*) avcC maxBytes:(int) maxBytes maxFrames:(int) maxFrames;
+
+@end
+
+@implementation GOPCache
+
+@synthesize bytes = _bytes;
+
++ (GOPCache*) cacheWithConfig:(NSData*) avcC maxBytes:(int) maxBytes maxFrames:(int) maxFrames
+{
+    return [[GOPCache alloc] initWithConfig:avcC maxBytes:maxBytes maxFrames:maxFrames];
+}
+
+- (GOPCache*) initWithConfig:(NSData*) avcC maxBytes:(int) maxBytes maxFrames:(int) maxFrames
+{
+    self = [super init];
+    
+    // the encoder sends parameter sets out-of-band, but a GOP replayed
+    // to a new client should be decodable on its own
+    avcCHeader avc((const BYTE*)[avcC bytes], (int)[avcC length]);
+    _sps = [NSData dataWithBytes:avc.sps()->Start() length:avc.sps()->Length()];
+    _pps = [NSData dataWithBytes:avc.pps()->Start() length:avc.pps()->Length()];
+    
+    _maxBytes = maxBytes;
+    _maxFrames = maxFrames;
+    _frames = [NSMutableArray arrayWithCapacity:maxFrames];
+    _bytes = 0;
+    _valid = NO;
+    return self;
+}
+
+- (void) addFrame:(RTPFrame*) frame
+{
+    @synchronized(self)
+    {
+        if (frame.frameClass == FrameIDR)
+        {
+            // start of a new GOP: drop our references to the old one.
+            // Only this copy of the IDR is packetized with the parameter
+            // sets; live sessions have them from the SDP.
+            [_frames removeAllObjects];
+            _bytes = 0;
+            _valid = YES;
+            NSMutableArray* first = [NSMutableArray arrayWithObjects:_sps, _pps, nil];
+            [first addObjectsFromArray:frame.nalus];
+            frame = [RTPFrame frameWithNALUs:first time:frame.pts];
+        }
+        if (!_valid)
+        {
+            return;
+        }
+        if (((_bytes + frame.bytes) > _maxBytes) || ((int)[_frames count] >= _maxFrames))
+        {
+            // too big to be worth holding; wait for the next IDR
+            [_frames removeAllObjects];
+            _bytes = 0;
+            _valid = NO;
+            return;
+        }
+        [_frames addObject:frame];
+        _bytes += frame.bytes;
+    }
+}
+
+- (NSArray*) frames
+{
+    @synchronized(self)
+    {
+        if (!_valid || ([_frames count] == 0))
+        {
+            return nil;
+        }
+        // a shallow copy: the frames themselves are immutable and shared
+        return [_frames copy];
+    }
+}
+
+@end
@@ -0,0 +1,47 @@
+//
+//  HLSSegmenter.h
+//  Encoder Demo
+//
+//  Low-latency HLS output. Frames from the encoder are muxed once into
+//  fMP4 partial segments, and segments start at an IDR unless the GOP
+//  would run past the fixed target duration. The parts, the
+//  init segment and the rendered playlist are kept in memory, and
+//  every viewer is served from those same objects. A segment is the
+//  list of its parts, so it takes no memory of its own. Only the last
+//  few segments are kept, so memory stays bounded.
+//
+
+#import <Foundation/Foundation.h>
+#import "RTPFrame.h"
+
+typedef enum
+{
+    HLSAvailable,
+    HLSPending,         // not yet, but soon: hold the request
+    HLSMissing,         // gone, or too far ahead
+} HLSStatus;
+
+@interface HLSSegmenter : NSObject
+
++ (HLSSegmenter*) segmenterWithConfig:(NSData*) avcC;
+
+// called on the encoder's thread, in decode order
+- (void) addFrame:(RTPFrame*) frame;
+
+// the playlist, if it has segment msn (and part, if part >= 0).
+// msn < 0, or one that has already left the playlist, gets the
+// current playlist without waiting.
+- (HLSStatus) playlistForMSN:(long) msn part:(int) part data:(NSData**) pData;
+
+// init.mp4, seg<msn>.m4s or part<msn>.<part>.m4s, as a list of NSData
+// to be sent one after the other
+- (HLSStatus) resource:(NSString*) name chunks:(NSArray**) pChunks;
+
+// called on the encoder's thread after each new part
+@property (copy) void (^publishHandler)(void);
+
+// in seconds
+@property (readonly) double partTarget;
+@property (readonly) int targetDuration;
+
+@end
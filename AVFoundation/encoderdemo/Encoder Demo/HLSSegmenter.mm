@@ -0,0 +1,348 @@
+//
+//  HLSSegmenter.mm
+//  Encoder Demo
+//
+
+#import "HLSSegmenter.h"
+#import "FMP4Writer.h"
+#import <deque>
+#import <math.h>
+
+// a part is closed before it would grow past this
+static const double part_target_seconds = 0.333;
+
+// a segment ends at the first IDR after this
+static const double segment_target_seconds = 2.0;
+
+// EXT-X-TARGETDURATION, which may not change once the stream starts. A
+// segment is cut without waiting for an IDR rather than run past it.
+static const int target_duration_seconds = 4;
+
+// complete segments kept for the playlist and for serving
+static const int window_segments = 6;
+
+// used when a frame's duration cannot be worked out from its neighbour
+static const int64_t default_frame_duration = fmp4_timescale / 30;
+
+struct HLSPart
+{
+    NSData* data;
+    double duration;
+    bool bIndependent;
+};
+
+struct HLSSegment
+{
+    long msn;
+    std::vector<HLSPart> parts;
+    double duration;
+    bool bComplete;
+};
+
+@interface HLSSegmenter ()
+{
+    FMP4Writer* _writer;
+    NSData* _init;
+
+    // the last frame is held until the next one gives its duration
+    RTPFrame* _pending;
+    int64_t _pendingTime;
+    int64_t _lastDuration;
+
+    std::deque<HLSSegment> _segments;
+    long _nextMSN;
+    uint64_t _decodeTime;
+    int64_t _partDuration;
+    bool _bPartIndependent;
+    bool _bPublished;
+
+    // rendered once per new part, and shared by every request
+    NSData* _playlist;
+    int _targetDuration;
+}
+
+- (HLSSegmenter*) initWithConfig:(NSData*) avcC;
+- (void) commitFrame:(RTPFrame*) frame duration:(int64_t) duration;
+- (void) closePart;
+- (void) renderPlaylist;
+- (HLSStatus) statusOfMSN:(long) msn part:(int) part;
+
+@end
+
+@implementation HLSSegmenter
+
+@synthesize publishHandler = _publishHandler;
+@synthesize targetDuration = _targetDuration;
+
++ (HLSSegmenter*) segmenterWithConfig:(NSData*) avcC
+{
+    return [[HLSSegmenter alloc] initWithConfig:avcC];
+}
+
+- (HLSSegmenter*) initWithConfig:(NSData*) avcC
+{
+    self = [super init];
+    _writer = new FMP4Writer((const BYTE*)[avcC bytes], (int)[avcC length]);
+    std::vector<BYTE> init;
+    _writer->InitSegment(&init);
+    _init = [NSData dataWithBytes:&init[0] length:init.size()];
+    _targetDuration = target_duration_seconds;
+    _lastDuration = default_frame_duration;
+    return self;
+}
+
+- (void) dealloc
+{
+    delete _writer;
+}
+
+- (double) partTarget
+{
+    return part_target_seconds;
+}
+
+- (void) addFrame:(RTPFrame*) frame
+{
+    BOOL bPublished;
+    @synchronized(self)
+    {
+        int64_t t = (int64_t)llround(frame.pts * fmp4_timescale);
+        if (_pending != nil)
+        {
+            // timestamps that do not advance (B-frames, or a clock step)
+            // get the last good duration, so decode time always moves on
+            int64_t duration = t - _pendingTime;
+            if ((duration <= 0) || (duration > fmp4_timescale))
+            {
+                duration = _lastDuration;
+            }
+            _lastDuration = duration;
+            [self commitFrame:_pending duration:duration];
+        }
+        _pending = frame;
+        _pendingTime = t;
+        bPublished = _bPublished;
+        _bPublished = false;
+    }
+    void (^handler)(void) = self.publishHandler;
+    if (bPublished && (handler != nil))
+    {
+        handler();
+    }
+}
+
+- (void) commitFrame:(RTPFrame*) frame duration:(int64_t) duration
+{
+    BOOL bIDR = (frame.frameClass == FrameIDR);
+    double segmentSoFar = _segments.empty() ? 0 : (_segments.back().duration + (double(_partDuration) / fmp4_timescale));
+    bool bFull = !_segments.empty() && ((segmentSoFar + (double(duration) / fmp4_timescale)) > _targetDuration);
+    if ((bIDR && (_segments.empty() || (segmentSoFar >= segment_target_seconds))) || bFull)
+    {
+        [self closePart];
+        if (!_segments.empty())
+        {
+            _segments.back().bComplete = true;
+        }
+        HLSSegment seg;
+        seg.msn = _nextMSN++;
+        seg.duration = 0;
+        seg.bComplete = false;
+        _segments.push_back(seg);
+
+        // the oldest segment goes once a new one starts, though anyone
+        // still sending it keeps its parts alive until they are done
+        while ((int)_segments.size() > (window_segments + 1))
+        {
+            _segments.pop_front();
+        }
+        [self renderPlaylist];
+    }
+    if (_segments.empty())
+    {
+        // nothing until the first IDR
+        return;
+    }
+    if ((_writer->Samples() > 0) && ((_partDuration + duration) > (part_target_seconds * fmp4_timescale)))
+    {
+        [self closePart];
+    }
+    if (_writer->Samples() == 0)
+    {
+        _writer->BeginFragment(_decodeTime);
+        _bPartIndependent = bIDR;
+    }
+    for (NSData* nalu in frame.nalus)
+    {
+        _writer->AddNALU((const BYTE*)[nalu bytes], (int)[nalu length]);
+    }
+    _writer->EndSample((uint32_t)duration, bIDR);
+    _partDuration += duration;
+    _decodeTime += duration;
+}
+
+- (void) closePart
+{
+    if (_writer->Samples() == 0)
+    {
+        return;
+    }
+    std::vector<BYTE> fragment;
+    _writer->WriteFragment(&fragment);
+    HLSPart part;
+    part.data = [NSData dataWithBytes:&fragment[0] length:fragment.size()];
+    part.duration = double(_partDuration) / fmp4_timescale;
+    part.bIndependent = _bPartIndependent;
+    HLSSegment& seg = _segments.back();
+    seg.parts.push_back(part);
+    seg.duration += part.duration;
+    _partDuration = 0;
+    _writer->BeginFragment(_decodeTime);
+    [self renderPlaylist];
+    _bPublished = true;
+}
+
+- (void) renderPlaylist
+{
+    NSMutableString* s = [NSMutableString stringWithCapacity:4096];
+    [s appendFormat:@"#EXTM3U\n#EXT-X-VERSION:6\n#EXT-X-TARGETDURATION:%d\n", _targetDuration];
+    [s appendFormat:@"#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n", part_target_seconds * 3];
+    [s appendFormat:@"#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_target_seconds];
+    [s appendFormat:@"#EXT-X-MEDIA-SEQUENCE:%ld\n", _segments.empty() ? 0 : _segments.front().msn];
+    [s appendString:@"#EXT-X-MAP:URI=\"init.mp4\"\n"];
+
+    // parts are listed for the last three target durations only
+    double partsFrom = 0;
+    for (size_t i = 0; i < _segments.size(); i++)
+    {
+        partsFrom += _segments[i].duration;
+    }
+    partsFrom -= _targetDuration * 3;
+
+    double t = 0;
+    for (size_t i = 0; i < _segments.size(); i++)
+    {
+        const HLSSegment& seg = _segments[i];
+        if ((t + seg.duration) > partsFrom)
+        {
+            for (size_t j = 0; j < seg.parts.size(); j++)
+            {
+                [s appendFormat:@"#EXT-X-PART:DURATION=%.5f,URI=\"part%ld.%d.m4s\"%@\n",
+                 seg.parts[j].duration, seg.msn, (int)j, seg.parts[j].bIndependent ? @",INDEPENDENT=YES" : @""];
+            }
+        }
+        if (seg.bComplete)
+        {
+            [s appendFormat:@"#EXTINF:%.5f,\nseg%ld.m4s\n", seg.duration, seg.msn];
+        }
+        t += seg.duration;
+    }
+    if (!_segments.empty())
+    {
+        const HLSSegment& last = _segments.back();
+        [s appendFormat:@"#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%ld.%d.m4s\"\n", last.msn, (int)last.parts.size()];
+    }
+    _playlist = [s dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (HLSStatus) statusOfMSN:(long) msn part:(int) part
+{
+    if (_segments.empty())
+    {
+        return HLSPending;
+    }
+    // a segment that has already left the playlist needs no wait
+    const HLSSegment& last = _segments.back();
+    if ((msn < last.msn) || ((msn == last.msn) && (part >= 0) && (part < (int)last.parts.size())))
+    {
+        return HLSAvailable;
+    }
+
+    // a client may ask up to two segments ahead, and wait for them
+    return (msn <= (last.msn + 2)) ? HLSPending : HLSMissing;
+}
+
+- (HLSStatus) playlistForMSN:(long) msn part:(int) part data:(NSData**) pData
+{
+    @synchronized(self)
+    {
+        HLSStatus status = (msn < 0) ? (_playlist ? HLSAvailable : HLSPending) : [self statusOfMSN:msn part:part];
+        if (status == HLSAvailable)
+        {
+            *pData = _playlist;
+        }
+        return status;
+    }
+}
+
+- (HLSStatus) resource:(NSString*) name chunks:(NSArray**) pChunks
+{
+    if ([name isEqualToString:@"init.mp4"])
+    {
+        *pChunks = @[_init];
+        return HLSAvailable;
+    }
+    long msn;
+    int part = -1;
+    NSScanner* scan = [NSScanner scannerWithString:name];
+    BOOL bPart = [scan scanString:@"part" intoString:nil];
+    if (!bPart && ![scan scanString:@"seg" intoString:nil])
+    {
+        return HLSMissing;
+    }
+    if (![scan scanLong:&msn] || (msn < 0))
+    {
+        return HLSMissing;
+    }
+    if (bPart && (![scan scanString:@"." intoString:nil] || ![scan scanInt:&part] || (part < 0)))
+    {
+        return HLSMissing;
+    }
+    if (![scan scanString:@".m4s" intoString:nil] || ![scan isAtEnd])
+    {
+        return HLSMissing;
+    }
+
+    @synchronized(self)
+    {
+        if (!_segments.empty() && (msn < _segments.front().msn))
+        {
+            return HLSMissing;
+        }
+        HLSStatus status = [self statusOfMSN:msn part:part];
+        if (status != HLSAvailable)
+        {
+            // only the next part or two are worth waiting for (the
+            // preload hint names the next one before it exists)
+            if ((status == HLSPending) && bPart && !_segments.empty())
+            {
+                const HLSSegment& last = _segments.back();
+                bool bNext = ((msn == last.msn) && (part <= ((int)last.parts.size() + 1))) || ((msn == (last.msn + 1)) && (part == 0));
+                return bNext ? HLSPending : HLSMissing;
+            }
+            return status;
+        }
+        const HLSSegment& seg = _segments[msn - _segments.front().msn];
+        if (bPart)
+        {
+            if (part >= (int)seg.parts.size())
+            {
+                return HLSMissing;
+            }
+            *pChunks = @[seg.parts[part].data];
+            return HLSAvailable;
+        }
+        if (!seg.bComplete)
+        {
+            return HLSPending;
+        }
+        NSMutableArray* chunks = [NSMutableArray arrayWithCapacity:seg.parts.size()];
+        for (size_t i = 0; i < seg.parts.size(); i++)
+        {
+            [chunks addObject:seg.parts[i].data];
+        }
+        *pChunks = chunks;
+        return HLSAvailable;
+    }
+}
+
+@end
@@ -0,0 +1,32 @@
+//
+//  HTTPServer.h
+//  Encoder Demo
+//
+//  Minimal HTTP/1.1 server for the low-latency HLS output: the playlist
+//  at /live.m3u8, and the init segment, segments and parts it refers
+//  to. Connections are kept alive and requests may be pipelined. A
+//  playlist request with _HLS_msn (and _HLS_part) is held until the
+//  segmenter has that part. A request for the part named in the preload
+//  hint is also held until the part exists. Responses are written
+//  straight from the segmenter's cached buffers, so each extra viewer
+//  costs no copy and no re-mux.
+//
+//  /metrics serves the process metrics (see Metrics.h) in the
+//  Prometheus text format, followed by whatever metricsHandler adds.
+//
+//  All sockets are handled on the main run loop, like the RTSP server.
+//
+
+#import <Foundation/Foundation.h>
+#import "HLSSegmenter.h"
+
+@interface HTTPServer : NSObject
+
++ (HTTPServer*) serverWithSegmenter:(HLSSegmenter*) hls port:(int) port;
+
+- (void) shutdown;
+
+// more metrics text, already in exposition format; called on the main thread
+@property (copy) NSString* (^metricsHandler)(void);
+
+@end
@@ -0,0 +1,700 @@
+//
+//  HTTPServer.mm
+//  Encoder Demo
+//
+
+#import "HTTPServer.h"
+#import "Metrics.h"
+#import "arpa/inet.h"
+#import "fcntl.h"
+#import <sys/uio.h>
+
+// past this much queued output, no further pipelined requests are
+// answered until the client catches up. The queue holds references to
+// cached buffers, so this bounds latency rather than memory.
+static const int max_queued_output = 1024 * 1024;
+
+// the socket goes on reading meanwhile: a client that sends more than
+// this ahead of the answers it has had is disconnected
+static const int max_pending_input = 64 * 1024;
+
+// iovecs per writev
+static const int max_write_chunks = 16;
+
+// a request header larger than this is refused
+static const int max_request_header = 8192;
+
+// nothing we serve takes a body, so a short one is stepped over and
+// anything longer is refused
+static const long max_request_body = 16384;
+
+// blocked requests are answered with 503 after this many target durations
+static const int block_timeout_targets = 3;
+
+// a Content-Length value: its decimal digits, saturating just past
+// max_request_body, or -1 if it is not an unsigned decimal at all
+static long parseContentLength(NSString* value)
+{
+    NSString* digits = [value stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    if ([digits length] == 0)
+    {
+        return -1;
+    }
+    long length = 0;
+    for (NSUInteger i = 0; i < [digits length]; i++)
+    {
+        unichar c = [digits characterAtIndex:i];
+        if ((c < '0') || (c > '9'))
+        {
+            return -1;
+        }
+        length = MIN((length * 10) + (c - '0'), max_request_body + 1);
+    }
+    return length;
+}
+
+static NSString* httpDate()
+{
+    static NSDateFormatter* formatter = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss 'GMT'";
+    });
+    return [formatter stringFromDate:[NSDate date]];
+}
+
+@class HTTPConnection;
+
+@interface HTTPServer ()
+{
+    CFSocketRef _listener;
+    HLSSegmenter* _hls;
+    NSMutableArray* _connections;
+}
+
+- (HTTPServer*) initWithSegmenter:(HLSSegmenter*) hls port:(int) port;
+- (void) onAccept:(CFSocketNativeHandle) childHandle;
+- (void) onPublish;
+- (void) removeConnection:(HTTPConnection*) conn;
+- (NSData*) metricsText;
+
+@end
+
+@interface HTTPConnection : NSObject
+{
+    CFSocketRef _s;
+    HTTPServer* __weak _server;
+    HLSSegmenter* _hls;
+    NSMutableData* _input;
+
+    // response chunks not yet written, and how far into the first
+    NSMutableArray* _output;
+    size_t _offset;
+    long _queued;
+    BOOL _bCloseAfterOutput;
+
+    // the request waiting for the segmenter, if any
+    NSString* _path;
+    NSDictionary* _query;
+    BOOL _bHead;
+    BOOL _bKeepAlive;
+    BOOL _bBlocked;
+    long _blockGeneration;
+}
+
++ (HTTPConnection*) connectionWithSocket:(CFSocketNativeHandle) s server:(HTTPServer*) server segmenter:(HLSSegmenter*) hls;
+- (HTTPConnection*) initWithSocket:(CFSocketNativeHandle) s server:(HTTPServer*) server segmenter:(HLSSegmenter*) hls;
+- (void) onSocketData:(CFDataRef) data;
+- (void) onWritable;
+- (void) processInput;
+- (BOOL) parseRequest:(NSString*) header;
+- (BOOL) answer;
+- (void) onPublish;
+- (void) onBlockTimeout:(long) generation;
+- (void) respond:(int) code text:(NSString*) text type:(NSString*) type cache:(NSString*) cache chunks:(NSArray*) chunks;
+- (void) flush;
+- (void) close;
+
+@end
+
+static void onConnectionSocket(CFSocketRef s,
+                               CFSocketCallBackType callbackType,
+                               CFDataRef address,
+                               const void *data,
+                               void *info
+                               )
+{
+    HTTPConnection* conn = (__bridge HTTPConnection*)info;
+    switch (callbackType)
+    {
+        case kCFSocketDataCallBack:
+            [conn onSocketData:(CFDataRef) data];
+            break;
+
+        case kCFSocketWriteCallBack:
+            [conn onWritable];
+            break;
+
+        default:
+            NSLog(@"unexpected socket event");
+            break;
+    }
+}
+
+static void onListenerSocket(CFSocketRef s,
+                             CFSocketCallBackType callbackType,
+                             CFDataRef address,
+                             const void *data,
+                             void *info
+                             )
+{
+    HTTPServer* server = (__bridge HTTPServer*)info;
+    switch (callbackType)
+    {
+        case kCFSocketAcceptCallBack:
+        {
+            CFSocketNativeHandle* pH = (CFSocketNativeHandle*) data;
+            [server onAccept:*pH];
+            break;
+        }
+        default:
+            NSLog(@"unexpected socket event");
+            break;
+    }
+}
+
+@implementation HTTPConnection
+
++ (HTTPConnection*) connectionWithSocket:(CFSocketNativeHandle) s server:(HTTPServer*) server segmenter:(HLSSegmenter*) hls
+{
+    return [[HTTPConnection alloc] initWithSocket:s server:server segmenter:hls];
+}
+
+- (HTTPConnection*) initWithSocket:(CFSocketNativeHandle) s server:(HTTPServer*) server segmenter:(HLSSegmenter*) hls
+{
+    self = [super init];
+    _server = server;
+    _hls = hls;
+    _input = [NSMutableData dataWithCapacity:1024];
+    _output = [NSMutableArray arrayWithCapacity:8];
+
+    // writes never block the run loop, and a client that goes away
+    // mid-response must not raise SIGPIPE
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    int t = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &t, sizeof(t));
+
+    // the socket holds a reference to us until it is invalidated
+    CFSocketContext info;
+    memset(&info, 0, sizeof(info));
+    info.info = (__bridge void*)self;
+    info.retain = CFRetain;
+    info.release = CFRelease;
+    _s = CFSocketCreateWithNative(nil, s, kCFSocketDataCallBack | kCFSocketWriteCallBack, onConnectionSocket, &info);
+    if (_s == nil)
+    {
+        ::close(s);
+        return nil;
+    }
+
+    // the write callback is only wanted while output is waiting
+    CFSocketDisableCallBacks(_s, kCFSocketWriteCallBack);
+    CFRunLoopSourceRef rls = CFSocketCreateRunLoopSource(nil, _s, 0);
+    CFRunLoopAddSource(CFRunLoopGetMain(), rls, kCFRunLoopCommonModes);
+    CFRelease(rls);
+    return self;
+}
+
+- (void) onSocketData:(CFDataRef) data
+{
+    if (CFDataGetLength(data) == 0)
+    {
+        [self close];
+        return;
+    }
+    [_input appendData:(__bridge NSData*)data];
+    [self processInput];
+    if ((_s != nil) && ([_input length] > max_pending_input))
+    {
+        // requests held while earlier ones wait; answering is not
+        // possible out of turn, so the connection just goes
+        NSLog(@"HTTP client sent %d bytes ahead of its answers", (int)[_input length]);
+        [self close];
+    }
+}
+
+- (void) onWritable
+{
+    [self flush];
+    [self processInput];
+}
+
+- (void) processInput
+{
+    while ((_s != nil) && !_bBlocked && !_bCloseAfterOutput && (_queued < max_queued_output))
+    {
+        NSData* blank = [NSData dataWithBytes:"\r\n\r\n" length:4];
+        NSRange end = [_input rangeOfData:blank options:0 range:NSMakeRange(0, [_input length])];
+        if (end.location == NSNotFound)
+        {
+            if ([_input length] > max_request_header)
+            {
+                [self respond:431 text:@"Request Header Fields Too Large" type:nil cache:nil chunks:nil];
+                _bCloseAfterOutput = YES;
+                [self flush];
+            }
+            return;
+        }
+        int cUsed = (int)(end.location + end.length);
+        NSString* header = [[NSString alloc] initWithBytes:[_input bytes] length:end.location encoding:NSUTF8StringEncoding];
+        long cBody = 0;
+        BOOL bValid = (header != nil) && [self parseRequest:header];
+        if (bValid)
+        {
+            // nothing we serve takes a body, but a body must be stepped over
+            for (NSString* line in [header componentsSeparatedByString:@"\r\n"])
+            {
+                NSRange colon = [line rangeOfString:@":"];
+                if ((colon.location != NSNotFound) &&
+                    ([[line substringToIndex:colon.location] caseInsensitiveCompare:@"content-length"] == NSOrderedSame))
+                {
+                    cBody = parseContentLength([line substringFromIndex:(colon.location + 1)]);
+                    if ((cBody < 0) || (cBody > max_request_body))
+                    {
+                        break;
+                    }
+                }
+            }
+            if ((cBody < 0) || (cBody > max_request_body))
+            {
+                // the body cannot be stepped over, so nothing after it can be read
+                _bKeepAlive = NO;
+                if (cBody < 0)
+                {
+                    [self respond:400 text:@"Bad Request" type:nil cache:nil chunks:nil];
+                }
+                else
+                {
+                    [self respond:413 text:@"Payload Too Large" type:nil cache:nil chunks:nil];
+                }
+                [_input setLength:0];
+                _bCloseAfterOutput = YES;
+                [self flush];
+                return;
+            }
+            if ((long)[_input length] < (cUsed + cBody))
+            {
+                return;
+            }
+        }
+        [_input replaceBytesInRange:NSMakeRange(0, cUsed + cBody) withBytes:NULL length:0];
+
+        if (!bValid)
+        {
+            _bKeepAlive = NO;
+            [self respond:400 text:@"Bad Request" type:nil cache:nil chunks:nil];
+        }
+        else if (![self answer])
+        {
+            // held until the segmenter publishes, or the time limit
+            _bBlocked = YES;
+            long generation = ++_blockGeneration;
+            double timeout = block_timeout_targets * _hls.targetDuration;
+            HTTPConnection* __weak weakSelf = self;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+                [weakSelf onBlockTimeout:generation];
+            });
+        }
+        if (!_bBlocked && !_bKeepAlive)
+        {
+            _bCloseAfterOutput = YES;
+        }
+        [self flush];
+    }
+}
+
+- (BOOL) parseRequest:(NSString*) header
+{
+    NSArray* lines = [header componentsSeparatedByString:@"\r\n"];
+    NSArray* request = [[lines objectAtIndex:0] componentsSeparatedByString:@" "];
+    if (([request count] != 3) || ![[request objectAtIndex:2] hasPrefix:@"HTTP/1."])
+    {
+        return NO;
+    }
+    NSString* method = [request objectAtIndex:0];
+    _bHead = [method isEqualToString:@"HEAD"];
+    if (!_bHead && ![method isEqualToString:@"GET"])
+    {
+        _path = nil;
+        _bKeepAlive = NO;
+        return YES;
+    }
+
+    // 1.1 is persistent unless the client says otherwise, 1.0 only if it asks
+    _bKeepAlive = [[request objectAtIndex:2] isEqualToString:@"HTTP/1.1"];
+    for (int i = 1; i < [lines count]; i++)
+    {
+        NSString* line = [lines objectAtIndex:i];
+        NSRange colon = [line rangeOfString:@":"];
+        if ((colon.location != NSNotFound) &&
+            ([[line substringToIndex:colon.location] caseInsensitiveCompare:@"connection"] == NSOrderedSame))
+        {
+            NSString* val = [[line substringFromIndex:(colon.location + 1)] lowercaseString];
+            if ([val rangeOfString:@"close"].location != NSNotFound)
+            {
+                _bKeepAlive = NO;
+            }
+            else if ([val rangeOfString:@"keep-alive"].location != NSNotFound)
+            {
+                _bKeepAlive = YES;
+            }
+        }
+    }
+
+    NSString* target = [request objectAtIndex:1];
+    NSMutableDictionary* query = [NSMutableDictionary dictionaryWithCapacity:2];
+    NSRange q = [target rangeOfString:@"?"];
+    if (q.location != NSNotFound)
+    {
+        for (NSString* pair in [[target substringFromIndex:(q.location + 1)] componentsSeparatedByString:@"&"])
+        {
+            NSArray* kv = [pair componentsSeparatedByString:@"="];
+            if ([kv count] == 2)
+            {
+                [query setObject:[kv objectAtIndex:1] forKey:[kv objectAtIndex:0]];
+            }
+        }
+        target = [target substringToIndex:q.location];
+    }
+    _path = target;
+    _query = query;
+    return YES;
+}
+
+// YES if a response was queued; NO if the request must wait
+- (BOOL) answer
+{
+    if (_path == nil)
+    {
+        [self respond:405 text:@"Method Not Allowed" type:nil cache:nil chunks:nil];
+        return YES;
+    }
+    if (![_path hasPrefix:@"/"] || ([_path rangeOfString:@"/" options:0 range:NSMakeRange(1, [_path length] - 1)].location != NSNotFound))
+    {
+        [self respond:404 text:@"Not Found" type:nil cache:nil chunks:nil];
+        return YES;
+    }
+    NSString* name = [_path substringFromIndex:1];
+
+    if ([name isEqualToString:@"metrics"])
+    {
+        NSData* text = [_server metricsText];
+        if (text == nil)
+        {
+            [self respond:404 text:@"Not Found" type:nil cache:nil chunks:nil];
+            return YES;
+        }
+        [self respond:200 text:@"OK" type:@"text/plain; version=0.0.4" cache:@"no-cache" chunks:@[text]];
+        return YES;
+    }
+
+    if ([name isEqualToString:@"live.m3u8"])
+    {
+        NSString* msnText = [_query objectForKey:@"_HLS_msn"];
+        NSString* partText = [_query objectForKey:@"_HLS_part"];
+        long msn = -1;
+        int part = -1;
+        if (msnText != nil)
+        {
+            msn = [msnText integerValue];
+            if (msn < 0)
+            {
+                [self respond:400 text:@"Bad Request" type:nil cache:nil chunks:nil];
+                return YES;
+            }
+        }
+        if (partText != nil)
+        {
+            part = [partText intValue];
+            if ((msnText == nil) || (part < 0))
+            {
+                [self respond:400 text:@"Bad Request" type:nil cache:nil chunks:nil];
+                return YES;
+            }
+        }
+        NSData* playlist = nil;
+        HLSStatus status = [_hls playlistForMSN:msn part:part data:&playlist];
+        if (status == HLSPending)
+        {
+            return NO;
+        }
+        if (status == HLSMissing)
+        {
+            // too far ahead to wait for (RFC 8216bis 6.2.5.2)
+            [self respond:400 text:@"Bad Request" type:nil cache:nil chunks:nil];
+            return YES;
+        }
+        [self respond:200 text:@"OK" type:@"application/vnd.apple.mpegurl" cache:@"no-cache" chunks:@[playlist]];
+        return YES;
+    }
+
+    NSArray* chunks = nil;
+    HLSStatus status = [_hls resource:name chunks:&chunks];
+    if (status == HLSPending)
+    {
+        return NO;
+    }
+    if (status == HLSMissing)
+    {
+        [self respond:404 text:@"Not Found" type:nil cache:nil chunks:nil];
+        return YES;
+    }
+    // media never changes once published
+    [self respond:200 text:@"OK" type:@"video/mp4" cache:@"max-age=60" chunks:chunks];
+    return YES;
+}
+
+- (void) onPublish
+{
+    if (_bBlocked && [self answer])
+    {
+        _bBlocked = NO;
+        if (!_bKeepAlive)
+        {
+            _bCloseAfterOutput = YES;
+        }
+        [self flush];
+        [self processInput];
+    }
+}
+
+- (void) onBlockTimeout:(long) generation
+{
+    if (_bBlocked && (generation == _blockGeneration))
+    {
+        _bBlocked = NO;
+        [self respond:503 text:@"Service Unavailable" type:nil cache:nil chunks:nil];
+        if (!_bKeepAlive)
+        {
+            _bCloseAfterOutput = YES;
+        }
+        [self flush];
+        [self processInput];
+    }
+}
+
+- (void) respond:(int) code text:(NSString*) text type:(NSString*) type cache:(NSString*) cache chunks:(NSArray*) chunks
+{
+    long cBody = 0;
+    for (NSData* chunk in chunks)
+    {
+        cBody += [chunk length];
+    }
+    NSMutableString* header = [NSMutableString stringWithFormat:@"HTTP/1.1 %d %@\r\nDate: %@\r\nContent-Length: %ld\r\nAccess-Control-Allow-Origin: *\r\n",
+                               code, text, httpDate(), cBody];
+    if (type != nil)
+    {
+        [header appendFormat:@"Content-Type: %@\r\n", type];
+    }
+    if (cache != nil)
+    {
+        [header appendFormat:@"Cache-Control: %@\r\n", cache];
+    }
+    if (!_bKeepAlive)
+    {
+        [header appendString:@"Connection: close\r\n"];
+    }
+    [header appendString:@"\r\n"];
+    NSData* headerData = [header dataUsingEncoding:NSUTF8StringEncoding];
+    [_output addObject:headerData];
+    _queued += [headerData length];
+    if (!_bHead)
+    {
+        for (NSData* chunk in chunks)
+        {
+            if ([chunk length] > 0)
+            {
+                [_output addObject:chunk];
+                _queued += [chunk length];
+            }
+        }
+    }
+}
+
+- (void) flush
+{
+    while ((_s != nil) && ([_output count] > 0))
+    {
+        struct iovec iov[max_write_chunks];
+        int cChunks = 0;
+        for (NSData* chunk in _output)
+        {
+            if (cChunks == max_write_chunks)
+            {
+                break;
+            }
+            size_t skip = (cChunks == 0) ? _offset : 0;
+            iov[cChunks].iov_base = (void*)((const uint8_t*)[chunk bytes] + skip);
+            iov[cChunks].iov_len = [chunk length] - skip;
+            cChunks++;
+        }
+        ssize_t cSent = writev(CFSocketGetNative(_s), iov, cChunks);
+        if (cSent < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                CFSocketEnableCallBacks(_s, kCFSocketWriteCallBack);
+                return;
+            }
+            if (errno != EINTR)
+            {
+                [self close];
+                return;
+            }
+            continue;
+        }
+        _queued -= cSent;
+        while ((cSent > 0) && ([_output count] > 0))
+        {
+            size_t cLeft = [[_output objectAtIndex:0] length] - _offset;
+            if ((size_t)cSent < cLeft)
+            {
+                _offset += cSent;
+                break;
+            }
+            cSent -= cLeft;
+            _offset = 0;
+            [_output removeObjectAtIndex:0];
+        }
+    }
+    if ((_s != nil) && _bCloseAfterOutput)
+    {
+        [self close];
+    }
+}
+
+- (void) close
+{
+    if (_s != nil)
+    {
+        CFSocketRef s = _s;
+        _s = nil;
+        _bBlocked = NO;
+        [_output removeAllObjects];
+        [_server removeConnection:self];
+
+        // releases the socket's reference to us, and closes the fd
+        CFSocketInvalidate(s);
+        CFRelease(s);
+    }
+}
+
+@end
+
+@implementation HTTPServer
+
+@synthesize metricsHandler = _metricsHandler;
+
++ (HTTPServer*) serverWithSegmenter:(HLSSegmenter*) hls port:(int) port
+{
+    return [[HTTPServer alloc] initWithSegmenter:hls port:port];
+}
+
+- (HTTPServer*) initWithSegmenter:(HLSSegmenter*) hls port:(int) port
+{
+    self = [super init];
+    _hls = hls;
+    _connections = [NSMutableArray arrayWithCapacity:10];
+
+    // parts are published on the encoder's thread; waiting requests
+    // are all on the main run loop
+    HTTPServer* __weak weakSelf = self;
+    hls.publishHandler = ^{
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf onPublish];
+        });
+    };
+
+    CFSocketContext info;
+    memset(&info, 0, sizeof(info));
+    info.info = (__bridge void*)self;
+    _listener = CFSocketCreate(nil, PF_INET, SOCK_STREAM, IPPROTO_TCP, kCFSocketAcceptCallBack, onListenerSocket, &info);
+
+    int t = 1;
+    setsockopt(CFSocketGetNative(_listener), SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    CFDataRef dataAddr = CFDataCreate(nil, (const uint8_t*)&addr, sizeof(addr));
+    CFSocketError e = CFSocketSetAddress(_listener, dataAddr);
+    CFRelease(dataAddr);
+    if (e)
+    {
+        NSLog(@"HTTP bind error %d", (int) e);
+    }
+
+    CFRunLoopSourceRef rls = CFSocketCreateRunLoopSource(nil, _listener, 0);
+    CFRunLoopAddSource(CFRunLoopGetMain(), rls, kCFRunLoopCommonModes);
+    CFRelease(rls);
+    return self;
+}
+
+- (void) onAccept:(CFSocketNativeHandle) childHandle
+{
+    HTTPConnection* conn = [HTTPConnection connectionWithSocket:childHandle server:self segmenter:_hls];
+    if (conn != nil)
+    {
+        [_connections addObject:conn];
+    }
+}
+
+- (void) onPublish
+{
+    // a copy, since an answer can close its connection
+    for (HTTPConnection* conn in [_connections copy])
+    {
+        [conn onPublish];
+    }
+}
+
+- (void) removeConnection:(HTTPConnection*) conn
+{
+    [_connections removeObject:conn];
+}
+
+- (NSData*) metricsText
+{
+    std::string text;
+    Metrics::Render(&text);
+    NSMutableData* data = [NSMutableData dataWithBytes:text.data() length:text.size()];
+    NSString* (^handler)(void) = self.metricsHandler;
+    if (handler != nil)
+    {
+        [data appendData:[handler() dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    return data;
+}
+
+- (void) shutdown
+{
+    _hls.publishHandler = nil;
+    self.metricsHandler = nil;
+    for (HTTPConnection* conn in [_connections copy])
+    {
+        [conn close];
+    }
+    if (_listener != nil)
+    {
+        CFSocketInvalidate(_listener);
+        CFRelease(_listener);
+        _listener = nil;
+    }
+}
+
+@end
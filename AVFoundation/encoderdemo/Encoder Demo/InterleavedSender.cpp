@@ -0,0 +1,226 @@
+//
+//  InterleavedSender.cpp
+//  Encoder Demo
+//
+//  Output queue for an RTSP control connection.
+//
+
+#include "InterleavedSender.h"
+#include "Metrics.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <unistd.h>
+
+// iovecs submitted per writev call
+static const int max_iov = 64;
+
+static MetricCounter* DropMetric()
+{
+    static MetricCounter* dropped = Metrics::Counter("rtp_packets_dropped_total", "Packets not sent to a session", "reason=\"tcp_queue\"");
+    return dropped;
+}
+
+InterleavedSender::InterleavedSender(int fd, int maxQueueBytes)
+: m_fd(fd),
+  m_maxQueue(maxQueueBytes),
+  m_cQueued(0),
+  m_offsetHead(0),
+  m_bWaitSync(false),
+  m_bFailed(false),
+  m_dropped(0)
+{
+#ifdef SO_NOSIGPIPE
+    // a client that disappears must not take the process down
+    int t = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &t, sizeof(t));
+#endif
+}
+
+void
+InterleavedSender::SendControl(const BYTE* p, int cBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Item item;
+    item.cHdr = 0;
+    item.bMedia = false;
+    item.payload.assign(p, p + cBytes);
+    m_queue.push_back(item);
+    m_cQueued += cBytes;
+}
+
+bool
+InterleavedSender::SendPacket(int channel, const BYTE* p, int cBytes, bool bSyncPoint)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bFailed || (cBytes > 0xffff))
+    {
+        m_dropped++;
+        DropMetric()->Add();
+        return false;
+    }
+
+    if ((m_cQueued + cBytes + 4) > m_maxQueue)
+    {
+        // client is not keeping up: throw away everything we were holding
+        // and resume at the next IDR, rather than growing without limit
+        DiscardMedia();
+        m_bWaitSync = true;
+    }
+    if (m_bWaitSync)
+    {
+        if (!bSyncPoint)
+        {
+            m_dropped++;
+            DropMetric()->Add();
+            return false;
+        }
+        m_bWaitSync = false;
+    }
+    Queue(channel, p, cBytes, true);
+    return true;
+}
+
+void
+InterleavedSender::SendReport(int channel, const BYTE* p, int cBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_bFailed && (cBytes <= 0xffff))
+    {
+        Queue(channel, p, cBytes, false);
+    }
+}
+
+void
+InterleavedSender::Queue(int channel, const BYTE* p, int cBytes, bool bMedia)
+{
+    Item item;
+    item.hdr[0] = '$';
+    item.hdr[1] = (BYTE) channel;
+    item.hdr[2] = (cBytes >> 8) & 0xff;
+    item.hdr[3] = cBytes & 0xff;
+    item.cHdr = 4;
+    item.bMedia = bMedia;
+    item.payload.assign(p, p + cBytes);
+    m_queue.push_back(item);
+    m_cQueued += item.Length();
+}
+
+void
+InterleavedSender::DiscardMedia()
+{
+    // the head may be partly written: it must be completed or the framing breaks
+    std::deque<Item> keep;
+    int cKept = 0;
+    for (size_t i = 0; i < m_queue.size(); i++)
+    {
+        const Item& item = m_queue[i];
+        if (!item.bMedia || ((i == 0) && (m_offsetHead > 0)))
+        {
+            keep.push_back(item);
+            cKept += item.Length() - ((i == 0) ? m_offsetHead : 0);
+        }
+        else
+        {
+            m_dropped++;
+            DropMetric()->Add();
+        }
+    }
+    if (keep.empty())
+    {
+        m_offsetHead = 0;
+    }
+    m_queue.swap(keep);
+    m_cQueued = cKept;
+}
+
+bool
+InterleavedSender::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_bFailed && !m_queue.empty())
+    {
+        struct iovec iov[max_iov];
+        int cIov = 0;
+        int skip = m_offsetHead;
+        for (size_t i = 0; (i < m_queue.size()) && (cIov < (max_iov - 1)); i++)
+        {
+            Item& item = m_queue[i];
+            if (skip < item.cHdr)
+            {
+                iov[cIov].iov_base = item.hdr + skip;
+                iov[cIov].iov_len = item.cHdr - skip;
+                cIov++;
+                skip = 0;
+            }
+            else
+            {
+                skip -= item.cHdr;
+            }
+            if (skip < (int)item.payload.size())
+            {
+                iov[cIov].iov_base = &item.payload[skip];
+                iov[cIov].iov_len = item.payload.size() - skip;
+                cIov++;
+            }
+            skip = 0;
+        }
+
+        static MetricHistogram* latency = Metrics::Histogram("rtp_send_seconds", "Time spent in one send call", "transport=\"tcp\"", 1e-9, 1 << 8, 1LL << 26);
+        int64_t start = MetricsNow();
+        ssize_t cWritten = writev(m_fd, iov, cIov);
+        latency->Record(MetricsNow() - start);
+        if (cWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return true;
+            }
+            m_bFailed = true;
+            return false;
+        }
+
+        // retire whatever went out completely
+        int cDone = (int) cWritten;
+        m_cQueued -= cDone;
+        while (cDone > 0)
+        {
+            int cHead = m_queue.front().Length() - m_offsetHead;
+            if (cDone < cHead)
+            {
+                m_offsetHead += cDone;
+                break;
+            }
+            cDone -= cHead;
+            m_offsetHead = 0;
+            m_queue.pop_front();
+        }
+    }
+    return !m_bFailed;
+}
+
+bool
+InterleavedSender::HasPending()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_queue.empty();
+}
+
+int
+InterleavedSender::QueuedBytes()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cQueued;
+}
+
+long
+InterleavedSender::DroppedPackets()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
@@ -0,0 +1,67 @@
+//
+//  InterleavedSender.h
+//  Encoder Demo
+//
+//  Output queue for an RTSP control connection. RTSP responses and
+//  RTP/RTCP packets interleaved as $ channel length frames share the
+//  same TCP socket, so everything written to it goes through here.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include <deque>
+#include <vector>
+#include <mutex>
+
+class InterleavedSender
+{
+public:
+    // fd must already be non-blocking. maxQueueBytes bounds the
+    // amount of media that can be held for a slow client.
+    InterleavedSender(int fd, int maxQueueBytes);
+
+    // RTSP response text. Never dropped.
+    void SendControl(const BYTE* p, int cBytes);
+
+    // RTP packet for an interleaved channel. bSyncPoint marks
+    // the first packet of an IDR: once the queue overflows, media is
+    // discarded until the next sync point. Returns false if dropped.
+    bool SendPacket(int channel, const BYTE* p, int cBytes, bool bSyncPoint);
+
+    // RTCP is small and infrequent, and is never dropped.
+    void SendReport(int channel, const BYTE* p, int cBytes);
+
+    // write as much as the socket will take without blocking.
+    // Returns false if the socket has failed.
+    bool Flush();
+
+    bool HasPending();
+    int QueuedBytes();
+    long DroppedPackets();
+
+private:
+    struct Item
+    {
+        BYTE hdr[4];
+        int cHdr;
+        bool bMedia;
+        std::vector<BYTE> payload;
+
+        int Length() const { return cHdr + (int)payload.size(); }
+    };
+
+    void Queue(int channel, const BYTE* p, int cBytes, bool bMedia);
+    void DiscardMedia();
+
+private:
+    std::mutex m_mutex;
+    int m_fd;
+    int m_maxQueue;
+    std::deque<Item> m_queue;
+    int m_cQueued;
+    int m_offsetHead;       // bytes of the head item already written
+    bool m_bWaitSync;
+    bool m_bFailed;
+    long m_dropped;
+};
@@ -0,0 +1,363 @@
+//
+//  Metrics.cpp
+//  Encoder Demo
+//
+//  Sharded lock-free metrics, and their text exposition.
+//
+
+#include "Metrics.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+// quantiles shown for each histogram, beside its buckets
+static const double exposition_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+int64_t MetricsNow()
+{
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+    {
+        mach_timebase_info(&timebase);
+    }
+    return (int64_t)(mach_absolute_time() * timebase.numer / timebase.denom);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// the same shard for the life of a thread. pthread_self is a register
+// read, where thread-local storage is not available on iOS 6.
+static inline int ShardIndex()
+{
+    uint64_t h = (uint64_t)(uintptr_t)pthread_self();
+    h = (h >> 12) * 0x9e3779b97f4a7c15ULL;
+    return (int)(h >> 61) & (metric_shards - 1);
+}
+
+// --- counter and gauge -----------------------------------------
+
+MetricCounter::MetricCounter()
+{
+    for (int i = 0; i < metric_shards; i++)
+    {
+        m_cells[i].value.store(0);
+    }
+}
+
+void
+MetricCounter::Add(int64_t n)
+{
+    m_cells[ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+int64_t
+MetricCounter::Value()
+{
+    int64_t total = 0;
+    for (int i = 0; i < metric_shards; i++)
+    {
+        total += m_cells[i].value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+MetricGauge::MetricGauge()
+: m_value(0)
+{
+}
+
+// --- histogram -------------------------------------------------
+
+MetricHistogram::MetricHistogram(double scale, int64_t lowest, int64_t highest)
+: m_scale(scale),
+  m_lowest(lowest),
+  m_highest(highest)
+{
+    for (int i = 0; i < metric_shards; i++)
+    {
+        m_shards[i].sum.store(0);
+        for (int j = 0; j < bucket_count; j++)
+        {
+            m_shards[i].buckets[j].store(0);
+        }
+    }
+}
+
+int
+MetricHistogram::BucketFor(int64_t v)
+{
+    if (v < sub_buckets)
+    {
+        return (v < 0) ? 0 : (int)v;
+    }
+    // the top bit picks the power of two, the next three the bucket in it
+    int e = 63 - __builtin_clzll((uint64_t)v);
+    if (e > max_exponent)
+    {
+        return bucket_count - 1;
+    }
+    return (sub_buckets * (e - sub_bucket_bits + 1)) + (int)((v >> (e - sub_bucket_bits)) & (sub_buckets - 1));
+}
+
+int64_t
+MetricHistogram::BucketUpper(int bucket)
+{
+    if (bucket < sub_buckets)
+    {
+        return bucket + 1;
+    }
+    int e = (bucket / sub_buckets) + sub_bucket_bits - 1;
+    int64_t m = bucket % sub_buckets;
+    return (sub_buckets + m + 1) << (e - sub_bucket_bits);
+}
+
+void
+MetricHistogram::Record(int64_t v)
+{
+    Shard& shard = m_shards[ShardIndex()];
+    shard.buckets[BucketFor(v)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(v, std::memory_order_relaxed);
+}
+
+void
+MetricHistogram::Totals(std::vector<int64_t>* pBuckets, int64_t* pCount, int64_t* pSum)
+{
+    pBuckets->assign(bucket_count, 0);
+    *pCount = 0;
+    *pSum = 0;
+    for (int i = 0; i < metric_shards; i++)
+    {
+        Shard& shard = m_shards[i];
+        for (int j = 0; j < bucket_count; j++)
+        {
+            (*pBuckets)[j] += shard.buckets[j].load(std::memory_order_relaxed);
+        }
+        *pSum += shard.sum.load(std::memory_order_relaxed);
+    }
+    for (int j = 0; j < bucket_count; j++)
+    {
+        *pCount += (*pBuckets)[j];
+    }
+}
+
+int64_t
+MetricHistogram::QuantileOf(const std::vector<int64_t>& buckets, int64_t count, double q)
+{
+    int64_t target = (int64_t)(q * count);
+    int64_t seen = 0;
+    for (int j = 0; j < bucket_count; j++)
+    {
+        seen += buckets[j];
+        if ((seen > target) && (seen > 0))
+        {
+            // the highest value the bucket could hold
+            return BucketUpper(j) - 1;
+        }
+    }
+    return 0;
+}
+
+int64_t
+MetricHistogram::Quantile(double q)
+{
+    std::vector<int64_t> buckets;
+    int64_t count, sum;
+    Totals(&buckets, &count, &sum);
+    return QuantileOf(buckets, count, q);
+}
+
+void
+MetricHistogram::Render(const std::string& name, const std::string& labels, std::string* out)
+{
+    std::vector<int64_t> buckets;
+    int64_t count, sum;
+    Totals(&buckets, &count, &sum);
+    std::string sep = labels.empty() ? "" : ",";
+    char line[256];
+
+    // power of two edges fall on bucket edges, so these counts are exact
+    int j = 0;
+    int64_t cumulative = 0;
+    for (int64_t edge = m_lowest; edge <= m_highest; edge *= 2)
+    {
+        while ((j < bucket_count) && (BucketUpper(j) <= edge))
+        {
+            cumulative += buckets[j++];
+        }
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %lld\n",
+                 name.c_str(), labels.c_str(), sep.c_str(), edge * m_scale, (long long)cumulative);
+        *out += line;
+    }
+    snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %lld\n", name.c_str(), labels.c_str(), sep.c_str(), (long long)count);
+    *out += line;
+    std::string braces = labels.empty() ? "" : ("{" + labels + "}");
+    snprintf(line, sizeof(line), "%s_sum%s %g\n%s_count%s %lld\n",
+             name.c_str(), braces.c_str(), sum * m_scale, name.c_str(), braces.c_str(), (long long)count);
+    *out += line;
+}
+
+void
+MetricHistogram::RenderQuantiles(const std::string& name, const std::string& labels, std::string* out)
+{
+    std::vector<int64_t> buckets;
+    int64_t count, sum;
+    Totals(&buckets, &count, &sum);
+    std::string sep = labels.empty() ? "" : ",";
+    char line[256];
+    for (size_t i = 0; i < sizeof(exposition_quantiles) / sizeof(exposition_quantiles[0]); i++)
+    {
+        double q = exposition_quantiles[i];
+        int64_t value = QuantileOf(buckets, count, q);
+        snprintf(line, sizeof(line), "%s_quantile{%s%squantile=\"%g\"} %g\n",
+                 name.c_str(), labels.c_str(), sep.c_str(), q, value * m_scale);
+        *out += line;
+    }
+}
+
+// --- registry --------------------------------------------------
+
+std::mutex Metrics::s_mutex;
+std::vector<Metrics::Entry>* Metrics::s_entries = NULL;
+
+void*
+Metrics::Find(Type type, const char* name, const char* labels)
+{
+    if (s_entries == NULL)
+    {
+        s_entries = new std::vector<Entry>();
+    }
+    std::string l = (labels != NULL) ? labels : "";
+    for (size_t i = 0; i < s_entries->size(); i++)
+    {
+        const Entry& e = (*s_entries)[i];
+        if ((e.type == type) && (e.name == name) && (e.labels == l))
+        {
+            return e.metric;
+        }
+    }
+    return NULL;
+}
+
+void
+Metrics::Add(Type type, const char* name, const char* help, const char* labels, void* metric)
+{
+    Entry e;
+    e.type = type;
+    e.name = name;
+    e.help = help;
+    e.labels = (labels != NULL) ? labels : "";
+    e.metric = metric;
+    s_entries->push_back(e);
+}
+
+MetricCounter*
+Metrics::Counter(const char* name, const char* help, const char* labels)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    MetricCounter* c = (MetricCounter*)Find(TypeCounter, name, labels);
+    if (c == NULL)
+    {
+        c = new MetricCounter();
+        Add(TypeCounter, name, help, labels, c);
+    }
+    return c;
+}
+
+MetricGauge*
+Metrics::Gauge(const char* name, const char* help, const char* labels)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    MetricGauge* g = (MetricGauge*)Find(TypeGauge, name, labels);
+    if (g == NULL)
+    {
+        g = new MetricGauge();
+        Add(TypeGauge, name, help, labels, g);
+    }
+    return g;
+}
+
+MetricHistogram*
+Metrics::Histogram(const char* name, const char* help, const char* labels,
+                   double scale, int64_t lowest, int64_t highest)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    MetricHistogram* h = (MetricHistogram*)Find(TypeHistogram, name, labels);
+    if (h == NULL)
+    {
+        h = new MetricHistogram(scale, lowest, highest);
+        Add(TypeHistogram, name, help, labels, h);
+    }
+    return h;
+}
+
+void
+Metrics::Render(std::string* out)
+{
+    static const char* type_names[] = { "counter", "gauge", "histogram" };
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_entries == NULL)
+    {
+        return;
+    }
+    std::vector<bool> done(s_entries->size(), false);
+    char line[256];
+    for (size_t i = 0; i < s_entries->size(); i++)
+    {
+        if (done[i])
+        {
+            continue;
+        }
+        const Entry& first = (*s_entries)[i];
+        *out += "# HELP " + first.name + " " + first.help + "\n";
+        *out += "# TYPE " + first.name + " " + type_names[first.type] + "\n";
+        std::vector<size_t> family;
+        for (size_t j = i; j < s_entries->size(); j++)
+        {
+            const Entry& e = (*s_entries)[j];
+            if (done[j] || (e.name != first.name))
+            {
+                continue;
+            }
+            done[j] = true;
+            family.push_back(j);
+            std::string braces = e.labels.empty() ? "" : ("{" + e.labels + "}");
+            switch (e.type)
+            {
+                case TypeCounter:
+                    snprintf(line, sizeof(line), "%s%s %lld\n", e.name.c_str(), braces.c_str(), (long long)((MetricCounter*)e.metric)->Value());
+                    *out += line;
+                    break;
+
+                case TypeGauge:
+                    snprintf(line, sizeof(line), "%s%s %lld\n", e.name.c_str(), braces.c_str(), (long long)((MetricGauge*)e.metric)->Value());
+                    *out += line;
+                    break;
+
+                case TypeHistogram:
+                    ((MetricHistogram*)e.metric)->Render(e.name, e.labels, out);
+                    break;
+            }
+        }
+
+        // a histogram's quantiles at full resolution, as their own gauge
+        // family: a histogram family may only hold its buckets, sum and count
+        if (first.type == TypeHistogram)
+        {
+            *out += "# HELP " + first.name + "_quantile " + first.help + ", at each quantile\n";
+            *out += "# TYPE " + first.name + "_quantile gauge\n";
+            for (size_t j = 0; j < family.size(); j++)
+            {
+                const Entry& e = (*s_entries)[family[j]];
+                ((MetricHistogram*)e.metric)->RenderQuantiles(e.name, e.labels, out);
+            }
+        }
+    }
+}
@@ -0,0 +1,153 @@
+//
+//  Metrics.h
+//  Encoder Demo
+//
+//  Process-wide counters, gauges and histograms for the streaming
+//  paths. Recording is a few relaxed atomic adds, with no locks and no
+//  allocation, so it is cheap enough to leave on all the time. To keep
+//  threads from fighting over one cache line, each metric is split into
+//  shards. A thread always records into the same shard, and the shards
+//  are summed when the metrics are read.
+//
+//  Histograms are log-linear, as in HdrHistogram: each power of two is
+//  split into 8 buckets, so any value is placed within 12.5%.
+//
+//  Metrics are created once, usually into a function-local static,
+//  and live for the life of the process:
+//
+//      static MetricHistogram* h = Metrics::Histogram("rtp_send_seconds", "...", NULL, 1e-9, 1 << 10, 1LL << 33);
+//      int64_t start = MetricsNow();
+//      ...
+//      h->Record(MetricsNow() - start);
+//
+//  Render produces the Prometheus text exposition format.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// monotonic nanoseconds
+int64_t MetricsNow();
+
+const int metric_shards = 8;
+
+class MetricCounter
+{
+public:
+    MetricCounter();
+
+    void Add(int64_t n = 1);
+    int64_t Value();
+
+private:
+    // a cache line each
+    struct Cell
+    {
+        std::atomic<int64_t> value;
+        char pad[64 - sizeof(std::atomic<int64_t>)];
+    };
+    Cell m_cells[metric_shards];
+};
+
+class MetricGauge
+{
+public:
+    MetricGauge();
+
+    void Set(int64_t v)     { m_value.store(v, std::memory_order_relaxed); }
+    void Add(int64_t n)     { m_value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Value()         { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_value;
+};
+
+class MetricHistogram
+{
+public:
+    // values are recorded as integers (nanoseconds, bytes) and shown
+    // multiplied by scale. Cumulative buckets are shown at each power
+    // of two from lowest to highest.
+    MetricHistogram(double scale, int64_t lowest, int64_t highest);
+
+    void Record(int64_t v);
+
+    // value at quantile q (0..1) of everything recorded so far, in
+    // recorded units
+    int64_t Quantile(double q);
+
+    // buckets, sum and count; and separately the quantiles, which
+    // belong in a gauge family of their own named name_quantile
+    void Render(const std::string& name, const std::string& labels, std::string* out);
+    void RenderQuantiles(const std::string& name, const std::string& labels, std::string* out);
+
+private:
+    static const int sub_bucket_bits = 3;
+    static const int sub_buckets = 1 << sub_bucket_bits;
+    static const int max_exponent = 40;
+    static const int bucket_count = sub_buckets * (max_exponent - sub_bucket_bits + 2);
+
+    static int BucketFor(int64_t v);
+    static int64_t BucketUpper(int bucket);
+
+    // the count is the sum of the buckets, so is not kept separately
+    struct Shard
+    {
+        std::atomic<int64_t> sum;
+        std::atomic<int64_t> buckets[bucket_count];
+        char pad[64];
+    };
+
+    // the shards summed
+    void Totals(std::vector<int64_t>* pBuckets, int64_t* pCount, int64_t* pSum);
+    static int64_t QuantileOf(const std::vector<int64_t>& buckets, int64_t count, double q);
+
+private:
+    double m_scale;
+    int64_t m_lowest;
+    int64_t m_highest;
+    Shard m_shards[metric_shards];
+};
+
+class Metrics
+{
+public:
+    // the same name and labels always give back the same metric. labels
+    // is Prometheus label text without braces, such as method="PLAY",
+    // or NULL. These take a lock, so call them once and keep the result.
+    static MetricCounter* Counter(const char* name, const char* help, const char* labels);
+    static MetricGauge* Gauge(const char* name, const char* help, const char* labels);
+    static MetricHistogram* Histogram(const char* name, const char* help, const char* labels,
+                                      double scale, int64_t lowest, int64_t highest);
+
+    // everything, grouped by name
+    static void Render(std::string* out);
+
+private:
+    enum Type
+    {
+        TypeCounter,
+        TypeGauge,
+        TypeHistogram,
+    };
+
+    struct Entry
+    {
+        Type type;
+        std::string name;
+        std::string help;
+        std::string labels;
+        void* metric;
+    };
+
+    static void* Find(Type type, const char* name, const char* labels);
+    static void Add(Type type, const char* name, const char* help, const char* labels, void* metric);
+
+    static std::mutex s_mutex;
+    static std::vector<Entry>* s_entries;
+};
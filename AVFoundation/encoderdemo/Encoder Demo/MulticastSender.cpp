@@ -0,0 +1,306 @@
+//
+//  MulticastSender.cpp
+//  Encoder Demo
+//
+//  One shared RTP sender for all multicast sessions.
+//
+
+#include "MulticastSender.h"
+#include "Metrics.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const int rtp_header_size = 12;
+static const int payload_h264 = 96;
+
+// payloads come from RTPFrame, which keeps whole packets under 1200
+static const int max_rtp_packet = 1500;
+
+// a frame is spread over at most one frame interval, capped here, as
+// for unicast
+static const double max_pacing_delay = 0.1;
+
+static void to_net_short(BYTE* p, uint16_t s)
+{
+    p[0] = s >> 8;
+    p[1] = s & 0xff;
+}
+
+static void to_net_long(BYTE* p, uint32_t l)
+{
+    p[0] = l >> 24;
+    p[1] = (l >> 16) & 0xff;
+    p[2] = (l >> 8) & 0xff;
+    p[3] = l & 0xff;
+}
+
+MulticastSender::MulticastSender()
+: m_refs(0),
+  m_port(0),
+  m_ttl(1),
+  m_fd(-1),
+  m_pacer(NULL),
+  m_flow(NULL),
+  m_ssrc(0),
+  m_seq(0),
+  m_bStarted(false),
+  m_ptsBase(0),
+  m_rtpBase(0),
+  m_lastPts(-1),
+  m_deadline(0),
+  m_lastReport(0),
+  m_packets(0),
+  m_payloadBytes(0),
+  m_bytes(0)
+{
+    memset(&m_addrRTP, 0, sizeof(m_addrRTP));
+    memset(&m_addrRTCP, 0, sizeof(m_addrRTCP));
+}
+
+MulticastSender::~MulticastSender()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Close();
+    }
+    delete m_pacer;
+}
+
+bool
+MulticastSender::Configure(const char* group, int port, int ttl, const char* iface)
+{
+    struct in_addr addr;
+    if ((inet_pton(AF_INET, group, &addr) != 1) || !IN_MULTICAST(ntohl(addr.s_addr)))
+    {
+        return false;
+    }
+    // RTP on an even port, RTCP on the next
+    if ((port <= 0) || (port > 65534) || (port & 1) || (ttl < 0) || (ttl > 255))
+    {
+        return false;
+    }
+    if ((iface != NULL) && (inet_pton(AF_INET, iface, &addr) != 1))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_group = group;
+    m_iface = (iface != NULL) ? iface : "";
+    m_port = port;
+    m_ttl = ttl;
+    return true;
+}
+
+int
+MulticastSender::Join()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((m_refs == 0) && !Open())
+    {
+        return 0;
+    }
+    return ++m_refs;
+}
+
+int
+MulticastSender::Leave()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((m_refs > 0) && (--m_refs == 0))
+    {
+        Close();
+    }
+    return m_refs;
+}
+
+bool
+MulticastSender::Active()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_fd >= 0;
+}
+
+bool
+MulticastSender::Open()
+{
+    if (m_group.empty())
+    {
+        return false;
+    }
+    m_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    unsigned char ttl = (unsigned char)m_ttl;
+    setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    // viewers on this host (and the loopback test) hear the group too
+    unsigned char loop = 1;
+    setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (!m_iface.empty())
+    {
+        struct in_addr iface;
+        inet_pton(AF_INET, m_iface.c_str(), &iface);
+        setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    }
+
+    m_addrRTP.sin_family = AF_INET;
+    inet_pton(AF_INET, m_group.c_str(), &m_addrRTP.sin_addr);
+    m_addrRTP.sin_port = htons(m_port);
+    m_addrRTCP = m_addrRTP;
+    m_addrRTCP.sin_port = htons(m_port + 1);
+
+    if (m_pacer == NULL)
+    {
+        m_pacer = new RTPPacer(0);
+    }
+    static MetricHistogram* age = Metrics::Histogram("rtp_frame_age_seconds", "Capture to the last packet of a frame on the wire", "transport=\"multicast\"", 1e-9, 1 << 20, 1LL << 33);
+    m_flow = m_pacer->AddFlow(OnPacedPacket, this, age);
+
+    m_ssrc = (uint32_t)random();
+    m_seq = (uint16_t)random();
+    m_rtcp.Reset(m_ssrc, 90000);
+    m_bStarted = false;
+    m_lastPts = -1;
+    m_lastReport = 0;
+    m_packets = 0;
+    m_payloadBytes = 0;
+    m_bytes = 0;
+    return true;
+}
+
+void
+MulticastSender::Close()
+{
+    if (m_flow != NULL)
+    {
+        // no further callbacks once this returns, so the socket can go
+        m_pacer->RemoveFlow(m_flow);
+        m_flow = NULL;
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void
+MulticastSender::SetRate(double bitsPerSecond, double burstFactor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_flow != NULL)
+    {
+        m_pacer->SetRate(m_flow, bitsPerSecond, burstFactor);
+    }
+}
+
+void
+MulticastSender::Send(const BYTE* payload, int cBytes, bool bMarker, bool bSync, double pts, double origin)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((m_fd < 0) || (cBytes <= 0) || (cBytes > (max_rtp_packet - rtp_header_size)))
+    {
+        return;
+    }
+    if (!m_bStarted)
+    {
+        // viewers joining later wait for the next IDR themselves
+        if (!bSync)
+        {
+            return;
+        }
+        m_bStarted = true;
+        m_ptsBase = pts;
+        m_rtpBase = (uint32_t)random();
+    }
+
+    // the whole frame should be out before the next one is due
+    double now = PacerNow();
+    if (pts != m_lastPts)
+    {
+        double interval = max_pacing_delay;
+        if ((m_lastPts >= 0) && (pts > m_lastPts))
+        {
+            interval = std::min(pts - m_lastPts, max_pacing_delay);
+        }
+        m_deadline = now + interval;
+        m_lastPts = pts;
+    }
+
+    BYTE packet[max_rtp_packet];
+    packet[0] = 0x80;
+    packet[1] = payload_h264 | (bMarker ? 0x80 : 0);
+    to_net_short(packet + 2, m_seq++);
+    uint32_t rtp = m_rtpBase + (uint32_t)(int64_t)((pts - m_ptsBase) * 90000);
+    to_net_long(packet + 4, rtp);
+    to_net_long(packet + 8, m_ssrc);
+    memcpy(packet + rtp_header_size, payload, cBytes);
+    m_pacer->Enqueue(m_flow, packet, cBytes + rtp_header_size, m_deadline, bMarker ? origin : 0);
+
+    m_packets++;
+    m_payloadBytes += cBytes;
+    m_bytes += cBytes + rtp_header_size;
+    if ((now - m_lastReport) >= 1)
+    {
+        SendReport(rtp);
+        m_lastReport = now;
+    }
+}
+
+void
+MulticastSender::SendReport(uint32_t rtp)
+{
+    BYTE buf[128];
+    int cReport = m_rtcp.BuildSenderReport(buf, sizeof(buf), NTPNow(), rtp,
+                                           (uint32_t)m_packets, (uint32_t)m_payloadBytes,
+                                           "AVEncoderDemo");
+    if (cReport > 0)
+    {
+        sendto(m_fd, buf, cReport, 0, (const struct sockaddr*)&m_addrRTCP, sizeof(m_addrRTCP));
+        m_bytes += cReport;
+    }
+}
+
+void
+MulticastSender::OnPacedPacket(void* ctx, const BYTE* p, int cBytes)
+{
+    // pacer thread. Close removes the flow before the socket goes,
+    // and it cannot change while the flow exists.
+    static MetricHistogram* latency = Metrics::Histogram("rtp_send_seconds", "Time spent in one send call", "transport=\"multicast\"", 1e-9, 1 << 8, 1LL << 26);
+    static MetricCounter* errors = Metrics::Counter("rtp_send_errors_total", "Send calls that failed", "transport=\"multicast\"");
+    MulticastSender* pThis = (MulticastSender*)ctx;
+    int64_t start = MetricsNow();
+    ssize_t cSent = sendto(pThis->m_fd, p, cBytes, 0, (const struct sockaddr*)&pThis->m_addrRTP, sizeof(pThis->m_addrRTP));
+    latency->Record(MetricsNow() - start);
+    if (cSent < 0)
+    {
+        errors->Add();
+    }
+}
+
+uint32_t
+MulticastSender::SSRC()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ssrc;
+}
+
+long
+MulticastSender::PacketsSent()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_packets;
+}
+
+long
+MulticastSender::BytesSent()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
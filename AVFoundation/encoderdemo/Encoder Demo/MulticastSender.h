@@ -0,0 +1,86 @@
+//
+//  MulticastSender.h
+//  Encoder Demo
+//
+//  The single RTP/RTCP sender for RTSP sessions that asked for
+//  multicast. However many viewers SETUP, the live stream is sent
+//  once to the group, so the uplink does not grow with their number.
+//  Sessions Join when they start playing and Leave at teardown. The
+//  sockets are open only while at least one session has joined. A new
+//  run starts at an IDR with a fresh SSRC.
+//
+//  RTP goes to group:port and sender reports to group:port+1. Packets
+//  are paced like unicast UDP, through a pacer of our own.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include "RTCP.h"
+#include "RTPPacer.h"
+#include <netinet/in.h>
+#include <mutex>
+#include <string>
+
+class MulticastSender
+{
+public:
+    MulticastSender();
+    ~MulticastSender();
+
+    // takes effect at the next first Join. group must be an IPv4
+    // multicast address; iface is the local address to send from, or
+    // NULL for the system's choice. Returns false if it is not usable.
+    bool Configure(const char* group, int port, int ttl, const char* iface);
+
+    // reference count of joined sessions, after the change
+    int Join();
+    int Leave();
+    bool Active();
+
+    void SetRate(double bitsPerSecond, double burstFactor);
+
+    // one RTP payload of the access unit at pts, without its header.
+    // Nothing goes out until the first payload with bSync set. origin
+    // is the frame's capture time on the pacer clock, or 0 if unknown.
+    void Send(const BYTE* payload, int cBytes, bool bMarker, bool bSync, double pts, double origin = 0);
+
+    uint32_t SSRC();
+    long PacketsSent();
+    long BytesSent();
+
+private:
+    static void OnPacedPacket(void* ctx, const BYTE* p, int cBytes);
+    bool Open();
+    void Close();
+    void SendReport(uint32_t rtp);
+
+private:
+    std::mutex m_mutex;
+    int m_refs;
+
+    std::string m_group;
+    std::string m_iface;
+    int m_port;
+    int m_ttl;
+
+    int m_fd;
+    struct sockaddr_in m_addrRTP;
+    struct sockaddr_in m_addrRTCP;
+    RTPPacer* m_pacer;
+    RTPPacer::Flow* m_flow;
+    RTCPSender m_rtcp;
+
+    uint32_t m_ssrc;
+    uint16_t m_seq;
+    bool m_bStarted;
+    double m_ptsBase;
+    uint32_t m_rtpBase;
+    double m_lastPts;
+    double m_deadline;
+    double m_lastReport;
+
+    long m_packets;
+    long m_payloadBytes;
+    long m_bytes;
+};
@@ -0,0 +1,31 @@
+//
+//  MulticastStream.h
+//  Encoder Demo
+//
+//  The live stream sent once to a multicast group for every RTSP
+//  session that asked for it (see MulticastSender). The server keeps
+//  one of these while any session has joined. Its frames are the same
+//  RTPFrame payloads the unicast sessions send.
+//
+
+#import <Foundation/Foundation.h>
+#import "RTPFrame.h"
+
+@interface MulticastStream : NSObject
+
+// nil if group, port or ttl is not usable
++ (MulticastStream*) streamWithGroup:(NSString*) group port:(int) port ttl:(int) ttl;
+
+// the number of sessions joined, after the change. A failed first
+// join returns 0.
+- (int) join;
+- (int) leave;
+
+// encoder thread
+- (void) deliverFrame:(RTPFrame*) frame bitrate:(int) bitrate;
+
+@property (readonly) NSString* group;
+@property (readonly) int port;
+@property (readonly) int ttl;
+
+@end
@@ -0,0 +1,88 @@
+//
+//  MulticastStream.mm
+//  Encoder Demo
+//
+
+#import "MulticastStream.h"
+#import "MulticastSender.h"
+
+// as for unicast UDP sessions
+static const double pacing_burst_factor = 1.5;
+
+@interface MulticastStream ()
+{
+    MulticastSender* _sender;
+}
+
+- (MulticastStream*) initWithGroup:(NSString*) group port:(int) port ttl:(int) ttl;
+
+@end
+
+@implementation MulticastStream
+
+@synthesize group = _group;
+@synthesize port = _port;
+@synthesize ttl = _ttl;
+
++ (MulticastStream*) streamWithGroup:(NSString*) group port:(int) port ttl:(int) ttl
+{
+    return [[MulticastStream alloc] initWithGroup:group port:port ttl:ttl];
+}
+
+- (MulticastStream*) initWithGroup:(NSString*) group port:(int) port ttl:(int) ttl
+{
+    self = [super init];
+    _sender = new MulticastSender();
+    if (!_sender->Configure([group UTF8String], port, ttl, NULL))
+    {
+        NSLog(@"Multicast group %@ port %d ttl %d not usable", group, port, ttl);
+        return nil;
+    }
+    _group = group;
+    _port = port;
+    _ttl = ttl;
+    return self;
+}
+
+- (void) dealloc
+{
+    delete _sender;
+}
+
+- (int) join
+{
+    int refs = _sender->Join();
+    if (refs == 1)
+    {
+        NSLog(@"Multicast to %@:%d started", _group, _port);
+    }
+    return refs;
+}
+
+- (int) leave
+{
+    int refs = _sender->Leave();
+    if (refs == 0)
+    {
+        NSLog(@"Multicast to %@:%d stopped", _group, _port);
+    }
+    return refs;
+}
+
+- (void) deliverFrame:(RTPFrame*) frame bitrate:(int) bitrate
+{
+    if (!_sender->Active())
+    {
+        return;
+    }
+    _sender->SetRate(bitrate, pacing_burst_factor);
+    const RTPPayload* payloads = [frame payloads];
+    const uint8_t* pData = [frame payloadBytes];
+    for (int i = 0; i < frame.payloadCount; i++)
+    {
+        const RTPPayload& payload = payloads[i];
+        _sender->Send(pData + payload.offset, payload.length, payload.bMarker, payload.bSync, frame.pts, frame.captureTime);
+    }
+}
+
+@end
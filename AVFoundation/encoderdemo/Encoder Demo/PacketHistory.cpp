@@ -0,0 +1,82 @@
+//
+//  PacketHistory.cpp
+//  Encoder Demo
+//
+//  Ring of sent RTP packets for retransmission.
+//
+
+#include "PacketHistory.h"
+#include <string.h>
+
+PacketHistory::PacketHistory(int cSlots, int cMaxPacket)
+: m_cMaxPacket(cMaxPacket),
+  m_mask(cSlots - 1),
+  m_slots(cSlots),
+  m_data(cSlots * cMaxPacket)
+{
+    Clear();
+}
+
+void
+PacketHistory::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        m_slots[i].seq = 0;
+        m_slots[i].cBytes = 0;
+        m_slots[i].bQueued = false;
+        m_slots[i].sent = 0;
+    }
+}
+
+void
+PacketHistory::Store(const BYTE* packet, int cBytes)
+{
+    if ((cBytes < 12) || (cBytes > m_cMaxPacket))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint16_t seq = (packet[2] << 8) | packet[3];
+    int idx = seq & m_mask;
+    Slot& slot = m_slots[idx];
+    slot.seq = seq;
+    slot.cBytes = cBytes;
+    slot.bQueued = true;
+    slot.sent = 0;
+    memcpy(&m_data[idx * m_cMaxPacket], packet, cBytes);
+}
+
+void
+PacketHistory::Sent(uint16_t seq, double now)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Slot& slot = m_slots[seq & m_mask];
+    if ((slot.cBytes != 0) && (slot.seq == seq))
+    {
+        slot.bQueued = false;
+        slot.sent = now;
+    }
+}
+
+int
+PacketHistory::Fetch(uint16_t seq, BYTE* buf, double now, double minInterval)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int idx = seq & m_mask;
+    Slot& slot = m_slots[idx];
+    if ((slot.cBytes == 0) || (slot.seq != seq))
+    {
+        return 0;
+    }
+    // age and interval run from the wire, not from the queue: under
+    // pacing a packet can wait a while before it goes
+    if (slot.bQueued || ((now - slot.sent) < minInterval))
+    {
+        return 0;
+    }
+    slot.bQueued = true;
+    memcpy(buf, &m_data[idx * m_cMaxPacket], slot.cBytes);
+    return slot.cBytes;
+}
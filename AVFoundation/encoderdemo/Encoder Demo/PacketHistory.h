@@ -0,0 +1,55 @@
+//
+//  PacketHistory.h
+//  Encoder Demo
+//
+//  The most recently sent RTP packets of one stream, so that packets
+//  a receiver reports missing (RFC 4585 generic NACK) can be sent
+//  again. A fixed ring of slots indexed by sequence number: storing a
+//  packet is a copy, and nothing is allocated once the ring exists.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+
+class PacketHistory
+{
+public:
+    // cSlots should be a power of two
+    PacketHistory(int cSlots, int cMaxPacket);
+
+    void Clear();
+
+    // packet is a complete RTP packet with seq in its header, as it is
+    // queued for sending
+    void Store(const BYTE* packet, int cBytes);
+
+    // the packet, or a retransmission of it, has gone out on the wire.
+    // Called from the pacer thread as it sends.
+    void Sent(uint16_t seq, double now);
+
+    // copies the packet with this sequence number to buf and returns its
+    // length, or 0 if it has been overwritten or was never sent. Also
+    // returns 0 if it is still queued, or last went out less than
+    // minInterval ago, so that repeated NACKs for one loss cost a single
+    // retransmission per RTT.
+    int Fetch(uint16_t seq, BYTE* buf, double now, double minInterval);
+
+private:
+    struct Slot
+    {
+        uint16_t seq;
+        int cBytes;
+        bool bQueued;       // waiting in the pacer, first time or again
+        double sent;
+    };
+
+    std::mutex m_mutex;
+    int m_cMaxPacket;
+    int m_mask;
+    std::vector<Slot> m_slots;
+    std::vector<BYTE> m_data;
+};
@@ -0,0 +1,380 @@
+//
+//  RTCP.cpp
+//  Encoder Demo
+//
+//  Sender reports out, and receiver report processing in.
+//
+
+#include "RTCP.h"
+#include <sys/time.h>
+#include <string.h>
+
+// seconds from 1900 (NTP epoch) to 1970 (unix epoch)
+static const uint64_t ntp_unix_offset = 2208988800ULL;
+
+// client SSRCs remembered per session; a client has one or two
+static const size_t max_peers = 4;
+
+static uint32_t from_net_long(const BYTE* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void to_net_long(BYTE* p, uint32_t l)
+{
+    p[0] = (l >> 24) & 0xff;
+    p[1] = (l >> 16) & 0xff;
+    p[2] = (l >> 8) & 0xff;
+    p[3] = l & 0xff;
+}
+
+uint64_t NTPNow()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t secs = uint64_t(tv.tv_sec) + ntp_unix_offset;
+    uint64_t frac = (uint64_t(tv.tv_usec) << 32) / 1000000;
+    return (secs << 32) | frac;
+}
+
+RTCPSender::RTCPSender()
+{
+    Reset(0, 90000);
+}
+
+void
+RTCPSender::Reset(uint32_t ssrc, int clockRate)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ssrc = ssrc;
+    m_clockRate = clockRate;
+    m_stats.reports = 0;
+    m_stats.fractionLost = 0;
+    m_stats.cumulativeLost = 0;
+    m_stats.highestSeq = 0;
+    m_stats.jitter = 0;
+    m_stats.rtt = -1;
+    m_stats.lastReport = -1;
+    m_stats.bye = false;
+    m_stats.nacks = 0;
+    m_stats.cname.clear();
+    m_ntpLastReport = 0;
+    m_peers.clear();
+}
+
+int
+RTCPSender::BuildSenderReport(BYTE* buf, int cSpace,
+                              uint64_t ntp, uint32_t rtp,
+                              uint32_t packets, uint32_t octets,
+                              const char* cname)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int cName = (int)strlen(cname);
+    if (cName > 255)
+    {
+        cName = 255;
+    }
+    // SDES chunk: ssrc, CNAME item, null terminator, padded to 32 bits
+    int cChunk = 4 + 2 + cName + 1;
+    cChunk = (cChunk + 3) & ~3;
+    int cTotal = 28 + 4 + cChunk;
+    if (cTotal > cSpace)
+    {
+        return 0;
+    }
+
+    // SR with no report blocks: we don't receive any media
+    buf[0] = 0x80;
+    buf[1] = RTCP_SR;
+    buf[2] = 0;
+    buf[3] = 6;     // length (count of uint32_t minus 1)
+    to_net_long(buf + 4, m_ssrc);
+    to_net_long(buf + 8, uint32_t(ntp >> 32));
+    to_net_long(buf + 12, uint32_t(ntp));
+    to_net_long(buf + 16, rtp);
+    to_net_long(buf + 20, packets);
+    to_net_long(buf + 24, octets);
+
+    BYTE* p = buf + 28;
+    int words = (4 + cChunk) / 4 - 1;
+    p[0] = 0x81;    // one chunk
+    p[1] = RTCP_SDES;
+    p[2] = (words >> 8) & 0xff;
+    p[3] = words & 0xff;
+    p += 4;
+    memset(p, 0, cChunk);
+    to_net_long(p, m_ssrc);
+    p[4] = 1;       // CNAME
+    p[5] = (BYTE) cName;
+    memcpy(p + 6, cname, cName);
+    return cTotal;
+}
+
+bool
+RTCPSender::Parse(const BYTE* p, int cBytes, std::vector<uint16_t>* pNacks)
+{
+    uint64_t ntpArrival = NTPNow();
+    bool bValid = false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // walk the compound packet
+    while (cBytes >= 4)
+    {
+        if ((p[0] >> 6) != 2)
+        {
+            break;
+        }
+        int count = p[0] & 0x1f;
+        int type = p[1];
+        int cThis = ((p[2] << 8) + p[3] + 1) * 4;
+        if (cThis > cBytes)
+        {
+            break;
+        }
+        bValid = true;
+
+        const BYTE* pBlocks = NULL;
+        switch (type)
+        {
+            case RTCP_SR:
+                // skip sender ssrc and sender info
+                pBlocks = p + 28;
+                break;
+
+            case RTCP_RR:
+                pBlocks = p + 8;
+                break;
+
+            case RTCP_SDES:
+                OnSDES(p + 4, cThis - 4, count);
+                break;
+
+            case RTCP_BYE:
+                // the client is leaving if any of the sources it lists is one of its own
+                for (int i = 0; (i < count) && ((8 + (i * 4)) <= cThis); i++)
+                {
+                    if (IsPeer(from_net_long(p + 4 + (i * 4))))
+                    {
+                        m_stats.bye = true;
+                    }
+                }
+                break;
+
+            case RTCP_RTPFB:
+                // FMT 1 is generic NACK; the others (TMMBR etc) we ignore
+                if ((count == 1) && OnNACK(p, cThis, pNacks))
+                {
+                    AddPeer(from_net_long(p + 4));
+                }
+                break;
+
+            default:
+                break;
+        }
+        if ((pBlocks != NULL) && (cThis >= 8))
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const BYTE* pBlock = pBlocks + (i * 24);
+                if ((pBlock + 24) > (p + cThis))
+                {
+                    break;
+                }
+                if (OnReportBlock(pBlock, ntpArrival))
+                {
+                    AddPeer(from_net_long(p + 4));
+                }
+            }
+        }
+        p += cThis;
+        cBytes -= cThis;
+    }
+    return bValid;
+}
+
+bool
+RTCPSender::IsForSession(const BYTE* p, int cBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (cBytes >= 8)
+    {
+        if ((p[0] >> 6) != 2)
+        {
+            break;
+        }
+        int count = p[0] & 0x1f;
+        int type = p[1];
+        int cThis = ((p[2] << 8) + p[3] + 1) * 4;
+        if (cThis > cBytes)
+        {
+            break;
+        }
+
+        // SR, RR, SDES and BYE all start with the client's ssrc
+        if (((type == RTCP_SR) || (type == RTCP_RR) || (type == RTCP_SDES) || (type == RTCP_BYE)) &&
+            (count > 0) && IsPeer(from_net_long(p + 4)))
+        {
+            return true;
+        }
+        if ((type == RTCP_SR) || (type == RTCP_RR))
+        {
+            int offset = (type == RTCP_SR) ? 28 : 8;
+            for (int i = 0; (i < count) && ((offset + ((i + 1) * 24)) <= cThis); i++)
+            {
+                if (from_net_long(p + offset + (i * 24)) == m_ssrc)
+                {
+                    return true;
+                }
+            }
+        }
+        if ((type == RTCP_RTPFB) && (cThis >= 12) && (from_net_long(p + 8) == m_ssrc))
+        {
+            return true;
+        }
+        p += cThis;
+        cBytes -= cThis;
+    }
+    return false;
+}
+
+void
+RTCPSender::AddPeer(uint32_t ssrc)
+{
+    if (IsPeer(ssrc))
+    {
+        return;
+    }
+    if (m_peers.size() == max_peers)
+    {
+        m_peers.erase(m_peers.begin());
+    }
+    m_peers.push_back(ssrc);
+}
+
+bool
+RTCPSender::IsPeer(uint32_t ssrc)
+{
+    for (size_t i = 0; i < m_peers.size(); i++)
+    {
+        if (m_peers[i] == ssrc)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+RTCPSender::OnReportBlock(const BYTE* p, uint64_t ntpArrival)
+{
+    if (from_net_long(p) != m_ssrc)
+    {
+        // a report about someone else's stream
+        return false;
+    }
+    m_stats.reports++;
+    m_stats.fractionLost = p[4] / 256.0;
+
+    // cumulative lost is a signed 24-bit value
+    long lost = (p[5] << 16) | (p[6] << 8) | p[7];
+    if (lost & 0x800000)
+    {
+        lost -= 0x1000000;
+    }
+    m_stats.cumulativeLost = lost;
+    m_stats.highestSeq = from_net_long(p + 8);
+    m_stats.jitter = double(from_net_long(p + 12)) / m_clockRate;
+
+    // RTT = arrival - LSR - DLSR, all in the middle 32 bits of NTP time
+    uint32_t lsr = from_net_long(p + 16);
+    uint32_t dlsr = from_net_long(p + 20);
+    if (lsr != 0)
+    {
+        uint32_t arrival = uint32_t(ntpArrival >> 16);
+        int32_t rtt = int32_t(arrival - lsr - dlsr);
+        if (rtt >= 0)
+        {
+            m_stats.rtt = rtt / 65536.0;
+        }
+    }
+    m_ntpLastReport = ntpArrival;
+    return true;
+}
+
+void
+RTCPSender::OnSDES(const BYTE* p, int cBytes, int count)
+{
+    for (int i = 0; (i < count) && (cBytes >= 4); i++)
+    {
+        // chunk: ssrc then items until a null type, padded to 32 bits.
+        // Another client's CNAME is stepped over.
+        bool bPeer = IsPeer(from_net_long(p));
+        int idx = 4;
+        while ((idx < cBytes) && (p[idx] != 0))
+        {
+            if ((idx + 2) > cBytes)
+            {
+                return;
+            }
+            int itemType = p[idx];
+            int cItem = p[idx + 1];
+            if ((idx + 2 + cItem) > cBytes)
+            {
+                return;
+            }
+            if ((itemType == 1) && bPeer)
+            {
+                m_stats.cname.assign((const char*)(p + idx + 2), cItem);
+            }
+            idx += 2 + cItem;
+        }
+        idx = (idx + 4) & ~3;
+        p += idx;
+        cBytes -= idx;
+    }
+}
+
+bool
+RTCPSender::OnNACK(const BYTE* p, int cBytes, std::vector<uint16_t>* pNacks)
+{
+    // sender ssrc, media ssrc, then one or more (PID, BLP) pairs:
+    // PID is lost, and so is PID + n + 1 for each bit n set in BLP
+    if ((cBytes < 16) || (from_net_long(p + 8) != m_ssrc))
+    {
+        return false;
+    }
+    for (int idx = 12; (idx + 4) <= cBytes; idx += 4)
+    {
+        uint16_t pid = (p[idx] << 8) | p[idx + 1];
+        uint16_t blp = (p[idx + 2] << 8) | p[idx + 3];
+        m_stats.nacks++;
+        if (pNacks != NULL)
+        {
+            pNacks->push_back(pid);
+        }
+        for (int bit = 0; bit < 16; bit++)
+        {
+            if (blp & (1 << bit))
+            {
+                m_stats.nacks++;
+                if (pNacks != NULL)
+                {
+                    pNacks->push_back(uint16_t(pid + bit + 1));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+RTCPStatistics
+RTCPSender::Statistics()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RTCPStatistics stats = m_stats;
+    if (m_ntpLastReport != 0)
+    {
+        stats.lastReport = double(NTPNow() - m_ntpLastReport) / 4294967296.0;
+    }
+    return stats;
+}
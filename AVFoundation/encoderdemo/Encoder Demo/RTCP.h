@@ -0,0 +1,89 @@
+//
+//  RTCP.h
+//  Encoder Demo
+//
+//  Sender reports out, and receiver report processing in, for one
+//  RTP sender. Keeps the per-session loss, jitter and round-trip
+//  figures that the client reports back to us.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+enum RTCPType
+{
+    RTCP_SR         = 200,
+    RTCP_RR         = 201,
+    RTCP_SDES       = 202,
+    RTCP_BYE        = 203,
+    RTCP_APP        = 204,
+    RTCP_RTPFB      = 205,
+    RTCP_PSFB       = 206,
+};
+
+// current wall-clock time as 32.32 NTP
+uint64_t NTPNow();
+
+// snapshot of what the receiver has told us
+struct RTCPStatistics
+{
+    long reports;           // report blocks received for our SSRC
+    double fractionLost;    // 0..1, over the last report interval
+    long cumulativeLost;
+    unsigned long highestSeq;   // extended highest sequence received
+    double jitter;          // interarrival jitter, seconds
+    double rtt;             // seconds, or -1 if not yet known
+    double lastReport;      // seconds since the last receiver report, or -1
+    bool bye;
+    long nacks;             // sequence numbers the client has asked for again
+    std::string cname;
+};
+
+class RTCPSender
+{
+public:
+    RTCPSender();
+
+    void Reset(uint32_t ssrc, int clockRate);
+
+    // compound SR + SDES(CNAME). ntp and rtp must be a simultaneous pair.
+    // Returns the length written to buf, or 0 if there is not room.
+    int BuildSenderReport(BYTE* buf, int cSpace,
+                          uint64_t ntp, uint32_t rtp,
+                          uint32_t packets, uint32_t octets,
+                          const char* cname);
+
+    // parse a compound packet received from the client. Sequence numbers
+    // from any generic NACK for our SSRC are appended to pNacks, if given.
+    // Returns false if it does not look like RTCP at all.
+    // BYE and CNAME are only taken from the client's own sources: those
+    // that have sent a report block or NACK about our SSRC.
+    bool Parse(const BYTE* p, int cBytes, std::vector<uint16_t>* pNacks);
+
+    // true if a compound packet belongs to this session: a report block
+    // or NACK names our SSRC, or it is from one of the client's sources.
+    // Used to route what arrives on the server's shared RTCP port.
+    bool IsForSession(const BYTE* p, int cBytes);
+
+    RTCPStatistics Statistics();
+
+private:
+    bool OnReportBlock(const BYTE* p, uint64_t ntpArrival);
+    void OnSDES(const BYTE* p, int cBytes, int count);
+    bool OnNACK(const BYTE* p, int cBytes, std::vector<uint16_t>* pNacks);
+    void AddPeer(uint32_t ssrc);
+    bool IsPeer(uint32_t ssrc);
+
+private:
+    std::mutex m_mutex;
+    uint32_t m_ssrc;
+    int m_clockRate;
+    RTCPStatistics m_stats;
+    uint64_t m_ntpLastReport;
+    std::vector<uint32_t> m_peers;  // the client's SSRCs, most recent last
+};
@@ -0,0 +1,54 @@
+//
+//  RTPFrame.h
+//  Encoder Demo
+//
+//  One access unit, packetized once (RFC 6184 single NALU and FU-A
+//  payloads) and shared by every session sending it. A session only
+//  adds its own 12-byte RTP header to each payload, so deciding to
+//  drop a frame, or to replay it from the GOP cache, never means
+//  packetizing it again.
+//
+
+#import <Foundation/Foundation.h>
+
+// largest RTP packet we send, header included
+static const int max_rtp_packet_size = 1200;
+
+typedef enum
+{
+    FrameIDR,               // starts a GOP
+    FrameReference,         // other frames may be predicted from it
+    FrameNonReference,      // nal_ref_idc == 0: nothing depends on it
+} FrameClass;
+
+typedef struct
+{
+    int offset;             // into payloadBytes
+    int length;
+    int naluType;           // of the NALU this payload carries (part of)
+    BOOL bMarker;           // last packet of the access unit
+    BOOL bSync;             // first packet of an IDR or SPS: a point
+                            // where a receiver can start decoding
+} RTPPayload;
+
+@interface RTPFrame : NSObject
+
++ (RTPFrame*) frameWithNALUs:(NSArray*) nalus time:(double) pts;
+
+// a frame from the camera's encoder, whose pts is on the host clock:
+// its captureTime is set, and its packetization is timed in the metrics
++ (RTPFrame*) liveFrameWithNALUs:(NSArray*) nalus time:(double) pts;
+
+@property (readonly) NSArray* nalus;
+@property (readonly) double pts;
+@property (readonly) FrameClass frameClass;
+@property (readonly) int bytes;         // NALU bytes, not counting RTP overhead
+
+// when the frame was captured, on the PacerNow clock, or 0 if not known
+@property (readonly) double captureTime;
+
+@property (readonly) int payloadCount;
+- (const RTPPayload*) payloads;
+- (const uint8_t*) payloadBytes;
+
+@end
@@ -0,0 +1,172 @@
+//
+//  RTPFrame.mm
+//  Encoder Demo
+//
+
+#import "RTPFrame.h"
+#import "NALUnit.h"
+#import "RTPPacer.h"
+#import "Metrics.h"
+
+static const int rtp_header_size = 12;
+
+// a pts further than this from now is not on the host clock (a replay)
+static const double max_capture_age = 10;
+
+@interface RTPFrame ()
+{
+    NSMutableData* _data;
+    NSMutableData* _payloads;
+}
+
+- (RTPFrame*) initWithNALUs:(NSArray*) nalus time:(double) pts;
+- (void) addPayload:(const uint8_t*) header length:(int) cHeader data:(const uint8_t*) p length:(int) cBytes type:(int) type marker:(BOOL) bMarker sync:(BOOL) bSync;
+
+@end
+
+@implementation RTPFrame
+
+@synthesize nalus = _nalus;
+@synthesize pts = _pts;
+@synthesize frameClass = _frameClass;
+@synthesize bytes = _bytes;
+@synthesize payloadCount = _payloadCount;
+@synthesize captureTime = _captureTime;
+
++ (RTPFrame*) frameWithNALUs:(NSArray*) nalus time:(double) pts
+{
+    return [[RTPFrame alloc] initWithNALUs:nalus time:pts];
+}
+
++ (RTPFrame*) liveFrameWithNALUs:(NSArray*) nalus time:(double) pts
+{
+    static MetricHistogram* packetize = Metrics::Histogram("rtp_packetize_seconds", "Time to packetize one access unit", NULL, 1e-9, 1 << 10, 1LL << 27);
+    static MetricCounter* frames = Metrics::Counter("rtp_frames_total", "Access units from the encoder", NULL);
+    
+    // on iOS, MetricsNow is mach_absolute_time, the clock capture pts are on
+    int64_t start = MetricsNow();
+    RTPFrame* frame = [[RTPFrame alloc] initWithNALUs:nalus time:pts];
+    int64_t end = MetricsNow();
+    packetize->Record(end - start);
+    frames->Add();
+    
+    double age = (end * 1e-9) - pts;
+    if ((age >= 0) && (age < max_capture_age))
+    {
+        frame->_captureTime = PacerNow() - age;
+    }
+    return frame;
+}
+
+- (RTPFrame*) initWithNALUs:(NSArray*) nalus time:(double) pts
+{
+    self = [super init];
+    _nalus = nalus;
+    _pts = pts;
+    _bytes = 0;
+    _payloadCount = 0;
+    
+    const int max_single_packet = max_rtp_packet_size - rtp_header_size;
+    const int max_fragment_packet = max_single_packet - 2;
+    
+    // non-reference unless some slice says otherwise
+    _frameClass = FrameNonReference;
+    int cTotal = 0;
+    for (NSData* nalu in nalus)
+    {
+        cTotal += (int)[nalu length];
+    }
+    _data = [NSMutableData dataWithCapacity:cTotal + (cTotal / max_fragment_packet + [nalus count]) * 2];
+    _payloads = [NSMutableData dataWithCapacity:(cTotal / max_fragment_packet + [nalus count] + 1) * sizeof(RTPPayload)];
+    
+    int nNALUs = (int)[nalus count];
+    for (int i = 0; i < nNALUs; i++)
+    {
+        NSData* nalu = [nalus objectAtIndex:i];
+        int cBytes = (int)[nalu length];
+        BOOL bLast = (i == nNALUs-1);
+        const uint8_t* pSource = (const uint8_t*)[nalu bytes];
+        _bytes += cBytes;
+        if (cBytes == 0)
+        {
+            continue;
+        }
+        
+        NALUnit nal(pSource, cBytes);
+        int type = nal.Type();
+        if (type == NALUnit::NAL_IDR_Slice)
+        {
+            _frameClass = FrameIDR;
+        }
+        else if ((type >= NALUnit::NAL_Slice) && (type <= NALUnit::NAL_PartitionC) && nal.IsRefPic() && (_frameClass != FrameIDR))
+        {
+            _frameClass = FrameReference;
+        }
+        BOOL bSync = (type == NALUnit::NAL_IDR_Slice) || (type == NALUnit::NAL_Sequence_Params);
+        
+        if (cBytes < max_single_packet)
+        {
+            [self addPayload:NULL length:0 data:pSource length:cBytes type:type marker:bLast sync:bSync];
+        }
+        else
+        {
+            uint8_t NALU_Header = pSource[0];
+            pSource += 1;
+            cBytes -= 1;
+            BOOL bStart = YES;
+            
+            while (cBytes)
+            {
+                int cThis = (cBytes < max_fragment_packet)? cBytes : max_fragment_packet;
+                BOOL bEnd = (cThis == cBytes);
+                
+                uint8_t fu[2];
+                fu[0] = (NALU_Header & 0xe0) + 28;   // FU_A type
+                fu[1] = (NALU_Header & 0x1f);
+                if (bStart)
+                {
+                    fu[1] |= 0x80;
+                }
+                else if (bEnd)
+                {
+                    fu[1] |= 0x40;
+                }
+                [self addPayload:fu length:2 data:pSource length:cThis type:type marker:(bLast && bEnd) sync:(bSync && bStart)];
+                bStart = NO;
+                
+                pSource += cThis;
+                cBytes -= cThis;
+            }
+        }
+    }
+    return self;
+}
+
+- (void) addPayload:(const uint8_t*) header length:(int) cHeader data:(const uint8_t*) p length:(int) cBytes type:(int) type marker:(BOOL) bMarker sync:(BOOL) bSync
+{
+    RTPPayload payload;
+    payload.offset = (int)[_data length];
+    payload.length = cHeader + cBytes;
+    payload.naluType = type;
+    payload.bMarker = bMarker;
+    payload.bSync = bSync;
+    if (cHeader > 0)
+    {
+        [_data appendBytes:header length:cHeader];
+    }
+    [_data appendBytes:p length:cBytes];
+    [_payloads appendBytes:&payload length:sizeof(payload)];
+    _payloadCount++;
+}
+
+- (const RTPPayload*) payloads
+{
+    return (const RTPPayload*)[_payloads bytes];
+}
+
+- (const uint8_t*) payloadBytes
+{
+    return (const uint8_t*)[_data bytes];
+}
+
+@end
@@ -0,0 +1,269 @@
+//
+//  RTPPacer.cpp
+//  Encoder Demo
+//
+//  Token-bucket pacing of RTP output.
+//
+
+#include "RTPPacer.h"
+#include <chrono>
+#include <algorithm>
+
+// bucket depth: enough for a few full-size packets, or a few ms at rate
+static const double min_bucket_depth = 4 * 1500;
+static const double bucket_depth_seconds = 0.004;
+
+double PacerNow()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double> >(steady_clock::now().time_since_epoch()).count();
+}
+
+// --- token bucket ---------------------------------------------
+
+TokenBucket::TokenBucket()
+: m_rate(0),
+  m_depth(0),
+  m_tokens(0),
+  m_last(0)
+{
+}
+
+void
+TokenBucket::SetRate(double bytesPerSecond, double depth)
+{
+    m_rate = bytesPerSecond;
+    m_depth = depth;
+    if (m_tokens > m_depth)
+    {
+        m_tokens = m_depth;
+    }
+}
+
+void
+TokenBucket::Refill(double now, double rate)
+{
+    if (m_last > 0)
+    {
+        m_tokens += (now - m_last) * rate;
+        if (m_tokens > m_depth)
+        {
+            m_tokens = m_depth;
+        }
+    }
+    else
+    {
+        m_tokens = m_depth;
+    }
+    m_last = now;
+}
+
+bool
+TokenBucket::HasTokens(int cBytes)
+{
+    // a packet may always go into a full bucket, even if it's bigger than the bucket
+    return Unlimited() || (m_tokens >= std::min(double(cBytes), m_depth));
+}
+
+void
+TokenBucket::Take(int cBytes)
+{
+    // tokens can go negative when a deadline forces a send: the debt
+    // is repaid before anything else goes
+    m_tokens -= cBytes;
+}
+
+double
+TokenBucket::TimeUntil(int cBytes, double rate)
+{
+    if (Unlimited() || HasTokens(cBytes) || (rate <= 0))
+    {
+        return 0;
+    }
+    return (std::min(double(cBytes), m_depth) - m_tokens) / rate;
+}
+
+// --- pacer -----------------------------------------------------
+
+struct RTPPacer::Flow
+{
+    pacer_send_t fn;
+    void* ctx;
+    TokenBucket bucket;
+    std::deque<Packet> queue;
+    int cQueued;
+    MetricHistogram* pAge;
+};
+
+RTPPacer::RTPPacer(double aggregateBitsPerSecond)
+: m_bExit(false),
+  m_next(0)
+{
+    double rate = aggregateBitsPerSecond / 8;
+    m_aggregate.SetRate(rate, std::max(min_bucket_depth, rate * bucket_depth_seconds));
+    m_thread = std::thread(&RTPPacer::Run, this);
+}
+
+RTPPacer::~RTPPacer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bExit = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+    for (size_t i = 0; i < m_flows.size(); i++)
+    {
+        delete m_flows[i];
+    }
+}
+
+RTPPacer::Flow*
+RTPPacer::AddFlow(pacer_send_t fn, void* ctx, MetricHistogram* pAge)
+{
+    Flow* flow = new Flow;
+    flow->fn = fn;
+    flow->ctx = ctx;
+    flow->cQueued = 0;
+    flow->pAge = pAge;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_flows.push_back(flow);
+    return flow;
+}
+
+void
+RTPPacer::RemoveFlow(Flow* flow)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_flows.erase(std::remove(m_flows.begin(), m_flows.end(), flow), m_flows.end());
+    }
+    // wait out any send that picked up this flow before it was removed
+    std::lock_guard<std::mutex> wait(m_sendLock);
+    delete flow;
+}
+
+void
+RTPPacer::SetRate(Flow* flow, double bitsPerSecond, double burstFactor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double rate = (bitsPerSecond * burstFactor) / 8;
+    flow->bucket.SetRate(rate, std::max(min_bucket_depth, rate * bucket_depth_seconds));
+}
+
+void
+RTPPacer::Enqueue(Flow* flow, const BYTE* p, int cBytes, double deadline, double origin)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Packet pkt;
+        pkt.data.assign(p, p + cBytes);
+        pkt.deadline = deadline;
+        pkt.origin = origin;
+        flow->queue.push_back(pkt);
+        flow->cQueued += cBytes;
+    }
+    m_cond.notify_one();
+}
+
+int
+RTPPacer::QueuedBytes(Flow* flow)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return flow->cQueued;
+}
+
+double
+RTPPacer::Backlog(Flow* flow, double now)
+{
+    // the rate needed to clear the queue by the last packet's deadline.
+    // If the configured rate would miss it, we go faster rather than
+    // leaving a burst for the deadline to force out.
+    double rate = flow->bucket.Rate();
+    double remaining = flow->queue.back().deadline - now;
+    if (remaining > 0.001)
+    {
+        rate = std::max(rate, flow->cQueued / remaining);
+    }
+    return rate;
+}
+
+void
+RTPPacer::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_bExit)
+    {
+        double now = PacerNow();
+        double wait = -1;
+        Flow* due = NULL;
+
+        m_aggregate.Refill(now, m_aggregate.Rate());
+        size_t cFlows = m_flows.size();
+        for (size_t i = 0; i < cFlows; i++)
+        {
+            // round-robin so that one busy flow cannot starve the others
+            size_t idx = (m_next + i) % cFlows;
+            Flow* flow = m_flows[idx];
+            if (flow->queue.empty())
+            {
+                continue;
+            }
+            double rate = Backlog(flow, now);
+            flow->bucket.Refill(now, rate);
+            const Packet& head = flow->queue.front();
+            int cBytes = (int)head.data.size();
+            if ((now >= head.deadline) ||
+                (flow->bucket.HasTokens(cBytes) && m_aggregate.HasTokens(cBytes)))
+            {
+                due = flow;
+                m_next = idx + 1;
+                break;
+            }
+            double t = std::max(flow->bucket.TimeUntil(cBytes, rate),
+                                m_aggregate.TimeUntil(cBytes, m_aggregate.Rate()));
+            t = std::min(t, head.deadline - now);
+            if ((wait < 0) || (t < wait))
+            {
+                wait = t;
+            }
+        }
+
+        if (due == NULL)
+        {
+            if (wait < 0)
+            {
+                m_cond.wait(lock);
+            }
+            else
+            {
+                m_cond.wait_for(lock, std::chrono::duration<double>(wait));
+            }
+            continue;
+        }
+
+        Packet pkt;
+        pkt.data.swap(due->queue.front().data);
+        pkt.origin = due->queue.front().origin;
+        due->queue.pop_front();
+        int cBytes = (int)pkt.data.size();
+        due->cQueued -= cBytes;
+        due->bucket.Take(cBytes);
+        m_aggregate.Take(cBytes);
+        pacer_send_t fn = due->fn;
+        void* ctx = due->ctx;
+        MetricHistogram* pAge = (pkt.origin > 0) ? due->pAge : NULL;
+
+        // send without holding the queue lock, so that the encoder
+        // thread is never held up by a slow sendto
+        std::lock_guard<std::mutex> sending(m_sendLock);
+        lock.unlock();
+        fn(ctx, &pkt.data[0], cBytes);
+        if (pAge != NULL)
+        {
+            pAge->Record((int64_t)((PacerNow() - pkt.origin) * 1e9));
+        }
+        lock.lock();
+    }
+}
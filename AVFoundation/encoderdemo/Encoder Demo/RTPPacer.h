@@ -0,0 +1,102 @@
+//
+//  RTPPacer.h
+//  Encoder Demo
+//
+//  Spreads each session's packets out in time, so that an IDR does
+//  not leave as one burst of a hundred or more datagrams. Each flow
+//  has its own token bucket running at the stream bitrate times a
+//  burst factor, underneath an optional aggregate bucket for the whole
+//  server. One thread services all flows.
+//
+
+#pragma once
+
+#include "NALUnit.h"
+#include "Metrics.h"
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// called on the pacer thread when a packet is due to go out
+typedef void (*pacer_send_t)(void* ctx, const BYTE* p, int cBytes);
+
+// monotonic seconds, on the same clock as packet deadlines
+double PacerNow();
+
+class TokenBucket
+{
+public:
+    TokenBucket();
+
+    // bytesPerSecond == 0 means unlimited
+    void SetRate(double bytesPerSecond, double depth);
+    void Refill(double now, double rate);
+    double Rate()   { return m_rate; }
+
+    bool Unlimited()    { return m_rate <= 0; }
+    bool HasTokens(int cBytes);
+    void Take(int cBytes);
+
+    // seconds until cBytes of tokens will be available at rate
+    double TimeUntil(int cBytes, double rate);
+
+private:
+    double m_rate;
+    double m_depth;
+    double m_tokens;
+    double m_last;
+};
+
+class RTPPacer
+{
+public:
+    struct Flow;
+
+    // aggregateBitsPerSecond caps the total of all flows; 0 for no cap
+    RTPPacer(double aggregateBitsPerSecond);
+    ~RTPPacer();
+
+    // pAge, if given, gets the age of each frame as its last packet
+    // goes out (see Enqueue)
+    Flow* AddFlow(pacer_send_t fn, void* ctx, MetricHistogram* pAge = NULL);
+
+    // on return, no further callbacks will be made for this flow
+    void RemoveFlow(Flow* flow);
+
+    void SetRate(Flow* flow, double bitsPerSecond, double burstFactor);
+
+    // deadline is on the PacerNow clock. A packet that reaches its
+    // deadline is sent whatever the bucket state, so pacing can delay
+    // a frame but never make it late. origin is when the frame was
+    // captured, also on the PacerNow clock: give it for a frame's last
+    // packet to have the frame's age recorded, and 0 otherwise.
+    void Enqueue(Flow* flow, const BYTE* p, int cBytes, double deadline, double origin = 0);
+
+    int QueuedBytes(Flow* flow);
+
+private:
+    struct Packet
+    {
+        std::vector<BYTE> data;
+        double deadline;
+        double origin;
+    };
+
+    void Run();
+    double Backlog(Flow* flow, double now);
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+    bool m_bExit;
+
+    // held while a send callback is in progress
+    std::mutex m_sendLock;
+
+    std::vector<Flow*> m_flows;
+    size_t m_next;
+    TokenBucket m_aggregate;
+};
@@ -8,13 +8,30 @@
 
 #import <Foundation/Foundation.h>
 #import "RTSPServer.h"
+#import "RTPFrame.h"
 
 @interface RTSPClientConnection : NSObject
 
 
 + (RTSPClientConnection*) createWithSocket:(CFSocketNativeHandle) s server:(RTSPServer*) server;
 
-- (void) onVideoData:(NSArray*) data time:(double) pts;
+// called on the connection's StreamEngine shard thread
+- (void) onVideoFrame:(RTPFrame*) frame;
+
+// also on the shard thread, before the frame that follows frames the
+// shard's queue had no room for
+- (void) onMissedFrames:(int) count reference:(BOOL) bReference;
+
+// set by StreamEngine before any frame is delivered
+- (void) setShard:(int) shard;
+- (void) onRTCP:(CFDataRef) data;
+
+// true if an RTCP packet from the server's shared port is for our session
+- (BOOL) ownsRTCP:(CFDataRef) data;
 - (void) shutdown;
 
+// per-session delivery figures from our counters and the client's
+// receiver reports, or nil if no session is set up
+- (NSDictionary*) statistics;
+
 @end
@@ -9,7 +9,19 @@
 #import "RTSPClientConnection.h"
 #import "RTSPMessage.h"
 #import "NALUnit.h"
+#import "InterleavedSender.h"
+#import "RTCP.h"
+#import "RTPPacer.h"
+#import "GOPCache.h"
+#import "PacketHistory.h"
+#import "FEC.h"
+#import "RTPFrame.h"
+#import "CongestionPolicy.h"
+#import "VODSource.h"
+#import "SessionDescription.h"
+#import "Metrics.h"
 #import "arpa/inet.h"
+#import "fcntl.h"
 
 void tonet_short(uint8_t* p, unsigned short s)
 {
@@ -24,61 +36,80 @@ void tonet_long(uint8_t* p, unsigned long l)
     p[3] = l & 0xff;
 }
 
-static const char* Base64Mapping = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-static const int max_packet_size = 1200;
 
-NSString* encodeLong(unsigned long val, int nPad)
+// media held for a TCP client before we start dropping to the next IDR
+static const int max_interleaved_queue = 512 * 1024;
+
+// client input held while a request or interleaved frame is incomplete.
+// A $ frame is at most 64K; a client sending more than this without
+// completing one is disconnected.
+static const int max_client_input = 128 * 1024;
+
+// UDP output is paced at the stream bitrate times this factor, and
+// each frame is spread over at most one frame interval (capped here)
+static const double pacing_burst_factor = 1.5;
+static const double max_pacing_delay = 0.1;
+
+// sent UDP packets kept for NACK retransmission: a couple of seconds at
+// typical bitrates. Retransmissions go out as an RFC 4588 stream.
+static const int rtx_history_slots = 512;
+static const int rtx_payload_type = 97;
+
+// CNAME in our sender reports and the SDP's source lines
+static NSString* const rtcp_cname = @"AVEncoderDemo";
+
+// row/column parity, when the server has it turned on
+static const int fec_payload_type = 98;
+
+// a cached GOP is replayed to a new viewer this many times faster than real time
+static const double catchup_speed = 4.0;
+
+// RFC 1123 date for the Date header, as RTSP requires
+static NSString* httpDate()
 {
-    char ch[4];
-    int cch = 4 - nPad;
-    for (int i = 0; i < cch; i++)
-    {
-        int shift = 6 * (cch - (i+1));
-        int bits = (val >> shift) & 0x3f;
-        ch[i] = Base64Mapping[bits];
-    }
-    for (int i = 0; i < nPad; i++)
-    {
-        ch[cch + i] = '=';
-    }
-    NSString* s = [[NSString alloc] initWithBytes:ch length:4 encoding:NSUTF8StringEncoding];
-    return s;
+    static NSDateFormatter* formatter = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss 'GMT'";
+    });
+    // requests all arrive on the main run loop, so one formatter can be shared
+    return [formatter stringFromDate:[NSDate date]];
 }
 
-NSString* encodeToBase64(NSData* data)
+// control requests by method, and how long each takes to answer
+static void recordRequest(NSString* cmd, int64_t nanoseconds)
 {
-    NSString* s = @"";
-    
-    const uint8_t* p = (const uint8_t*) [data bytes];
-    int cBytes = (int)[data length];
-    while (cBytes >= 3)
-    {
-        unsigned long val = (p[0] << 16) + (p[1] << 8) + p[2];
-        p += 3;
-        cBytes -= 3;
-        
-        s = [s stringByAppendingString:encodeLong(val, 0)];
-    }
-    if (cBytes > 0)
-    {
-        int nPad;
-        unsigned long val;
-        if (cBytes == 1)
+    static const char* methods[] = { "OPTIONS", "DESCRIBE", "SETUP", "PLAY", "TEARDOWN", "other" };
+    static const int method_count = sizeof(methods) / sizeof(methods[0]);
+    static MetricCounter* counters[method_count];
+    static MetricHistogram* latency[method_count];
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        for (int i = 0; i < method_count; i++)
         {
-            // pad 8 bits to 2 x 6 and add 2 ==
-            nPad = 2;
-            val = p[0] << 4;
+            char labels[64];
+            snprintf(labels, sizeof(labels), "method=\"%s\"", methods[i]);
+            counters[i] = Metrics::Counter("rtsp_requests_total", "RTSP requests handled", labels);
+            latency[i] = Metrics::Histogram("rtsp_request_seconds", "Time to handle an RTSP request", labels, 1e-9, 1 << 12, 1LL << 30);
         }
-        else
-        {
-            // must be two bytes -- pad 16 bits to 3 x 6 and add one =
-            nPad = 1;
-            val = (p[0] << 8) + p[1];
-            val = val << 2;
-        }
-        s = [s stringByAppendingString:encodeLong(val, nPad)];
+    });
+    int i = 0;
+    while ((i < (method_count - 1)) && ([cmd caseInsensitiveCompare:[NSString stringWithUTF8String:methods[i]]] != NSOrderedSame))
+    {
+        i++;
     }
-    return s;
+    counters[i]->Add();
+    latency[i]->Record(nanoseconds);
+}
+
+static MetricHistogram* frameAgeMetric(const char* transport)
+{
+    char labels[64];
+    snprintf(labels, sizeof(labels), "transport=\"%s\"", transport);
+    return Metrics::Histogram("rtp_frame_age_seconds", "Capture to the last packet of a frame on the wire", labels, 1e-9, 1 << 20, 1LL << 33);
 }
 
 enum ServerState
@@ -93,9 +124,28 @@ enum ServerState
     CFSocketRef _s;
     RTSPServer* _server;
     CFRunLoopSourceRef _rls;
+    NSMutableData* _input;
+    
+    // everything written to the control socket, including
+    // interleaved RTP/RTCP when the client asked for TCP
+    InterleavedSender* _output;
+    BOOL _bInterleaved;
+    int _channelRTP;
+    int _channelRTCP;
     
     CFDataRef _addrRTP;
     CFSocketRef _sRTP;
+    RTPPacer* _pacer;
+    RTPPacer::Flow* _flow;
+    int _shard;
+    double _lastPts;
+    double _deadline;
+    double _origin;         // capture time of the frame going out
+    
+    // GOP to replay ahead of the first live frame after PLAY
+    NSArray* _catchup;
+    double _catchupEnd;
+    double _catchupLast;
     CFDataRef _addrRTCP;
     CFSocketRef _sRTCP;
     NSString* _session;
@@ -105,24 +155,54 @@ enum ServerState
     long _ssrc;
     BOOL _bFirst;
     
-    // time mapping using NTP
-    uint64_t _ntpBase;
+    // time mapping
     uint64_t _rtpBase;
     double _ptsBase;
+    
+    // most recent RTP timestamp and when it went out, so that
+    // sender reports can give a current NTP/RTP pair
+    uint32_t _rtpLast;
+    uint64_t _ntpLast;
 
-    // RTCP stats
-    long _packetsReported;
-    long _bytesReported;
+    // sender reports out, receiver reports in
+    RTCPSender* _rtcp;
+    long _payloadSent;
     NSDate* _sentRTCP;
     
-    // reader reports
-    CFSocketRef _recvRTCP;
-    CFRunLoopSourceRef _rlsRTCP;
+    // retransmission (UDP only: TCP does its own)
+    PacketHistory* _history;
+    long _ssrcRTX;
+    long _packetsRTX;
+    long _retransmitted;
+    
+    // parity over the UDP media stream
+    FECEncoder* _fec;
+    
+    // what to shed when the client cannot keep up
+    CongestionPolicy* _congestion;
+    
+    // set when SETUP named a recorded file rather than the live stream
+    VODSource* _vodSource;
+    VODPlayer* _player;
+    NSString* _vodURL;
+    
+    // set when SETUP asked for multicast: the server's shared sender
+    // carries our media, and we only count as one of its viewers
+    BOOL _bMulticast;
+    BOOL _bJoined;
 }
 
 - (RTSPClientConnection*) initWithSocket:(CFSocketNativeHandle) s Server:(RTSPServer*) server;
 - (void) onSocketData:(CFDataRef)data;
-- (void) onRTCP:(CFDataRef) data;
+- (void) onWritable;
+- (void) disconnect;
+- (void) sendPacedPacket:(const uint8_t*) packet length:(int) cBytes;
+- (void) retransmit:(uint16_t) seq minInterval:(double) minInterval;
+- (NSString*) playVOD:(RTSPMessage*) msg;
+- (void) onVODFrame:(RTPFrame*) frame player:(VODPlayer*) player deadline:(double) deadline;
+- (int) streamBitrate;
+- (NSString*) playMulticast:(RTSPMessage*) msg;
+- (void) leaveMulticast;
 
 @end
 
@@ -141,6 +221,10 @@ static void onSocket (
             [conn onSocketData:(CFDataRef) data];
             break;
             
+        case kCFSocketWriteCallBack:
+            [conn onWritable];
+            break;
+            
         default:
             NSLog(@"unexpected socket event");
             break;
@@ -148,24 +232,23 @@ static void onSocket (
     
 }
 
-static void onRTCP(CFSocketRef s,
-                   CFSocketCallBackType callbackType,
-                   CFDataRef address,
-                   const void *data,
-                   void *info
-                   )
+static void onPacedPacket(void* ctx, const BYTE* p, int cBytes)
 {
-    RTSPClientConnection* conn = (__bridge RTSPClientConnection*)info;
-    switch (callbackType)
+    RTSPClientConnection* conn = (__bridge RTSPClientConnection*)ctx;
+    [conn sendPacedPacket:p length:cBytes];
+}
+
+// one pacing thread per StreamEngine shard, serving that shard's UDP sessions
+static RTPPacer* pacerForShard(int shard)
+{
+    static std::mutex lock;
+    static std::vector<RTPPacer*> pacers;
+    std::lock_guard<std::mutex> guard(lock);
+    while ((int)pacers.size() <= shard)
     {
-        case kCFSocketDataCallBack:
-            [conn onRTCP:(CFDataRef) data];
-            break;
-            
-        default:
-            NSLog(@"unexpected socket event");
-            break;
+        pacers.push_back(new RTPPacer(0));
     }
+    return pacers[shard];
 }
 
 @implementation RTSPClientConnection
@@ -184,11 +267,25 @@ static void onRTCP(CFSocketRef s,
 {
     _state = ServerIdle;
     _server = server;
+    _input = [NSMutableData dataWithCapacity:1024];
+    
+    // a slow client must never block the encoder thread: writes
+    // are queued and completed from the write callback
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    _output = new InterleavedSender(s, max_interleaved_queue);
+    _rtcp = new RTCPSender();
+    
+    // fixed for the connection, as DESCRIBE gives them to the client
+    // before SETUP starts a session
+    _ssrc = random();
+    _ssrcRTX = random();
+    _congestion = new CongestionPolicy();
+    
     CFSocketContext info;
     memset(&info, 0, sizeof(info));
     info.info = (void*)CFBridgingRetain(self);
     
-    _s = CFSocketCreateWithNative(nil, s, kCFSocketDataCallBack, onSocket, &info);
+    _s = CFSocketCreateWithNative(nil, s, kCFSocketDataCallBack | kCFSocketWriteCallBack, onSocket, &info);
     
     _rls = CFSocketCreateRunLoopSource(nil, _s, 0);
     CFRunLoopAddSource(CFRunLoopGetMain(), _rls, kCFRunLoopCommonModes);
@@ -196,19 +293,154 @@ static void onRTCP(CFSocketRef s,
     return self;
 }
 
+- (void) dealloc
+{
+    delete _output;
+    delete _rtcp;
+    delete _history;
+    delete _fec;
+    delete _congestion;
+}
+
 - (void) onSocketData:(CFDataRef)data
 {
     if (CFDataGetLength(data) == 0)
     {
-        [self tearDown];
+        [self disconnect];
+        return;
+    }
+    [_input appendData:(__bridge NSData*)data];
+    
+    // requests and, for TCP clients, $-framed RTCP can arrive
+    // together in one read or split across several
+    while ([_input length] > 0)
+    {
+        const uint8_t* p = (const uint8_t*)[_input bytes];
+        int cBytes = (int)[_input length];
+        int cUsed = 0;
+        if (p[0] == '$')
+        {
+            if (cBytes < 4)
+            {
+                break;
+            }
+            int cFrame = (p[2] << 8) + p[3];
+            if (cBytes < (cFrame + 4))
+            {
+                break;
+            }
+            if (_bInterleaved && (p[1] == _channelRTCP))
+            {
+                CFDataRef rtcp = CFDataCreate(nil, p + 4, cFrame);
+                [self onRTCP:rtcp];
+                CFRelease(rtcp);
+            }
+            cUsed = cFrame + 4;
+        }
+        else
+        {
+            NSData* blank = [NSData dataWithBytes:"\r\n\r\n" length:4];
+            NSRange end = [_input rangeOfData:blank options:0 range:NSMakeRange(0, cBytes)];
+            if (end.location == NSNotFound)
+            {
+                break;
+            }
+            cUsed = (int)(end.location + end.length);
+            CFDataRef request = CFDataCreate(nil, p, cUsed);
+            RTSPMessage* msg = [RTSPMessage createWithData:request];
+            CFRelease(request);
+            
+            // we don't use any request bodies, but must step over them
+            int cBody = 0;
+            NSString* length = [msg valueForOption:@"content-length"];
+            if (length != nil)
+            {
+                NSScanner* scan = [NSScanner scannerWithString:length];
+                unsigned long long val;
+                if (![scan scanUnsignedLongLong:&val] || ![scan isAtEnd] ||
+                    ([length rangeOfString:@"-"].location != NSNotFound) ||
+                    (val > (unsigned long long)(max_client_input - cUsed)))
+                {
+                    NSLog(@"RTSP request with bad Content-Length: %@", length);
+                    if (msg != nil)
+                    {
+                        NSString* response = [[msg createResponse:400 text:@"Bad Request"] stringByAppendingString:@"\r\n"];
+                        NSData* dataResponse = [response dataUsingEncoding:NSUTF8StringEncoding];
+                        _output->SendControl((const BYTE*)[dataResponse bytes], (int)[dataResponse length]);
+                        _output->Flush();
+                    }
+                    [self disconnect];
+                    return;
+                }
+                cBody = (int)val;
+            }
+            if (cBytes < (cUsed + cBody))
+            {
+                break;
+            }
+            cUsed += cBody;
+            [self onRequest:msg];
+        }
+        [_input replaceBytesInRange:NSMakeRange(0, cUsed) withBytes:NULL length:0];
+    }
+    if ([_input length] > max_client_input)
+    {
+        NSLog(@"RTSP client sent %d bytes without a complete request", (int)[_input length]);
+        [self disconnect];
+    }
+}
+
+// the client has gone, or can no longer be written to
+- (void) disconnect
+{
+    [self tearDown];
+    @synchronized(self)
+    {
+        if (_s == nil)
+        {
+            return;
+        }
         CFSocketInvalidate(_s);
         _s = nil;
-        [_server shutdownConnection:self];
-        return;
     }
-    RTSPMessage* msg = [RTSPMessage createWithData:data];
+    [_server shutdownConnection:self];
+}
+
+- (void) onWritable
+{
+    [self flushOutput];
+}
+
+- (void) flushOutput
+{
+    @synchronized(self)
+    {
+        if (_s == nil)
+        {
+            return;
+        }
+        if (!_output->Flush())
+        {
+            // a session must not carry on for a client that is gone. This
+            // can be the encoder's thread, so the teardown is left to main.
+            NSLog(@"RTSP connection write failed");
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [self disconnect];
+            });
+            return;
+        }
+        if (_output->HasPending())
+        {
+            CFSocketEnableCallBacks(_s, kCFSocketWriteCallBack);
+        }
+    }
+}
+
+- (void) onRequest:(RTSPMessage*) msg
+{
     if (msg != nil)
     {
+        int64_t start = MetricsNow();
         NSString* response = nil;
         NSString* cmd = msg.command;
         if ([cmd caseInsensitiveCompare:@"options"] == NSOrderedSame)
@@ -219,22 +451,57 @@ static void onRTCP(CFSocketRef s,
         }
         else if ([cmd caseInsensitiveCompare:@"describe"] == NSOrderedSame)
         {
-            NSString* sdp = [self makeSDP];
-            response = [msg createResponse:200 text:@"OK"];
-            NSString* date = [NSDateFormatter localizedStringFromDate:[NSDate date] dateStyle:NSDateFormatterLongStyle timeStyle:NSDateFormatterLongStyle];
             CFDataRef dlocaladdr = CFSocketCopyAddress(_s);
             struct sockaddr_in* localaddr = (struct sockaddr_in*) CFDataGetBytePtr(dlocaladdr);
-            
-            response = [response stringByAppendingFormat:@"Content-base: rtsp://%s/\r\n", inet_ntoa(localaddr->sin_addr)];
+            NSString* address = [NSString stringWithUTF8String:inet_ntoa(localaddr->sin_addr)];
             CFRelease(dlocaladdr);
-            response = [response stringByAppendingFormat:@"Date: %@\r\nContent-Type: application/sdp\r\nContent-Length: %d\r\n\r\n", date, (int)[sdp length] ];
-            response = [response stringByAppendingString:sdp];
+            NSData* sdp;
+            NSString* base;
+            VODSource* vod = [_server vodSourceForURL:msg.url];
+            if (vod != nil)
+            {
+                sdp = [vod.sessionDescription sdpForAddress:address bitrate:vod.bitrate packetSize:max_rtp_packet_size fec:(_server.fecColumns > 0)];
+                base = [msg.url hasSuffix:@"/"] ? msg.url : [msg.url stringByAppendingString:@"/"];
+            }
+            else
+            {
+                sdp = [_server sdpForAddress:address packetSize:max_rtp_packet_size];
+                base = [NSString stringWithFormat:@"rtsp://%@/", address];
+            }
+            sdp = [SessionDescription sdp:sdp withSSRC:(uint32_t)_ssrc rtx:(uint32_t)_ssrcRTX cname:rtcp_cname];
+            
+            response = [msg createResponse:200 text:@"OK"];
+            response = [response stringByAppendingFormat:@"Content-base: %@\r\n", base];
+            response = [response stringByAppendingFormat:@"Date: %@\r\nContent-Type: application/sdp\r\nContent-Length: %d\r\n\r\n", httpDate(), (int)[sdp length]];
+            
+            // header and body go out as they are: the body is never re-encoded
+            NSData* header = [response dataUsingEncoding:NSUTF8StringEncoding];
+            _output->SendControl((const BYTE*)[header bytes], (int)[header length]);
+            _output->SendControl((const BYTE*)[sdp bytes], (int)[sdp length]);
+            [self flushOutput];
+            response = nil;
         }
         else if ([cmd caseInsensitiveCompare:@"setup"] == NSOrderedSame)
         {
             NSString* transport = [msg valueForOption:@"transport"];
             NSArray* props = [transport componentsSeparatedByString:@";"];
             NSArray* ports = nil;
+            NSArray* channels = nil;
+            BOOL bTCP = ([props count] > 0) && ([props[0] caseInsensitiveCompare:@"RTP/AVP/TCP"] == NSOrderedSame);
+            BOOL bMulticast = NO;
+            for (NSString* s in props)
+            {
+                bMulticast = bMulticast || ([s caseInsensitiveCompare:@"multicast"] == NSOrderedSame);
+            }
+            VODSource* vod = [_server vodSourceForURL:msg.url];
+            
+            // a new SETUP replaces any multicast session we had
+            [self leaveMulticast];
+            @synchronized(self)
+            {
+                _vodSource = vod;
+                _vodURL = msg.url;
+            }
             for (NSString* s in props)
             {
                 if ([s length] > 14)
@@ -246,8 +513,52 @@ static void onRTCP(CFSocketRef s,
                         break;
                     }
                 }
+                if ([s length] > 12)
+                {
+                    if ([s compare:@"interleaved=" options:0 range:NSMakeRange(0, 12)] == NSOrderedSame)
+                    {
+                        NSString* val = [s substringFromIndex:12];
+                        channels = [val componentsSeparatedByString:@"-"];
+                        break;
+                    }
+                }
             }
-            if ([ports count] == 2)
+            if (bMulticast && !bTCP)
+            {
+                // recorded files are per viewer, so they are never multicast
+                if (vod == nil)
+                {
+                    NSString* session_name = [self createMulticastSession];
+                    response = [msg createResponse:200 text:@"OK"];
+                    response = [response stringByAppendingFormat:@"Session: %@\r\nTransport: RTP/AVP;multicast;destination=%@;port=%d-%d;ttl=%d\r\n\r\n",
+                                session_name,
+                                _server.multicastGroup, _server.multicastPort, _server.multicastPort + 1, _server.multicastTTL];
+                }
+                else
+                {
+                    response = [msg createResponse:461 text:@"Unsupported Transport"];
+                }
+            }
+            else if (bTCP)
+            {
+                // RTP/RTCP over this connection, as $ channel length frames
+                int chRTP = 0;
+                int chRTCP = 1;
+                if ([channels count] == 2)
+                {
+                    chRTP = (int)[channels[0] integerValue];
+                    chRTCP = (int)[channels[1] integerValue];
+                }
+                NSString* session_name = [self createInterleavedSession:chRTP rtcp:chRTCP];
+                if (session_name != nil)
+                {
+                    response = [msg createResponse:200 text:@"OK"];
+                    response = [response stringByAppendingFormat:@"Session: %@\r\nTransport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n\r\n",
+                                session_name,
+                                chRTP, chRTCP];
+                }
+            }
+            else if ([ports count] == 2)
             {
                 int portRTP = (int)[ports[0] integerValue];
                 int portRTCP = (int) [ports[1] integerValue];
@@ -267,20 +578,53 @@ static void onRTCP(CFSocketRef s,
                 response = [msg createResponse:451 text:@"Need better error string here"];
             }
         }
+        else if (([cmd caseInsensitiveCompare:@"play"] == NSOrderedSame) && (_vodSource != nil))
+        {
+            response = [self playVOD:msg];
+        }
+        else if (([cmd caseInsensitiveCompare:@"play"] == NSOrderedSame) && _bMulticast)
+        {
+            response = [self playMulticast:msg];
+        }
         else if ([cmd caseInsensitiveCompare:@"play"] == NSOrderedSame)
         {
-            @synchronized(self)
+            // the GOP snapshot must be taken between two frames being added
+            // to the cache, so hold the server lock as its onVideoData does
+            // (and in the same order: server, then connection)
+            @synchronized(_server)
             {
-                if (_state != Setup)
-                {
-                    response = [msg createResponse:451 text:@"Wrong state"];
-                }
-                else
+                @synchronized(self)
                 {
-                    _state = Playing;
-                    _bFirst = YES;
-                    response = [msg createResponse:200 text:@"OK"];
-                    response = [response stringByAppendingFormat:@"Session: %@\r\n\r\n", _session];
+                    if (_state != Setup)
+                    {
+                        response = [msg createResponse:451 text:@"Wrong state"];
+                    }
+                    else
+                    {
+                        _state = Playing;
+                        
+                        // start from the cached GOP if there is one, otherwise
+                        // wait for the next IDR. A TCP client's queue must be
+                        // able to hold the whole GOP, or it would just be dropped.
+                        _catchup = [_server cachedGOP];
+                        if (_bInterleaved)
+                        {
+                            int cBytes = 0;
+                            for (RTPFrame* f in _catchup)
+                            {
+                                cBytes += f.bytes;
+                            }
+                            if (cBytes > (max_interleaved_queue / 2))
+                            {
+                                _catchup = nil;
+                            }
+                        }
+                        _catchupEnd = 0;
+                        _catchupLast = (_catchup != nil) ? ((RTPFrame*)[_catchup lastObject]).pts : -1;
+                        _bFirst = (_catchup == nil);
+                        response = [msg createResponse:200 text:@"OK"];
+                        response = [response stringByAppendingFormat:@"Session: %@\r\n\r\n", _session];
+                    }
                 }
             }
         }
@@ -297,48 +641,13 @@ static void onRTCP(CFSocketRef s,
         if (response != nil)
         {
             NSData* dataResponse = [response dataUsingEncoding:NSUTF8StringEncoding];
-            CFSocketError e = CFSocketSendData(_s, NULL, (__bridge CFDataRef)(dataResponse), 2);
-            if (e)
-            {
-                NSLog(@"send %ld", e);
-            }
+            _output->SendControl((const BYTE*)[dataResponse bytes], (int)[dataResponse length]);
+            [self flushOutput];
         }
+        recordRequest(cmd, MetricsNow() - start);
     }
 }
 
-- (NSString*) makeSDP
-{
-    NSData* config = [_server getConfigData];
-    
-    avcCHeader avcC((const BYTE*)[config bytes], (int)[config length]);
-    SeqParamSet seqParams;
-    seqParams.Parse(avcC.sps());
-    int cx = (int)seqParams.EncodedWidth();
-    int cy = (int)seqParams.EncodedHeight();
-    
-    NSString* profile_level_id = [NSString stringWithFormat:@"%02x%02x%02x", seqParams.Profile(), seqParams.Compat(), seqParams.Level()];
-    
-    NSData* data = [NSData dataWithBytes:avcC.sps()->Start() length:avcC.sps()->Length()];
-    NSString* sps = encodeToBase64(data);
-    data = [NSData dataWithBytes:avcC.pps()->Start() length:avcC.pps()->Length()];
-    NSString* pps = encodeToBase64(data);
-    
-    // !! o=, s=, u=, c=, b=? control for track?
-    unsigned long verid = random();
-    
-    CFDataRef dlocaladdr = CFSocketCopyAddress(_s);
-    struct sockaddr_in* localaddr = (struct sockaddr_in*) CFDataGetBytePtr(dlocaladdr);
-    NSString* sdp = [NSString stringWithFormat:@"v=0\r\no=- %ld %ld IN IP4 %s\r\ns=Live stream from iOS\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\na=control:*\r\n", verid, verid, inet_ntoa(localaddr->sin_addr)];
-    CFRelease(dlocaladdr);
-    
-    int packets = (_server.bitrate / (max_packet_size * 8)) + 1;
-    
-    sdp = [sdp stringByAppendingFormat:@"m=video 0 RTP/AVP 96\r\nb=TIAS:%d\r\na=maxprate:%d.0000\r\na=control:streamid=1\r\n", _server.bitrate, packets];
-    sdp = [sdp stringByAppendingFormat:@"a=rtpmap:96 H264/90000\r\na=mimetype:string;\"video/H264\"\r\na=framesize:96 %d-%d\r\na=Width:integer;%d\r\na=Height:integer;%d\r\n", cx, cy, cx, cy];
-    sdp = [sdp stringByAppendingFormat:@"a=fmtp:96 packetization-mode=1;profile-level-id=%@;sprop-parameter-sets=%@,%@\r\n", profile_level_id, sps, pps];
-    return sdp;
-}
-
 - (NSString*) createSession:(int) portRTP rtcp:(int) portRTCP
 {
     // !! most basic possible for initial testing
@@ -355,113 +664,379 @@ static void onRTCP(CFSocketRef s,
         _sRTCP = CFSocketCreate(nil, PF_INET, SOCK_DGRAM, IPPROTO_UDP, 0, nil, nil);
         CFRelease(data);
         
-        // reader reports received here
-        CFSocketContext info;
-        memset(&info, 0, sizeof(info));
-        info.info = (void*)CFBridgingRetain(self);
-        _recvRTCP = CFSocketCreate(nil, PF_INET, SOCK_DGRAM, IPPROTO_UDP, kCFSocketDataCallBack, onRTCP, &info);
-        
-        struct sockaddr_in addr;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(6971);
-        CFDataRef dataAddr = CFDataCreate(nil, (const uint8_t*)&addr, sizeof(addr));
-        CFSocketSetAddress(_recvRTCP, dataAddr);
-        CFRelease(dataAddr);
-        
-        _rlsRTCP = CFSocketCreateRunLoopSource(nil, _recvRTCP, 0);
-        CFRunLoopAddSource(CFRunLoopGetMain(), _rlsRTCP, kCFRunLoopCommonModes);
-        
+        // receiver reports arrive at the server's RTCP port and are passed to onRTCP
+        _bInterleaved = NO;
+        if (_flow == NULL)
+        {
+            _pacer = pacerForShard(_shard);
+            static MetricHistogram* age = frameAgeMetric("udp");
+            _flow = _pacer->AddFlow(onPacedPacket, (__bridge void*)self, age);
+        }
+        if (_history == NULL)
+        {
+            _history = new PacketHistory(rtx_history_slots, max_rtp_packet_size);
+        }
+        if (_fec == NULL)
+        {
+            _fec = new FECEncoder(max_rtp_packet_size);
+        }
+        [self startSession];
+    }
+    return _session;
+}
+
+- (NSString*) createMulticastSession
+{
+    @synchronized(self)
+    {
+        _bInterleaved = NO;
+        _bMulticast = YES;
+        [self startSession];
+    }
+    return _session;
+}
+
+- (NSString*) createInterleavedSession:(int) chRTP rtcp:(int) chRTCP
+{
+    @synchronized(self)
+    {
+        _bInterleaved = YES;
+        _channelRTP = chRTP;
+        _channelRTCP = chRTCP;
+        [self startSession];
+    }
+    return _session;
+}
+
+- (void) startSession
+{
+    @synchronized(self)
+    {
         // flag that setup is valid
         long sessionid = random();
         _session = [NSString stringWithFormat:@"%ld", sessionid];
         _state = Setup;
-        _ssrc = random();
         _packets = 0;
         _bytesSent = 0;
+        _payloadSent = 0;
         _rtpBase = 0;
+        _lastPts = -1;
     
         _sentRTCP = nil;
-        _packetsReported = 0;
-        _bytesReported = 0;
+        _rtcp->Reset((uint32_t)_ssrc, 90000);
+        
+        _packetsRTX = 0;
+        _retransmitted = 0;
+        _congestion->Reset();
+        if (_history)
+        {
+            _history->Clear();
+        }
+        if (_fec)
+        {
+            _fec->Reset((uint32_t)_ssrc, (uint32_t)random(), fec_payload_type);
+        }
     }
-    return _session;
 }
 
-- (void) onVideoData:(NSArray*) data time:(double) pts
+- (void) onVideoFrame:(RTPFrame*) frame
 {
+    NSArray* catchup;
     @synchronized(self)
     {
-        if (_state != Playing)
+        if ((_state != Playing) || (_vodSource != nil) || _bMulticast)
+        {
+            return;
+        }
+        // our shard may still have frames queued from before PLAY that
+        // are also in the snapshot we replay
+        if (frame.pts <= _catchupLast)
         {
             return;
         }
+        catchup = _catchup;
+        _catchup = nil;
     }
     
-    const int rtp_header_size = 12;
-    const int max_single_packet = max_packet_size - rtp_header_size;
-    const int max_fragment_packet = max_single_packet - 2;
-    unsigned char packet[max_packet_size];
+    // no point replaying the old GOP if a new one starts now
+    if ((catchup != nil) && (frame.frameClass != FrameIDR))
+    {
+        [self sendCatchup:catchup];
+    }
     
-    int nNALUs = (int)[data count];
-    for (int i = 0; i < nNALUs; i++)
+    // the whole frame should be on the wire before the next one is due,
+    // and after anything still going out from the catch-up burst
+    double pts = frame.pts;
+    double interval = max_pacing_delay;
+    double catchupEnd;
+    @synchronized(self)
+    {
+        if ((_lastPts >= 0) && (pts > _lastPts))
+        {
+            interval = MIN(pts - _lastPts, max_pacing_delay);
+        }
+        _lastPts = pts;
+        catchupEnd = _catchupEnd;
+    }
+    [self setPacingRate:_server.bitrate burst:pacing_burst_factor];
+    if (![self admitFrame:frame])
     {
-        NSData* nalu = [data objectAtIndex:i];
-        int cBytes = (int)[nalu length];
-        BOOL bLast = (i == nNALUs-1);
+        return;
+    }
+    [self sendFrame:frame deadline:MAX(PacerNow(), catchupEnd) + interval];
+}
+
+- (void) setPacingRate:(int) bitrate burst:(double) burst
+{
+    // tearDown removes the flow under our lock, on another thread
+    @synchronized(self)
+    {
+        if (_flow == NULL)
+        {
+            return;
+        }
+        _pacer->SetRate(_flow, bitrate, burst);
+        _fec->Configure(_server.fecColumns, _server.fecRows);
+    }
+}
+
+- (void) onMissedFrames:(int) count reference:(BOOL) bReference
+{
+    @synchronized(self)
+    {
+        if ((_state != Playing) || (_vodSource != nil) || _bMulticast)
+        {
+            return;
+        }
+        _congestion->OnLost(count, bReference);
+    }
+}
+
+- (NSString*) playVOD:(RTSPMessage*) msg
+{
+    // Range: npt=start-[end]. We play to the end of the file, and
+    // "now" (or no range) is the start, since there is no pause.
+    double npt = 0;
+    NSString* range = [msg valueForOption:@"range"];
+    if ([range hasPrefix:@"npt="])
+    {
+        npt = MAX([[[[range substringFromIndex:4] componentsSeparatedByString:@"-"] objectAtIndex:0] doubleValue], 0.0);
+    }
+    
+    // a seek replaces the player. It must be stopped without our lock
+    // held, as its last delivery may be waiting for it.
+    VODPlayer* old;
+    @synchronized(self)
+    {
+        if ((_state != Setup) && (_state != Playing))
+        {
+            return [msg createResponse:451 text:@"Wrong state"];
+        }
+        old = _player;
+        _player = nil;
+    }
+    [old stop];
+    
+    VODSource* source = _vodSource;
+    VODPlayer* player = [VODPlayer playerWithSource:source start:npt];
+    unsigned short seq;
+    uint32_t rtptime;
+    @synchronized(self)
+    {
+        _state = Playing;
+        _catchup = nil;
+        _catchupEnd = 0;
+        _catchupLast = -1;
+        _lastPts = -1;
         
-        const unsigned char* pSource = (unsigned char*)[nalu bytes];
- 
+        // the player starts at a sync sample, so there is no IDR to wait
+        // for. RTP time restarts at the seek point, as RTP-Info says.
+        _bFirst = NO;
+        _rtpBase = (uint32_t)random() | 1;
+        _ptsBase = player.start;
+        seq = _packets & 0xffff;
+        rtptime = (uint32_t)_rtpBase;
+        _player = player;
+    }
+    
+    __weak RTSPClientConnection* weakSelf = self;
+    __weak VODPlayer* weakPlayer = player;
+    [player play:^(RTPFrame* frame, double deadline) {
+        [weakSelf onVODFrame:frame player:weakPlayer deadline:deadline];
+    }];
+    NSLog(@"VOD %@ playing from %.3f", [source.path lastPathComponent], player.start);
+    
+    NSString* response = [msg createResponse:200 text:@"OK"];
+    response = [response stringByAppendingFormat:@"Session: %@\r\nRange: npt=%.3f-%.3f\r\nRTP-Info: url=%@;seq=%d;rtptime=%u\r\n\r\n",
+                _session, player.start, source.duration, _vodURL, seq, rtptime];
+    return response;
+}
+
+- (NSString*) playMulticast:(RTSPMessage*) msg
+{
+    @synchronized(self)
+    {
+        if ((_state != Setup) && (_state != Playing))
+        {
+            return [msg createResponse:451 text:@"Wrong state"];
+        }
+    }
+    
+    // the server's lock is taken to join, and must not be taken inside ours
+    if (!_bJoined)
+    {
+        if (![_server joinMulticast])
+        {
+            return [msg createResponse:503 text:@"Service Unavailable"];
+        }
+        _bJoined = YES;
+    }
+    @synchronized(self)
+    {
+        _state = Playing;
+    }
+    NSString* response = [msg createResponse:200 text:@"OK"];
+    response = [response stringByAppendingFormat:@"Session: %@\r\n\r\n", _session];
+    return response;
+}
+
+- (void) leaveMulticast
+{
+    // run loop thread, like every other change to _bJoined
+    if (_bJoined)
+    {
+        _bJoined = NO;
+        [_server leaveMulticast];
+    }
+    @synchronized(self)
+    {
+        _bMulticast = NO;
+    }
+}
+
+- (void) onVODFrame:(RTPFrame*) frame player:(VODPlayer*) player deadline:(double) deadline
+{
+    // player queue
+    @synchronized(self)
+    {
+        if ((_state != Playing) || (_player != player))
+        {
+            return;
+        }
+    }
+    [self setPacingRate:[self streamBitrate] burst:pacing_burst_factor];
+    if (![self admitFrame:frame])
+    {
+        return;
+    }
+    [self sendFrame:frame deadline:deadline];
+}
+
+- (int) streamBitrate
+{
+    VODSource* source = _vodSource;
+    return (source != nil) ? source.bitrate : _server.bitrate;
+}
+
+- (BOOL) admitFrame:(RTPFrame*) frame
+{
+    // queue depth in seconds of stream, and the client's loss if it
+    // has reported recently enough for it to mean anything
+    static MetricHistogram* queueTCP = Metrics::Histogram("rtp_queue_bytes", "Bytes queued for a session as each frame arrives", "transport=\"tcp\"", 1, 1 << 10, 1 << 24);
+    static MetricHistogram* queueUDP = Metrics::Histogram("rtp_queue_bytes", "Bytes queued for a session as each frame arrives", "transport=\"udp\"", 1, 1 << 10, 1 << 24);
+    static MetricCounter* dropped = Metrics::Counter("rtp_frames_dropped_total", "Frames not sent to a session", "reason=\"congestion\"");
+    int bitrate = MAX([self streamBitrate], 1);
+    int cQueued;
+    @synchronized(self)
+    {
+        cQueued = _bInterleaved ? _output->QueuedBytes() : (_flow ? _pacer->QueuedBytes(_flow) : 0);
+    }
+    (_bInterleaved ? queueTCP : queueUDP)->Record(cQueued);
+    double queueSeconds = (cQueued * 8.0) / bitrate;
+    RTCPStatistics stats = _rtcp->Statistics();
+    double loss = ((stats.lastReport >= 0) && (stats.lastReport < 3)) ? stats.fractionLost : -1;
+    
+    @synchronized(self)
+    {
+        CongestionPolicy::Level before = _congestion->CurrentLevel();
+        BOOL bSend = _congestion->ShouldSend(frame.frameClass == FrameIDR,
+                                             frame.frameClass == FrameReference,
+                                             queueSeconds, loss);
+        if (_congestion->CurrentLevel() != before)
+        {
+            NSLog(@"Session %@ congestion level %d (queue %.2fs, loss %.2f)", _session, (int)_congestion->CurrentLevel(), queueSeconds, loss);
+        }
+        if (!bSend)
+        {
+            dropped->Add();
+        }
+        return bSend;
+    }
+}
+
+- (void) sendCatchup:(NSArray*) frames
+{
+    // the GOP goes out with its original timestamps, so the session's
+    // RTP timeline is based at the cached IDR and runs on into the live
+    // frames. It is spread over its duration divided by catchup_speed.
+    [self setPacingRate:_server.bitrate burst:pacing_burst_factor * catchup_speed];
+    double now = PacerNow();
+    double first = ((RTPFrame*)frames[0]).pts;
+    double deadline = now;
+    for (RTPFrame* f in frames)
+    {
+        deadline = MAX(deadline, now + ((f.pts - first) / catchup_speed));
+        [self sendFrame:f deadline:deadline + (max_pacing_delay / catchup_speed)];
+    }
+    @synchronized(self)
+    {
+        _catchupEnd = deadline;
+    }
+    NSLog(@"Playback starting with %d cached frames", (int)[frames count]);
+}
+
+- (void) sendFrame:(RTPFrame*) frame deadline:(double) deadline
+{
+    // sendPacket: and retransmit: read these under the lock
+    @synchronized(self)
+    {
+        _deadline = deadline;
+        _origin = frame.captureTime;
+    }
+    
+    // the payloads are shared with every other session: we only add our header
+    const int rtp_header_size = 12;
+    uint8_t packet[max_rtp_packet_size];
+    const RTPPayload* payloads = [frame payloads];
+    const uint8_t* pData = [frame payloadBytes];
+    int count = frame.payloadCount;
+    for (int i = 0; i < count; i++)
+    {
+        const RTPPayload& payload = payloads[i];
         if (_bFirst)
         {
-            if ((pSource[0] & 0x1f) != 5)
+            if (payload.naluType != NALUnit::NAL_IDR_Slice)
             {
                 continue;
             }
             _bFirst = NO;
             NSLog(@"Playback starting at first IDR");
         }
-        
-        if (cBytes < max_single_packet)
-        {
-            [self writeHeader:packet marker:bLast time:pts];
-            memcpy(packet + rtp_header_size, [nalu bytes], cBytes);
-            [self sendPacket:packet length:(cBytes + rtp_header_size)];
-        }
-        else
+        [self writeHeader:packet marker:payload.bMarker time:frame.pts];
+        memcpy(packet + rtp_header_size, pData + payload.offset, payload.length);
+        [self sendPacket:packet length:(payload.length + rtp_header_size) sync:payload.bSync];
+    }
+    
+    // one vectored write for the whole access unit. Its age is taken
+    // here, as it is handed to the socket: anything still queued behind
+    // a slow client is not counted.
+    if (_bInterleaved)
+    {
+        static MetricHistogram* age = frameAgeMetric("tcp");
+        [self flushOutput];
+        if (frame.captureTime > 0)
         {
-            unsigned char NALU_Header = pSource[0];
-            pSource += 1;
-            cBytes -= 1;
-            BOOL bStart = YES;
-            
-            while (cBytes)
-            {
-                int cThis = (cBytes < max_fragment_packet)? cBytes : max_fragment_packet;
-                BOOL bEnd = (cThis == cBytes);
-                [self writeHeader:packet marker:(bLast && bEnd) time:pts];
-                unsigned char* pDest = packet + rtp_header_size;
-                
-                pDest[0] = (NALU_Header & 0xe0) + 28;   // FU_A type
-                unsigned char fu_header = (NALU_Header & 0x1f);
-                if (bStart)
-                {
-                    fu_header |= 0x80;
-                    bStart = false;
-                }
-                else if (bEnd)
-                {
-                    fu_header |= 0x40;
-                }
-                pDest[1] = fu_header;
-                pDest += 2;
-                memcpy(pDest, pSource, cThis);
-                pDest += cThis;
-                [self sendPacket:packet length:(int)(pDest - packet)];
-                
-                pSource += cThis;
-                cBytes -= cThis;
-            }
+            age->Record((int64_t)((PacerNow() - frame.captureTime) * 1e9));
         }
     }
 }
@@ -485,48 +1060,65 @@ static void onRTCP(CFSocketRef s,
     {
         _rtpBase = random();
         _ptsBase = pts;
-        NSDate* now = [NSDate date];
-        // ntp is based on 1900. There's a known fixed offset from 1900 to 1970.
-        NSDate* ref = [NSDate dateWithTimeIntervalSince1970:-2208988800L];
-        double interval = [now timeIntervalSinceDate:ref];
-        _ntpBase = (uint64_t)(interval * (1LL << 32));
     }
     pts -= _ptsBase;
-    uint64_t rtp = (uint64_t)(pts * 90000);
+    // a recorded file's B-frames can be presented before the frame we started at
+    uint64_t rtp = (uint64_t)(int64_t)(pts * 90000);
     rtp += _rtpBase;
     tonet_long(packet + 4, rtp);
     tonet_long(packet + 8, _ssrc);
+    
+    _rtpLast = (uint32_t) rtp;
+    _ntpLast = NTPNow();
 }
 
-- (void) sendPacket:(uint8_t*) packet length:(int) cBytes
+- (void) sendPacket:(uint8_t*) packet length:(int) cBytes sync:(BOOL) bSync
 {
     @synchronized(self)
     {
-        if (_sRTP)
+        if (_bInterleaved)
         {
-            CFDataRef data = CFDataCreate(nil, packet, cBytes);
-            CFSocketSendData(_sRTP, _addrRTP, data, 0);
-            CFRelease(data);
+            _output->SendPacket(_channelRTP, packet, cBytes, bSync);
+        }
+        else if (_flow)
+        {
+            // the frame's age is taken when its marked last packet goes
+            _pacer->Enqueue(_flow, packet, cBytes, _deadline, (packet[1] & 0x80) ? _origin : 0);
+            _history->Store(packet, cBytes);
+            if (_fec->Enabled())
+            {
+                // parity goes out with the frame it protects
+                std::vector<std::vector<BYTE> > repair;
+                _fec->Add(packet, cBytes, &repair);
+                for (size_t i = 0; i < repair.size(); i++)
+                {
+                    _pacer->Enqueue(_flow, &repair[i][0], (int)repair[i].size(), _deadline);
+                    _bytesSent += repair[i].size();
+                }
+            }
         }
         _packets++;
         _bytesSent += cBytes;
+        _payloadSent += cBytes - 12;
         
         // RTCP packets
         NSDate* now = [NSDate date];
         if ((_sentRTCP == nil) || ([now timeIntervalSinceDate:_sentRTCP] >= 1))
         {
-            uint8_t buf[7 * sizeof(uint32_t)];
-            buf[0] = 0x80;
-            buf[1] = 200;   // type == SR
-            tonet_short(buf+2, 6);  // length (count of uint32_t minus 1)
-            tonet_long(buf+4, _ssrc);
-            tonet_long(buf+8, (_ntpBase >> 32));
-            tonet_long(buf+12, _ntpBase);
-            tonet_long(buf+16, _rtpBase);
-            tonet_long(buf+20, (_packets - _packetsReported));
-            tonet_long(buf+24, (_bytesSent - _bytesReported));
-            int lenRTCP = 28;
-            if (_sRTCP)
+            // project the last RTP timestamp forward to now, so the
+            // receiver can map our timestamps onto wall-clock time
+            uint64_t ntp = NTPNow();
+            uint32_t rtp = _rtpLast + (uint32_t)(((ntp - _ntpLast) * 90000) >> 32);
+            
+            uint8_t buf[128];
+            int lenRTCP = _rtcp->BuildSenderReport(buf, sizeof(buf), ntp, rtp,
+                                                   (uint32_t)_packets, (uint32_t)_payloadSent,
+                                                   [rtcp_cname UTF8String]);
+            if (_bInterleaved)
+            {
+                _output->SendReport(_channelRTCP, buf, lenRTCP);
+            }
+            else if (_sRTCP)
             {
                 CFDataRef dataRTCP = CFDataCreate(nil, buf, lenRTCP);
                 CFSocketSendData(_sRTCP, _addrRTCP, dataRTCP, lenRTCP);
@@ -534,21 +1126,174 @@ static void onRTCP(CFSocketRef s,
             }
             
             _sentRTCP = now;
-            _packetsReported = _packets;
-            _bytesReported = _bytesSent;
         }
     }
 }
 
+- (void) setShard:(int) shard
+{
+    _shard = shard;
+}
+
+- (void) sendPacedPacket:(const uint8_t*) packet length:(int) cBytes
+{
+    static MetricHistogram* latency = Metrics::Histogram("rtp_send_seconds", "Time spent in one send call", "transport=\"udp\"", 1e-9, 1 << 8, 1LL << 26);
+    static MetricCounter* errors = Metrics::Counter("rtp_send_errors_total", "Send calls that failed", "transport=\"udp\"");
+    
+    // pacer thread. tearDown removes the flow before closing the
+    // socket, so _sRTP is valid for as long as we can be called.
+    int64_t start = MetricsNow();
+    ssize_t cSent = sendto(CFSocketGetNative(_sRTP), packet, cBytes, 0,
+                           (const struct sockaddr*)CFDataGetBytePtr(_addrRTP), (socklen_t)CFDataGetLength(_addrRTP));
+    latency->Record(MetricsNow() - start);
+    if (cSent < 0)
+    {
+        errors->Add();
+    }
+    
+    // retransmission intervals run from here, when a packet is on the
+    // wire, rather than from when it was queued behind the pacer
+    int payloadType = packet[1] & 0x7f;
+    if (payloadType == rtx_payload_type)
+    {
+        _history->Sent((packet[12] << 8) | packet[13], PacerNow());
+    }
+    else if (payloadType == 96)
+    {
+        _history->Sent((packet[2] << 8) | packet[3], PacerNow());
+    }
+}
+
+- (BOOL) ownsRTCP:(CFDataRef) data
+{
+    return _rtcp->IsForSession(CFDataGetBytePtr(data), (int)CFDataGetLength(data));
+}
+
 - (void) onRTCP:(CFDataRef) data
 {
-    // NSLog(@"RTCP recv");
+    // reports about another session's SSRC, and BYE or CNAME from
+    // another client, are ignored here as well as by the server's routing
+    std::vector<uint16_t> nacks;
+    _rtcp->Parse(CFDataGetBytePtr(data), (int)CFDataGetLength(data), &nacks);
+    if (nacks.empty())
+    {
+        return;
+    }
+    
+    // a receiver will NACK a loss again if the retransmission has not
+    // arrived within about one RTT, so don't resend more often than that
+    double rtt = _rtcp->Statistics().rtt;
+    double minInterval = (rtt > 0) ? rtt : 0.02;
+    @synchronized(self)
+    {
+        for (size_t i = 0; i < nacks.size(); i++)
+        {
+            [self retransmit:nacks[i] minInterval:minInterval];
+        }
+    }
+}
+
+- (void) retransmit:(uint16_t) seq minInterval:(double) minInterval
+{
+    if ((_state != Playing) || (_flow == NULL) || (_history == NULL))
+    {
+        return;
+    }
+    uint8_t original[max_rtp_packet_size];
+    double now = PacerNow();
+    int cBytes = _history->Fetch(seq, original, now, minInterval);
+    if (cBytes == 0)
+    {
+        return;
+    }
+    
+    // RFC 4588: same timestamp and marker, our RTX ssrc and sequence,
+    // and the original sequence number in front of the original payload
+    uint8_t packet[max_rtp_packet_size + 2];
+    packet[0] = 0x80;
+    packet[1] = (original[1] & 0x80) | rtx_payload_type;
+    tonet_short(packet + 2, _packetsRTX & 0xffff);
+    memcpy(packet + 4, original + 4, 4);
+    tonet_long(packet + 8, _ssrcRTX);
+    memcpy(packet + 12, original + 2, 2);
+    memcpy(packet + 14, original + 12, cBytes - 12);
+    _packetsRTX++;
+    _retransmitted++;
+    
+    // through the pacer with the frame currently going out, so that
+    // repairs cannot burst past the session's rate
+    _pacer->Enqueue(_flow, packet, cBytes + 2, MAX(now, _deadline));
+}
+
+- (NSDictionary*) statistics
+{
+    NSString* session;
+    long packets;
+    long bytes;
+    long retransmitted;
+    long fec;
+    long dropped;
+    long lost;
+    int level;
+    @synchronized(self)
+    {
+        session = _session;
+        packets = _packets;
+        bytes = _bytesSent;
+        retransmitted = _retransmitted;
+        fec = _fec ? _fec->RepairPackets() : 0;
+        dropped = _congestion->Dropped();
+        lost = _congestion->Lost();
+        level = (int)_congestion->CurrentLevel();
+    }
+    if (session == nil)
+    {
+        return nil;
+    }
+    RTCPStatistics stats = _rtcp->Statistics();
+    return @{
+             @"session": session,
+             @"transport": _bInterleaved ? @"tcp" : @"udp",
+             @"packetsSent": @(packets),
+             @"bytesSent": @(bytes),
+             @"reports": @(stats.reports),
+             @"fractionLost": @(stats.fractionLost),
+             @"cumulativeLost": @(stats.cumulativeLost),
+             @"highestSequence": @(stats.highestSeq),
+             @"jitter": @(stats.jitter),
+             @"rtt": @(stats.rtt),
+             @"lastReport": @(stats.lastReport),
+             @"bye": @(stats.bye),
+             @"nacks": @(stats.nacks),
+             @"retransmitted": @(retransmitted),
+             @"fecPackets": @(fec),
+             @"framesDropped": @(dropped),
+             @"framesLost": @(lost),
+             @"congestionLevel": @(level),
+             @"cname": [NSString stringWithUTF8String:stats.cname.c_str()],
+             };
 }
 
 - (void) tearDown
 {
+    [self leaveMulticast];
+    
+    VODPlayer* player;
+    @synchronized(self)
+    {
+        player = _player;
+        _player = nil;
+        _vodSource = nil;
+    }
+    [player stop];
+    
     @synchronized(self)
     {
+        if (_flow)
+        {
+            _pacer->RemoveFlow(_flow);
+            _flow = NULL;
+        }
         if (_sRTP)
         {
             CFSocketInvalidate(_sRTP);
@@ -559,11 +1304,8 @@ static void onRTCP(CFSocketRef s,
             CFSocketInvalidate(_sRTCP);
             _sRTCP = nil;
         }
-        if (_recvRTCP)
-        {
-            CFSocketInvalidate(_recvRTCP);
-            _recvRTCP = nil;
-        }
+        _bInterleaved = NO;
+        _state = ServerIdle;
         _session = nil;
     }
 }
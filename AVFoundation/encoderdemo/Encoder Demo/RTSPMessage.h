@@ -18,5 +18,6 @@
 
 @property NSString* command;
 @property int sequence;
+@property NSString* url;
 
 @end
@@ -13,6 +13,7 @@
 {
     NSArray* _lines;
     NSString* _request;
+    NSString* _url;
     int _cseq;
 }
 
@@ -24,6 +25,7 @@
 
 @synthesize command = _request;
 @synthesize sequence = _cseq;
+@synthesize url = _url;
 
 + (RTSPMessage*) createWithData:(CFDataRef) data
 {
@@ -43,6 +45,10 @@
     }
     NSArray* lineone = [[_lines objectAtIndex:0] componentsSeparatedByString:@" "];
     _request = [lineone objectAtIndex:0];
+    if ([lineone count] > 1)
+    {
+        _url = [lineone objectAtIndex:1];
+    }
     NSString* strSeq = [self valueForOption:@"CSeq"];
     if (strSeq == nil)
     {
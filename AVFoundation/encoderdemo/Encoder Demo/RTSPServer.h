@@ -11,6 +11,8 @@
 #include <sys/socket.h> 
 #include <netinet/in.h>
 
+@class VODSource;
+
 @interface RTSPServer : NSObject
 
 
@@ -18,10 +20,43 @@
 + (RTSPServer*) setupListener:(NSData*) configData;
 
 - (NSData*) getConfigData;
+
+// cached SDP text for DESCRIBE (see SessionDescription)
+- (NSData*) sdpForAddress:(NSString*) address packetSize:(int) cMaxPacket;
+
+// recorded file for an rtsp://host/vod/<name> url, or nil if the url
+// is for the live stream (or names no playable file)
+- (VODSource*) vodSourceForURL:(NSString*) url;
 - (void) onVideoData:(NSArray*) data time:(double) pts;
+
+// a session that SETUP with multicast joins when it plays and leaves at
+// teardown. The stream is sent to the group while any session is joined.
+- (BOOL) joinMulticast;
+- (void) leaveMulticast;
 - (void) shutdownConnection:(id) conn;
+
+// most recent GOP as RTPFrame objects, or nil (see GOPCache)
+- (NSArray*) cachedGOP;
+
+// one statistics dictionary (see RTSPClientConnection) per active session
+- (NSArray*) sessionStatistics;
 - (void) shutdownServer;
 
 @property (readwrite, atomic) int bitrate;
 
+// FEC block for UDP sessions: a parity packet per row of fecColumns
+// packets, and per column if fecRows > 0. fecColumns == 0 (the
+// default) sends no FEC.
+@property (readwrite, atomic) int fecColumns;
+@property (readwrite, atomic) int fecRows;
+
+// where vod urls are looked up; the app's Documents folder by default
+@property (readwrite, atomic) NSString* vodDirectory;
+
+// multicast group and RTP port (RTCP is the next port) for sessions
+// that ask for multicast. Changes apply when the group next starts.
+@property (readwrite, atomic) NSString* multicastGroup;
+@property (readwrite, atomic) int multicastPort;
+@property (readwrite, atomic) int multicastTTL;
+
 @end
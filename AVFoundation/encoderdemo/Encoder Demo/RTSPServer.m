@@ -8,6 +8,13 @@
 
 #import "RTSPServer.h"
 #import "RTSPClientConnection.h"
+#import "GOPCache.h"
+#import "SessionDescription.h"
+#import "StreamEngine.h"
+#import "VODSource.h"
+#import "HLSSegmenter.h"
+#import "HTTPServer.h"
+#import "MulticastStream.h"
 #import "ifaddrs.h"
 #import "arpa/inet.h"
 
@@ -15,13 +22,41 @@
 
 {
     CFSocketRef _listener;
+    CFSocketRef _rtcpListener;
     NSMutableArray* _connections;
     NSData* _configData;
     int _bitrate;
+    int _fecColumns;
+    int _fecRows;
+    
+    // shared by all sessions for instant start
+    GOPCache* _gop;
+    
+    // rendered once per config, not once per DESCRIBE
+    SessionDescription* _sdp;
+    
+    // sending is done on its worker threads, not the encoder's
+    StreamEngine* _engine;
+    
+    // indexed once per file, and shared by all of its viewers
+    NSString* _vodDirectory;
+    NSMutableDictionary* _vodSources;
+    
+    // muxed once for every HLS viewer
+    HLSSegmenter* _hls;
+    HTTPServer* _http;
+    
+    // one sender for every multicast session, while any are joined
+    MulticastStream* _multicast;
+    NSString* _multicastGroup;
+    int _multicastPort;
+    int _multicastTTL;
 }
 
 - (RTSPServer*) init:(NSData*) configData;
 - (void) onAccept:(CFSocketNativeHandle) childHandle;
+- (void) onRTCP:(CFDataRef) data;
+- (NSString*) metricsText;
 
 @end
 
@@ -49,9 +84,35 @@ static void onSocket (
     
 }
 
+static void onRTCP(CFSocketRef s,
+                   CFSocketCallBackType callbackType,
+                   CFDataRef address,
+                   const void *data,
+                   void *info
+                   )
+{
+    RTSPServer* server = (__bridge RTSPServer*)info;
+    switch (callbackType)
+    {
+        case kCFSocketDataCallBack:
+            [server onRTCP:(CFDataRef) data];
+            break;
+            
+        default:
+            NSLog(@"unexpected socket event");
+            break;
+    }
+}
+
 @implementation RTSPServer
 
 @synthesize bitrate = _bitrate;
+@synthesize fecColumns = _fecColumns;
+@synthesize fecRows = _fecRows;
+@synthesize vodDirectory = _vodDirectory;
+@synthesize multicastGroup = _multicastGroup;
+@synthesize multicastPort = _multicastPort;
+@synthesize multicastTTL = _multicastTTL;
 
 + (RTSPServer*) setupListener:(NSData*) configData
 {
@@ -67,6 +128,20 @@ static void onSocket (
 {
     _configData = configData;
     _connections = [NSMutableArray arrayWithCapacity:10];
+    _gop = [GOPCache cacheWithConfig:configData maxBytes:(4 * 1024 * 1024) maxFrames:300];
+    _sdp = [SessionDescription descriptionWithConfig:configData];
+    _engine = [StreamEngine engineWithShards:0];
+    _vodDirectory = [NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES) objectAtIndex:0];
+    _vodSources = [NSMutableDictionary dictionaryWithCapacity:4];
+    _multicastGroup = @"239.255.42.42";
+    _multicastPort = 5004;
+    _multicastTTL = 1;
+    _hls = [HLSSegmenter segmenterWithConfig:configData];
+    _http = [HTTPServer serverWithSegmenter:_hls port:8080];
+    RTSPServer* __weak weakSelf = self;
+    _http.metricsHandler = ^{
+        return [weakSelf metricsText];
+    };
     
     CFSocketContext info;
     memset(&info, 0, sizeof(info));
@@ -97,6 +172,21 @@ static void onSocket (
     CFRunLoopAddSource(CFRunLoopGetMain(), rls, kCFRunLoopCommonModes);
     CFRelease(rls);
     
+    // receiver reports from all UDP clients arrive on the one server_port
+    // we advertise, so they are shared out here rather than per connection
+    _rtcpListener = CFSocketCreate(nil, PF_INET, SOCK_DGRAM, IPPROTO_UDP, kCFSocketDataCallBack, onRTCP, &info);
+    addr.sin_port = htons(6971);
+    dataAddr = CFDataCreate(nil, (const uint8_t*)&addr, sizeof(addr));
+    e = CFSocketSetAddress(_rtcpListener, dataAddr);
+    CFRelease(dataAddr);
+    if (e)
+    {
+        NSLog(@"RTCP bind error %d", (int) e);
+    }
+    rls = CFSocketCreateRunLoopSource(nil, _rtcpListener, 0);
+    CFRunLoopAddSource(CFRunLoopGetMain(), rls, kCFRunLoopCommonModes);
+    CFRelease(rls);
+    
     return self;
 }
 
@@ -105,6 +195,43 @@ static void onSocket (
     return _configData;
 }
 
+- (NSData*) sdpForAddress:(NSString*) address packetSize:(int) cMaxPacket
+{
+    return [_sdp sdpForAddress:address bitrate:self.bitrate packetSize:cMaxPacket fec:(self.fecColumns > 0)];
+}
+
+- (VODSource*) vodSourceForURL:(NSString*) url
+{
+    NSRange r = [url rangeOfString:@"/vod/"];
+    if (r.location == NSNotFound)
+    {
+        return nil;
+    }
+    // the name ends at any per-track control suffix; only the last
+    // component is used, so a url cannot reach outside the directory
+    NSString* name = [url substringFromIndex:(r.location + r.length)];
+    name = [[name componentsSeparatedByString:@"/"] objectAtIndex:0];
+    name = [[name stringByRemovingPercentEncoding] lastPathComponent];
+    if (([name length] == 0) || [name hasPrefix:@"."])
+    {
+        return nil;
+    }
+    
+    @synchronized(_vodSources)
+    {
+        VODSource* source = [_vodSources objectForKey:name];
+        if (source == nil)
+        {
+            source = [VODSource sourceWithFile:[self.vodDirectory stringByAppendingPathComponent:name]];
+            if (source != nil)
+            {
+                [_vodSources setObject:source forKey:name];
+            }
+        }
+        return source;
+    }
+}
+
 - (void) onAccept:(CFSocketNativeHandle) childHandle
 {
     RTSPClientConnection* conn = [RTSPClientConnection createWithSocket:childHandle server:self];
@@ -114,28 +241,154 @@ static void onSocket (
         {
             NSLog(@"Client connected");
             [_connections addObject:conn];
+            [_engine addConnection:conn];
         }
     }
     
 }
 
 - (void) onVideoData:(NSArray*) data time:(double) pts
+{
+    // packetized once here, for every session and the cache
+    RTPFrame* frame = [RTPFrame liveFrameWithNALUs:data time:pts];
+    MulticastStream* multicast;
+    @synchronized(self)
+    {
+        [_gop addFrame:frame];
+        [_engine deliverFrame:frame];
+        multicast = _multicast;
+    }
+    
+    // sent once, however many sessions are watching it
+    [multicast deliverFrame:frame bitrate:self.bitrate];
+    
+    // muxing is kept out of the lock that RTSP delivery takes; frames
+    // still arrive in order, since there is only the encoder's thread
+    [_hls addFrame:frame];
+}
+
+- (BOOL) joinMulticast
 {
+    @synchronized(self)
+    {
+        if (_multicast == nil)
+        {
+            _multicast = [MulticastStream streamWithGroup:self.multicastGroup port:self.multicastPort ttl:self.multicastTTL];
+        }
+        if ([_multicast join] == 0)
+        {
+            _multicast = nil;
+            return NO;
+        }
+        return YES;
+    }
+}
+
+- (void) leaveMulticast
+{
+    @synchronized(self)
+    {
+        if ([_multicast leave] == 0)
+        {
+            _multicast = nil;
+        }
+    }
+}
+
+- (void) onRTCP:(CFDataRef) data
+{
+    // the RTCP port is shared by every session: each packet goes only to
+    // the one whose stream it reports on, or whose client sent it
     @synchronized(self)
     {
         for (RTSPClientConnection* conn in _connections)
         {
-            [conn onVideoData:data time:pts];
+            if ([conn ownsRTCP:data])
+            {
+                [conn onRTCP:data];
+                break;
+            }
         }
     }
 }
 
+- (NSArray*) cachedGOP
+{
+    // taken under the same lock as delivery, so that a connection that
+    // starts playing under this lock gets every frame exactly once
+    @synchronized(self)
+    {
+        return [_gop frames];
+    }
+}
+
+- (NSArray*) sessionStatistics
+{
+    NSMutableArray* stats = [NSMutableArray arrayWithCapacity:10];
+    @synchronized(self)
+    {
+        for (RTSPClientConnection* conn in _connections)
+        {
+            NSDictionary* s = [conn statistics];
+            if (s != nil)
+            {
+                [stats addObject:s];
+            }
+        }
+    }
+    return stats;
+}
+
+// per-session figures for /metrics, as gauges labelled by session id.
+// These are read from the sessions at scrape time, and go with them.
+- (NSString*) metricsText
+{
+    static NSArray* fields = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        fields = @[
+                   @[@"packetsSent", @"rtsp_session_packets_sent", @"RTP packets sent"],
+                   @[@"bytesSent", @"rtsp_session_bytes_sent", @"RTP bytes sent"],
+                   @[@"fractionLost", @"rtsp_session_fraction_lost", @"Fraction of packets lost (0 to 1) in the last receiver report"],
+                   @[@"cumulativeLost", @"rtsp_session_packets_lost", @"Packets lost, from receiver reports"],
+                   @[@"jitter", @"rtsp_session_jitter_seconds", @"Interarrival jitter from receiver reports"],
+                   @[@"rtt", @"rtsp_session_rtt_seconds", @"Round trip time from receiver reports"],
+                   @[@"nacks", @"rtsp_session_nacks", @"Generic NACKs received"],
+                   @[@"retransmitted", @"rtsp_session_packets_retransmitted", @"Packets sent again after a NACK"],
+                   @[@"fecPackets", @"rtsp_session_fec_packets", @"FEC repair packets sent"],
+                   @[@"framesDropped", @"rtsp_session_frames_dropped", @"Frames dropped by congestion control"],
+                   @[@"framesLost", @"rtsp_session_frames_lost", @"Frames lost to a full shard queue"],
+                   @[@"congestionLevel", @"rtsp_session_congestion_level", @"Current congestion level"],
+                   ];
+    });
+    
+    NSArray* stats = [self sessionStatistics];
+    long connections;
+    @synchronized(self)
+    {
+        connections = [_connections count];
+    }
+    NSMutableString* text = [NSMutableString stringWithCapacity:4096];
+    [text appendFormat:@"# HELP rtsp_connections RTSP control connections open\n# TYPE rtsp_connections gauge\nrtsp_connections %ld\n", connections];
+    [text appendFormat:@"# HELP rtsp_sessions Sessions set up\n# TYPE rtsp_sessions gauge\nrtsp_sessions %ld\n", (long)[stats count]];
+    for (NSArray* field in fields)
+    {
+        [text appendFormat:@"# HELP %@ %@\n# TYPE %@ gauge\n", field[1], field[2], field[1]];
+        for (NSDictionary* s in stats)
+        {
+            [text appendFormat:@"%@{session=\"%@\",transport=\"%@\"} %@\n", field[1], s[@"session"], s[@"transport"], s[field[0]]];
+        }
+    }
+    return text;
+}
+
 - (void) shutdownConnection:(id)conn
 {
     @synchronized(self)
     {
         NSLog(@"Client disconnected");
         [_connections removeObject:conn];
+        [_engine removeConnection:conn];
     }
 }
 
@@ -148,11 +401,19 @@ static void onSocket (
             [conn shutdown];
         }
         _connections = [NSMutableArray arrayWithCapacity:10];
+        [_engine shutdown];
+        [_http shutdown];
+        _http = nil;
         if (_listener != nil)
         {
             CFSocketInvalidate(_listener);
             _listener = nil;
         }
+        if (_rtcpListener != nil)
+        {
+            CFSocketInvalidate(_rtcpListener);
+            _rtcpListener = nil;
+        }
     }
 }
 
@@ -0,0 +1,72 @@
+//
+//  SPSCQueue.h
+//  Encoder Demo
+//
+//  Bounded lock-free queue for exactly one producer thread and one
+//  consumer thread. Push and Pop never block and never allocate: a
+//  full queue is the producer's problem, an empty one the consumer's.
+//
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+template<typename T>
+class SPSCQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    SPSCQueue(size_t capacity)
+    : m_head(0),
+      m_tail(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        m_mask = size - 1;
+        m_items.resize(size);
+    }
+
+    // producer only. Returns false if the queue is full.
+    bool Push(const T& item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if ((tail - m_head.load(std::memory_order_acquire)) > m_mask)
+        {
+            return false;
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only. Returns false if the queue is empty.
+    bool Pop(T& item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Count()
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    // head and tail on separate cache lines, so that the two threads
+    // do not invalidate each other's line on every operation
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) size_t m_mask;
+    std::vector<T> m_items;
+};
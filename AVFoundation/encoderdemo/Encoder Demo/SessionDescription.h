@@ -0,0 +1,32 @@
+//
+//  SessionDescription.h
+//  Encoder Demo
+//
+//  The SDP returned for DESCRIBE. The parameter sets are parsed and
+//  base64-encoded once per avcC config, and the rendered text is kept
+//  for each local address and bitrate it has been asked for, so that
+//  answering a DESCRIBE is a copy rather than a parse-and-encode.
+//
+
+#import <Foundation/Foundation.h>
+
+@interface SessionDescription : NSObject
+
++ (SessionDescription*) descriptionWithConfig:(NSData*) avcC;
+
+// for a recorded file: adds its npt range, so that players can seek
++ (SessionDescription*) descriptionWithConfig:(NSData*) avcC duration:(double) seconds;
+
+// UTF-8 SDP text, ready to send as a message body. bFEC adds the
+// FlexFEC repair payload type.
+- (NSData*) sdpForAddress:(NSString*) address bitrate:(int) bitrate packetSize:(int) cMaxPacket fec:(BOOL) bFEC;
+
+// sdp with one session's source lines added: its media and RTX SSRCs,
+// grouped (RFC 5576 FID) so that a receiver can tie the retransmission
+// stream to the one it repairs. These follow the cached text.
++ (NSData*) sdp:(NSData*) sdp withSSRC:(uint32_t) ssrc rtx:(uint32_t) ssrcRTX cname:(NSString*) cname;
+
+// session version for the o= line: changes whenever the config does
+@property (readonly) unsigned long version;
+
+@end
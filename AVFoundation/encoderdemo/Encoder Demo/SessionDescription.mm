@@ -0,0 +1,136 @@
+//
+//  SessionDescription.mm
+//  Encoder Demo
+//
+
+#import "SessionDescription.h"
+#import "NALUnit.h"
+#import "Base64.h"
+
+// seconds from 1900 to 1970: session versions are NTP-based, as RFC 4566 suggests
+static const unsigned long ntp_unix_offset = 2208988800UL;
+
+static NSString* encodeNALU(NALUnit* nalu)
+{
+    int cChars = Base64EncodedLength(nalu->Length());
+    NSMutableData* data = [NSMutableData dataWithLength:cChars];
+    Base64Encode(nalu->Start(), nalu->Length(), (char*)[data mutableBytes]);
+    return [[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding];
+}
+
+@interface SessionDescription ()
+{
+    unsigned long _version;
+    NSString* _session;
+    NSString* _media;
+    NSMutableDictionary* _rendered;
+}
+
+- (SessionDescription*) initWithConfig:(NSData*) avcC duration:(double) seconds;
+
+@end
+
+@implementation SessionDescription
+
+@synthesize version = _version;
+
++ (SessionDescription*) descriptionWithConfig:(NSData*) avcC
+{
+    return [[SessionDescription alloc] initWithConfig:avcC duration:0];
+}
+
++ (SessionDescription*) descriptionWithConfig:(NSData*) avcC duration:(double) seconds
+{
+    return [[SessionDescription alloc] initWithConfig:avcC duration:seconds];
+}
+
+- (SessionDescription*) initWithConfig:(NSData*) avcC duration:(double) seconds
+{
+    self = [super init];
+    
+    // two configs created within the same second still get distinct versions
+    static unsigned long lastVersion = 0;
+    @synchronized([SessionDescription class])
+    {
+        unsigned long v = (unsigned long)time(NULL) + ntp_unix_offset;
+        lastVersion = (v > lastVersion) ? v : lastVersion + 1;
+        _version = lastVersion;
+    }
+    
+    // a live stream has no range; a file's lets the player seek
+    if (seconds > 0)
+    {
+        _session = [NSString stringWithFormat:@"s=Recorded stream from iOS\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\na=control:*\r\na=range:npt=0-%.3f\r\n", seconds];
+    }
+    else
+    {
+        _session = @"s=Live stream from iOS\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\na=control:*\r\n";
+    }
+    
+    avcCHeader header((const BYTE*)[avcC bytes], (int)[avcC length]);
+    SeqParamSet seqParams;
+    seqParams.Parse(header.sps());
+    int cx = (int)seqParams.EncodedWidth();
+    int cy = (int)seqParams.EncodedHeight();
+    NSString* profile_level_id = [NSString stringWithFormat:@"%02x%02x%02x", seqParams.Profile(), seqParams.Compat(), seqParams.Level()];
+    NSString* sps = encodeNALU(header.sps());
+    NSString* pps = encodeNALU(header.pps());
+    
+    // everything after the bitrate-dependent lines is fixed for this config
+    NSMutableString* media = [NSMutableString stringWithCapacity:256];
+    [media appendFormat:@"a=rtpmap:96 H264/90000\r\na=mimetype:string;\"video/H264\"\r\na=framesize:96 %d-%d\r\na=Width:integer;%d\r\na=Height:integer;%d\r\n", cx, cy, cx, cy];
+    [media appendFormat:@"a=fmtp:96 packetization-mode=1;profile-level-id=%@;sprop-parameter-sets=%@,%@\r\n", profile_level_id, sps, pps];
+    
+    // retransmissions of payload 96 in response to NACK (RFC 4588, ssrc-multiplexed)
+    [media appendString:@"a=rtpmap:97 rtx/90000\r\na=fmtp:97 apt=96\r\na=rtcp-fb:96 nack\r\n"];
+    _media = media;
+    _rendered = [NSMutableDictionary dictionaryWithCapacity:2];
+    return self;
+}
+
+- (NSData*) sdpForAddress:(NSString*) address bitrate:(int) bitrate packetSize:(int) cMaxPacket fec:(BOOL) bFEC
+{
+    NSString* key = [NSString stringWithFormat:@"%@/%d/%d/%d", address, bitrate, cMaxPacket, (int)bFEC];
+    @synchronized(self)
+    {
+        NSData* sdp = [_rendered objectForKey:key];
+        if (sdp != nil)
+        {
+            return sdp;
+        }
+        
+        int packets = (bitrate / (cMaxPacket * 8)) + 1;
+        NSMutableString* s = [NSMutableString stringWithCapacity:512];
+        [s appendFormat:@"v=0\r\no=- %lu %lu IN IP4 %@\r\n%@", _version, _version, address, _session];
+        [s appendFormat:@"m=video 0 RTP/AVP 96 97%@\r\nb=TIAS:%d\r\na=maxprate:%d.0000\r\na=control:streamid=1\r\n", bFEC ? @" 98" : @"", bitrate, packets];
+        [s appendString:_media];
+        if (bFEC)
+        {
+            // repair-window in microseconds: how long a receiver should hold
+            // media for recovery (a block is well under a second)
+            [s appendString:@"a=rtpmap:98 flexfec/90000\r\na=fmtp:98 repair-window=1000000\r\n"];
+        }
+        sdp = [s dataUsingEncoding:NSUTF8StringEncoding];
+        
+        // the bitrate can change during a session, so keep this bounded
+        if ([_rendered count] >= 8)
+        {
+            [_rendered removeAllObjects];
+        }
+        [_rendered setObject:sdp forKey:key];
+        return sdp;
+    }
+}
+
++ (NSData*) sdp:(NSData*) sdp withSSRC:(uint32_t) ssrc rtx:(uint32_t) ssrcRTX cname:(NSString*) cname
+{
+    // the media section is last, so its attributes can simply be appended
+    NSString* sources = [NSString stringWithFormat:@"a=ssrc-group:FID %u %u\r\na=ssrc:%u cname:%@\r\na=ssrc:%u cname:%@\r\n",
+                         ssrc, ssrcRTX, ssrc, cname, ssrcRTX, cname];
+    NSMutableData* session = [NSMutableData dataWithCapacity:([sdp length] + [sources length])];
+    [session appendData:sdp];
+    [session appendData:[sources dataUsingEncoding:NSUTF8StringEncoding]];
+    return session;
+}
+
+@end
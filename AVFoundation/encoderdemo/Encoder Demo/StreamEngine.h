@@ -0,0 +1,36 @@
+//
+//  StreamEngine.h
+//  Encoder Demo
+//
+//  Spreads RTP sending across worker threads, one per core. Each
+//  connection belongs to exactly one shard for its whole life, and
+//  only that shard's thread sends to it. The producer hands each
+//  frame to every shard through a lock-free per-shard queue, so the
+//  encoder thread never waits on a client and shards never wait on
+//  each other.
+//
+
+#import <Foundation/Foundation.h>
+#import "RTPFrame.h"
+
+@class RTSPClientConnection;
+
+@interface StreamEngine : NSObject
+
+// shards == 0 means one per active core
++ (StreamEngine*) engineWithShards:(int) shards;
+
+// these three must not be called concurrently with each other
+// (the server calls them all under its own lock)
+- (void) addConnection:(RTSPClientConnection*) conn;
+- (void) removeConnection:(RTSPClientConnection*) conn;
+- (void) deliverFrame:(RTPFrame*) frame;
+
+- (void) shutdown;
+
+@property (readonly) int shards;
+
+// frames not delivered to a shard because its queue was full
+@property (readonly) long droppedFrames;
+
+@end
@@ -0,0 +1,267 @@
+//
+//  StreamEngine.mm
+//  Encoder Demo
+//
+
+#import "StreamEngine.h"
+#import "RTSPClientConnection.h"
+#import "SPSCQueue.h"
+#import "Metrics.h"
+#import <mach/mach.h>
+#import <mach/thread_policy.h>
+#import <pthread.h>
+#import <thread>
+
+// frames waiting for a shard: a shard this far behind is dropping anyway
+static const int shard_queue_frames = 64;
+
+enum ShardItemType
+{
+    ShardFrame,
+    ShardAdd,
+    ShardRemove,
+    ShardExit,
+};
+
+struct ShardItem
+{
+    ShardItemType type;
+    void* obj;      // retained across the queue with CFBridgingRetain
+
+    // frames lost to a full queue just before this one, and whether
+    // any was an IDR or reference frame
+    int cMissed;
+    bool bMissedReference;
+};
+
+struct Shard
+{
+    Shard()
+    : queue(shard_queue_frames),
+      cConnections(0),
+      cMissed(0),
+      bMissedReference(false)
+    {
+    }
+
+    SPSCQueue<ShardItem> queue;
+    dispatch_semaphore_t wake;
+    std::thread thread;
+
+    // producer side only
+    int cConnections;
+    int cMissed;
+    bool bMissedReference;
+};
+
+static void pinToCore(int core)
+{
+    // an affinity tag is only a hint (and iOS ignores it), but shards with
+    // different tags are kept on different cores where the kernel can
+    thread_affinity_policy_data_t policy = { core + 1 };
+    thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                      (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+}
+
+static void runShard(Shard* shard, int index)
+{
+    pinToCore(index);
+    pthread_setname_np([[NSString stringWithFormat:@"RTP shard %d", index] UTF8String]);
+    
+    // only this thread ever touches this list
+    NSMutableArray* connections = [NSMutableArray arrayWithCapacity:16];
+    for (;;)
+    {
+        @autoreleasepool
+        {
+            ShardItem item;
+            while (shard->queue.Pop(item))
+            {
+                switch (item.type)
+                {
+                    case ShardFrame:
+                    {
+                        RTPFrame* frame = (RTPFrame*)CFBridgingRelease(item.obj);
+                        for (RTSPClientConnection* conn in connections)
+                        {
+                            if (item.cMissed > 0)
+                            {
+                                [conn onMissedFrames:item.cMissed reference:item.bMissedReference];
+                            }
+                            [conn onVideoFrame:frame];
+                        }
+                        break;
+                    }
+                        
+                    case ShardAdd:
+                        [connections addObject:(RTSPClientConnection*)CFBridgingRelease(item.obj)];
+                        break;
+                        
+                    case ShardRemove:
+                        [connections removeObjectIdenticalTo:(RTSPClientConnection*)CFBridgingRelease(item.obj)];
+                        break;
+                        
+                    case ShardExit:
+                        return;
+                }
+            }
+        }
+        dispatch_semaphore_wait(shard->wake, DISPATCH_TIME_FOREVER);
+    }
+}
+
+@interface StreamEngine ()
+{
+    std::vector<Shard*> _shardList;
+    NSMutableDictionary* _assignment;
+    long _dropped;
+}
+
+- (StreamEngine*) initWithShards:(int) shards;
+- (void) push:(ShardItem) item to:(Shard*) shard;
+
+@end
+
+@implementation StreamEngine
+
+@synthesize droppedFrames = _dropped;
+
++ (StreamEngine*) engineWithShards:(int) shards
+{
+    return [[StreamEngine alloc] initWithShards:shards];
+}
+
+- (StreamEngine*) initWithShards:(int) shards
+{
+    self = [super init];
+    if (shards <= 0)
+    {
+        shards = (int)[[NSProcessInfo processInfo] activeProcessorCount];
+    }
+    _assignment = [NSMutableDictionary dictionaryWithCapacity:16];
+    _dropped = 0;
+    for (int i = 0; i < shards; i++)
+    {
+        Shard* shard = new Shard();
+        shard->wake = dispatch_semaphore_create(0);
+        shard->thread = std::thread(runShard, shard, i);
+        _shardList.push_back(shard);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    [self shutdown];
+}
+
+- (int) shards
+{
+    return (int)_shardList.size();
+}
+
+- (void) push:(ShardItem) item to:(Shard*) shard
+{
+    // membership changes must not be lost: wait for the shard to make room
+    while (!shard->queue.Push(item))
+    {
+        dispatch_semaphore_signal(shard->wake);
+        std::this_thread::yield();
+    }
+    dispatch_semaphore_signal(shard->wake);
+}
+
+- (void) addConnection:(RTSPClientConnection*) conn
+{
+    if (_shardList.empty())
+    {
+        return;
+    }
+    // the least loaded shard, for the life of the connection
+    int best = 0;
+    for (int i = 1; i < (int)_shardList.size(); i++)
+    {
+        if (_shardList[i]->cConnections < _shardList[best]->cConnections)
+        {
+            best = i;
+        }
+    }
+    Shard* shard = _shardList[best];
+    shard->cConnections++;
+    [_assignment setObject:@(best) forKey:[NSValue valueWithNonretainedObject:conn]];
+    [conn setShard:best];
+    
+    ShardItem item = { ShardAdd, (void*)CFBridgingRetain(conn), 0, false };
+    [self push:item to:shard];
+}
+
+- (void) removeConnection:(RTSPClientConnection*) conn
+{
+    NSValue* key = [NSValue valueWithNonretainedObject:conn];
+    NSNumber* index = [_assignment objectForKey:key];
+    if (index == nil)
+    {
+        return;
+    }
+    [_assignment removeObjectForKey:key];
+    Shard* shard = _shardList[[index intValue]];
+    shard->cConnections--;
+    
+    ShardItem item = { ShardRemove, (void*)CFBridgingRetain(conn), 0, false };
+    [self push:item to:shard];
+}
+
+- (void) deliverFrame:(RTPFrame*) frame
+{
+    static MetricCounter* droppedMetric = Metrics::Counter("rtp_frames_dropped_total", "Frames not sent to a session", "reason=\"shard_queue\"");
+    for (size_t i = 0; i < _shardList.size(); i++)
+    {
+        Shard* shard = _shardList[i];
+        if (shard->cConnections == 0)
+        {
+            continue;
+        }
+        ShardItem item = { ShardFrame, (void*)CFBridgingRetain(frame), shard->cMissed, shard->bMissedReference };
+        if (!shard->queue.Push(item))
+        {
+            // this shard's sessions lose a frame; nobody else waits for it.
+            // They are told with the next frame that gets through, so that
+            // a lost reference frame makes them shed to the next IDR
+            // rather than send frames that cannot be decoded.
+            CFBridgingRelease(item.obj);
+            shard->cMissed++;
+            shard->bMissedReference = shard->bMissedReference || (frame.frameClass != FrameNonReference);
+            _dropped++;
+            droppedMetric->Add();
+            continue;
+        }
+        shard->cMissed = 0;
+        shard->bMissedReference = false;
+        dispatch_semaphore_signal(shard->wake);
+    }
+}
+
+- (void) shutdown
+{
+    for (size_t i = 0; i < _shardList.size(); i++)
+    {
+        Shard* shard = _shardList[i];
+        ShardItem item = { ShardExit, NULL, 0, false };
+        [self push:item to:shard];
+        shard->thread.join();
+        
+        // release anything the shard did not get to
+        while (shard->queue.Pop(item))
+        {
+            if (item.obj != NULL)
+            {
+                CFBridgingRelease(item.obj);
+            }
+        }
+        delete shard;
+    }
+    _shardList.clear();
+    [_assignment removeAllObjects];
+}
+
+@end
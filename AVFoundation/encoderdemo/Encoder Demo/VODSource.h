@@ -0,0 +1,49 @@
+//
+//  VODSource.h
+//  Encoder Demo
+//
+//  Recorded MP4 files served on demand over the same RTSP endpoint as
+//  the live stream. VODSource walks the file once with MP4Atom and
+//  keeps an index of the H.264 track's samples; it is shared by all of
+//  the file's viewers. Each viewer has a VODPlayer that reads ahead of
+//  its play position and hands frames out in real time.
+//
+
+#import <Foundation/Foundation.h>
+#import "RTPFrame.h"
+#import "SessionDescription.h"
+
+@interface VODSource : NSObject
+
+// nil if the file has no H.264 track we can use
++ (VODSource*) sourceWithFile:(NSString*) path;
+
+@property (readonly) NSString* path;
+@property (readonly) NSData* avcC;
+@property (readonly) double duration;       // seconds
+@property (readonly) int bitrate;           // average, bits per second
+@property (readonly) int sampleCount;
+@property (readonly) SessionDescription* sessionDescription;
+
+// last sync sample at or before npt seconds
+- (int) syncSampleBefore:(double) npt;
+
+// presentation time, in seconds from the start of the file
+- (double) ptsForSample:(int) idx;
+
+@end
+
+@interface VODPlayer : NSObject
+
+// playback starts at the sync sample at or before npt
++ (VODPlayer*) playerWithSource:(VODSource*) source start:(double) npt;
+
+// presentation time of the first frame to be delivered
+@property (readonly) double start;
+
+// frames are delivered, in decode order, on a private serial queue,
+// each with the time by which its packets should all be sent
+- (void) play:(void (^)(RTPFrame* frame, double deadline)) deliver;
+- (void) stop;
+
+@end
@@ -0,0 +1,648 @@
+//
+//  VODSource.mm
+//  Encoder Demo
+//
+
+#import "VODSource.h"
+#import "MP4Atom.h"
+#import "NALUnit.h"
+#import "RTPPacer.h"
+#import <sys/stat.h>
+#import <unistd.h>
+#import <vector>
+#import <deque>
+#import <climits>
+
+// how far each viewer reads ahead, and when it starts the next read
+static const double prefetch_high_seconds = 4.0;
+static const double prefetch_low_seconds = 2.0;
+
+// contiguous samples are fetched in reads of up to this size: a few
+// large reads per viewer are what keep a spinning disk streaming
+static const int prefetch_read_bytes = 1024 * 1024;
+
+// a frame more than this late means we stalled on the disk: carry on
+// from where we are rather than bursting to catch up
+static const double max_vod_lateness = 0.5;
+
+// a frame's packets are spread over at most this, as for live frames
+static const double max_vod_frame_interval = 0.1;
+
+static unsigned int to_host(const unsigned char* p)
+{
+    return (p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+struct VODSample
+{
+    int64_t offset;
+    int size;
+    int64_t dts;        // in the track timescale
+    int32_t ctsOffset;
+    bool bSync;
+};
+
+// all viewers' reads go through one queue, so that the disk sees one
+// large sequential read at a time rather than many competing seeks
+static dispatch_queue_t vodReadQueue()
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        queue = dispatch_queue_create("uk.co.gdcl.vod.read", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+@interface VODSource ()
+{
+    NSFileHandle* _file;
+    int _fileSize;
+    int _lengthSize;
+    int _timescale;
+    std::vector<VODSample> _samples;
+}
+
+- (VODSource*) initWithFile:(NSString*) path;
+- (BOOL) parseTrack:(MP4Atom*) trak;
+- (BOOL) buildIndex:(MP4Atom*) stbl;
+- (int64_t) samplesInTimes:(NSData*) stts;
+- (int64_t) samplesInChunks:(NSData*) stco runs:(NSData*) stsc longOffsets:(BOOL) bLongOffsets;
+
+// used by VODPlayer
+- (int) fileDescriptor;
+- (const VODSample*) sample:(int) idx;
+- (double) seconds:(int64_t) t;
+- (NSArray*) nalusIn:(const uint8_t*) p length:(int) cBytes;
+
+@end
+
+@implementation VODSource
+
+@synthesize path = _path;
+@synthesize avcC = _avcC;
+@synthesize duration = _duration;
+@synthesize bitrate = _bitrate;
+@synthesize sessionDescription = _sessionDescription;
+
++ (VODSource*) sourceWithFile:(NSString*) path
+{
+    return [[VODSource alloc] initWithFile:path];
+}
+
+- (VODSource*) initWithFile:(NSString*) path
+{
+    self = [super init];
+    _path = path;
+    _file = [NSFileHandle fileHandleForReadingAtPath:path];
+    if (_file == nil)
+    {
+        return nil;
+    }
+    // atoms are parsed with int offsets and sizes
+    struct stat s;
+    if ((fstat([_file fileDescriptor], &s) != 0) || (s.st_size > INT_MAX))
+    {
+        NSLog(@"%@ is too large to serve", path);
+        return nil;
+    }
+    _fileSize = (int)s.st_size;
+    MP4Atom* movie = [MP4Atom atomAt:0 size:_fileSize type:(OSType)('file') inFile:_file];
+    MP4Atom* moov = [movie childOfType:(OSType)('moov') startAt:0];
+    BOOL bFound = NO;
+    if (moov != nil)
+    {
+        for (MP4Atom* trak = [moov nextChild]; (trak != nil) && !bFound; trak = [moov nextChild])
+        {
+            if (trak.type == (OSType)('trak'))
+            {
+                bFound = [self parseTrack:trak];
+            }
+        }
+    }
+    if (!bFound || _samples.empty())
+    {
+        NSLog(@"No usable H.264 track in %@", path);
+        return nil;
+    }
+    // the last frame is shown for as long as the one before it
+    const VODSample& last = _samples.back();
+    int64_t lastDuration = (_samples.size() > 1) ? (last.dts - _samples[_samples.size() - 2].dts) : 0;
+    _duration = [self seconds:last.dts + last.ctsOffset + lastDuration];
+    int64_t cTotal = 0;
+    for (size_t i = 0; i < _samples.size(); i++)
+    {
+        cTotal += _samples[i].size;
+    }
+    _bitrate = (_duration > 0) ? (int)((cTotal * 8) / _duration) : 0;
+    _sessionDescription = [SessionDescription descriptionWithConfig:_avcC duration:_duration];
+    NSLog(@"VOD %@: %d samples, %.1f seconds", [path lastPathComponent], (int)_samples.size(), _duration);
+    return self;
+}
+
+- (BOOL) parseTrack:(MP4Atom*) trak
+{
+    MP4Atom* media = [trak childOfType:(OSType)('mdia') startAt:0];
+    if (media == nil)
+    {
+        return NO;
+    }
+    MP4Atom* mdhd = [media childOfType:(OSType)('mdhd') startAt:0];
+    if (mdhd == nil)
+    {
+        return NO;
+    }
+    // version 1 has 64-bit creation and modification times
+    NSData* header = [mdhd readAt:0 size:24];
+    const unsigned char* p = (const unsigned char*)[header bytes];
+    if ([header length] < 24)
+    {
+        return NO;
+    }
+    _timescale = to_host(p + ((p[0] == 1) ? 20 : 12));
+    if (_timescale == 0)
+    {
+        return NO;
+    }
+
+    MP4Atom* minf = [media childOfType:(OSType)('minf') startAt:0];
+    MP4Atom* stbl = [minf childOfType:(OSType)('stbl') startAt:0];
+    MP4Atom* stsd = [stbl childOfType:(OSType)('stsd') startAt:0];
+    MP4Atom* avc1 = [stsd childOfType:(OSType)('avc1') startAt:8];
+    MP4Atom* esd = [avc1 childOfType:(OSType)('avcC') startAt:78];
+    if (esd == nil)
+    {
+        // not video, or not H.264
+        return NO;
+    }
+    _avcC = [esd readAt:0 size:(int)esd.length];
+    _lengthSize = (((const unsigned char*)[_avcC bytes])[4] & 3) + 1;
+    return [self buildIndex:stbl];
+}
+
+- (int64_t) samplesInTimes:(NSData*) stts
+{
+    const unsigned char* p = (const unsigned char*)[stts bytes];
+    size_t cEntries = MIN((size_t)to_host(p + 4), ([stts length] - 8) / 8);
+    int64_t cSamples = 0;
+    for (size_t i = 0; i < cEntries; i++)
+    {
+        cSamples = MIN(cSamples + to_host(p + 8 + (i * 8)), (int64_t)INT_MAX);
+    }
+    return cSamples;
+}
+
+- (int64_t) samplesInChunks:(NSData*) stco runs:(NSData*) stsc longOffsets:(BOOL) bLongOffsets
+{
+    // each sample-to-chunk run covers the chunks up to the next run's first
+    const unsigned char* pChunks = (const unsigned char*)[stco bytes];
+    int64_t cChunks = MIN((size_t)to_host(pChunks + 4), ([stco length] - 8) / (bLongOffsets ? 8 : 4));
+    const unsigned char* pRuns = (const unsigned char*)[stsc bytes];
+    size_t cRuns = MIN((size_t)to_host(pRuns + 4), ([stsc length] - 8) / 12);
+    int64_t cSamples = 0;
+    for (size_t run = 0; run < cRuns; run++)
+    {
+        const unsigned char* e = pRuns + 8 + (run * 12);
+        int64_t firstChunk = (int64_t)to_host(e) - 1;
+        int64_t lastChunk = (run + 1 < cRuns) ? (int64_t)to_host(e + 12) - 1 : cChunks;
+        firstChunk = MAX(firstChunk, (int64_t)0);
+        lastChunk = MIN(lastChunk, cChunks);
+        if (lastChunk > firstChunk)
+        {
+            cSamples = MIN(cSamples + ((lastChunk - firstChunk) * to_host(e + 4)), (int64_t)INT_MAX);
+        }
+    }
+    return cSamples;
+}
+
+- (BOOL) buildIndex:(MP4Atom*) stbl
+{
+    // each table is read whole: they are small next to the media
+    MP4Atom* atom = [stbl childOfType:(OSType)('stsz') startAt:0];
+    NSData* stsz = [atom readAt:0 size:(int)atom.length];
+    atom = [stbl childOfType:(OSType)('stco') startAt:0];
+    BOOL bLongOffsets = NO;
+    if (atom == nil)
+    {
+        atom = [stbl childOfType:(OSType)('co64') startAt:0];
+        bLongOffsets = YES;
+    }
+    NSData* stco = [atom readAt:0 size:(int)atom.length];
+    atom = [stbl childOfType:(OSType)('stsc') startAt:0];
+    NSData* stsc = [atom readAt:0 size:(int)atom.length];
+    atom = [stbl childOfType:(OSType)('stts') startAt:0];
+    NSData* stts = [atom readAt:0 size:(int)atom.length];
+    atom = [stbl childOfType:(OSType)('ctts') startAt:0];
+    NSData* ctts = (atom != nil) ? [atom readAt:0 size:(int)atom.length] : nil;
+    atom = [stbl childOfType:(OSType)('stss') startAt:0];
+    NSData* stss = (atom != nil) ? [atom readAt:0 size:(int)atom.length] : nil;
+    if ((stsz == nil) || (stco == nil) || (stsc == nil) || (stts == nil) ||
+        ([stsz length] < 12) || ([stco length] < 8) || ([stsc length] < 8) || ([stts length] < 8))
+    {
+        return NO;
+    }
+
+    // sizes. The count comes from the file, so it is checked against
+    // the table that holds it, and against the samples that the time
+    // and chunk tables describe, before anything is allocated for it.
+    const unsigned char* p = (const unsigned char*)[stsz bytes];
+    int fixedSize = to_host(p + 4);
+    int count = to_host(p + 8);
+    if ((count < 0) || (fixedSize < 0))
+    {
+        return NO;
+    }
+    if (fixedSize == 0)
+    {
+        if ((([stsz length] - 12) / 4) < (size_t)count)
+        {
+            return NO;
+        }
+    }
+    else if (count > (_fileSize / fixedSize))
+    {
+        return NO;
+    }
+    count = (int)MIN((int64_t)count, MIN([self samplesInTimes:stts], [self samplesInChunks:stco runs:stsc longOffsets:bLongOffsets]));
+    _samples.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        _samples[i].size = fixedSize ? fixedSize : to_host(p + 12 + (i * 4));
+        _samples[i].ctsOffset = 0;
+        _samples[i].bSync = (stss == nil);
+    }
+
+    // offsets: walk the chunks, using sample-to-chunk runs for the count in each
+    const unsigned char* pChunks = (const unsigned char*)[stco bytes];
+    int cChunks = MIN((int)to_host(pChunks + 4), (int)(([stco length] - 8) / (bLongOffsets ? 8 : 4)));
+    const unsigned char* pRuns = (const unsigned char*)[stsc bytes];
+    int cRuns = MIN((int)to_host(pRuns + 4), (int)(([stsc length] - 8) / 12));
+    int sample = 0;
+    for (int run = 0; (run < cRuns) && (sample < count); run++)
+    {
+        const unsigned char* e = pRuns + 8 + (run * 12);
+        int firstChunk = to_host(e) - 1;
+        int lastChunk = (run + 1 < cRuns) ? (int)to_host(e + 12) - 1 : cChunks;
+        int perChunk = to_host(e + 4);
+        for (int chunk = firstChunk; (chunk < lastChunk) && (chunk < cChunks) && (sample < count); chunk++)
+        {
+            int64_t offset;
+            if (bLongOffsets)
+            {
+                offset = ((int64_t)to_host(pChunks + 8 + (chunk * 8)) << 32) + to_host(pChunks + 12 + (chunk * 8));
+            }
+            else
+            {
+                offset = to_host(pChunks + 8 + (chunk * 4));
+            }
+            for (int i = 0; (i < perChunk) && (sample < count); i++)
+            {
+                _samples[sample].offset = offset;
+                offset += _samples[sample].size;
+                sample++;
+            }
+        }
+    }
+    if (sample < count)
+    {
+        _samples.resize(sample);
+        count = sample;
+    }
+
+    // decode times
+    p = (const unsigned char*)[stts bytes];
+    int cEntries = MIN((int)to_host(p + 4), (int)(([stts length] - 8) / 8));
+    int64_t dts = 0;
+    sample = 0;
+    for (int i = 0; i < cEntries; i++)
+    {
+        int n = to_host(p + 8 + (i * 8));
+        int delta = to_host(p + 12 + (i * 8));
+        for (int j = 0; (j < n) && (sample < count); j++)
+        {
+            _samples[sample++].dts = dts;
+            dts += delta;
+        }
+    }
+    for (; sample < count; sample++)
+    {
+        _samples[sample].dts = dts;
+    }
+
+    // composition offsets: signed in version 1, and in practice in version 0 too
+    if (ctts != nil)
+    {
+        p = (const unsigned char*)[ctts bytes];
+        cEntries = MIN((int)to_host(p + 4), (int)(([ctts length] - 8) / 8));
+        sample = 0;
+        for (int i = 0; i < cEntries; i++)
+        {
+            int n = to_host(p + 8 + (i * 8));
+            int32_t offset = (int32_t)to_host(p + 12 + (i * 8));
+            for (int j = 0; (j < n) && (sample < count); j++)
+            {
+                _samples[sample++].ctsOffset = offset;
+            }
+        }
+    }
+
+    // sync samples (1-based)
+    if (stss != nil)
+    {
+        p = (const unsigned char*)[stss bytes];
+        cEntries = MIN((int)to_host(p + 4), (int)(([stss length] - 8) / 4));
+        for (int i = 0; i < cEntries; i++)
+        {
+            int idx = to_host(p + 8 + (i * 4)) - 1;
+            if ((idx >= 0) && (idx < count))
+            {
+                _samples[idx].bSync = true;
+            }
+        }
+    }
+    return YES;
+}
+
+- (int) sampleCount
+{
+    return (int)_samples.size();
+}
+
+- (int) fileDescriptor
+{
+    return [_file fileDescriptor];
+}
+
+- (const VODSample*) sample:(int) idx
+{
+    return &_samples[idx];
+}
+
+- (double) seconds:(int64_t) t
+{
+    return double(t) / _timescale;
+}
+
+- (double) ptsForSample:(int) idx
+{
+    return [self seconds:_samples[idx].dts + _samples[idx].ctsOffset];
+}
+
+- (int) syncSampleBefore:(double) npt
+{
+    int64_t t = int64_t(npt * _timescale);
+    int best = 0;
+    // samples are in decode order, so the last sync sample with
+    // dts <= t is the one to start from
+    for (int i = 0; i < (int)_samples.size(); i++)
+    {
+        if (_samples[i].dts > t)
+        {
+            break;
+        }
+        if (_samples[i].bSync)
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+- (NSArray*) nalusIn:(const uint8_t*) p length:(int) cBytes
+{
+    NSMutableArray* nalus = [NSMutableArray arrayWithCapacity:4];
+    while (cBytes > _lengthSize)
+    {
+        int cNALU = 0;
+        for (int i = 0; i < _lengthSize; i++)
+        {
+            cNALU = (cNALU << 8) + p[i];
+        }
+        p += _lengthSize;
+        cBytes -= _lengthSize;
+        if ((cNALU <= 0) || (cNALU > cBytes))
+        {
+            break;
+        }
+        [nalus addObject:[NSData dataWithBytes:p length:cNALU]];
+        p += cNALU;
+        cBytes -= cNALU;
+    }
+    return nalus;
+}
+
+@end
+
+@interface VODPlayer ()
+{
+    VODSource* _source;
+    dispatch_queue_t _queue;
+    dispatch_source_t _timer;
+    void (^_deliver)(RTPFrame*, double);
+
+    // read-ahead: frames ready to go, with their decode times
+    NSMutableArray* _ready;
+    std::deque<double> _readyDue;
+    int _nextRead;
+    BOOL _bReading;
+    BOOL _bStopped;
+
+    // maps decode time onto PacerNow
+    double _clockBase;
+    double _dtsBase;
+}
+
+- (VODPlayer*) initWithSource:(VODSource*) source start:(double) npt;
+- (void) prefetch;
+- (void) onTimer;
+
+@end
+
+@implementation VODPlayer
+
+@synthesize start = _start;
+
++ (VODPlayer*) playerWithSource:(VODSource*) source start:(double) npt
+{
+    return [[VODPlayer alloc] initWithSource:source start:npt];
+}
+
+- (VODPlayer*) initWithSource:(VODSource*) source start:(double) npt
+{
+    self = [super init];
+    _source = source;
+    _nextRead = [source syncSampleBefore:npt];
+    _start = [source ptsForSample:_nextRead];
+    _dtsBase = [source seconds:[source sample:_nextRead]->dts];
+    _ready = [NSMutableArray arrayWithCapacity:128];
+    _queue = dispatch_queue_create("uk.co.gdcl.vod.player", DISPATCH_QUEUE_SERIAL);
+    return self;
+}
+
+- (void) play:(void (^)(RTPFrame* frame, double deadline)) deliver
+{
+    _deliver = deliver;
+    _clockBase = PacerNow();
+    [self prefetch];
+
+    _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+    dispatch_source_set_timer(_timer, DISPATCH_TIME_NOW, 10 * NSEC_PER_MSEC, 2 * NSEC_PER_MSEC);
+    __weak VODPlayer* weakSelf = self;
+    dispatch_source_set_event_handler(_timer, ^{
+        [weakSelf onTimer];
+    });
+    dispatch_resume(_timer);
+}
+
+- (void) stop
+{
+    @synchronized(self)
+    {
+        _bStopped = YES;
+        [_ready removeAllObjects];
+        _readyDue.clear();
+    }
+    if (_timer != nil)
+    {
+        dispatch_source_cancel(_timer);
+        _timer = nil;
+    }
+
+    // wait out a delivery in progress, so that none follows our return
+    dispatch_sync(_queue, ^{});
+    _deliver = nil;
+}
+
+- (void) dealloc
+{
+    if (_timer != nil)
+    {
+        dispatch_source_cancel(_timer);
+    }
+}
+
+- (void) prefetch
+{
+    // starts one read, if we are running short and none is in flight
+    int first;
+    int last;
+    @synchronized(self)
+    {
+        if (_bStopped || _bReading || (_nextRead >= _source.sampleCount))
+        {
+            return;
+        }
+        double buffered = _readyDue.empty() ? 0 : (_readyDue.back() - _readyDue.front());
+        if (buffered >= prefetch_low_seconds)
+        {
+            return;
+        }
+
+        // a run of samples that sit back to back in the file, up to the
+        // read size or the read-ahead limit
+        first = _nextRead;
+        last = first;
+        int64_t end = [_source sample:first]->offset + [_source sample:first]->size;
+        double dtsFirst = [_source seconds:[_source sample:first]->dts];
+        while ((last + 1) < _source.sampleCount)
+        {
+            const VODSample* next = [_source sample:last + 1];
+            if ((next->offset != end) ||
+                ((end + next->size - [_source sample:first]->offset) > prefetch_read_bytes) ||
+                (([_source seconds:next->dts] - dtsFirst) > (prefetch_high_seconds - buffered)))
+            {
+                break;
+            }
+            end += next->size;
+            last++;
+        }
+        _bReading = YES;
+    }
+
+    VODSource* source = _source;
+    __weak VODPlayer* weakSelf = self;
+    dispatch_async(vodReadQueue(), ^{
+        VODPlayer* player = weakSelf;
+        if (player == nil)
+        {
+            return;
+        }
+        int64_t offset = [source sample:first]->offset;
+        int cBytes = (int)([source sample:last]->offset + [source sample:last]->size - offset);
+        NSMutableData* data = [NSMutableData dataWithLength:cBytes];
+        ssize_t cRead = pread([source fileDescriptor], [data mutableBytes], cBytes, offset);
+
+        // packetized here, off the delivery queue
+        NSMutableArray* frames = [NSMutableArray arrayWithCapacity:(last - first + 1)];
+        std::vector<double> due;
+        if (cRead == cBytes)
+        {
+            const uint8_t* p = (const uint8_t*)[data bytes];
+            for (int i = first; i <= last; i++)
+            {
+                const VODSample* s = [source sample:i];
+                NSArray* nalus = [source nalusIn:p + (s->offset - offset) length:s->size];
+                [frames addObject:[RTPFrame frameWithNALUs:nalus time:[source ptsForSample:i]]];
+                due.push_back([source seconds:s->dts]);
+            }
+        }
+        else
+        {
+            NSLog(@"VOD read failed at %lld", (long long)offset);
+        }
+        @synchronized(player)
+        {
+            player->_bReading = NO;
+            if (!player->_bStopped)
+            {
+                [player->_ready addObjectsFromArray:frames];
+                player->_readyDue.insert(player->_readyDue.end(), due.begin(), due.end());
+                // a failed read skips those samples rather than retrying forever
+                player->_nextRead = last + 1;
+            }
+        }
+        [player prefetch];
+    });
+}
+
+- (void) onTimer
+{
+    double now = PacerNow();
+    for (;;)
+    {
+        RTPFrame* frame;
+        double due;
+        double interval = max_vod_frame_interval;
+        @synchronized(self)
+        {
+            if (_bStopped || ([_ready count] == 0))
+            {
+                break;
+            }
+            due = _clockBase + (_readyDue.front() - _dtsBase);
+            if (due > now)
+            {
+                break;
+            }
+            if ((now - due) > max_vod_lateness)
+            {
+                // the disk fell behind: resume from here
+                _clockBase += (now - due);
+                due = now;
+            }
+            // all of it should be out by the time the next frame is due
+            double dts = _readyDue.front();
+            frame = [_ready objectAtIndex:0];
+            [_ready removeObjectAtIndex:0];
+            _readyDue.pop_front();
+            if (!_readyDue.empty() && (_readyDue.front() > dts))
+            {
+                interval = MIN(_readyDue.front() - dts, max_vod_frame_interval);
+            }
+        }
+        _deliver(frame, due + interval);
+    }
+    [self prefetch];
+}
+
+@end
@@ -0,0 +1,292 @@
+//
+//  fec_bench.cpp
+//  Encoder Demo
+//
+//  Checks and times the FlexFEC row/column parity in FEC.cpp. The
+//  checks rebuild single losses in every row, losses that need a row
+//  repair before a column one, and a packet whose parity cannot rebuild
+//  it yet, then compare every rebuilt packet with the original.
+//
+//  Then it times XORBytes against a byte loop, the encoder with a 10x10
+//  and a row-only block, and the decoder under 5% random loss, in
+//  media Mbit/s on one core.
+//
+//  Build from this directory with:
+//
+//      g++ -std=c++11 -O2 -I"../Encoder Demo" fec_bench.cpp "../Encoder Demo/FEC.cpp" -o fec_bench
+//
+//  and run with no arguments.
+//
+
+#include "FEC.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static const int max_packet = 1500;
+static const int payload_type = 98;
+
+static int failures;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void Check(bool bOK, const char* what)
+{
+    printf("%s  %s\n", bOK ? "pass" : "FAIL", what);
+    if (!bOK)
+    {
+        failures++;
+    }
+}
+
+// media packets of varying length, as a frame's last packet is short
+static std::vector<std::vector<BYTE> > MakeStream(int count, unsigned seed)
+{
+    std::vector<std::vector<BYTE> > stream(count);
+    srand(seed);
+    for (int i = 0; i < count; i++)
+    {
+        int cBytes = ((i % 7) == 6) ? (12 + 100 + (rand() % 900)) : 1200;
+        stream[i].resize(cBytes);
+        BYTE* p = &stream[i][0];
+        for (int j = 12; j < cBytes; j++)
+        {
+            p[j] = BYTE(rand());
+        }
+        p[0] = 0x80;
+        p[1] = BYTE(96 | (((i % 7) == 6) ? 0x80 : 0));
+        p[2] = BYTE(i >> 8);
+        p[3] = BYTE(i);
+        uint32_t ts = uint32_t((i / 7) * 3000);
+        p[4] = BYTE(ts >> 24);
+        p[5] = BYTE(ts >> 16);
+        p[6] = BYTE(ts >> 8);
+        p[7] = BYTE(ts);
+        p[8] = 0x12; p[9] = 0x34; p[10] = 0x56; p[11] = 0x78;
+    }
+    return stream;
+}
+
+static void Encode(const std::vector<std::vector<BYTE> >& stream, int columns, int rows, std::vector<std::vector<BYTE> >* pRepair)
+{
+    FECEncoder encoder(max_packet);
+    encoder.Configure(columns, rows);
+    encoder.Reset(0x12345678, 0x9abcdef0, payload_type);
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        encoder.Add(&stream[i][0], (int)stream[i].size(), pRepair);
+    }
+}
+
+// feeds media with the given packets lost, and the repair stream after
+// each block; returns how many lost packets came back byte for byte
+static int Decode(const std::vector<std::vector<BYTE> >& stream, const std::vector<std::vector<BYTE> >& repair,
+                  const std::vector<bool>& lost, int* pWrong)
+{
+    FECDecoder decoder(1024, max_packet);
+    std::vector<std::vector<BYTE> > recovered;
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        if (!lost[i])
+        {
+            decoder.AddMedia(&stream[i][0], (int)stream[i].size());
+        }
+    }
+    for (size_t i = 0; i < repair.size(); i++)
+    {
+        decoder.AddRepair(&repair[i][0], (int)repair[i].size(), &recovered);
+    }
+    int cRight = 0;
+    *pWrong = 0;
+    for (size_t i = 0; i < recovered.size(); i++)
+    {
+        int seq = (recovered[i][2] << 8) | recovered[i][3];
+        if ((seq < (int)stream.size()) && lost[seq] && (recovered[i] == stream[seq]))
+        {
+            cRight++;
+        }
+        else
+        {
+            (*pWrong)++;
+        }
+    }
+    return cRight;
+}
+
+static void CheckRecovery()
+{
+    // one block of 4 columns and 4 rows
+    std::vector<std::vector<BYTE> > stream = MakeStream(16, 1);
+    std::vector<std::vector<BYTE> > repair;
+    Encode(stream, 4, 4, &repair);
+    Check(repair.size() == 8, "a 4x4 block gives 4 row and 4 column parity packets");
+
+    std::vector<bool> lost(16, false);
+    int wrong;
+    for (int row = 0; row < 4; row++)
+    {
+        lost[(row * 4) + row] = true;
+    }
+    Check((Decode(stream, repair, lost, &wrong) == 4) && (wrong == 0), "one loss in each row rebuilt exactly");
+
+    // 0 and 1 share row 0, 0 and 4 column 0: 1 comes back from its column,
+    // which leaves 0 alone in its row
+    lost.assign(16, false);
+    lost[0] = lost[1] = lost[4] = true;
+    Check((Decode(stream, repair, lost, &wrong) == 3) && (wrong == 0), "losses that need one repair before another rebuilt exactly");
+
+    // a 2x2 square: every row and column has two losses, so nothing can come back
+    lost.assign(16, false);
+    lost[0] = lost[1] = lost[4] = lost[5] = true;
+    Check((Decode(stream, repair, lost, &wrong) == 0) && (wrong == 0), "a square of losses is left alone");
+
+    // the row parity arrives before the loss it would repair can be
+    // seen: it must stay pending rather than count as used
+    {
+        FECDecoder decoder(1024, max_packet);
+        std::vector<std::vector<BYTE> > recovered;
+        std::vector<std::vector<BYTE> > rowOnly;
+        Encode(stream, 4, 0, &rowOnly);
+        decoder.AddMedia(&stream[0][0], (int)stream[0].size());
+        decoder.AddRepair(&rowOnly[0][0], (int)rowOnly[0].size(), &recovered);
+        decoder.AddMedia(&stream[1][0], (int)stream[1].size());
+        decoder.AddMedia(&stream[2][0], (int)stream[2].size());
+        decoder.AddRepair(&rowOnly[1][0], (int)rowOnly[1].size(), &recovered);
+        Check((recovered.size() == 1) && (recovered[0] == stream[3]), "a repair kept until its row has a single loss");
+    }
+}
+
+static void TimeXOR()
+{
+    const int cBytes = 1200;
+    const long rounds = 2000000;
+    std::vector<BYTE> a(cBytes, 0x5a);
+    std::vector<BYTE> b(cBytes, 0xa5);
+
+    double start = Now();
+    for (long r = 0; r < rounds; r++)
+    {
+        XORBytes(&a[0], &b[0], cBytes);
+    }
+    double vector = Now() - start;
+
+    volatile BYTE* dst = &a[0];
+    start = Now();
+    for (long r = 0; r < (rounds / 8); r++)
+    {
+        for (int i = 0; i < cBytes; i++)
+        {
+            dst[i] ^= b[i];
+        }
+    }
+    double bytewise = (Now() - start) * 8;
+    printf("XORBytes over 1200 bytes: %.1f GB/s, a byte loop %.1f GB/s\n",
+           (double)cBytes * rounds / vector / 1e9, (double)cBytes * rounds / bytewise / 1e9);
+}
+
+static void TimeEncoder(int columns, int rows)
+{
+    std::vector<std::vector<BYTE> > stream = MakeStream(4000, 2);
+    long cMedia = 0;
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        cMedia += (long)stream[i].size();
+    }
+    FECEncoder encoder(max_packet);
+    encoder.Configure(columns, rows);
+    encoder.Reset(0x12345678, 0x9abcdef0, payload_type);
+    std::vector<std::vector<BYTE> > repair;
+    const int passes = 100;
+    double start = Now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < stream.size(); i++)
+        {
+            encoder.Add(&stream[i][0], (int)stream[i].size(), &repair);
+        }
+        repair.clear();
+    }
+    double seconds = Now() - start;
+    printf("encode %dx%d: %.0f Mbit/s of media\n", columns, rows, cMedia * 8.0 * passes / seconds / 1e6);
+}
+
+static void TimeDecoder()
+{
+    const int count = 10000;
+    std::vector<std::vector<BYTE> > stream = MakeStream(count, 3);
+    std::vector<std::vector<BYTE> > repair;
+    Encode(stream, 10, 10, &repair);
+    std::vector<bool> lost(count, false);
+    int cLost = 0;
+    long cMedia = 0;
+    srand(4);
+    for (int i = 0; i < count; i++)
+    {
+        lost[i] = (rand() % 100) < 5;
+        cLost += lost[i] ? 1 : 0;
+        cMedia += (long)stream[i].size();
+    }
+
+    // a block at a time, as the repairs for it arrive
+    const int passes = 10;
+    int cRecovered = 0;
+    int cWrong = 0;
+    double start = Now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        FECDecoder decoder(1024, max_packet);
+        std::vector<std::vector<BYTE> > recovered;
+        size_t next = 0;
+        for (int block = 0; block < (count / 100); block++)
+        {
+            for (int i = block * 100; i < (block + 1) * 100; i++)
+            {
+                if (!lost[i])
+                {
+                    decoder.AddMedia(&stream[i][0], (int)stream[i].size());
+                }
+            }
+            for (int k = 0; (k < 20) && (next < repair.size()); k++, next++)
+            {
+                decoder.AddRepair(&repair[next][0], (int)repair[next].size(), &recovered);
+            }
+        }
+        if (pass == 0)
+        {
+            for (size_t i = 0; i < recovered.size(); i++)
+            {
+                int seq = (recovered[i][2] << 8) | recovered[i][3];
+                if (lost[seq] && (recovered[i] == stream[seq]))
+                {
+                    cRecovered++;
+                }
+                else
+                {
+                    cWrong++;
+                }
+            }
+        }
+    }
+    double seconds = Now() - start;
+    printf("decode 10x10 at 5%% loss: %d of %d lost packets rebuilt, %.0f Mbit/s of media\n",
+           cRecovered, cLost, cMedia * 8.0 * passes / seconds / 1e6);
+    Check((cWrong == 0) && (cRecovered > (cLost * 8 / 10)), "most random losses rebuilt, and none wrongly");
+}
+
+int main()
+{
+    CheckRecovery();
+    TimeXOR();
+    TimeEncoder(10, 10);
+    TimeEncoder(10, 0);
+    TimeDecoder();
+    printf("%s\n", (failures == 0) ? "all passed" : "FAILED");
+    return (failures == 0) ? 0 : 1;
+}
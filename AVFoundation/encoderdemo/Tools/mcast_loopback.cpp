@@ -0,0 +1,353 @@
+//
+//  mcast_loopback.cpp
+//  Encoder Demo
+//
+//  Loopback test for MulticastSender. The server's shared multicast
+//  sender runs in-process, sending to a group on the loopback interface
+//  at 30 frames a second. Several receivers join the group on the same
+//  host. Sessions join the sender in steps, and the test checks that:
+//
+//   - nothing is sent before the first join, or after the last leave
+//   - sending starts at an IDR, with a single SSRC and no gaps in sequence
+//   - every receiver gets every packet, and sender reports on port+1
+//   - the bytes sent per second are the same for 1 session and for many
+//
+//  Linux only. Build from this directory with:
+//
+//      g++ -std=c++11 -O2 -pthread -I"../Encoder Demo" mcast_loopback.cpp "../Encoder Demo/MulticastSender.cpp" "../Encoder Demo/RTPPacer.cpp" "../Encoder Demo/RTCP.cpp" "../Encoder Demo/Metrics.cpp" -o mcast_loopback
+//
+//  and run with, for example:
+//
+//      ./mcast_loopback -r 4 -n 50
+//
+//  The loopback interface must accept multicast; on most systems it
+//  does, otherwise "ip link set lo multicast on".
+//
+
+#include "MulticastSender.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static const char* loopback = "127.0.0.1";
+static const double frame_interval = 1.0 / 30;
+static const int gop_frames = 30;
+
+// an IDR is about this many packets, other frames a few
+static const int idr_packets = 20;
+static const int frame_packets = 3;
+static const int payload_size = 1100;
+
+struct Options
+{
+    const char* group;
+    int port;
+    int receivers;
+    int sessions;
+    double seconds;         // per phase
+};
+
+struct Receiver
+{
+    int fdRTP;
+    int fdRTCP;
+    long packets;
+    long reports;
+    long gaps;
+    long wrongSSRC;
+    bool bFirst;
+    bool bStartedAtIDR;
+    uint16_t nextSeq;
+};
+
+static int OpenReceiver(const Options& opts, int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // every receiver binds the same group and port
+    int t = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t));
+    int cBuffer = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &cBuffer, sizeof(cBuffer));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, opts.group, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    struct ip_mreq mreq;
+    inet_pton(AF_INET, opts.group, &mreq.imr_multiaddr);
+    inet_pton(AF_INET, loopback, &mreq.imr_interface);
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+class Test
+{
+public:
+    Test(const Options& opts)
+    : m_opts(opts),
+      m_frame(0),
+      m_failures(0)
+    {
+    }
+
+    bool Run();
+
+private:
+    void SendFrames(long frames);
+    void SendFrame();
+    void Drain(double seconds);
+    void Check(bool bOK, const char* what);
+
+private:
+    Options m_opts;
+    MulticastSender m_sender;
+    std::vector<Receiver> m_receivers;
+    long m_frame;
+    int m_failures;
+};
+
+void
+Test::Check(bool bOK, const char* what)
+{
+    printf("%s  %s\n", bOK ? "pass" : "FAIL", what);
+    if (!bOK)
+    {
+        m_failures++;
+    }
+}
+
+void
+Test::SendFrame()
+{
+    // payloads shaped like RTPFrame's: the first packet of an IDR is
+    // a sync point, and the last packet of each frame has the marker
+    BYTE payload[payload_size];
+    bool bIDR = (m_frame % gop_frames) == 0;
+    int count = bIDR ? idr_packets : frame_packets;
+    double pts = m_frame * frame_interval;
+    for (int i = 0; i < count; i++)
+    {
+        memset(payload, (int)(m_frame & 0xff), sizeof(payload));
+        payload[0] = bIDR ? 0x7c : 0x5c;      // FU indicator, as sent
+        payload[1] = bIDR ? 0x05 : 0x01;
+        m_sender.Send(payload, sizeof(payload), i == (count - 1), bIDR && (i == 0), pts);
+    }
+    m_frame++;
+}
+
+void
+Test::SendFrames(long frames)
+{
+    for (long i = 0; i < frames; i++)
+    {
+        SendFrame();
+        Drain(frame_interval);
+    }
+}
+
+void
+Test::Drain(double seconds)
+{
+    std::vector<struct pollfd> fds;
+    for (size_t i = 0; i < m_receivers.size(); i++)
+    {
+        struct pollfd p = { m_receivers[i].fdRTP, POLLIN, 0 };
+        fds.push_back(p);
+        p.fd = m_receivers[i].fdRTCP;
+        fds.push_back(p);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double end = ts.tv_sec + (ts.tv_nsec / 1e9) + seconds;
+    for (;;)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        double now = ts.tv_sec + (ts.tv_nsec / 1e9);
+        if (now >= end)
+        {
+            break;
+        }
+        if (poll(&fds[0], fds.size(), (int)((end - now) * 1000) + 1) <= 0)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            Receiver& r = m_receivers[i / 2];
+            BYTE buf[2048];
+            int cBytes = (int)recv(fds[i].fd, buf, sizeof(buf), 0);
+            if (cBytes < 12)
+            {
+                continue;
+            }
+            uint32_t ssrc = (buf[8] << 24) | (buf[9] << 16) | (buf[10] << 8) | buf[11];
+            if (fds[i].fd == r.fdRTCP)
+            {
+                r.reports++;
+                continue;
+            }
+            if (ssrc != m_sender.SSRC())
+            {
+                r.wrongSSRC++;
+            }
+            uint16_t seq = (buf[2] << 8) | buf[3];
+            if (r.bFirst)
+            {
+                r.bFirst = false;
+                r.bStartedAtIDR = (cBytes > 13) && ((buf[13] & 0x1f) == 5);
+            }
+            else if (seq != r.nextSeq)
+            {
+                r.gaps++;
+            }
+            r.nextSeq = seq + 1;
+            r.packets++;
+        }
+    }
+}
+
+bool
+Test::Run()
+{
+    if (!m_sender.Configure(m_opts.group, m_opts.port, 0, loopback))
+    {
+        fprintf(stderr, "%s:%d is not a usable group and port\n", m_opts.group, m_opts.port);
+        return false;
+    }
+    for (int i = 0; i < m_opts.receivers; i++)
+    {
+        Receiver r;
+        memset(&r, 0, sizeof(r));
+        r.bFirst = true;
+        r.fdRTP = OpenReceiver(m_opts, m_opts.port);
+        r.fdRTCP = OpenReceiver(m_opts, m_opts.port + 1);
+        if ((r.fdRTP < 0) || (r.fdRTCP < 0))
+        {
+            perror("joining group on loopback");
+            return false;
+        }
+        m_receivers.push_back(r);
+    }
+
+    // whole GOPs per phase, so that each phase sends the same frames
+    long gops = (long)(m_opts.seconds / (gop_frames * frame_interval) + 0.5);
+    long phase = ((gops > 0) ? gops : 1) * gop_frames;
+    double seconds = phase * frame_interval;
+
+    // the stream is already running when the first session arrives
+    SendFrames(gop_frames);
+    Check(!m_sender.Active() && (m_receivers[0].packets == 0), "nothing sent with no sessions");
+
+    Check(m_sender.Join() == 1, "first session joins");
+    m_sender.SetRate(8 * 1024 * 1024, 1.5);
+    SendFrames(phase);
+    long bytesOne = m_sender.BytesSent();
+
+    for (int i = 1; i < m_opts.sessions; i++)
+    {
+        m_sender.Join();
+    }
+    SendFrames(phase);
+    long bytesMany = m_sender.BytesSent() - bytesOne;
+    long sent = m_sender.PacketsSent();
+    printf("sent %ld packets: %.0f kB/s with 1 session, %.0f kB/s with %d\n",
+           sent, bytesOne / seconds / 1024, bytesMany / seconds / 1024, m_opts.sessions);
+    double ratio = (bytesOne > 0) ? (double(bytesMany) / bytesOne) : 0;
+    Check((ratio > 0.9) && (ratio < 1.1), "bytes sent do not grow with the number of sessions");
+
+    for (int i = 1; i < m_opts.sessions; i++)
+    {
+        m_sender.Leave();
+    }
+    Check(m_sender.Active(), "still sending while one session remains");
+    Check(m_sender.Leave() == 0, "last session leaves");
+    Check(!m_sender.Active(), "sender closed after the last leave");
+
+    // anything still in flight, then make sure nothing more comes
+    Drain(0.2);
+    long received = m_receivers[0].packets;
+    SendFrames(gop_frames);
+    Check(m_receivers[0].packets == received, "nothing sent after the last leave");
+
+    for (size_t i = 0; i < m_receivers.size(); i++)
+    {
+        const Receiver& r = m_receivers[i];
+        printf("receiver %d: %ld packets, %ld gaps, %ld sender reports\n", (int)i, r.packets, r.gaps, r.reports);
+        bool bOK = (r.packets == sent) && (r.gaps == 0) && (r.wrongSSRC == 0) && r.bStartedAtIDR && (r.reports > 0);
+        Check(bOK, "receiver got every packet from the first IDR, and sender reports");
+        close(r.fdRTP);
+        close(r.fdRTCP);
+    }
+    printf("%s\n", (m_failures == 0) ? "all passed" : "FAILED");
+    return m_failures == 0;
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: mcast_loopback [options]\n"
+            "  -g group     multicast group (239.255.42.42)\n"
+            "  -p port      RTP port, even; RTCP is the next (5004)\n"
+            "  -r count     receivers on the group (4)\n"
+            "  -n count     sessions joined in the second phase (50)\n"
+            "  -t seconds   length of each phase (3)\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    opts.group = "239.255.42.42";
+    opts.port = 5004;
+    opts.receivers = 4;
+    opts.sessions = 50;
+    opts.seconds = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:p:r:n:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'g': opts.group = optarg; break;
+            case 'p': opts.port = atoi(optarg); break;
+            case 'r': opts.receivers = atoi(optarg); break;
+            case 'n': opts.sessions = atoi(optarg); break;
+            case 't': opts.seconds = atof(optarg); break;
+            default:
+                Usage();
+                return 1;
+        }
+    }
+    if ((optind != argc) || (opts.receivers < 1) || (opts.sessions < 1) || (opts.seconds <= 0))
+    {
+        Usage();
+        return 1;
+    }
+
+    Test test(opts);
+    return test.Run() ? 0 : 1;
+}
@@ -0,0 +1,448 @@
+//
+//  pacer_loopback.cpp
+//  Encoder Demo
+//
+//  Loopback test for RTPPacer. Packets go through the pacer to a UDP
+//  socket on the loopback interface, and the receiver takes the kernel's
+//  arrival time of each one. The test checks that:
+//
+//   - one flow is sent at its configured rate
+//   - no stretch of the output is more than the bucket depth ahead of
+//     that rate, so bursts never exceed the configured limit
+//   - two flows under an aggregate cap share the cap, and together
+//     keep to the aggregate rate and burst
+//   - a frame that cannot go out at the configured rate by its deadline
+//     is spread over the time there is, and is not late
+//
+//  Linux only. Build from this directory with:
+//
+//      g++ -std=c++11 -O2 -pthread -I"../Encoder Demo" pacer_loopback.cpp "../Encoder Demo/RTPPacer.cpp" "../Encoder Demo/Metrics.cpp" -o pacer_loopback
+//
+//  and run with, for example:
+//
+//      ./pacer_loopback -r 16 -t 2
+//
+
+#include "RTPPacer.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+static const int payload_size = 1200;
+
+// as RTPPacer.cpp sizes its buckets
+static const double min_bucket_depth = 4 * 1500;
+static const double bucket_depth_seconds = 0.004;
+
+// allowance for the receive timestamps: a packet, and this long at rate
+static const double timestamp_slack = 0.0005;
+
+// a frame's last packet may arrive this long after its deadline
+static const double deadline_slack = 0.002;
+
+struct Options
+{
+    double rate;            // bits per second for one flow
+    double seconds;         // length of the rate phases
+};
+
+struct Arrival
+{
+    int flow;
+    double time;            // PacerNow clock
+    int cBytes;
+};
+
+struct Sender
+{
+    int fd;
+};
+
+static void onSend(void* ctx, const BYTE* p, int cBytes)
+{
+    send(((Sender*)ctx)->fd, p, cBytes, 0);
+}
+
+static double RealtimeNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static double BucketDepth(double bytesPerSecond)
+{
+    return std::max(min_bucket_depth, bytesPerSecond * bucket_depth_seconds);
+}
+
+class Test
+{
+public:
+    Test(const Options& opts)
+    : m_opts(opts),
+      m_fdReceive(-1),
+      m_bStop(false),
+      m_failures(0)
+    {
+    }
+
+    bool Run();
+
+private:
+    bool Open();
+    void Receive();
+    std::vector<Arrival> Collect(size_t count, double timeout);
+    void Fill(RTPPacer& pacer, RTPPacer::Flow* flow, int id, long cBytes, double deadline);
+    double Rate(const std::vector<Arrival>& arrivals, int flow, double depth);
+    double Burst(const std::vector<Arrival>& arrivals, double bytesPerSecond);
+    void Check(bool bOK, const char* what);
+
+    void SingleFlow();
+    void Aggregate();
+    void Deadline();
+
+private:
+    Options m_opts;
+    int m_fdReceive;
+    Sender m_senders[2];
+    double m_clockOffset;       // realtime minus PacerNow
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::vector<Arrival> m_arrivals;
+    std::atomic<bool> m_bStop;
+    int m_failures;
+};
+
+void
+Test::Check(bool bOK, const char* what)
+{
+    printf("%s  %s\n", bOK ? "pass" : "FAIL", what);
+    if (!bOK)
+    {
+        m_failures++;
+    }
+}
+
+bool
+Test::Open()
+{
+    m_fdReceive = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_fdReceive < 0)
+    {
+        return false;
+    }
+    int cBuffer = 8 * 1024 * 1024;
+    setsockopt(m_fdReceive, SOL_SOCKET, SO_RCVBUF, &cBuffer, sizeof(cBuffer));
+    int t = 1;
+    setsockopt(m_fdReceive, SOL_SOCKET, SO_TIMESTAMPNS, &t, sizeof(t));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    socklen_t cAddr = sizeof(addr);
+    if ((bind(m_fdReceive, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+        (getsockname(m_fdReceive, (struct sockaddr*)&addr, &cAddr) < 0))
+    {
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        m_senders[i].fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if ((m_senders[i].fd < 0) || (connect(m_senders[i].fd, (struct sockaddr*)&addr, sizeof(addr)) < 0))
+        {
+            return false;
+        }
+    }
+    m_clockOffset = RealtimeNow() - PacerNow();
+    return true;
+}
+
+void
+Test::Receive()
+{
+    while (!m_bStop)
+    {
+        struct pollfd p = { m_fdReceive, POLLIN, 0 };
+        if (poll(&p, 1, 50) <= 0)
+        {
+            continue;
+        }
+        BYTE buf[2048];
+        char control[256];
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int cBytes = (int)recvmsg(m_fdReceive, &msg, 0);
+        if (cBytes < 1)
+        {
+            continue;
+        }
+
+        // the kernel's arrival time, so that the receiving thread's
+        // scheduling does not show up as bursts
+        Arrival a;
+        a.flow = buf[0];
+        a.cBytes = cBytes;
+        a.time = PacerNow();
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c))
+        {
+            if ((c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SO_TIMESTAMPNS))
+            {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                a.time = ts.tv_sec + (ts.tv_nsec / 1e9) - m_clockOffset;
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_arrivals.push_back(a);
+    }
+}
+
+std::vector<Arrival>
+Test::Collect(size_t count, double timeout)
+{
+    double end = PacerNow() + timeout;
+    std::vector<Arrival> arrivals;
+    while (PacerNow() < end)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_arrivals.size() >= count)
+            {
+                break;
+            }
+        }
+        usleep(10000);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    arrivals.swap(m_arrivals);
+    return arrivals;
+}
+
+void
+Test::Fill(RTPPacer& pacer, RTPPacer::Flow* flow, int id, long cBytes, double deadline)
+{
+    BYTE packet[payload_size];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = (BYTE) id;
+    for (long cQueued = 0; cQueued < cBytes; cQueued += payload_size)
+    {
+        pacer.Enqueue(flow, packet, payload_size, deadline);
+    }
+}
+
+// bytes per second once the bucket's initial depth has gone out
+double
+Test::Rate(const std::vector<Arrival>& arrivals, int flow, double depth)
+{
+    long cTotal = 0;
+    long cAfter = 0;
+    double start = -1;
+    double last = 0;
+    for (size_t i = 0; i < arrivals.size(); i++)
+    {
+        if ((flow >= 0) && (arrivals[i].flow != flow))
+        {
+            continue;
+        }
+        cTotal += arrivals[i].cBytes;
+        if (start >= 0)
+        {
+            cAfter += arrivals[i].cBytes;
+        }
+        else if (cTotal >= depth)
+        {
+            start = arrivals[i].time;
+        }
+        last = arrivals[i].time;
+    }
+    return (last > start) ? (cAfter / (last - start)) : 0;
+}
+
+// the most that any stretch of the output is ahead of the rate, in
+// bytes: at most the bucket depth if the pacer keeps to its limits
+double
+Test::Burst(const std::vector<Arrival>& arrivals, double bytesPerSecond)
+{
+    // the bytes from packet i to packet j, less the rate times the time
+    // between them, is (S[j] - r t[j]) - (S[i-1] - r t[i])
+    double worst = 0;
+    double lowest = 0;
+    double sum = 0;
+    for (size_t j = 0; j < arrivals.size(); j++)
+    {
+        double here = sum - bytesPerSecond * arrivals[j].time;
+        lowest = (j == 0) ? here : std::min(lowest, here);
+        sum += arrivals[j].cBytes;
+        worst = std::max(worst, (sum - bytesPerSecond * arrivals[j].time) - lowest);
+    }
+    return worst;
+}
+
+void
+Test::SingleFlow()
+{
+    RTPPacer pacer(0);
+    RTPPacer::Flow* flow = pacer.AddFlow(onSend, &m_senders[0]);
+    double rate = m_opts.rate / 8;
+    double depth = BucketDepth(rate);
+    pacer.SetRate(flow, m_opts.rate, 1.0);
+
+    // deadlines well beyond the run, so that only the bucket decides
+    long cBytes = (long)(rate * m_opts.seconds);
+    long count = (cBytes + payload_size - 1) / payload_size;
+    Fill(pacer, flow, 0, cBytes, PacerNow() + (4 * m_opts.seconds));
+    std::vector<Arrival> arrivals = Collect(count, 2 * m_opts.seconds + 1);
+    pacer.RemoveFlow(flow);
+
+    double measured = Rate(arrivals, -1, depth);
+    double burst = Burst(arrivals, rate);
+    printf("one flow: %ld of %ld packets, %.0f kB/s against %.0f, largest burst %.0f bytes against a depth of %.0f\n",
+           (long)arrivals.size(), count, measured / 1024, rate / 1024, burst, depth);
+    Check((long)arrivals.size() == count, "every packet arrives");
+    Check(fabs(measured - rate) < (0.03 * rate), "sent at the configured rate, within 3%");
+    Check(burst <= (depth + payload_size + (rate * timestamp_slack)), "no burst beyond the bucket depth");
+}
+
+void
+Test::Aggregate()
+{
+    // two flows that would each take the whole cap
+    double cap = 1.2 * m_opts.rate;
+    RTPPacer pacer(cap);
+    RTPPacer::Flow* flows[2];
+    double deadline = PacerNow() + (4 * m_opts.seconds);
+    long cBytes = (long)(cap / 8 * m_opts.seconds / 2);
+    long count = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        flows[i] = pacer.AddFlow(onSend, &m_senders[i]);
+        pacer.SetRate(flows[i], m_opts.rate, 1.0);
+        Fill(pacer, flows[i], i, cBytes, deadline);
+        count += (cBytes + payload_size - 1) / payload_size;
+    }
+    std::vector<Arrival> arrivals = Collect(count, 2 * m_opts.seconds + 1);
+    for (int i = 0; i < 2; i++)
+    {
+        pacer.RemoveFlow(flows[i]);
+    }
+
+    double rate = cap / 8;
+    double depth = BucketDepth(rate);
+    double measured = Rate(arrivals, -1, depth);
+    double burst = Burst(arrivals, rate);
+    printf("two flows under a cap of %.0f kB/s: %.0f kB/s in all, %.0f and %.0f kB/s each, largest burst %.0f bytes\n",
+           rate / 1024, measured / 1024, Rate(arrivals, 0, depth / 2) / 1024, Rate(arrivals, 1, depth / 2) / 1024, burst);
+    Check((long)arrivals.size() == count, "every packet arrives");
+    Check(fabs(measured - rate) < (0.03 * rate), "together at the aggregate rate, within 3%");
+
+    // the flows finish together if they shared the cap evenly
+    double ends[2] = { 0, 0 };
+    for (size_t i = 0; i < arrivals.size(); i++)
+    {
+        ends[arrivals[i].flow & 1] = arrivals[i].time;
+    }
+    double length = arrivals.empty() ? 0 : (arrivals.back().time - arrivals.front().time);
+    Check(fabs(ends[0] - ends[1]) < (0.05 * length), "the flows share the cap evenly");
+    Check(burst <= (depth + payload_size + (rate * timestamp_slack)), "no burst beyond the aggregate bucket depth");
+}
+
+void
+Test::Deadline()
+{
+    RTPPacer pacer(0);
+    RTPPacer::Flow* flow = pacer.AddFlow(onSend, &m_senders[0]);
+    double rate = m_opts.rate / 8;
+    pacer.SetRate(flow, m_opts.rate, 1.0);
+
+    // a frame that would take three times the time to its deadline
+    double window = 0.02;
+    long cBytes = (long)(3 * window * rate);
+    long count = (cBytes + payload_size - 1) / payload_size;
+    double start = PacerNow();
+    Fill(pacer, flow, 0, cBytes, start + window);
+    std::vector<Arrival> arrivals = Collect(count, 1);
+    pacer.RemoveFlow(flow);
+
+    double first = arrivals.empty() ? 0 : (arrivals.front().time - start);
+    double last = arrivals.empty() ? 0 : (arrivals.back().time - start);
+    printf("frame of %ld packets due in %.0f ms: first out at %.1f ms, last at %.1f ms\n",
+           count, window * 1000, first * 1000, last * 1000);
+    Check((long)arrivals.size() == count, "every packet arrives");
+    Check(last <= (window + deadline_slack), "the last packet is not late");
+    Check((last - first) >= (window / 2), "the frame is spread over the time to its deadline, not sent at once");
+}
+
+bool
+Test::Run()
+{
+    if (!Open())
+    {
+        perror("opening loopback sockets");
+        return false;
+    }
+    m_thread = std::thread(&Test::Receive, this);
+
+    SingleFlow();
+    Aggregate();
+    Deadline();
+
+    m_bStop = true;
+    m_thread.join();
+    close(m_fdReceive);
+    close(m_senders[0].fd);
+    close(m_senders[1].fd);
+    printf("%s\n", (m_failures == 0) ? "all passed" : "FAILED");
+    return m_failures == 0;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "usage: pacer_loopback [options]\n"
+            "  -r Mbit/s    rate of one flow (16)\n"
+            "  -t seconds   length of each rate phase (2)\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    opts.rate = 16e6;
+    opts.seconds = 2;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': opts.rate = atof(optarg) * 1e6; break;
+            case 't': opts.seconds = atof(optarg); break;
+            default:
+                Usage();
+                return 1;
+        }
+    }
+    if ((optind != argc) || (opts.rate <= 0) || (opts.seconds <= 0))
+    {
+        Usage();
+        return 1;
+    }
+
+    Test test(opts);
+    return test.Run() ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+//
+//  rtp_pcap.cpp
+//  Encoder Demo
+//
+//  Replays the H.264 stream in a pcap or pcapng capture of RTSP/RTP
+//  traffic, so that problems reported from the field can be reproduced
+//  and benchmarked. Each frame is handed to a callback of the same shape
+//  as AVEncoder's (the NALUs of one access unit and its time), either
+//  as fast as the capture can be read or at its original timing or a
+//  multiple of it. Frames can also be written out as an Annex-B
+//  elementary stream for a decoder or analyser. At the end, a summary
+//  of loss, damaged frames and the longest gaps between frames.
+//
+//  RTP over UDP and interleaved on the RTSP connection are both read.
+//  The capture is mapped and parsed in place; see CaptureReader.
+//
+//  Build from this directory with:
+//
+//      g++ -std=c++11 -O2 -I"../Encoder Demo" rtp_pcap.cpp "../Encoder Demo/CaptureReader.cpp" "../Encoder Demo/Base64.cpp" -o rtp_pcap
+//
+//  and run with, for example:
+//
+//      ./rtp_pcap -x stream.264 customer.pcapng
+//      ./rtp_pcap -s 4 -g 0.2 customer.pcap
+//
+
+#include "CaptureReader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+// the longest gaps are listed, up to this many
+static const int max_stalls_listed = 10;
+
+struct Options
+{
+    const char* path;
+    const char* annexB;
+    double speed;           // 0: as fast as possible
+    double stallSeconds;
+    int port;
+    int payloadType;
+    bool bVerbose;
+};
+
+struct Stall
+{
+    double at;              // capture seconds from the first frame
+    double seconds;
+};
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+class Replay
+{
+public:
+    Replay(const Options& opts)
+    : m_opts(opts),
+      m_out(NULL),
+      m_pReader(NULL),
+      m_bStarted(false),
+      m_clockBase(0),
+      m_firstArrival(0),
+      m_lastArrival(0),
+      m_frames(0),
+      m_idrs(0),
+      m_damaged(0),
+      m_nalus(0),
+      m_bytes(0),
+      m_maxLate(0)
+    {
+    }
+
+    bool Run();
+    void Report(CaptureReader& reader, H264Depacketizer& depacketizer, long packets, double elapsed);
+
+private:
+    static void OnAccessUnit(void* ctx, const AccessUnit& au);
+    void Schedule(const AccessUnit& au);
+
+    // where the server's encoder callback would be called with this frame
+    void OnFrame(const AccessUnit& au);
+
+private:
+    Options m_opts;
+    FILE* m_out;
+    CaptureReader* m_pReader;
+    bool m_bStarted;
+    double m_clockBase;
+    double m_firstArrival;
+    double m_lastArrival;
+    long m_frames;
+    long m_idrs;
+    long m_damaged;
+    long m_nalus;
+    long m_bytes;
+    double m_maxLate;
+    std::vector<Stall> m_stalls;
+};
+
+bool
+Replay::Run()
+{
+    CaptureReader reader;
+    if (!reader.Open(m_opts.path))
+    {
+        fprintf(stderr, "%s: not a readable pcap or pcapng file\n", m_opts.path);
+        return false;
+    }
+    reader.SetPort(m_opts.port);
+    m_pReader = &reader;
+    if (m_opts.annexB != NULL)
+    {
+        m_out = fopen(m_opts.annexB, "wb");
+        if (m_out == NULL)
+        {
+            perror(m_opts.annexB);
+            return false;
+        }
+        // frames are written whole: a large buffer saves a syscall per NALU
+        setvbuf(m_out, NULL, _IOFBF, 1024 * 1024);
+    }
+
+    H264Depacketizer depacketizer(OnAccessUnit, this, m_opts.payloadType);
+    CapturedRTP packet;
+    long packets = 0;
+    double start = Now();
+    while (reader.Next(&packet))
+    {
+        packets++;
+        depacketizer.Add(packet);
+    }
+    depacketizer.Flush();
+    double elapsed = Now() - start;
+
+    if (m_out != NULL)
+    {
+        fclose(m_out);
+        m_out = NULL;
+    }
+    Report(reader, depacketizer, packets, elapsed);
+    m_pReader = NULL;
+    return true;
+}
+
+void
+Replay::OnAccessUnit(void* ctx, const AccessUnit& au)
+{
+    Replay* pThis = (Replay*)ctx;
+    pThis->Schedule(au);
+}
+
+void
+Replay::Schedule(const AccessUnit& au)
+{
+    if (!m_bStarted)
+    {
+        m_bStarted = true;
+        m_firstArrival = au.arrival;
+        m_lastArrival = au.arrival;
+        m_clockBase = Now();
+    }
+
+    // gaps are measured on the capture's clock, whatever the replay speed
+    double gap = au.arrival - m_lastArrival;
+    if (gap >= m_opts.stallSeconds)
+    {
+        Stall s;
+        s.at = m_lastArrival - m_firstArrival;
+        s.seconds = gap;
+        m_stalls.push_back(s);
+    }
+    m_lastArrival = au.arrival;
+
+    if (m_opts.speed > 0)
+    {
+        // frames go when they arrived in the capture, so that the
+        // stalls the client saw are reproduced, scaled by the speed
+        double due = m_clockBase + ((au.arrival - m_firstArrival) / m_opts.speed);
+        double now = Now();
+        if (due > now)
+        {
+            usleep((useconds_t)((due - now) * 1e6));
+        }
+        else
+        {
+            m_maxLate = std::max(m_maxLate, now - due);
+        }
+    }
+    OnFrame(au);
+}
+
+void
+Replay::OnFrame(const AccessUnit& au)
+{
+    static const BYTE start_code[] = { 0, 0, 0, 1 };
+    m_frames++;
+    m_nalus += au.Count();
+    if (au.bIDR)
+    {
+        m_idrs++;
+    }
+    if (au.bDamaged)
+    {
+        m_damaged++;
+    }
+    if ((m_frames == 1) && (m_out != NULL))
+    {
+        // a stream whose parameter sets were only in the SDP needs
+        // them in front, or nothing can decode it
+        bool bInBand = false;
+        for (int i = 0; i < au.Count(); i++)
+        {
+            bInBand = bInBand || ((au.NALU(i)[0] & 0x1f) == NALUnit::NAL_Sequence_Params);
+        }
+        const std::vector<std::vector<BYTE> >& params = m_pReader->ParameterSets();
+        for (size_t i = 0; !bInBand && (i < params.size()); i++)
+        {
+            fwrite(start_code, 1, sizeof(start_code), m_out);
+            fwrite(&params[i][0], 1, params[i].size(), m_out);
+        }
+    }
+    int cBytes = 0;
+    for (int i = 0; i < au.Count(); i++)
+    {
+        cBytes += au.Length(i);
+        if (m_out != NULL)
+        {
+            fwrite(start_code, 1, sizeof(start_code), m_out);
+            fwrite(au.NALU(i), 1, au.Length(i), m_out);
+        }
+    }
+    m_bytes += cBytes;
+    if (m_opts.bVerbose)
+    {
+        printf("%8.3f  pts %8.3f  %2d NALUs %7d bytes%s%s\n",
+               au.arrival - m_firstArrival, au.pts, au.Count(), cBytes,
+               au.bIDR ? "  IDR" : "", au.bDamaged ? "  damaged" : "");
+    }
+}
+
+static bool LongerStall(const Stall& a, const Stall& b)
+{
+    return a.seconds > b.seconds;
+}
+
+void
+Replay::Report(CaptureReader& reader, H264Depacketizer& depacketizer, long packets, double elapsed)
+{
+    double mb = reader.FileSize() / (1024.0 * 1024.0);
+    printf("%s: %.1f MB, %ld records, %ld RTP packets (ssrc %08x)\n",
+           m_opts.path, mb, reader.Records(), packets, depacketizer.SSRC());
+    printf("frames %ld  IDR %ld  NALUs %ld  bytes %ld  lost packets %ld  damaged frames %ld\n",
+           m_frames, m_idrs, m_nalus, m_bytes, depacketizer.Lost(), m_damaged);
+    if (m_frames > 0)
+    {
+        double span = m_lastArrival - m_firstArrival;
+        printf("capture span %.1f s, processed in %.2f s (%.0f MB/s, %.0fx real time)\n",
+               span, elapsed, (elapsed > 0) ? (mb / elapsed) : 0, (elapsed > 0) ? (span / elapsed) : 0);
+    }
+    if (m_opts.speed > 0)
+    {
+        printf("replayed at %gx: latest frame %.1f ms behind schedule\n", m_opts.speed, m_maxLate * 1000);
+    }
+
+    std::sort(m_stalls.begin(), m_stalls.end(), LongerStall);
+    printf("%d gaps of %.0f ms or more between frames\n", (int)m_stalls.size(), m_opts.stallSeconds * 1000);
+    for (int i = 0; (i < (int)m_stalls.size()) && (i < max_stalls_listed); i++)
+    {
+        printf("  at %9.3f s: %.0f ms\n", m_stalls[i].at, m_stalls[i].seconds * 1000);
+    }
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: rtp_pcap [options] capture\n"
+            "  -x file      write the H.264 stream to file as Annex-B\n"
+            "  -s speed     replay at the capture's timing times speed (as fast as possible)\n"
+            "  -g seconds   report gaps between frames of at least this (0.25)\n"
+            "  -p port      only UDP RTP to or from this port (any)\n"
+            "  -P type      H.264 payload type, or -1 for the first dynamic type (96)\n"
+            "  -v           a line per frame\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    opts.path = NULL;
+    opts.annexB = NULL;
+    opts.speed = 0;
+    opts.stallSeconds = 0.25;
+    opts.port = 0;
+    opts.payloadType = 96;
+    opts.bVerbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "x:s:g:p:P:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'x': opts.annexB = optarg; break;
+            case 's': opts.speed = atof(optarg); break;
+            case 'g': opts.stallSeconds = atof(optarg); break;
+            case 'p': opts.port = atoi(optarg); break;
+            case 'P': opts.payloadType = atoi(optarg); break;
+            case 'v': opts.bVerbose = true; break;
+            default:
+                Usage();
+                return 1;
+        }
+    }
+    if ((optind >= argc) || (opts.speed < 0) || (opts.stallSeconds <= 0))
+    {
+        Usage();
+        return 1;
+    }
+    opts.path = argv[optind];
+
+    Replay replay(opts);
+    return replay.Run() ? 0 : 1;
+}
@@ -0,0 +1,1208 @@
+//
+//  rtsp_loadgen.cpp
+//  Encoder Demo
+//
+//  Load generator and test receiver for RTSPServer. Opens N RTSP
+//  sessions from one process, runs OPTIONS / DESCRIBE / SETUP / PLAY
+//  on each, and receives the RTP that follows: FU-A and STAP-A are
+//  reassembled into NALUs, sequence numbers and timestamps are checked,
+//  RTX and FlexFEC are used to repair losses, and receiver reports go
+//  back to the server so that its RTCP path is exercised too. At the
+//  end, a line per session and a summary of loss, jitter and the time
+//  from PLAY to the first IDR.
+//
+//  Linux only (epoll). Build from this directory with:
+//
+//      g++ -std=c++11 -O2 -I"../Encoder Demo" rtsp_loadgen.cpp "../Encoder Demo/FEC.cpp" -o rtsp_loadgen
+//
+//  and run with, for example:
+//
+//      ./rtsp_loadgen -n 2000 -t 30 192.168.1.20
+//
+//  Each UDP session uses three descriptors, so raise ulimit -n first.
+//
+
+#include "FEC.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static const int max_packet_size = 1500;
+static const int payload_h264 = 96;
+static const int payload_rtx = 97;
+static const int payload_fec = 98;
+static const int server_rtcp_port = 6971;
+
+enum SessionState
+{
+    Connecting,
+    WaitOptions,
+    WaitDescribe,
+    WaitSetup,
+    WaitPlay,
+    Playing,
+    Failed,
+};
+
+static const char* state_names[] = { "connecting", "options", "describe", "setup", "play", "playing", "failed" };
+
+enum EndpointKind
+{
+    EndpointControl,
+    EndpointRTP,
+    EndpointRTCP,
+};
+
+struct Session;
+
+struct Endpoint
+{
+    Session* session;
+    EndpointKind kind;
+};
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static uint16_t from_net_short(const BYTE* p)
+{
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+static uint32_t from_net_long(const BYTE* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void to_net_long(BYTE* p, uint32_t l)
+{
+    p[0] = (l >> 24) & 0xff;
+    p[1] = (l >> 16) & 0xff;
+    p[2] = (l >> 8) & 0xff;
+    p[3] = l & 0xff;
+}
+
+// --- receive statistics (RFC 3550 A.1, A.8) ------------------------
+
+class StreamStatistics
+{
+public:
+    StreamStatistics()
+    : m_bInit(false),
+      m_ssrc(0),
+      m_baseSeq(0),
+      m_maxSeq(0),
+      m_cycles(0),
+      m_received(0),
+      m_outOfOrder(0),
+      m_jitter(0),
+      m_transit(0),
+      m_lastTS(0),
+      m_bLastMarker(false),
+      m_tsErrors(0),
+      m_bytes(0),
+      m_expectedPrior(0),
+      m_receivedPrior(0)
+    {
+    }
+
+    // 1 if the packet is the next in sequence, 0 if it follows a gap,
+    // or -1 if it is late or a duplicate
+    int Add(const BYTE* p, int cBytes, double arrival, bool bRepair)
+    {
+        uint16_t seq = from_net_short(p + 2);
+        uint32_t ts = from_net_long(p + 4);
+        bool bMarker = (p[1] & 0x80) != 0;
+        m_received++;
+        m_bytes += cBytes;
+        if (!m_bInit)
+        {
+            m_bInit = true;
+            m_ssrc = from_net_long(p + 8);
+            m_baseSeq = m_maxSeq = seq;
+            Track(ts, bMarker, arrival, bRepair);
+            return 1;
+        }
+        int16_t delta = int16_t(seq - m_maxSeq);
+        if (delta <= 0)
+        {
+            // late, a duplicate, or a repair of something we had given up on
+            if (!bRepair)
+            {
+                m_outOfOrder++;
+            }
+            return -1;
+        }
+        if (seq < m_maxSeq)
+        {
+            m_cycles += 65536;
+        }
+        m_maxSeq = seq;
+        if (delta == 1)
+        {
+            // within an access unit the timestamp is fixed; after the
+            // marker it must move forward
+            int32_t step = int32_t(ts - m_lastTS);
+            if ((!m_bLastMarker && (step != 0)) || (m_bLastMarker && (step <= 0)))
+            {
+                m_tsErrors++;
+            }
+        }
+        Track(ts, bMarker, arrival, bRepair);
+        return (delta == 1) ? 1 : 0;
+    }
+
+    uint32_t SSRC()         { return m_ssrc; }
+    long Expected()         { return m_bInit ? long(m_cycles + m_maxSeq - m_baseSeq + 1) : 0; }
+    long Received()         { return m_received; }
+    long Lost()             { return std::max(0L, Expected() - m_received); }
+    long OutOfOrder()       { return m_outOfOrder; }
+    long TimestampErrors()  { return m_tsErrors; }
+    long Bytes()            { return m_bytes; }
+    uint32_t ExtendedMax()  { return m_cycles + m_maxSeq; }
+    double Jitter()         { return m_jitter / 90000; }
+
+    // report block fields since the last call
+    void Interval(int* pFraction, long* pCumulative)
+    {
+        long expected = Expected();
+        long intervalExpected = expected - m_expectedPrior;
+        long intervalReceived = m_received - m_receivedPrior;
+        m_expectedPrior = expected;
+        m_receivedPrior = m_received;
+        long lost = intervalExpected - intervalReceived;
+        *pFraction = ((intervalExpected == 0) || (lost <= 0)) ? 0 : int((lost << 8) / intervalExpected);
+        *pCumulative = Lost();
+    }
+
+    uint32_t JitterUnits()  { return uint32_t(m_jitter); }
+
+private:
+    void Track(uint32_t ts, bool bMarker, double arrival, bool bRepair)
+    {
+        m_lastTS = ts;
+        m_bLastMarker = bMarker;
+        if (bRepair)
+        {
+            // arrival time of a repair says nothing about network jitter
+            return;
+        }
+        double transit = (arrival * 90000) - ts;
+        if (m_transit != 0)
+        {
+            double d = fabs(transit - m_transit);
+            m_jitter += (d - m_jitter) / 16;
+        }
+        m_transit = transit;
+    }
+
+private:
+    bool m_bInit;
+    uint32_t m_ssrc;
+    uint16_t m_baseSeq;
+    uint16_t m_maxSeq;
+    uint32_t m_cycles;
+    long m_received;
+    long m_outOfOrder;
+    double m_jitter;
+    double m_transit;
+    uint32_t m_lastTS;
+    bool m_bLastMarker;
+    long m_tsErrors;
+    long m_bytes;
+    long m_expectedPrior;
+    long m_receivedPrior;
+};
+
+// --- H.264 depacketizer (RFC 6184) -----------------------------------
+
+class Depacketizer
+{
+public:
+    Depacketizer()
+    : m_bFragment(false),
+      m_nalus(0),
+      m_idrs(0),
+      m_discarded(0)
+    {
+    }
+
+    // bContiguous is false if packets have been lost since the last call.
+    // Returns the number of IDR NALUs completed by this packet.
+    int Add(const BYTE* p, int cBytes, bool bContiguous)
+    {
+        if (!bContiguous && m_bFragment)
+        {
+            // a hole in the middle of a fragmented NALU
+            m_bFragment = false;
+            m_discarded++;
+        }
+        if (cBytes < 1)
+        {
+            return 0;
+        }
+        int type = p[0] & 0x1f;
+        int idrs = 0;
+        if ((type >= 1) && (type <= 23))
+        {
+            idrs += OnNALU(p[0]);
+        }
+        else if (type == 24)
+        {
+            // STAP-A: 16-bit length before each NALU
+            int idx = 1;
+            while ((idx + 2) <= cBytes)
+            {
+                int cNALU = from_net_short(p + idx);
+                idx += 2;
+                if ((cNALU == 0) || ((idx + cNALU) > cBytes))
+                {
+                    m_discarded++;
+                    break;
+                }
+                idrs += OnNALU(p[idx]);
+                idx += cNALU;
+            }
+        }
+        else if ((type == 28) && (cBytes >= 2))
+        {
+            BYTE fu = p[1];
+            if (fu & 0x80)
+            {
+                if (m_bFragment)
+                {
+                    m_discarded++;
+                }
+                m_bFragment = true;
+                m_nalu.clear();
+                m_nalu.push_back((p[0] & 0xe0) | (fu & 0x1f));
+            }
+            else if (!m_bFragment)
+            {
+                // the start was lost
+                return 0;
+            }
+            m_nalu.insert(m_nalu.end(), p + 2, p + cBytes);
+            if (fu & 0x40)
+            {
+                m_bFragment = false;
+                idrs += OnNALU(m_nalu[0]);
+            }
+        }
+        else
+        {
+            m_discarded++;
+        }
+        return idrs;
+    }
+
+    long NALUs()        { return m_nalus; }
+    long IDRs()         { return m_idrs; }
+    long Discarded()    { return m_discarded; }
+
+private:
+    // a complete NALU, known by its header byte
+    int OnNALU(BYTE header)
+    {
+        m_nalus++;
+        if ((header & 0x1f) == 5)
+        {
+            m_idrs++;
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    bool m_bFragment;
+    std::vector<BYTE> m_nalu;
+    long m_nalus;
+    long m_idrs;
+    long m_discarded;
+};
+
+// --- one RTSP session ---------------------------------------------
+
+struct Session
+{
+    int id;
+    SessionState state;
+    int fd;
+    int fdRTP;
+    int fdRTCP;
+    int portRTP;
+    int portRTCP;
+    Endpoint epControl;
+    Endpoint epRTP;
+    Endpoint epRTCP;
+
+    int cseq;
+    std::string session;
+    std::string input;
+    std::string output;
+    std::string error;
+
+    double tStart;
+    double tPlay;
+    double tFirstPacket;
+    double tFirstIDR;
+    double tLastRR;
+
+    // middle 32 bits of the last SR's NTP time, and when it arrived
+    uint32_t lsr;
+    double tLSR;
+
+    StreamStatistics stats;
+    Depacketizer depack;
+    FECDecoder* fec;
+    long rtx;
+    long fecRepairs;
+    long recovered;
+    long reports;
+};
+
+struct Options
+{
+    const char* host;
+    int port;
+    int sessions;
+    double duration;
+    double rampRate;        // new sessions per second
+    bool bTCP;
+    bool bVerbose;
+};
+
+class LoadGenerator
+{
+public:
+    LoadGenerator(const Options& opts)
+    : m_opts(opts),
+      m_epoll(-1),
+      m_started(0)
+    {
+        memset(&m_server, 0, sizeof(m_server));
+    }
+
+    ~LoadGenerator()
+    {
+        for (size_t i = 0; i < m_sessions.size(); i++)
+        {
+            Close(m_sessions[i]);
+            delete m_sessions[i]->fec;
+            delete m_sessions[i];
+        }
+        if (m_epoll >= 0)
+        {
+            close(m_epoll);
+        }
+    }
+
+    bool Run();
+    void Report();
+
+private:
+    bool Resolve();
+    bool Start(Session* s);
+    void Close(Session* s);
+    void Fail(Session* s, const char* why);
+    void Watch(int fd, Endpoint* ep, uint32_t events);
+
+    void OnControlWritable(Session* s);
+    void OnControlReadable(Session* s);
+    void OnResponse(Session* s, int status, const std::string& headers, const std::string& body);
+    void SendRequest(Session* s, const char* method, const std::string& url, const std::string& extra);
+
+    void OnUDP(Session* s, int fd, bool bRTCP);
+    void OnRTP(Session* s, const BYTE* p, int cBytes, double now);
+    void OnMedia(Session* s, const BYTE* p, int cBytes, double now, bool bRepair);
+    void OnRTCP(Session* s, const BYTE* p, int cBytes, double now);
+    void SendReceiverReport(Session* s, double now);
+
+    std::string URL(const char* path);
+
+private:
+    Options m_opts;
+    int m_epoll;
+    struct sockaddr_in m_server;
+    std::vector<Session*> m_sessions;
+    int m_started;
+};
+
+static std::string HeaderValue(const std::string& headers, const char* name)
+{
+    size_t cName = strlen(name);
+    size_t idx = 0;
+    while (idx < headers.size())
+    {
+        size_t end = headers.find("\r\n", idx);
+        if (end == std::string::npos)
+        {
+            end = headers.size();
+        }
+        if (((end - idx) > cName) && (strncasecmp(headers.c_str() + idx, name, cName) == 0) && (headers[idx + cName] == ':'))
+        {
+            size_t v = idx + cName + 1;
+            while ((v < end) && (headers[v] == ' '))
+            {
+                v++;
+            }
+            return headers.substr(v, end - v);
+        }
+        idx = end + 2;
+    }
+    return std::string();
+}
+
+bool
+LoadGenerator::Resolve()
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    if ((getaddrinfo(m_opts.host, NULL, &hints, &result) != 0) || (result == NULL))
+    {
+        fprintf(stderr, "cannot resolve %s\n", m_opts.host);
+        return false;
+    }
+    memcpy(&m_server, result->ai_addr, sizeof(m_server));
+    m_server.sin_port = htons(m_opts.port);
+    freeaddrinfo(result);
+    return true;
+}
+
+std::string
+LoadGenerator::URL(const char* path)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "rtsp://%s:%d/%s", inet_ntoa(m_server.sin_addr), m_opts.port, path);
+    return url;
+}
+
+void
+LoadGenerator::Watch(int fd, Endpoint* ep, uint32_t events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = ep;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+static int BindUDP(int* pPort)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int size = 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    socklen_t cAddr = sizeof(addr);
+    if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+        (getsockname(fd, (struct sockaddr*)&addr, &cAddr) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+    *pPort = ntohs(addr.sin_port);
+    return fd;
+}
+
+bool
+LoadGenerator::Start(Session* s)
+{
+    s->state = Connecting;
+    s->tStart = Now();
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd < 0)
+    {
+        Fail(s, strerror(errno));
+        return false;
+    }
+    int t = 1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &t, sizeof(t));
+    if ((connect(s->fd, (struct sockaddr*)&m_server, sizeof(m_server)) < 0) && (errno != EINPROGRESS))
+    {
+        Fail(s, strerror(errno));
+        return false;
+    }
+    s->epControl.session = s;
+    s->epControl.kind = EndpointControl;
+    Watch(s->fd, &s->epControl, EPOLLIN | EPOLLOUT);
+
+    if (!m_opts.bTCP)
+    {
+        s->fdRTP = BindUDP(&s->portRTP);
+        s->fdRTCP = BindUDP(&s->portRTCP);
+        if ((s->fdRTP < 0) || (s->fdRTCP < 0))
+        {
+            Fail(s, "cannot bind UDP ports");
+            return false;
+        }
+        s->epRTP.session = s;
+        s->epRTP.kind = EndpointRTP;
+        s->epRTCP.session = s;
+        s->epRTCP.kind = EndpointRTCP;
+        Watch(s->fdRTP, &s->epRTP, EPOLLIN);
+        Watch(s->fdRTCP, &s->epRTCP, EPOLLIN);
+    }
+    return true;
+}
+
+void
+LoadGenerator::Close(Session* s)
+{
+    int* fds[] = { &s->fd, &s->fdRTP, &s->fdRTCP };
+    for (int i = 0; i < 3; i++)
+    {
+        if (*fds[i] >= 0)
+        {
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, *fds[i], NULL);
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+}
+
+void
+LoadGenerator::Fail(Session* s, const char* why)
+{
+    if (s->state != Failed)
+    {
+        s->error = std::string(state_names[s->state]) + ": " + why;
+        s->state = Failed;
+        if (m_opts.bVerbose)
+        {
+            fprintf(stderr, "session %d failed in %s\n", s->id, s->error.c_str());
+        }
+    }
+    Close(s);
+}
+
+void
+LoadGenerator::SendRequest(Session* s, const char* method, const std::string& url, const std::string& extra)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: rtsp_loadgen\r\n", method, url.c_str(), ++s->cseq);
+    s->output += line;
+    s->output += extra;
+    s->output += "\r\n";
+    OnControlWritable(s);
+}
+
+void
+LoadGenerator::OnControlWritable(Session* s)
+{
+    if (s->state == Connecting)
+    {
+        int err = 0;
+        socklen_t cErr = sizeof(err);
+        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &cErr);
+        if (err != 0)
+        {
+            Fail(s, strerror(err));
+            return;
+        }
+        s->state = WaitOptions;
+        SendRequest(s, "OPTIONS", URL(""), "");
+        return;
+    }
+    while (!s->output.empty())
+    {
+        ssize_t cSent = send(s->fd, s->output.data(), s->output.size(), MSG_NOSIGNAL);
+        if (cSent < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            Fail(s, strerror(errno));
+            return;
+        }
+        s->output.erase(0, cSent);
+    }
+    Watch(s->fd, &s->epControl, s->output.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT));
+}
+
+void
+LoadGenerator::OnControlReadable(Session* s)
+{
+    char buf[16 * 1024];
+    for (;;)
+    {
+        ssize_t cRead = recv(s->fd, buf, sizeof(buf), 0);
+        if (cRead == 0)
+        {
+            Fail(s, "server closed the connection");
+            return;
+        }
+        if (cRead < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            Fail(s, strerror(errno));
+            return;
+        }
+        s->input.append(buf, cRead);
+    }
+
+    double now = Now();
+    while (!s->input.empty() && (s->state != Failed))
+    {
+        const BYTE* p = (const BYTE*)s->input.data();
+        size_t cBytes = s->input.size();
+        size_t cUsed;
+        if (p[0] == '$')
+        {
+            // interleaved RTP or RTCP
+            if (cBytes < 4)
+            {
+                break;
+            }
+            size_t cFrame = from_net_short(p + 2);
+            if (cBytes < (cFrame + 4))
+            {
+                break;
+            }
+            if (p[1] == 0)
+            {
+                OnRTP(s, p + 4, (int)cFrame, now);
+            }
+            else if (p[1] == 1)
+            {
+                OnRTCP(s, p + 4, (int)cFrame, now);
+            }
+            cUsed = cFrame + 4;
+        }
+        else
+        {
+            size_t end = s->input.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            std::string headers = s->input.substr(0, end + 2);
+            size_t cBody = atoi(HeaderValue(headers, "Content-Length").c_str());
+            if (cBytes < (end + 4 + cBody))
+            {
+                break;
+            }
+            std::string body = s->input.substr(end + 4, cBody);
+            int status = 0;
+            if (sscanf(headers.c_str(), "RTSP/1.0 %d", &status) != 1)
+            {
+                Fail(s, "bad response line");
+                return;
+            }
+            OnResponse(s, status, headers, body);
+            cUsed = end + 4 + cBody;
+        }
+        s->input.erase(0, cUsed);
+    }
+}
+
+void
+LoadGenerator::OnResponse(Session* s, int status, const std::string& headers, const std::string& body)
+{
+    if (status != 200)
+    {
+        char why[64];
+        snprintf(why, sizeof(why), "status %d", status);
+        Fail(s, why);
+        return;
+    }
+    switch (s->state)
+    {
+        case WaitOptions:
+            s->state = WaitDescribe;
+            SendRequest(s, "DESCRIBE", URL(""), "Accept: application/sdp\r\n");
+            break;
+
+        case WaitDescribe:
+        {
+            if (body.find("m=video") == std::string::npos)
+            {
+                Fail(s, "no video in SDP");
+                return;
+            }
+            char transport[128];
+            if (m_opts.bTCP)
+            {
+                snprintf(transport, sizeof(transport), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+            }
+            else
+            {
+                snprintf(transport, sizeof(transport), "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", s->portRTP, s->portRTCP);
+            }
+            s->state = WaitSetup;
+            SendRequest(s, "SETUP", URL("streamid=1"), transport);
+            break;
+        }
+
+        case WaitSetup:
+        {
+            s->session = HeaderValue(headers, "Session");
+            size_t semi = s->session.find(';');
+            if (semi != std::string::npos)
+            {
+                s->session.erase(semi);
+            }
+            if (s->session.empty())
+            {
+                Fail(s, "no session id");
+                return;
+            }
+            s->state = WaitPlay;
+            s->tPlay = Now();
+            SendRequest(s, "PLAY", URL(""), "Session: " + s->session + "\r\n");
+            break;
+        }
+
+        case WaitPlay:
+            s->state = Playing;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void
+LoadGenerator::OnUDP(Session* s, int fd, bool bRTCP)
+{
+    BYTE buf[max_packet_size];
+    for (;;)
+    {
+        ssize_t cRead = recv(fd, buf, sizeof(buf), 0);
+        if (cRead < 0)
+        {
+            break;
+        }
+        double now = Now();
+        if (bRTCP)
+        {
+            OnRTCP(s, buf, (int)cRead, now);
+        }
+        else
+        {
+            OnRTP(s, buf, (int)cRead, now);
+        }
+    }
+}
+
+void
+LoadGenerator::OnRTP(Session* s, const BYTE* p, int cBytes, double now)
+{
+    if ((cBytes < 12) || ((p[0] >> 6) != 2))
+    {
+        return;
+    }
+    if (s->tFirstPacket == 0)
+    {
+        s->tFirstPacket = now;
+    }
+    int pt = p[1] & 0x7f;
+    if (pt == payload_h264)
+    {
+        OnMedia(s, p, cBytes, now, false);
+    }
+    else if ((pt == payload_rtx) && (cBytes >= 14))
+    {
+        // rebuild the original: its sequence number is the first two
+        // bytes of payload, and the rest of its header is ours
+        BYTE original[max_packet_size];
+        memcpy(original, p, 12);
+        original[1] = (p[1] & 0x80) | payload_h264;
+        original[2] = p[12];
+        original[3] = p[13];
+        to_net_long(original + 8, s->stats.SSRC());
+        memcpy(original + 12, p + 14, cBytes - 14);
+        s->rtx++;
+        OnMedia(s, original, cBytes - 2, now, true);
+    }
+    else if (pt == payload_fec)
+    {
+        s->fecRepairs++;
+        std::vector<std::vector<BYTE> > recovered;
+        s->fec->AddRepair(p, cBytes, &recovered);
+        for (size_t i = 0; i < recovered.size(); i++)
+        {
+            s->recovered++;
+            OnMedia(s, &recovered[i][0], (int)recovered[i].size(), now, true);
+        }
+    }
+}
+
+void
+LoadGenerator::OnMedia(Session* s, const BYTE* p, int cBytes, double now, bool bRepair)
+{
+    if (!bRepair)
+    {
+        s->fec->AddMedia(p, cBytes);
+    }
+    int order = s->stats.Add(p, cBytes, now, bRepair);
+
+    // a packet (or repair) that arrives after later packets only counts
+    // towards loss: the NALU it belonged to has already been given up on
+    if (order >= 0)
+    {
+        int idrs = s->depack.Add(p + 12, cBytes - 12, order > 0);
+        if ((idrs > 0) && (s->tFirstIDR == 0))
+        {
+            s->tFirstIDR = now;
+        }
+    }
+    if ((s->tLastRR == 0) || ((now - s->tLastRR) >= 1))
+    {
+        SendReceiverReport(s, now);
+    }
+}
+
+void
+LoadGenerator::OnRTCP(Session* s, const BYTE* p, int cBytes, double now)
+{
+    // only the SR matters to us: its NTP time goes back as LSR
+    while (cBytes >= 8)
+    {
+        int cThis = (from_net_short(p + 2) + 1) * 4;
+        if (cThis > cBytes)
+        {
+            break;
+        }
+        if ((p[1] == 200) && (cThis >= 28))
+        {
+            s->lsr = (from_net_long(p + 8) << 16) | (from_net_long(p + 12) >> 16);
+            s->tLSR = now;
+        }
+        p += cThis;
+        cBytes -= cThis;
+    }
+}
+
+void
+LoadGenerator::SendReceiverReport(Session* s, double now)
+{
+    s->tLastRR = now;
+    int fraction;
+    long cumulative;
+    s->stats.Interval(&fraction, &cumulative);
+    uint32_t dlsr = 0;
+    if (s->tLSR > 0)
+    {
+        dlsr = uint32_t((now - s->tLSR) * 65536);
+    }
+
+    // RR with one report block, then SDES CNAME
+    BYTE buf[64];
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0x81;
+    buf[1] = 201;
+    buf[3] = 7;
+    to_net_long(buf + 4, 0x10000 + s->id);
+    to_net_long(buf + 8, s->stats.SSRC());
+    buf[12] = BYTE(std::min(fraction, 255));
+    buf[13] = (cumulative >> 16) & 0xff;
+    buf[14] = (cumulative >> 8) & 0xff;
+    buf[15] = cumulative & 0xff;
+    to_net_long(buf + 16, s->stats.ExtendedMax());
+    to_net_long(buf + 20, s->stats.JitterUnits());
+    to_net_long(buf + 24, s->lsr);
+    to_net_long(buf + 28, dlsr);
+
+    BYTE* sdes = buf + 32;
+    char cname[16];
+    int cName = snprintf(cname, sizeof(cname), "loadgen%d", s->id);
+    int cChunk = ((4 + 2 + cName + 1) + 3) & ~3;
+    sdes[0] = 0x81;
+    sdes[1] = 202;
+    sdes[3] = BYTE(cChunk / 4);
+    to_net_long(sdes + 4, 0x10000 + s->id);
+    sdes[8] = 1;
+    sdes[9] = BYTE(cName);
+    memcpy(sdes + 10, cname, cName);
+    int cTotal = 32 + 4 + cChunk;
+
+    if (m_opts.bTCP)
+    {
+        if (cTotal < 256)
+        {
+            char frame[4] = { '$', 1, 0, char(cTotal) };
+            s->output.append(frame, 4);
+            s->output.append((const char*)buf, cTotal);
+            OnControlWritable(s);
+        }
+    }
+    else
+    {
+        struct sockaddr_in addr = m_server;
+        addr.sin_port = htons(server_rtcp_port);
+        sendto(s->fdRTCP, buf, cTotal, 0, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    s->reports++;
+}
+
+bool
+LoadGenerator::Run()
+{
+    if (!Resolve())
+    {
+        return false;
+    }
+    m_epoll = epoll_create1(0);
+    if (m_epoll < 0)
+    {
+        perror("epoll_create1");
+        return false;
+    }
+    for (int i = 0; i < m_opts.sessions; i++)
+    {
+        Session* s = new Session();
+        s->id = i;
+        s->fd = s->fdRTP = s->fdRTCP = -1;
+        s->fec = new FECDecoder(1024, max_packet_size);
+        m_sessions.push_back(s);
+    }
+
+    double tBegin = Now();
+    double tEnd = tBegin + m_opts.duration;
+    std::vector<struct epoll_event> events(1024);
+    for (;;)
+    {
+        double now = Now();
+        if (now >= tEnd)
+        {
+            break;
+        }
+        // ramp up rather than opening every connection at once
+        int due = m_opts.sessions;
+        if (m_opts.rampRate > 0)
+        {
+            due = std::min(m_opts.sessions, int((now - tBegin) * m_opts.rampRate) + 1);
+        }
+        while (m_started < due)
+        {
+            Start(m_sessions[m_started++]);
+        }
+
+        int n = epoll_wait(m_epoll, &events[0], (int)events.size(), 10);
+        for (int i = 0; i < n; i++)
+        {
+            Endpoint* ep = (Endpoint*)events[i].data.ptr;
+            Session* s = ep->session;
+            if (s->state == Failed)
+            {
+                continue;
+            }
+            switch (ep->kind)
+            {
+                case EndpointControl:
+                    if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    {
+                        int err = 0;
+                        socklen_t cErr = sizeof(err);
+                        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &cErr);
+                        Fail(s, err ? strerror(err) : "hangup");
+                        break;
+                    }
+                    if (events[i].events & EPOLLOUT)
+                    {
+                        OnControlWritable(s);
+                    }
+                    if ((events[i].events & EPOLLIN) && (s->state != Failed))
+                    {
+                        OnControlReadable(s);
+                    }
+                    break;
+
+                case EndpointRTP:
+                    OnUDP(s, s->fdRTP, false);
+                    break;
+
+                case EndpointRTCP:
+                    OnUDP(s, s->fdRTCP, true);
+                    break;
+            }
+        }
+    }
+
+    // polite shutdown, so the server's session count drops straight away
+    for (size_t i = 0; i < m_sessions.size(); i++)
+    {
+        Session* s = m_sessions[i];
+        if ((s->state != Failed) && (s->fd >= 0) && !s->session.empty())
+        {
+            SendRequest(s, "TEARDOWN", URL(""), "Session: " + s->session + "\r\n");
+        }
+    }
+    return true;
+}
+
+static double Percentile(std::vector<double>& v, double pct)
+{
+    if (v.empty())
+    {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    size_t idx = size_t(pct * (v.size() - 1));
+    return v[idx];
+}
+
+void
+LoadGenerator::Report()
+{
+    long expected = 0;
+    long lost = 0;
+    long bytes = 0;
+    long tsErrors = 0;
+    long outOfOrder = 0;
+    long nalus = 0;
+    long discarded = 0;
+    long rtx = 0;
+    long recovered = 0;
+    int playing = 0;
+    int failed = 0;
+    double maxJitter = 0;
+    double sumJitter = 0;
+    std::vector<double> joins;
+
+    if (m_opts.bVerbose)
+    {
+        printf("%6s %-8s %9s %7s %8s %9s %9s %6s %6s %s\n",
+               "id", "state", "packets", "lost", "jit(ms)", "idr(ms)", "nalus", "rtx", "fec", "error");
+    }
+    for (size_t i = 0; i < m_sessions.size(); i++)
+    {
+        Session* s = m_sessions[i];
+        double join = ((s->tFirstIDR > 0) && (s->tPlay > 0)) ? (s->tFirstIDR - s->tPlay) : -1;
+        if (m_opts.bVerbose)
+        {
+            printf("%6d %-8s %9ld %7ld %8.2f %9.1f %9ld %6ld %6ld %s\n",
+                   s->id, state_names[s->state], s->stats.Received(), s->stats.Lost(),
+                   s->stats.Jitter() * 1000, join * 1000, s->depack.NALUs(),
+                   s->rtx, s->recovered, s->error.c_str());
+        }
+        if (s->state == Failed)
+        {
+            failed++;
+        }
+        else if (s->state == Playing)
+        {
+            playing++;
+        }
+        expected += s->stats.Expected();
+        lost += s->stats.Lost();
+        bytes += s->stats.Bytes();
+        tsErrors += s->stats.TimestampErrors();
+        outOfOrder += s->stats.OutOfOrder();
+        nalus += s->depack.NALUs();
+        discarded += s->depack.Discarded();
+        rtx += s->rtx;
+        recovered += s->recovered;
+        sumJitter += s->stats.Jitter();
+        maxJitter = std::max(maxJitter, s->stats.Jitter());
+        if (join >= 0)
+        {
+            joins.push_back(join);
+        }
+    }
+
+    int cSessions = (int)m_sessions.size();
+    printf("sessions:   %d started, %d playing, %d failed\n", m_started, playing, failed);
+    printf("received:   %.1f MB, %.2f Mbit/s aggregate\n", bytes / 1e6, (bytes * 8) / (m_opts.duration * 1e6));
+    printf("loss:       %ld of %ld packets (%.3f%%) after %ld retransmissions and %ld FEC recoveries\n",
+           lost, expected, expected ? (100.0 * lost / expected) : 0.0, rtx, recovered);
+    printf("order:      %ld out of order, %ld timestamp errors\n", outOfOrder, tsErrors);
+    printf("jitter:     %.2f ms mean, %.2f ms max\n",
+           cSessions ? (sumJitter * 1000 / cSessions) : 0.0, maxJitter * 1000);
+    printf("NALUs:      %ld complete, %ld discarded\n", nalus, discarded);
+    printf("first IDR:  %zu sessions; %.1f / %.1f / %.1f / %.1f ms (min / median / p95 / max)\n",
+           joins.size(),
+           Percentile(joins, 0) * 1000, Percentile(joins, 0.5) * 1000,
+           Percentile(joins, 0.95) * 1000, Percentile(joins, 1) * 1000);
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: rtsp_loadgen [options] host\n"
+            "  -p port      RTSP port (554)\n"
+            "  -n sessions  number of sessions (1)\n"
+            "  -t seconds   test duration (10)\n"
+            "  -r rate      sessions started per second (all at once)\n"
+            "  -T           RTP over the RTSP connection instead of UDP\n"
+            "  -v           a line per session\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    opts.host = NULL;
+    opts.port = 554;
+    opts.sessions = 1;
+    opts.duration = 10;
+    opts.rampRate = 0;
+    opts.bTCP = false;
+    opts.bVerbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:t:r:Tv")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': opts.port = atoi(optarg); break;
+            case 'n': opts.sessions = atoi(optarg); break;
+            case 't': opts.duration = atof(optarg); break;
+            case 'r': opts.rampRate = atof(optarg); break;
+            case 'T': opts.bTCP = true; break;
+            case 'v': opts.bVerbose = true; break;
+            default:
+                Usage();
+                return 1;
+        }
+    }
+    if ((optind >= argc) || (opts.sessions < 1))
+    {
+        Usage();
+        return 1;
+    }
+    opts.host = argv[optind];
+
+    LoadGenerator gen(opts);
+    if (!gen.Run())
+    {
+        return 1;
+    }
+    gen.Report();
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+     File: CPUBlur.c
+ Abstract: Separable blur of any radius for CPUImaging, and the sharpen filters built on it.
+
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "CPUBlur.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CPU_AVX2 1
+#endif
+
+
+// The boxes run along strips of 8 rows, one pixel of each in a vector. A block is
+// 4 strips, so that each row of the transposed output gets 128 bytes at a time.
+#define STRIP_ROWS 8
+#define COLUMN_BYTES (4*STRIP_ROWS)
+#define BLOCK_STRIPS 4
+#define BLOCK_ROWS (STRIP_ROWS*BLOCK_STRIPS)
+#define BLOCK_BYTES (4*BLOCK_ROWS)
+
+// Rows per task when extrapolating
+#define BAND_ROWS 32
+
+
+void gaussianBoxRadii(float sigma, int radii[3])
+{
+	// Boxes of odd widths wl and wl+2, as many of each as brings the summed variance
+	// of the three, (w*w-1)/12 each, closest to sigma*sigma
+	const int n = 3;
+	double ideal = sqrt(12.0*sigma*sigma/n + 1);
+	int wl = (int)floor(ideal), wu, m, i;
+
+	if (wl % 2 == 0)
+		wl--;
+	if (wl < 1)
+		wl = 1;
+	wu = wl+2;
+	m = (int)floor((n*(wu*wu - 1) - 12.0*sigma*sigma) / (wu*wu - wl*wl) + 0.5);
+	m = m < 0 ? 0 : (m > n ? n : m);
+	for (i = 0; i < n; i++)
+		radii[i] = ((i < m ? wl : wu) - 1) / 2;
+}
+
+
+// col[32*x + 4*i + c] = channel c of pixel x in row y0+i, with rows past the end clamped
+static void loadColumns(const CPUImage *src, int y0, unsigned char *col)
+{
+	const unsigned char *rows[STRIP_ROWS];
+	int i, x = 0;
+
+	for (i = 0; i < STRIP_ROWS; i++)
+		rows[i] = src->data + (y0+i < src->high ? y0+i : src->high-1)*src->rowbytes;
+
+#if CPU_AVX2
+	for (; cpuUsingSIMD() && x + 8 <= src->wide; x += 8)
+	{
+		// An 8x8 transpose of 32-bit pixels
+		__m256i r0 = _mm256_loadu_si256((const __m256i *)(rows[0] + 4*x));
+		__m256i r1 = _mm256_loadu_si256((const __m256i *)(rows[1] + 4*x));
+		__m256i r2 = _mm256_loadu_si256((const __m256i *)(rows[2] + 4*x));
+		__m256i r3 = _mm256_loadu_si256((const __m256i *)(rows[3] + 4*x));
+		__m256i r4 = _mm256_loadu_si256((const __m256i *)(rows[4] + 4*x));
+		__m256i r5 = _mm256_loadu_si256((const __m256i *)(rows[5] + 4*x));
+		__m256i r6 = _mm256_loadu_si256((const __m256i *)(rows[6] + 4*x));
+		__m256i r7 = _mm256_loadu_si256((const __m256i *)(rows[7] + 4*x));
+		__m256i t0 = _mm256_unpacklo_epi32(r0, r1), t1 = _mm256_unpackhi_epi32(r0, r1);
+		__m256i t2 = _mm256_unpacklo_epi32(r2, r3), t3 = _mm256_unpackhi_epi32(r2, r3);
+		__m256i t4 = _mm256_unpacklo_epi32(r4, r5), t5 = _mm256_unpackhi_epi32(r4, r5);
+		__m256i t6 = _mm256_unpacklo_epi32(r6, r7), t7 = _mm256_unpackhi_epi32(r6, r7);
+		__m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+		__m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+		__m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+		__m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+		__m256i *c = (__m256i *)(col + COLUMN_BYTES*x);
+		_mm256_store_si256(c+0, _mm256_permute2x128_si256(u0, u4, 0x20));
+		_mm256_store_si256(c+1, _mm256_permute2x128_si256(u1, u5, 0x20));
+		_mm256_store_si256(c+2, _mm256_permute2x128_si256(u2, u6, 0x20));
+		_mm256_store_si256(c+3, _mm256_permute2x128_si256(u3, u7, 0x20));
+		_mm256_store_si256(c+4, _mm256_permute2x128_si256(u0, u4, 0x31));
+		_mm256_store_si256(c+5, _mm256_permute2x128_si256(u1, u5, 0x31));
+		_mm256_store_si256(c+6, _mm256_permute2x128_si256(u2, u6, 0x31));
+		_mm256_store_si256(c+7, _mm256_permute2x128_si256(u3, u7, 0x31));
+	}
+#endif
+	for (; x < src->wide; x++)
+		for (i = 0; i < STRIP_ROWS; i++)
+			memcpy(col + COLUMN_BYTES*x + 4*i, rows[i] + 4*x, 4);
+}
+
+
+// Row x of dst gets the pixels of column x of a block, starting at pixel y0. dst is
+// src transposed.
+static void storeBlock(const unsigned char *block, int n, CPUImage *dst, int y0)
+{
+	int count = dst->wide - y0 < BLOCK_ROWS ? dst->wide - y0 : BLOCK_ROWS;
+	int x;
+
+#if CPU_AVX2
+	// Each store is to a different row, too far apart for the prefetcher, so write
+	// whole cache lines around the cache rather than reading them in first
+	if (cpuUsingSIMD() && count == BLOCK_ROWS && (((uintptr_t)dst->data | dst->rowbytes) & 31) == 0)
+	{
+		for (x = 0; x < n; x++)
+		{
+			const __m256i *b = (const __m256i *)(block + BLOCK_BYTES*x);
+			__m256i *d = (__m256i *)(dst->data + x*dst->rowbytes + 4*y0);
+			_mm256_stream_si256(d+0, _mm256_load_si256(b+0));
+			_mm256_stream_si256(d+1, _mm256_load_si256(b+1));
+			_mm256_stream_si256(d+2, _mm256_load_si256(b+2));
+			_mm256_stream_si256(d+3, _mm256_load_si256(b+3));
+		}
+		_mm_sfence();
+		return;
+	}
+#endif
+	if (count == BLOCK_ROWS)
+		for (x = 0; x < n; x++)
+			memcpy(dst->data + x*dst->rowbytes + 4*y0, block + BLOCK_BYTES*x, BLOCK_BYTES);
+	else
+		for (x = 0; x < n; x++)
+			memcpy(dst->data + x*dst->rowbytes + 4*y0, block + BLOCK_BYTES*x, 4*count);
+}
+
+
+// One box pass of radius r along n columns: out[x] = mean of in[x-r..x+r], clamped at
+// the ends. The mean is (sum*inv + half) >> 24, exact enough for 8-bit results, and the
+// same in the vector and plain C versions. Output columns are stride bytes apart.
+static void boxColumns(const unsigned char *in, unsigned char *out, size_t stride, int n, int r)
+{
+	const unsigned int inv = (1u << 24) / (2*r+1), half = 1u << 23;
+	int x = 0, i, j;
+
+#if CPU_AVX2
+	if (cpuUsingSIMD())
+	{
+		const __m256i vinv = _mm256_set1_epi32(inv), vhalf = _mm256_set1_epi32(half);
+		const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		__m256i acc[4], q[4];
+		#define WIDEN(p, k) _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)((p) + 8*(k))))
+
+		for (j = 0; j < 4; j++)
+			acc[j] = _mm256_mullo_epi32(WIDEN(in, j), _mm256_set1_epi32(r+1));
+		for (i = 1; i <= r; i++)
+		{
+			const unsigned char *p = in + COLUMN_BYTES*(i < n ? i : n-1);
+			for (j = 0; j < 4; j++)
+				acc[j] = _mm256_add_epi32(acc[j], WIDEN(p, j));
+		}
+		for (; x < n; x++)
+		{
+			const unsigned char *add = in + COLUMN_BYTES*(x+r+1 < n ? x+r+1 : n-1);
+			const unsigned char *sub = in + COLUMN_BYTES*(x-r > 0 ? x-r : 0);
+			__m256i w;
+			for (j = 0; j < 4; j++)
+			{
+				q[j] = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(acc[j], vinv), vhalf), 24);
+				acc[j] = _mm256_add_epi32(acc[j], _mm256_sub_epi32(WIDEN(add, j), WIDEN(sub, j)));
+			}
+			// The packs work within 128-bit lanes, so put the quarters back in order
+			w = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+			_mm256_store_si256((__m256i *)(out + stride*x), _mm256_permutevar8x32_epi32(w, order));
+		}
+		#undef WIDEN
+		return;
+	}
+#endif
+	{
+		unsigned int acc[COLUMN_BYTES];
+
+		for (j = 0; j < COLUMN_BYTES; j++)
+			acc[j] = (r+1)*in[j];
+		for (i = 1; i <= r; i++)
+		{
+			const unsigned char *p = in + COLUMN_BYTES*(i < n ? i : n-1);
+			for (j = 0; j < COLUMN_BYTES; j++)
+				acc[j] += p[j];
+		}
+		for (; x < n; x++)
+		{
+			const unsigned char *add = in + COLUMN_BYTES*(x+r+1 < n ? x+r+1 : n-1);
+			const unsigned char *sub = in + COLUMN_BYTES*(x-r > 0 ? x-r : 0);
+			for (j = 0; j < COLUMN_BYTES; j++)
+			{
+				out[stride*x + j] = (acc[j]*inv + half) >> 24;
+				acc[j] += add[j] - sub[j];
+			}
+		}
+	}
+}
+
+
+typedef struct {
+	const CPUImage *src;
+	CPUImage *dst;
+	const int *radii;
+	int count;
+} BoxPass;
+
+
+static void boxPassBlock(void *ctx, int block, void *scratch)
+{
+	BoxPass *p = ctx;
+	int n = p->src->wide, s, i;
+	unsigned char *out = scratch, *t;
+
+	// With no boxes, a radius of 0 copies the columns
+	for (s = 0; s < BLOCK_STRIPS; s++)
+	{
+		unsigned char *a = out + BLOCK_BYTES*n, *b = a + COLUMN_BYTES*n;
+		loadColumns(p->src, BLOCK_ROWS*block + STRIP_ROWS*s, a);
+		for (i = 0; i < p->count-1; i++)
+		{
+			boxColumns(a, b, COLUMN_BYTES, n, p->radii[i]);
+			t = a; a = b; b = t;
+		}
+		boxColumns(a, out + COLUMN_BYTES*s, BLOCK_BYTES, n, p->count > 0 ? p->radii[p->count-1] : 0);
+	}
+	storeBlock(out, n, p->dst, BLOCK_ROWS*block);
+}
+
+
+// All the boxes along the rows of src, into dst transposed
+static int boxPass(const CPUImage *src, CPUImage *dst, const int *radii, int count, int threads)
+{
+	BoxPass p = { src, dst, radii, count };
+	int blocks = (src->high + BLOCK_ROWS-1) / BLOCK_ROWS;
+
+	return cpuParallel(blocks, threads, (BLOCK_BYTES + 2*COLUMN_BYTES)*(size_t)src->wide, boxPassBlock, &p);
+}
+
+
+int cpuBoxBlur(const CPUImage *src, CPUImage *dst, const int *radii, int count, int threads)
+{
+	CPUImage transposed;
+	int ok;
+
+	if (!cpuImageCreate(&transposed, src->high, src->wide))
+		return 0;
+	ok = boxPass(src, &transposed, radii, count, threads) &&
+	     boxPass(&transposed, dst, radii, count, threads);
+	cpuImageDestroy(&transposed);
+	return ok;
+}
+
+
+int cpuGaussianBlur(const CPUImage *src, CPUImage *dst, float sigma, int threads)
+{
+	int radii[3];
+
+	gaussianBoxRadii(sigma, radii);
+	return cpuBoxBlur(src, dst, radii, 3, threads);
+}
+
+
+typedef struct {
+	const CPUImage *src, *degen;
+	CPUImage *dst;
+	float t;
+} Extrapolation;
+
+
+static void extrapolateBand(void *ctx, int band, void *scratch)
+{
+	Extrapolation *e = ctx;
+	int y = BAND_ROWS*band;
+	int rows = e->src->high - y < BAND_ROWS ? e->src->high - y : BAND_ROWS;
+	CPUImage s = *e->src, g = *e->degen, d = *e->dst;
+
+	(void)scratch;
+	s.data += y*s.rowbytes;
+	g.data += y*g.rowbytes;
+	d.data += y*d.rowbytes;
+	s.high = g.high = d.high = rows;
+	cpuExtrapolate(&s, &g, &d, e->t);
+}
+
+
+int cpuUnsharpMask(const CPUImage *src, CPUImage *dst, float sigma, float amount, int threads)
+{
+	CPUImage blur;
+	Extrapolation e;
+	int ok;
+
+	if (!cpuImageCreate(&blur, src->wide, src->high))
+		return 0;
+	ok = cpuGaussianBlur(src, &blur, sigma, threads);
+	if (ok)
+	{
+		// Blur + (1+amount)*(Src - Blur)
+		e.src = src;
+		e.degen = &blur;
+		e.dst = dst;
+		e.t = 1+amount;
+		ok = cpuParallel((src->high + BAND_ROWS-1) / BAND_ROWS, threads, 0, extrapolateBand, &e);
+	}
+	cpuImageDestroy(&blur);
+	return ok;
+}
@@ -0,0 +1,45 @@
+/*
+     File: CPUBlur.h
+ Abstract: Separable blur of any radius for CPUImaging, and the sharpen filters built on it.
+
+ */
+
+#ifndef CPUBLUR_H
+#define CPUBLUR_H
+
+#include "CPUImaging.h"
+
+//
+//  blur() in Imaging.c has a fixed footprint of MAX_FILTER_RADIUS. This engine blurs
+//  with any radius at a cost per pixel that does not depend on it: each box pass is a
+//  running sum, adding the pixel entering the window and removing the one leaving it.
+//  Three box passes of suitable widths approximate a Gaussian to within a few percent.
+//
+//  The image is worked in strips of 8 rows. A strip is transposed into a buffer of
+//  columns, so that the running sum along the row steps through 8 rows at once in
+//  one vector, and all the horizontal boxes are run there while it is in cache. The
+//  columns are written out transposed, 32 rows' worth at a time, and the same pass
+//  run again over the transposed image does the vertical boxes and turns it the
+//  right way round. The whole blur is two trips through memory, whatever the
+//  number of boxes.
+//
+//  Blocks of 32 rows are shared out among threads, one per core unless asked
+//  otherwise; a thread takes the next block as it finishes one. All four channels
+//  are blurred. Edges are clamped, as GL_CLAMP_TO_EDGE does. src and dst may be the
+//  same image.
+//
+
+// Radii of the three box passes that approximate a Gaussian of sigma pixels
+void gaussianBoxRadii(float sigma, int radii[3]);
+
+// Box passes of the given radii, one after another, in both directions.
+// threads is the number of threads to use, or 0 for one per core.
+// These return 0 if scratch memory could not be allocated.
+int  cpuBoxBlur(const CPUImage *src, CPUImage *dst, const int *radii, int count, int threads);
+int  cpuGaussianBlur(const CPUImage *src, CPUImage *dst, float sigma, int threads);
+
+// Src + amount*(Src - Gaussian(Src)): the sharpness filter's extrapolation, away
+// from a Gaussian blur of any size rather than the fixed one of blur()
+int  cpuUnsharpMask(const CPUImage *src, CPUImage *dst, float sigma, float amount, int threads);
+
+#endif /* CPUBLUR_H */
@@ -0,0 +1,912 @@
+/*
+     File: CPUImaging.c
+ Abstract: The Imaging.c filters on the CPU, for RGBA8 buffers in memory.
+
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "CPUImaging.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CPU_AVX2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CPU_NEON 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+// Weights that greyscale() loads into the dot3 unit, before the unit's 2x scale and bias
+static const float avrg[3] = { .667, .667, .667 };	// average
+static const float prcp[3] = { .646, .794, .557 };	// perceptual NTSC
+
+// Vector kernels are used unless cpuSetSIMD(0) has been called
+static int useSIMD = 1;
+
+
+// Matrix Utilities for Hue rotation
+static void matrixmult(float a[4][4], float b[4][4], float c[4][4])
+{
+	int x, y;
+	float temp[4][4];
+
+	for(y=0; y<4; y++)
+		for(x=0; x<4; x++)
+			temp[y][x] = b[y][0] * a[0][x] + b[y][1] * a[1][x] + b[y][2] * a[2][x] + b[y][3] * a[3][x];
+	for(y=0; y<4; y++)
+		for(x=0; x<4; x++)
+			c[y][x] = temp[y][x];
+}
+
+
+static void xrotatemat(float mat[4][4], float rs, float rc)
+{
+	mat[0][0] = 1.0;
+	mat[0][1] = 0.0;
+	mat[0][2] = 0.0;
+	mat[0][3] = 0.0;
+
+	mat[1][0] = 0.0;
+	mat[1][1] = rc;
+	mat[1][2] = rs;
+	mat[1][3] = 0.0;
+
+	mat[2][0] = 0.0;
+	mat[2][1] = -rs;
+	mat[2][2] = rc;
+	mat[2][3] = 0.0;
+
+	mat[3][0] = 0.0;
+	mat[3][1] = 0.0;
+	mat[3][2] = 0.0;
+	mat[3][3] = 1.0;
+ }
+
+
+static void yrotatemat(float mat[4][4], float rs, float rc)
+{
+	mat[0][0] = rc;
+	mat[0][1] = 0.0;
+	mat[0][2] = -rs;
+	mat[0][3] = 0.0;
+
+	mat[1][0] = 0.0;
+	mat[1][1] = 1.0;
+	mat[1][2] = 0.0;
+	mat[1][3] = 0.0;
+
+	mat[2][0] = rs;
+	mat[2][1] = 0.0;
+	mat[2][2] = rc;
+	mat[2][3] = 0.0;
+
+	mat[3][0] = 0.0;
+	mat[3][1] = 0.0;
+	mat[3][2] = 0.0;
+	mat[3][3] = 1.0;
+}
+
+
+static void zrotatemat(float mat[4][4], float rs, float rc)
+{
+	mat[0][0] = rc;
+	mat[0][1] = rs;
+	mat[0][2] = 0.0;
+	mat[0][3] = 0.0;
+
+	mat[1][0] = -rs;
+	mat[1][1] = rc;
+	mat[1][2] = 0.0;
+	mat[1][3] = 0.0;
+
+	mat[2][0] = 0.0;
+	mat[2][1] = 0.0;
+	mat[2][2] = 1.0;
+	mat[2][3] = 0.0;
+
+	mat[3][0] = 0.0;
+	mat[3][1] = 0.0;
+	mat[3][2] = 0.0;
+	mat[3][3] = 1.0;
+}
+
+
+void cpuHueMatrix(float mat[4][4], float angle)
+{
+	float mag, rot[4][4];
+	float xrs, xrc;
+	float yrs, yrc;
+	float zrs, zrc;
+
+	// Rotate the grey vector into positive Z
+	mag = sqrt(2.0);
+	xrs = 1.0/mag;
+	xrc = 1.0/mag;
+	xrotatemat(mat, xrs, xrc);
+	mag = sqrt(3.0);
+	yrs = -1.0/mag;
+	yrc = sqrt(2.0)/mag;
+	yrotatemat(rot, yrs, yrc);
+	matrixmult(rot, mat, mat);
+
+	// Rotate the hue
+	zrs = sin(angle);
+	zrc = cos(angle);
+	zrotatemat(rot, zrs, zrc);
+	matrixmult(rot, mat, mat);
+
+	// Rotate the grey vector back into place
+	yrotatemat(rot, -yrs, yrc);
+	matrixmult(rot,  mat, mat);
+	xrotatemat(rot, -xrs, xrc);
+	matrixmult(rot,  mat, mat);
+}
+
+
+void identityColorMatrix(ColorMatrix *cm)
+{
+	int i;
+
+	memset(cm, 0, sizeof(*cm));
+	for (i = 0; i < 4; i++)
+		cm->m[i][i] = 1.0;
+}
+
+
+void contrastColorMatrix(ColorMatrix *cm, float t)	// t [0..2]
+{
+	int i;
+
+	// 2*(Src*t/2 + 0.25 - 0.5*t/2) = Src*t + 0.5*(1-t)
+	identityColorMatrix(cm);
+	for (i = 0; i < 3; i++)
+	{
+		cm->m[i][i] = t;
+		cm->bias[i] = 0.5*(1-t);
+	}
+}
+
+
+static void greyWeights(float w[3], float t)	// t = 1 for standard perceptual weighting
+{
+	int i;
+
+	// The dot3 unit computes 4*((0.5+Src/2 - 0.5) * (dot3 - 0.5)), so each
+	// weight it applies to Src is 2*(dot3 - 0.5)
+	for (i = 0; i < 3; i++)
+		w[i] = 2*((prcp[i]*t + avrg[i]*(1-t)) - 0.5);
+}
+
+
+void saturationColorMatrix(ColorMatrix *cm, float t)	// t [0..2]
+{
+	float w[3];
+	int i, j;
+
+	// Src*t + Grey*(1-t), where Grey is the perceptual dot product of Src
+	greyWeights(w, 1.0);
+	identityColorMatrix(cm);
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			cm->m[i][j] = (i == j ? t : 0) + w[j]*(1-t);
+}
+
+
+void hueColorMatrix(ColorMatrix *cm, float t)	// t [0..2] == [-180..180] degrees
+{
+	// The three dot3 passes of hue() apply the rows of cpuHueMatrix exactly,
+	// once the prescale into [0.5..1.0] is undone
+	identityColorMatrix(cm);
+	cpuHueMatrix(cm->m, (t-1.0)*M_PI);
+	cm->m[0][3] = cm->m[1][3] = cm->m[2][3] = 0.0;
+	cm->m[3][0] = cm->m[3][1] = cm->m[3][2] = 0.0;
+	cm->m[3][3] = 1.0;
+}
+
+
+void brightnessColorMatrix(ColorMatrix *cm, float t)	// t [0..2]
+{
+	int i;
+
+	identityColorMatrix(cm);
+	for (i = 0; i < 3; i++)
+		cm->bias[i] = t-1;
+}
+
+
+void concatColorMatrix(ColorMatrix *cm, const ColorMatrix *first, const ColorMatrix *then)
+{
+	// then(first(x)) = then.m*first.m*x + then.m*first.bias + then.bias
+	float a[4][4], b[4][4], bias[4];
+	int i;
+
+	memcpy(a, first->m, sizeof(a));
+	memcpy(b, then->m, sizeof(b));
+	for (i = 0; i < 4; i++)
+		bias[i] = b[i][0]*first->bias[0] + b[i][1]*first->bias[1] + b[i][2]*first->bias[2] + b[i][3]*first->bias[3] + then->bias[i];
+	matrixmult(a, b, cm->m);
+	memcpy(cm->bias, bias, sizeof(bias));
+}
+
+
+int filterColorMatrix(ColorMatrix *cm, int mode, float val)
+{
+	switch (mode)
+	{
+		case 0: brightnessColorMatrix(cm, val); return 1;
+		case 1: contrastColorMatrix(cm, val);   return 1;
+		case 2: saturationColorMatrix(cm, val); return 1;
+		case 3: hueColorMatrix(cm, val);        return 1;
+	}
+	return 0;
+}
+
+
+int compileFilterChain(ColorMatrix *cm, const FilterStep *steps, int count)
+{
+	ColorMatrix step;
+	int i;
+
+	identityColorMatrix(cm);
+	for (i = 0; i < count; i++)
+	{
+		if (!filterColorMatrix(&step, steps[i].mode, steps[i].val))
+			break;
+		concatColorMatrix(cm, cm, &step);
+	}
+	return i;
+}
+
+
+int cpuImageCreate(CPUImage *image, int wide, int high)
+{
+	size_t rowbytes = ((size_t)wide*4 + 63) & ~(size_t)63;
+	void *data = NULL;
+
+	memset(image, 0, sizeof(*image));
+	if (wide <= 0 || high <= 0 || posix_memalign(&data, 64, rowbytes*high) != 0)
+		return 0;
+	image->data = data;
+	image->wide = wide;
+	image->high = high;
+	image->rowbytes = rowbytes;
+	return 1;
+}
+
+
+void cpuImageDestroy(CPUImage *image)
+{
+	free(image->data);
+	memset(image, 0, sizeof(*image));
+}
+
+
+static inline unsigned char clampround(float v)
+{
+	if (v <= 0.0f)
+		return 0;
+	if (v >= 255.0f)
+		return 255;
+	return (unsigned char)(v + 0.5f);
+}
+
+
+// Row kernels. Each runs its vector loop over as many whole vectors as the row holds,
+// then finishes the row in plain C.
+
+static void brightnessRow(const unsigned char *s, unsigned char *d, int n, int offset)
+{
+	int x = 0, c, v;
+
+#if CPU_AVX2
+	if (useSIMD)
+	{
+		// Saturating byte add or subtract, with 0 in the alpha lanes
+		int k = (offset < 0 ? -offset : offset) * 0x010101;
+		__m256i K = _mm256_set1_epi32(k);
+		for (; x + 8 <= n; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)(s + 4*x));
+			p = offset < 0 ? _mm256_subs_epu8(p, K) : _mm256_adds_epu8(p, K);
+			_mm256_storeu_si256((__m256i *)(d + 4*x), p);
+		}
+	}
+#elif CPU_NEON
+	if (useSIMD)
+	{
+		uint8_t k = (uint8_t)(offset < 0 ? -offset : offset);
+		const uint8_t lanes[16] = { k, k, k, 0, k, k, k, 0, k, k, k, 0, k, k, k, 0 };
+		uint8x16_t K = vld1q_u8(lanes);
+		for (; x + 4 <= n; x += 4)
+		{
+			uint8x16_t p = vld1q_u8(s + 4*x);
+			p = offset < 0 ? vqsubq_u8(p, K) : vqaddq_u8(p, K);
+			vst1q_u8(d + 4*x, p);
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		for (c = 0; c < 3; c++)
+		{
+			v = s[4*x+c] + offset;
+			d[4*x+c] = v < 0 ? 0 : (v > 255 ? 255 : v);
+		}
+		d[4*x+3] = s[4*x+3];
+	}
+}
+
+
+// k holds the three rows of the matrix, each as three weights and a bias, in 8-bit units
+static void matrixRow(const unsigned char *s, unsigned char *d, int n, const float k[12])
+{
+	int x = 0, c;
+
+#if CPU_AVX2
+	if (useSIMD)
+	{
+		const __m256i mask = _mm256_set1_epi32(0xff);
+		const __m256i amask = _mm256_set1_epi32((int)0xff000000);
+		const __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(255.0f);
+		__m256 K[12];
+		for (c = 0; c < 12; c++)
+			K[c] = _mm256_set1_ps(k[c]);
+		for (; x + 8 <= n; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)(s + 4*x));
+			__m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(p, mask));
+			__m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), mask));
+			__m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+			__m256 R = _mm256_fmadd_ps(K[0], r, _mm256_fmadd_ps(K[1], g, _mm256_fmadd_ps(K[2],  b, K[3])));
+			__m256 G = _mm256_fmadd_ps(K[4], r, _mm256_fmadd_ps(K[5], g, _mm256_fmadd_ps(K[6],  b, K[7])));
+			__m256 B = _mm256_fmadd_ps(K[8], r, _mm256_fmadd_ps(K[9], g, _mm256_fmadd_ps(K[10], b, K[11])));
+			__m256i Ri = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(R, lo), hi));
+			__m256i Gi = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(G, lo), hi));
+			__m256i Bi = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(B, lo), hi));
+			__m256i q = _mm256_or_si256(_mm256_or_si256(Ri, _mm256_slli_epi32(Gi, 8)),
+			                            _mm256_or_si256(_mm256_slli_epi32(Bi, 16), _mm256_and_si256(p, amask)));
+			_mm256_storeu_si256((__m256i *)(d + 4*x), q);
+		}
+	}
+#elif CPU_NEON
+	if (useSIMD)
+	{
+		const float32x4_t lo = vdupq_n_f32(0.0f), hi = vdupq_n_f32(255.0f), half = vdupq_n_f32(0.5f);
+		for (; x + 16 <= n; x += 16)
+		{
+			uint8x16x4_t p = vld4q_u8(s + 4*x);
+			uint16x8_t r16[2] = { vmovl_u8(vget_low_u8(p.val[0])), vmovl_u8(vget_high_u8(p.val[0])) };
+			uint16x8_t g16[2] = { vmovl_u8(vget_low_u8(p.val[1])), vmovl_u8(vget_high_u8(p.val[1])) };
+			uint16x8_t b16[2] = { vmovl_u8(vget_low_u8(p.val[2])), vmovl_u8(vget_high_u8(p.val[2])) };
+			uint16x4_t out[3][4];
+			int h, q;
+			for (h = 0; h < 2; h++)
+			{
+				for (q = 0; q < 2; q++)
+				{
+					float32x4_t r = vcvtq_f32_u32(vmovl_u16(q ? vget_high_u16(r16[h]) : vget_low_u16(r16[h])));
+					float32x4_t g = vcvtq_f32_u32(vmovl_u16(q ? vget_high_u16(g16[h]) : vget_low_u16(g16[h])));
+					float32x4_t b = vcvtq_f32_u32(vmovl_u16(q ? vget_high_u16(b16[h]) : vget_low_u16(b16[h])));
+					for (c = 0; c < 3; c++)
+					{
+						float32x4_t v = vdupq_n_f32(k[4*c+3]);
+						v = vmlaq_n_f32(v, r, k[4*c+0]);
+						v = vmlaq_n_f32(v, g, k[4*c+1]);
+						v = vmlaq_n_f32(v, b, k[4*c+2]);
+						v = vaddq_f32(vminq_f32(vmaxq_f32(v, lo), hi), half);
+						out[c][2*h+q] = vmovn_u32(vcvtq_u32_f32(v));
+					}
+				}
+			}
+			for (c = 0; c < 3; c++)
+				p.val[c] = vcombine_u8(vqmovn_u16(vcombine_u16(out[c][0], out[c][1])),
+				                       vqmovn_u16(vcombine_u16(out[c][2], out[c][3])));
+			vst4q_u8(d + 4*x, p);
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		float r = s[4*x], g = s[4*x+1], b = s[4*x+2];
+		for (c = 0; c < 3; c++)
+			d[4*x+c] = clampround(k[4*c]*r + k[4*c+1]*g + k[4*c+2]*b + k[4*c+3]);
+		d[4*x+3] = s[4*x+3];
+	}
+}
+
+
+// Degen + t*(Src - Degen), which is 2*(Src*t/2 + Degen*(0.5-t/2)). Alpha is Src's.
+static void extrapolateRow(const unsigned char *s, const unsigned char *g, unsigned char *d, int n, float t)
+{
+	int x = 0, c;
+
+#if CPU_AVX2
+	if (useSIMD)
+	{
+		// t is 1 in the alpha lanes, which gives back Src exactly
+		const __m256 T = _mm256_setr_ps(t, t, t, 1, t, t, t, 1);
+		const __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(255.0f);
+		for (; x + 8 <= n; x += 8)
+		{
+			__m256i q[4];
+			for (c = 0; c < 4; c++)
+			{
+				__m256 sv = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(s + 4*x + 8*c))));
+				__m256 gv = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(g + 4*x + 8*c))));
+				__m256 v = _mm256_fmadd_ps(T, _mm256_sub_ps(sv, gv), gv);
+				q[c] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+			}
+			// The packs work within 128-bit lanes, so put the quarters back in order
+			__m256i w = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+			w = _mm256_permutevar8x32_epi32(w, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+			_mm256_storeu_si256((__m256i *)(d + 4*x), w);
+		}
+	}
+#elif CPU_NEON
+	if (useSIMD)
+	{
+		const float lanes[4] = { t, t, t, 1 };
+		const float32x4_t T = vld1q_f32(lanes);
+		const float32x4_t lo = vdupq_n_f32(0.0f), hi = vdupq_n_f32(255.0f), half = vdupq_n_f32(0.5f);
+		for (; x + 4 <= n; x += 4)
+		{
+			uint8x16_t sp = vld1q_u8(s + 4*x), gp = vld1q_u8(g + 4*x);
+			uint16x8_t s16[2] = { vmovl_u8(vget_low_u8(sp)), vmovl_u8(vget_high_u8(sp)) };
+			uint16x8_t g16[2] = { vmovl_u8(vget_low_u8(gp)), vmovl_u8(vget_high_u8(gp)) };
+			uint16x4_t out[4];
+			for (c = 0; c < 4; c++)
+			{
+				float32x4_t sv = vcvtq_f32_u32(vmovl_u16((c & 1) ? vget_high_u16(s16[c >> 1]) : vget_low_u16(s16[c >> 1])));
+				float32x4_t gv = vcvtq_f32_u32(vmovl_u16((c & 1) ? vget_high_u16(g16[c >> 1]) : vget_low_u16(g16[c >> 1])));
+				float32x4_t v = vmlaq_f32(gv, T, vsubq_f32(sv, gv));
+				v = vaddq_f32(vminq_f32(vmaxq_f32(v, lo), hi), half);
+				out[c] = vmovn_u32(vcvtq_u32_f32(v));
+			}
+			vst1q_u8(d + 4*x, vcombine_u8(vqmovn_u16(vcombine_u16(out[0], out[1])),
+			                              vqmovn_u16(vcombine_u16(out[2], out[3]))));
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		for (c = 0; c < 3; c++)
+			d[4*x+c] = clampround(g[4*x+c] + t*(s[4*x+c] - g[4*x+c]));
+		d[4*x+3] = s[4*x+3];
+	}
+}
+
+
+void cpuBrightness(const CPUImage *src, CPUImage *dst, float t)	// t [0..2]
+{
+	// Src + (t-1), as the ADD or SUBTRACT of brightness()
+	int offset = (int)lrintf((t-1)*255);
+	int y;
+
+	for (y = 0; y < src->high; y++)
+		brightnessRow(src->data + y*src->rowbytes, dst->data + y*dst->rowbytes, src->wide, offset);
+}
+
+
+void cpuColorMatrix(const CPUImage *src, CPUImage *dst, const ColorMatrix *cm)
+{
+	float k[12];
+	int i, y;
+
+	for (i = 0; i < 3; i++)
+	{
+		k[4*i+0] = cm->m[i][0];
+		k[4*i+1] = cm->m[i][1];
+		k[4*i+2] = cm->m[i][2];
+		k[4*i+3] = cm->bias[i]*255;
+	}
+	for (y = 0; y < src->high; y++)
+		matrixRow(src->data + y*src->rowbytes, dst->data + y*dst->rowbytes, src->wide, k);
+}
+
+
+void cpuContrast(const CPUImage *src, CPUImage *dst, float t)
+{
+	ColorMatrix cm;
+
+	contrastColorMatrix(&cm, t);
+	cpuColorMatrix(src, dst, &cm);
+}
+
+
+void cpuGreyscale(const CPUImage *src, CPUImage *dst, float t)
+{
+	ColorMatrix cm;
+	float w[3];
+	int i, j;
+
+	greyWeights(w, t);
+	identityColorMatrix(&cm);
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			cm.m[i][j] = w[j];
+	cpuColorMatrix(src, dst, &cm);
+}
+
+
+void cpuSaturation(const CPUImage *src, CPUImage *dst, float t)
+{
+	ColorMatrix cm;
+
+	saturationColorMatrix(&cm, t);
+	cpuColorMatrix(src, dst, &cm);
+}
+
+
+void cpuHue(const CPUImage *src, CPUImage *dst, float t)
+{
+	ColorMatrix cm;
+
+	hueColorMatrix(&cm, t);
+	cpuColorMatrix(src, dst, &cm);
+}
+
+
+void cpuGamma(const CPUImage *src, CPUImage *dst, float t)	// t (0..2]
+{
+	// Src^(1/t), by table
+	unsigned char table[256];
+	int i, x, y;
+
+	t = t < 1.0f/64 ? 1.0f/64 : t;
+	for (i = 0; i < 256; i++)
+		table[i] = (unsigned char)lrintf(255*powf(i/255.0f, 1/t));
+	for (y = 0; y < src->high; y++)
+	{
+		const unsigned char *s = src->data + y*src->rowbytes;
+		unsigned char *d = dst->data + y*dst->rowbytes;
+		for (x = 0; x < src->wide; x++)
+		{
+			d[4*x+0] = table[s[4*x+0]];
+			d[4*x+1] = table[s[4*x+1]];
+			d[4*x+2] = table[s[4*x+2]];
+			d[4*x+3] = s[4*x+3];
+		}
+	}
+}
+
+
+void cpuExtrapolate(const CPUImage *src, const CPUImage *degen, CPUImage *dst, float t)
+{
+	int y;
+
+	for (y = 0; y < src->high; y++)
+		extrapolateRow(src->data + y*src->rowbytes, degen->data + y*degen->rowbytes,
+		               dst->data + y*dst->rowbytes, src->wide, t);
+}
+
+
+static inline int clampi(int v, int lo, int hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+
+int cpuBlur(const CPUImage *src, CPUImage *dst)
+{
+	// blur() takes the center texel at 1/5 and four bilinear samples at 1/5 each,
+	// placed halfway between texels so that each averages a 2x2 block:
+	//
+	//   (x+1..x+2, y..y+1)   (x-2..x-1, y-1..y)   (x-1..x, y+1..y+2)   (x..x+1, y-2..y-1)
+	//
+	// That is (4*center + four 2x2 sums)/20. The 2x2 sums are made once into a table
+	// with a border of MAX_FILTER_RADIUS, from a copy of the image with its edges
+	// repeated, as GL_CLAMP_TO_EDGE does. Both loops are straight runs over bytes.
+	enum { R = 2 };
+	int W = src->wide, H = src->high;
+	int bw = W + 2*R, bh = H + 2*R;
+	int pw = bw + 1, ph = bh + 1;
+	unsigned short *box = malloc(sizeof(unsigned short)*4*bw*bh);
+	unsigned char *pad = malloc(4*pw*ph);
+	int x, y;
+
+	if (box == NULL || pad == NULL)
+	{
+		free(box);
+		free(pad);
+		return 0;
+	}
+	for (y = 0; y < ph; y++)
+	{
+		const unsigned char *s = src->data + clampi(y-R, 0, H-1)*src->rowbytes;
+		unsigned char *p = pad + 4*y*pw;
+		for (x = 0; x < R; x++)
+			memcpy(p + 4*x, s, 4);
+		memcpy(p + 4*R, s, 4*W);
+		for (x = R+W; x < pw; x++)
+			memcpy(p + 4*x, s + 4*(W-1), 4);
+	}
+	for (y = 0; y < bh; y++)
+	{
+		const unsigned char *p0 = pad + 4*y*pw, *p1 = p0 + 4*pw;
+		unsigned short *b = box + 4*y*bw;
+		for (x = 0; x < 4*bw; x++)
+			b[x] = p0[x] + p0[x+4] + p1[x] + p1[x+4];
+	}
+	free(pad);
+	for (y = 0; y < H; y++)
+	{
+		// Rows of the table holding each block's top edge
+		const unsigned short *a = box + 4*((y+R)*bw + R+1);
+		const unsigned short *b = box + 4*((y-1+R)*bw + R-2);
+		const unsigned short *d = box + 4*((y+1+R)*bw + R-1);
+		const unsigned short *e = box + 4*((y-2+R)*bw + R);
+		const unsigned char *s = src->data + y*src->rowbytes;
+		unsigned char *o = dst->data + y*dst->rowbytes;
+		for (x = 0; x < 4*W; x++)
+			o[x] = (4*s[x] + a[x] + b[x] + d[x] + e[x] + 10) / 20;
+		for (x = 0; x < W; x++)
+			o[4*x+3] = s[4*x+3];
+	}
+	free(box);
+	return 1;
+}
+
+
+int cpuSharpness(const CPUImage *src, CPUImage *dst, float t)
+{
+	CPUImage blur;
+	int ok;
+
+	if (!cpuImageCreate(&blur, src->wide, src->high))
+		return 0;
+	ok = cpuBlur(src, &blur);
+	if (ok)
+		cpuExtrapolate(src, &blur, dst, t);
+	cpuImageDestroy(&blur);
+	return ok;
+}
+
+
+int cpuFilter(const CPUImage *src, CPUImage *dst, float val, int mode)
+{
+	switch (mode)
+	{
+		case 0: cpuBrightness(src, dst, val); return 1;
+		case 1: cpuContrast(src, dst, val);   return 1;
+		case 2: cpuSaturation(src, dst, val); return 1;
+		case 3: cpuHue(src, dst, val);        return 1;
+		case 4: return cpuSharpness(src, dst, val);
+		case 5: cpuGamma(src, dst, val);      return 1;
+	}
+	return 0;
+}
+
+
+int cpuFilterChain(const CPUImage *src, CPUImage *dst, const FilterStep *steps, int count)
+{
+	const CPUImage *in = src;
+	ColorMatrix cm;
+	int i = 0, n;
+
+	// The first pass reads src, the rest work in place on dst
+	if (count == 0 && src->data != dst->data)
+		for (n = 0; n < src->high; n++)
+			memcpy(dst->data + n*dst->rowbytes, src->data + n*src->rowbytes, 4*src->wide);
+	while (i < count)
+	{
+		n = compileFilterChain(&cm, steps + i, count - i);
+		if (n == 1)
+		{
+			// A lone filter keeps its own kernel, which may be quicker
+			cpuFilter(in, dst, steps[i].val, steps[i].mode);
+		}
+		else if (n > 1)
+		{
+			cpuColorMatrix(in, dst, &cm);
+		}
+		else if (!cpuFilter(in, dst, steps[i].val, steps[i].mode))
+		{
+			return 0;
+		}
+		i += n > 0 ? n : 1;
+		in = dst;
+	}
+	return 1;
+}
+
+
+int cpuFilterChainPasses(const FilterStep *steps, int count)
+{
+	ColorMatrix cm;
+	int i = 0, n, passes = 0;
+
+	// The same walk as cpuFilterChain, without the work
+	while (i < count)
+	{
+		n = compileFilterChain(&cm, steps + i, count - i);
+		i += n > 0 ? n : 1;
+		passes++;
+	}
+	return passes;
+}
+
+
+const char *cpuImagingEngine(void)
+{
+#if CPU_AVX2
+	return useSIMD ? "avx2" : "scalar";
+#elif CPU_NEON
+	return useSIMD ? "neon" : "scalar";
+#else
+	return "scalar";
+#endif
+}
+
+
+void cpuSetSIMD(int enable)
+{
+	useSIMD = enable;
+}
+
+
+int cpuUsingSIMD(void)
+{
+	return useSIMD;
+}
+
+
+// A pool of workers, started as calls first ask for them and kept for the life of the
+// process, that take tasks in order from a shared counter until none are left. Between
+// calls they wait on a condition variable, as the RosyWriter TileScheduler's do, so a
+// call costs a wakeup rather than a thread creation for each core. Each thread keeps
+// its scratch memory from call to call, and grows it when a call asks for more.
+
+#define MAX_THREADS 64
+
+static struct {
+	pthread_mutex_t run;		// held for a whole cpuParallel call, so calls take turns
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	unsigned generation;
+	int workers;				// started so far, not counting the caller
+	int active;					// threads taking part in this call, the caller included
+	int busy;
+
+	// The call in progress
+	CPUTaskFunc func;
+	void *ctx;
+	int tasks;
+	size_t scratch;
+	volatile int next;
+	volatile int done;
+
+	void *scratchData[MAX_THREADS];
+	size_t scratchSize[MAX_THREADS];
+} pool = {
+	.run = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+static int cpuCount(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : (int)n);
+}
+
+
+// Thread 0 is whoever called cpuParallel. A thread without the scratch it needs
+// takes no tasks, and the others do its share.
+static void runTasks(int thread)
+{
+	void *scratch = NULL;
+	int i;
+
+	if (pool.scratch > pool.scratchSize[thread])
+	{
+		free(pool.scratchData[thread]);
+		pool.scratchData[thread] = NULL;
+		pool.scratchSize[thread] = 0;
+		if (posix_memalign(&scratch, 64, pool.scratch) != 0)
+			return;
+		pool.scratchData[thread] = scratch;
+		pool.scratchSize[thread] = pool.scratch;
+	}
+	scratch = pool.scratch > 0 ? pool.scratchData[thread] : NULL;
+	while ((i = __sync_fetch_and_add(&pool.next, 1)) < pool.tasks)
+	{
+		pool.func(pool.ctx, i, scratch);
+		__sync_fetch_and_add(&pool.done, 1);
+	}
+}
+
+
+static void *poolWorker(void *arg)
+{
+	int thread = (int)(intptr_t)arg;
+	unsigned seen = 0;
+	int join;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&pool.lock);
+		while (pool.generation == seen)
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		seen = pool.generation;
+		join = thread < pool.active;
+		pthread_mutex_unlock(&pool.lock);
+		if (!join)
+			continue;
+
+		runTasks(thread);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.busy == 0)
+			pthread_cond_signal(&pool.idle);
+		pthread_mutex_unlock(&pool.lock);
+	}
+	return NULL;
+}
+
+
+// Starts workers until there are enough for threads, counting the caller. If one
+// cannot be started, calls just use fewer threads.
+static void growPool(int threads)
+{
+	pthread_t tid;
+
+	while (pool.workers + 1 < threads)
+	{
+		if (pthread_create(&tid, NULL, poolWorker, (void *)(intptr_t)(pool.workers + 1)) != 0)
+			break;
+		pthread_detach(tid);
+		pool.workers++;
+	}
+}
+
+
+int cpuParallel(int tasks, int threads, size_t scratch, CPUTaskFunc func, void *ctx)
+{
+	int ok;
+
+	if (threads <= 0)
+		threads = cpuCount();
+	threads = threads > tasks ? tasks : threads;
+	threads = threads > MAX_THREADS ? MAX_THREADS : (threads < 1 ? 1 : threads);
+
+	pthread_mutex_lock(&pool.run);
+	growPool(threads);
+	pool.func = func;
+	pool.ctx = ctx;
+	pool.tasks = tasks;
+	pool.scratch = scratch;
+	pool.next = 0;
+	pool.done = 0;
+	pool.active = threads > pool.workers + 1 ? pool.workers + 1 : threads;
+
+	if (pool.active > 1)
+	{
+		pthread_mutex_lock(&pool.lock);
+		pool.busy = pool.active - 1;
+		pool.generation++;
+		pthread_cond_broadcast(&pool.wake);
+		pthread_mutex_unlock(&pool.lock);
+	}
+	runTasks(0);
+	if (pool.active > 1)
+	{
+		pthread_mutex_lock(&pool.lock);
+		while (pool.busy > 0)
+			pthread_cond_wait(&pool.idle, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+	}
+	ok = pool.done == tasks;
+	pthread_mutex_unlock(&pool.run);
+	return ok;
+}
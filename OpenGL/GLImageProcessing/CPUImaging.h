@@ -0,0 +1,130 @@
+/*
+     File: CPUImaging.h
+ Abstract: The Imaging.c filters on the CPU, for RGBA8 buffers in memory.
+
+ */
+
+#ifndef CPUIMAGING_H
+#define CPUIMAGING_H
+
+#include <stddef.h>
+
+//
+//  The same math as the TexEnv passes in Imaging.c, without GL, so that the filters
+//  can run where there is no GPU. Every filter matches what its TexEnv setup computes,
+//  including the clamp to [0..1] at the end of each texture unit:
+//
+//  brightness   Src + (t-1)                                   t [0..2]
+//  contrast     2*(Src*t/2 + 0.25 - 0.5*t/2), towards grey     t [0..2]
+//  greyscale    dot3 with perceptual weights (the degenerate image for saturation)
+//  saturation   2*(Src*t/2 + Grey*(0.5-t/2))                  t [0..2]
+//  hue          rotation about the grey axis, from cpuHueMatrix t [0..2] == [-180..180] degrees
+//  blur         the 17 texel rotated pattern of blur()
+//  sharpness    2*(Src*t/2 + Blur*(0.5-t/2))                  t [0..2]
+//  gamma        Src^(1/t), here only, as mode 5                 t (0..2]
+//
+//  Saturation is a single pass here: extrapolating from a dot3 of the same pixel is
+//  itself a color matrix, so the degenerate image is never built.
+//
+//  Brightness, contrast, saturation and hue are all affine, so a chain of them folds
+//  into one ColorMatrix (compileFilterChain) and costs one pass however long it is.
+//  The only difference from running the filters one by one is that nothing is
+//  clamped between them, so an intermediate result outside [0..1] is carried through
+//  rather than clipped. drawChainGL in Imaging.c renders the same matrix on the GPU.
+//
+//  Pixels are 4 bytes, R G B A in memory. Alpha passes through unchanged, as it does
+//  on the GPU. Rows are rowbytes apart, which may include padding. Per-pixel filters
+//  may work in place (src == dst); blur may not.
+//
+//  The kernels use AVX2 (with FMA) or NEON when the compiler targets them, and plain C
+//  otherwise. On x86 build with -mavx2 -mfma (or -march=native) to get the fast path.
+//
+
+// A 2D RGBA8 image in memory
+typedef struct {
+	unsigned char *data;
+	int wide, high;
+	size_t rowbytes;
+} CPUImage;
+
+// An affine color transform, in the layout used by cpuHueMatrix:
+// out[i] = m[i][0]*R + m[i][1]*G + m[i][2]*B + bias[i], for i in R, G, B.
+// Values are in [0..1]. Row and column 3 (alpha) are ignored.
+typedef struct {
+	float m[4][4];
+	float bias[4];
+} ColorMatrix;
+
+// One step of a filter chain: a drawGL mode and its value
+typedef struct {
+	int mode;
+	float val;
+} FilterStep;
+
+// Rotation of angle radians about the grey axis, shared with hue() in Imaging.c
+void cpuHueMatrix(float mat[4][4], float angle);
+
+// Color matrices for the affine filters
+void identityColorMatrix(ColorMatrix *cm);
+void contrastColorMatrix(ColorMatrix *cm, float t);
+void saturationColorMatrix(ColorMatrix *cm, float t);
+void hueColorMatrix(ColorMatrix *cm, float t);
+void brightnessColorMatrix(ColorMatrix *cm, float t);
+
+// cm = the transform 'first' followed by 'then'. cm may be either input.
+void concatColorMatrix(ColorMatrix *cm, const ColorMatrix *first, const ColorMatrix *then);
+
+// The color matrix for a drawGL mode, or 0 if that filter is not affine (sharpness)
+int  filterColorMatrix(ColorMatrix *cm, int mode, float val);
+
+// Fold steps into cm, starting from the first, until one is not affine.
+// Returns the number of steps folded; cm is the identity if that is 0.
+int  compileFilterChain(ColorMatrix *cm, const FilterStep *steps, int count);
+
+// Allocate and free an image with rows padded to 64 bytes
+int  cpuImageCreate(CPUImage *image, int wide, int high);
+void cpuImageDestroy(CPUImage *image);
+
+// The filters. src and dst must be the same size.
+void cpuBrightness(const CPUImage *src, CPUImage *dst, float t);
+void cpuContrast(const CPUImage *src, CPUImage *dst, float t);
+void cpuGreyscale(const CPUImage *src, CPUImage *dst, float t);
+void cpuSaturation(const CPUImage *src, CPUImage *dst, float t);
+void cpuHue(const CPUImage *src, CPUImage *dst, float t);
+void cpuGamma(const CPUImage *src, CPUImage *dst, float t);
+
+// These need scratch memory, and return 0 if it could not be allocated
+int  cpuBlur(const CPUImage *src, CPUImage *dst);
+int  cpuSharpness(const CPUImage *src, CPUImage *dst, float t);
+
+// Building blocks: an affine transform, and 2*(Src*t/2 + Degen*(0.5-t/2)) from any
+// degenerate image.
+void cpuColorMatrix(const CPUImage *src, CPUImage *dst, const ColorMatrix *cm);
+void cpuExtrapolate(const CPUImage *src, const CPUImage *degen, CPUImage *dst, float t);
+
+// The filter selected by mode, with the same numbering as drawGL, and 5 for gamma.
+// Returns 0 if mode is out of range or a scratch image could not be allocated.
+int  cpuFilter(const CPUImage *src, CPUImage *dst, float val, int mode);
+
+// The steps in order. Each run of affine steps is folded into one pass; the
+// filters between runs are applied as they are. Returns 0 as cpuFilter does.
+int  cpuFilterChain(const CPUImage *src, CPUImage *dst, const FilterStep *steps, int count);
+
+// How many passes over the image cpuFilterChain makes for these steps
+int  cpuFilterChainPasses(const FilterStep *steps, int count);
+
+// Which kernels are in use: "avx2", "neon" or "scalar". cpuSetSIMD(0) forces the
+// plain C kernels, for testing them against the vector ones.
+const char *cpuImagingEngine(void);
+void cpuSetSIMD(int enable);
+int  cpuUsingSIMD(void);
+
+// Run func(ctx, task, scratch) for every task in [0..tasks), spread over threads
+// (0 for one per core), each with its own scratch bytes aligned to 64. Returns 0
+// if some task did not run because scratch memory could not be allocated.
+// The threads are a pool kept from call to call. Calls from different threads take
+// turns, and func must not call cpuParallel itself.
+typedef void (*CPUTaskFunc)(void *ctx, int task, void *scratch);
+int  cpuParallel(int tasks, int threads, size_t scratch, CPUTaskFunc func, void *ctx);
+
+#endif /* CPUIMAGING_H */
@@ -0,0 +1,394 @@
+/*
+     File: CPULut.c
+ Abstract: Filter chains baked into a 3D color lookup table, applied by tetrahedral interpolation.
+
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "CPULut.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CPU_AVX2 1
+#endif
+
+
+// Passes of cpuFilterChain from which a table of up to this size is the quicker, as
+// timed by Tools/cpuimaging_check.c
+static const struct { int size, passes; } crossover[] = { { 17, 4 }, { 33, 5 }, { 65, 7 } };
+
+// A step of a chain ready to evaluate: a color matrix, or a gamma if exponent is not 0
+typedef struct {
+	ColorMatrix cm;
+	float exponent;
+} PixelStep;
+
+
+static int compilePixelSteps(PixelStep *ps, const FilterStep *steps, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		ps[i].exponent = 0;
+		if (steps[i].mode == 5)
+			ps[i].exponent = 1 / (steps[i].val < 1.0f/64 ? 1.0f/64 : steps[i].val);
+		else if (!filterColorMatrix(&ps[i].cm, steps[i].mode, steps[i].val))
+			return 0;
+	}
+	return 1;
+}
+
+
+static void evalPixelSteps(float rgb[3], const PixelStep *ps, int count)
+{
+	float v[3];
+	int i, c;
+
+	for (i = 0; i < count; i++)
+	{
+		for (c = 0; c < 3; c++)
+		{
+			if (ps[i].exponent != 0)
+				v[c] = powf(rgb[c], ps[i].exponent);
+			else
+				v[c] = ps[i].cm.m[c][0]*rgb[0] + ps[i].cm.m[c][1]*rgb[1] + ps[i].cm.m[c][2]*rgb[2] + ps[i].cm.bias[c];
+		}
+		// Each filter's result is clamped, as it is written to a texture
+		for (c = 0; c < 3; c++)
+			rgb[c] = v[c] < 0 ? 0 : (v[c] > 1 ? 1 : v[c]);
+	}
+}
+
+
+int evalFilterChain(float rgb[3], const FilterStep *steps, int count)
+{
+	PixelStep *ps = malloc(sizeof(PixelStep)*(count > 0 ? count : 1));
+	int ok = ps != NULL && compilePixelSteps(ps, steps, count);
+
+	if (ok)
+		evalPixelSteps(rgb, ps, count);
+	free(ps);
+	return ok;
+}
+
+
+int cpuLUTCreate(ColorLUT *lut, int size)
+{
+	lut->size = size;
+	lut->table = NULL;
+	if (size < 2 || size > 256)
+		return 0;
+	lut->table = malloc(8*(size_t)size*size*size);
+	return lut->table != NULL;
+}
+
+
+void cpuLUTDestroy(ColorLUT *lut)
+{
+	free(lut->table);
+	lut->table = NULL;
+}
+
+
+typedef struct {
+	const PixelStep *ps;
+	int count;
+	ColorLUT *lut;
+} Bake;
+
+
+// One plane of constant blue
+static void bakePlane(void *ctx, int b, void *scratch)
+{
+	Bake *k = ctx;
+	int n = k->lut->size, r, g;
+	unsigned short *e = k->lut->table + 4*(size_t)b*n*n;
+
+	(void)scratch;
+	for (g = 0; g < n; g++)
+	{
+		for (r = 0; r < n; r++, e += 4)
+		{
+			float rgb[3] = { (float)r/(n-1), (float)g/(n-1), (float)b/(n-1) };
+			evalPixelSteps(rgb, k->ps, k->count);
+			e[0] = (unsigned short)lrintf(rgb[0]*65535);
+			e[1] = (unsigned short)lrintf(rgb[1]*65535);
+			e[2] = (unsigned short)lrintf(rgb[2]*65535);
+			e[3] = 0;
+		}
+	}
+}
+
+
+int cpuBakeLUT(ColorLUT *lut, const FilterStep *steps, int count, int threads)
+{
+	PixelStep *ps = malloc(sizeof(PixelStep)*(count > 0 ? count : 1));
+	Bake k = { ps, count, lut };
+	int ok = ps != NULL && compilePixelSteps(ps, steps, count);
+
+	if (ok)
+		ok = cpuParallel(lut->size, threads, 0, bakePlane, &k);
+	free(ps);
+	return ok;
+}
+
+
+// Tetrahedral interpolation at lattice coordinates f [0..size-1], giving [0..65535].
+// The cell's corners from (r0,g0,b0) to (r0+1,g0+1,b0+1) are walked along the axes in
+// order of decreasing fraction, which picks the tetrahedron holding the point.
+static inline void interpolate(const ColorLUT *lut, const float f[3], float out[3])
+{
+	const int n = lut->size;
+	const int stride[3] = { 1, n, n*n };
+	int i[3], k, a, b, c, t;
+	float d[3];
+	const unsigned short *c0, *c1, *c2, *c3;
+
+	for (k = 0; k < 3; k++)
+	{
+		i[k] = (int)f[k];
+		i[k] = i[k] > n-2 ? n-2 : i[k];
+		d[k] = f[k] - i[k];
+	}
+	// a, b, c: the axes by decreasing fraction, ties to the lower axis
+	a = 0; b = 1; c = 2;
+	if (d[b] > d[a]) { t = a; a = b; b = t; }
+	if (d[c] > d[b]) { t = b; b = c; c = t; }
+	if (d[b] > d[a]) { t = a; a = b; b = t; }
+
+	c0 = lut->table + 4*(i[0] + n*i[1] + n*n*i[2]);
+	c1 = c0 + 4*stride[a];
+	c2 = c1 + 4*stride[b];
+	c3 = c2 + 4*stride[c];
+	for (k = 0; k < 3; k++)
+		out[k] = c0[k] + d[a]*(c1[k] - c0[k]) + d[b]*(c2[k] - c1[k]) + d[c]*(c3[k] - c2[k]);
+}
+
+
+typedef struct {
+	const ColorLUT *lut;
+	const PixelStep *ps;
+	int count;
+	float worst[256];
+} Error;
+
+
+static void errorPlane(void *ctx, int b, void *scratch)
+{
+	Error *e = ctx;
+	float scale = (e->lut->size - 1) / 255.0f, worst = 0;
+	int r, g, k;
+
+	(void)scratch;
+	for (g = 0; g < 256; g++)
+	{
+		for (r = 0; r < 256; r++)
+		{
+			float rgb[3] = { r/255.0f, g/255.0f, b/255.0f };
+			float f[3] = { r*scale, g*scale, b*scale }, out[3];
+			interpolate(e->lut, f, out);
+			evalPixelSteps(rgb, e->ps, e->count);
+			for (k = 0; k < 3; k++)
+			{
+				float diff = fabsf(out[k]/65535 - rgb[k]);
+				worst = diff > worst ? diff : worst;
+			}
+		}
+	}
+	e->worst[b] = worst;
+}
+
+
+float cpuLUTError(const ColorLUT *lut, const FilterStep *steps, int count, int threads)
+{
+	Error *e = malloc(sizeof(Error));
+	PixelStep *ps = malloc(sizeof(PixelStep)*(count > 0 ? count : 1));
+	float worst = -1;
+	int b;
+
+	if (e != NULL && ps != NULL && compilePixelSteps(ps, steps, count))
+	{
+		e->lut = lut;
+		e->ps = ps;
+		e->count = count;
+		if (cpuParallel(256, threads, 0, errorPlane, e))
+			for (b = 0, worst = 0; b < 256; b++)
+				worst = e->worst[b] > worst ? e->worst[b] : worst;
+	}
+	free(e);
+	free(ps);
+	return worst;
+}
+
+
+#if CPU_AVX2
+// The same interpolation for 8 colors at once. Corner offsets are chosen with masks
+// instead of a sort: the largest fraction's axis gives the first, the smallest's
+// is the one left out of the third.
+static inline void interpolate8(const ColorLUT *lut, __m256 fr, __m256 fg, __m256 fb, __m256 out[3])
+{
+	const int n = lut->size;
+	const __m256i top = _mm256_set1_epi32(n-2);
+	const __m256i sr = _mm256_set1_epi32(1), sg = _mm256_set1_epi32(n), sb = _mm256_set1_epi32(n*n);
+	const int *table = (const int *)lut->table;
+	__m256i ir = _mm256_min_epi32(_mm256_cvttps_epi32(fr), top);
+	__m256i ig = _mm256_min_epi32(_mm256_cvttps_epi32(fg), top);
+	__m256i ib = _mm256_min_epi32(_mm256_cvttps_epi32(fb), top);
+	__m256 dr = _mm256_sub_ps(fr, _mm256_cvtepi32_ps(ir));
+	__m256 dg = _mm256_sub_ps(fg, _mm256_cvtepi32_ps(ig));
+	__m256 db = _mm256_sub_ps(fb, _mm256_cvtepi32_ps(ib));
+	__m256i rg = _mm256_castps_si256(_mm256_cmp_ps(dr, dg, _CMP_GE_OQ));
+	__m256i gb = _mm256_castps_si256(_mm256_cmp_ps(dg, db, _CMP_GE_OQ));
+	__m256i rb = _mm256_castps_si256(_mm256_cmp_ps(dr, db, _CMP_GE_OQ));
+	__m256i first = _mm256_blendv_epi8(_mm256_blendv_epi8(sb, sg, gb), sr, _mm256_and_si256(rg, rb));
+	__m256i last = _mm256_blendv_epi8(_mm256_blendv_epi8(sr, sg, _mm256_andnot_si256(gb, rg)), sb, _mm256_and_si256(rb, gb));
+	__m256 dmax = _mm256_max_ps(_mm256_max_ps(dr, dg), db);
+	__m256 dmin = _mm256_min_ps(_mm256_min_ps(dr, dg), db);
+	__m256 dmid = _mm256_sub_ps(_mm256_add_ps(dr, _mm256_add_ps(dg, db)), _mm256_add_ps(dmax, dmin));
+	__m256i i0 = _mm256_add_epi32(ir, _mm256_add_epi32(_mm256_mullo_epi32(ig, sg), _mm256_mullo_epi32(ib, sb)));
+	__m256i i3 = _mm256_add_epi32(i0, _mm256_add_epi32(sr, _mm256_add_epi32(sg, sb)));
+	__m256i idx[4], mask = _mm256_set1_epi32(0xffff);
+	__m256 w[4];
+	int k, c;
+
+	idx[0] = i0;
+	idx[1] = _mm256_add_epi32(i0, first);
+	idx[2] = _mm256_sub_epi32(i3, last);
+	idx[3] = i3;
+	w[0] = _mm256_sub_ps(_mm256_set1_ps(1), dmax);
+	w[1] = _mm256_sub_ps(dmax, dmid);
+	w[2] = _mm256_sub_ps(dmid, dmin);
+	w[3] = dmin;
+	for (c = 0; c < 3; c++)
+		out[c] = _mm256_setzero_ps();
+	for (k = 0; k < 4; k++)
+	{
+		// Entries are 8 bytes: R and G in the first 32 bits, B in the second
+		__m256i rgw = _mm256_i32gather_epi32(table, idx[k], 8);
+		__m256i bw = _mm256_i32gather_epi32(table + 1, idx[k], 8);
+		out[0] = _mm256_fmadd_ps(w[k], _mm256_cvtepi32_ps(_mm256_and_si256(rgw, mask)), out[0]);
+		out[1] = _mm256_fmadd_ps(w[k], _mm256_cvtepi32_ps(_mm256_srli_epi32(rgw, 16)), out[1]);
+		out[2] = _mm256_fmadd_ps(w[k], _mm256_cvtepi32_ps(bw), out[2]);
+	}
+}
+#endif
+
+
+static void lutRow(const unsigned char *s, unsigned char *d, int n, const ColorLUT *lut)
+{
+	const float scale = (lut->size - 1) / 255.0f;
+	int x = 0, k;
+
+#if CPU_AVX2
+	if (cpuUsingSIMD())
+	{
+		const __m256 vscale = _mm256_set1_ps(scale), down = _mm256_set1_ps(255.0f/65535);
+		const __m256i byte = _mm256_set1_epi32(0xff), alpha = _mm256_set1_epi32(0xff000000);
+		for (; x + 8 <= n; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)(s + 4*x));
+			__m256 fr = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(p, byte)), vscale);
+			__m256 fg = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), byte)), vscale);
+			__m256 fb = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 16), byte)), vscale);
+			__m256 out[3];
+			__m256i r, g, b;
+			interpolate8(lut, fr, fg, fb, out);
+			r = _mm256_cvtps_epi32(_mm256_mul_ps(out[0], down));
+			g = _mm256_cvtps_epi32(_mm256_mul_ps(out[1], down));
+			b = _mm256_cvtps_epi32(_mm256_mul_ps(out[2], down));
+			p = _mm256_or_si256(_mm256_and_si256(p, alpha),
+			    _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16))));
+			_mm256_storeu_si256((__m256i *)(d + 4*x), p);
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		float f[3] = { s[4*x+0]*scale, s[4*x+1]*scale, s[4*x+2]*scale }, out[3];
+		interpolate(lut, f, out);
+		for (k = 0; k < 3; k++)
+			d[4*x+k] = (unsigned char)lrintf(out[k]*(255.0f/65535));
+		d[4*x+3] = s[4*x+3];
+	}
+}
+
+
+static void lutRow16(const unsigned short *s, unsigned short *d, int n, const ColorLUT *lut)
+{
+	const float scale = (lut->size - 1) / 65535.0f;
+	int x = 0, k;
+
+#if CPU_AVX2
+	if (cpuUsingSIMD())
+	{
+		const __m256 vscale = _mm256_set1_ps(scale);
+		const __m256i low = _mm256_set1_epi32(0xffff), high = _mm256_set1_epi32(0xffff0000);
+		for (; x + 8 <= n; x += 8)
+		{
+			// Split 8 pixels into R|G and B|A words, in pixel order
+			__m256 p0 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(s + 4*x)));
+			__m256 p1 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(s + 4*x + 16)));
+			__m256i rgw = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(p0, p1, _MM_SHUFFLE(2,0,2,0))), _MM_SHUFFLE(3,1,2,0));
+			__m256i baw = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(p0, p1, _MM_SHUFFLE(3,1,3,1))), _MM_SHUFFLE(3,1,2,0));
+			__m256 fr = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(rgw, low)), vscale);
+			__m256 fg = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(rgw, 16)), vscale);
+			__m256 fb = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(baw, low)), vscale);
+			__m256 out[3];
+			interpolate8(lut, fr, fg, fb, out);
+			rgw = _mm256_or_si256(_mm256_cvtps_epi32(out[0]), _mm256_slli_epi32(_mm256_cvtps_epi32(out[1]), 16));
+			baw = _mm256_or_si256(_mm256_cvtps_epi32(out[2]), _mm256_and_si256(baw, high));
+			// And back: pixels 0-3 from the low halves, 4-7 from the high
+			rgw = _mm256_permute4x64_epi64(rgw, _MM_SHUFFLE(3,1,2,0));
+			baw = _mm256_permute4x64_epi64(baw, _MM_SHUFFLE(3,1,2,0));
+			_mm256_storeu_si256((__m256i *)(d + 4*x), _mm256_unpacklo_epi32(rgw, baw));
+			_mm256_storeu_si256((__m256i *)(d + 4*x + 16), _mm256_unpackhi_epi32(rgw, baw));
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		float f[3] = { s[4*x+0]*scale, s[4*x+1]*scale, s[4*x+2]*scale }, out[3];
+		interpolate(lut, f, out);
+		for (k = 0; k < 3; k++)
+			d[4*x+k] = (unsigned short)lrintf(out[k]);
+		d[4*x+3] = s[4*x+3];
+	}
+}
+
+
+void cpuApplyLUT(const CPUImage *src, CPUImage *dst, const ColorLUT *lut)
+{
+	int y;
+
+	for (y = 0; y < src->high; y++)
+		lutRow(src->data + y*src->rowbytes, dst->data + y*dst->rowbytes, src->wide, lut);
+}
+
+
+void cpuApplyLUT16(const CPUImage16 *src, CPUImage16 *dst, const ColorLUT *lut)
+{
+	int y;
+
+	for (y = 0; y < src->high; y++)
+		lutRow16((const unsigned short *)((const unsigned char *)src->data + y*src->rowbytes),
+		         (unsigned short *)((unsigned char *)dst->data + y*dst->rowbytes), src->wide, lut);
+}
+
+
+int cpuLUTFaster(const FilterStep *steps, int count, int size)
+{
+	ColorMatrix cm;
+	int passes, i;
+
+	for (i = 0; i < count; i++)
+		if (steps[i].mode != 5 && !filterColorMatrix(&cm, steps[i].mode, steps[i].val))
+			return 0;
+	passes = cpuFilterChainPasses(steps, count);
+	for (i = 0; i < (int)(sizeof(crossover)/sizeof(crossover[0])); i++)
+		if (size <= crossover[i].size)
+			return passes >= crossover[i].passes;
+	// Larger tables than any timed fall out of cache: never
+	return 0;
+}
@@ -404,125 +404,6 @@ static void extrapolate(V2fT2f *quad, float t)	// t [0..2]
 }
 
 
-// Matrix Utilities for Hue rotation
-static void matrixmult(float a[4][4], float b[4][4], float c[4][4])
-{
-	int x, y;
-	float temp[4][4];
-
-	for(y=0; y<4; y++)
-		for(x=0; x<4; x++)
-			temp[y][x] = b[y][0] * a[0][x] + b[y][1] * a[1][x] + b[y][2] * a[2][x] + b[y][3] * a[3][x];
-	for(y=0; y<4; y++)
-		for(x=0; x<4; x++)
-			c[y][x] = temp[y][x];
-}
-
-
-static void xrotatemat(float mat[4][4], float rs, float rc)
-{
-	mat[0][0] = 1.0;
-	mat[0][1] = 0.0;
-	mat[0][2] = 0.0;
-	mat[0][3] = 0.0;
-
-	mat[1][0] = 0.0;
-	mat[1][1] = rc;
-	mat[1][2] = rs;
-	mat[1][3] = 0.0;
-
-	mat[2][0] = 0.0;
-	mat[2][1] = -rs;
-	mat[2][2] = rc;
-	mat[2][3] = 0.0;
-
-	mat[3][0] = 0.0;
-	mat[3][1] = 0.0;
-	mat[3][2] = 0.0;
-	mat[3][3] = 1.0;
- }
-
-
-static void yrotatemat(float mat[4][4], float rs, float rc)
-{
-	mat[0][0] = rc;
-	mat[0][1] = 0.0;
-	mat[0][2] = -rs;
-	mat[0][3] = 0.0;
-
-	mat[1][0] = 0.0;
-	mat[1][1] = 1.0;
-	mat[1][2] = 0.0;
-	mat[1][3] = 0.0;
-
-	mat[2][0] = rs;
-	mat[2][1] = 0.0;
-	mat[2][2] = rc;
-	mat[2][3] = 0.0;
-
-	mat[3][0] = 0.0;
-	mat[3][1] = 0.0;
-	mat[3][2] = 0.0;
-	mat[3][3] = 1.0;
-}
-
-
-static void zrotatemat(float mat[4][4], float rs, float rc)
-{
-	mat[0][0] = rc;
-	mat[0][1] = rs;
-	mat[0][2] = 0.0;
-	mat[0][3] = 0.0;
-
-	mat[1][0] = -rs;
-	mat[1][1] = rc;
-	mat[1][2] = 0.0;
-	mat[1][3] = 0.0;
-
-	mat[2][0] = 0.0;
-	mat[2][1] = 0.0;
-	mat[2][2] = 1.0;
-	mat[2][3] = 0.0;
-
-	mat[3][0] = 0.0;
-	mat[3][1] = 0.0;
-	mat[3][2] = 0.0;
-	mat[3][3] = 1.0;
-}
-
-
-static void huematrix(GLfloat mat[4][4], float angle)
-{
-	float mag, rot[4][4];
-	float xrs, xrc;
-	float yrs, yrc;
-	float zrs, zrc;
-
-	// Rotate the grey vector into positive Z
-	mag = sqrt(2.0);
-	xrs = 1.0/mag;
-	xrc = 1.0/mag;
-	xrotatemat(mat, xrs, xrc);
-	mag = sqrt(3.0);
-	yrs = -1.0/mag;
-	yrc = sqrt(2.0)/mag;
-	yrotatemat(rot, yrs, yrc);
-	matrixmult(rot, mat, mat);
-
-	// Rotate the hue
-	zrs = sin(angle);
-	zrc = cos(angle);
-	zrotatemat(rot, zrs, zrc);
-	matrixmult(rot, mat, mat);
-
-	// Rotate the grey vector back into place
-	yrotatemat(rot, -yrs, yrc);
-	matrixmult(rot,  mat, mat);
-	xrotatemat(rot, -xrs, xrc);
-	matrixmult(rot,  mat, mat);
-}
-
-
 static void hue(V2fT2f *quad, float t)	// t [0..2] == [-180..180] degrees
 {
 	GLfloat mat[4][4];
@@ -532,7 +413,7 @@ static void hue(V2fT2f *quad, float t)	// t [0..2] == [-180..180] degrees
 	// Each DOT3 needs inputs prescaled to [0.5..1.0]
 
 	// Construct 3x3 matrix
-	huematrix(mat, (t-1.0)*M_PI);
+	cpuHueMatrix(mat, (t-1.0)*M_PI);
 
 	// Prescale matrix weights
 	mat[0][0] *= 0.5; mat[0][0] += 0.5;
@@ -595,6 +476,113 @@ static void hue(V2fT2f *quad, float t)	// t [0..2] == [-180..180] degrees
 }
 
 
+static void colormatrix(V2fT2f *quad, const ColorMatrix *cm)
+{
+	GLfloat lerp[4] = { 1.0, 1.0, 1.0, 0.5 };
+	GLfloat weight[3][4];
+	GLfloat bias[4];
+	GLint scale;
+	float largest = 0, positive;
+	int i, j;
+
+	// Any affine transform, such as a folded chain of the filters above.
+	// This is hue() with the result scaled up to allow weights beyond [-1..1],
+	// and a third unit to add the bias, which DOT3 has no term for.
+	//
+	// Three passes using three units, one pass per output channel:
+	// Unit 0 scales and biases into [0.5..1.0]
+	// Unit 1 dot products with 0.5 + m/(2*scale), giving m.x/scale
+	// Unit 2 adds 0.5 + bias/scale with ADD_SIGNED, then scales
+	//
+	// The scale is chosen so that the dot product stays under 1.0 and the
+	// bias fits the constant; past the largest RGB_SCALE of 4 they are clamped.
+	// The dot product is also clamped at 0.0 before the bias is added, so
+	// where m.x goes negative and a positive bias brings it back (saturation
+	// or hue followed by brightness), this clips where cpuColorMatrix doesn't.
+
+	for (i = 0; i < 3; i++)
+	{
+		positive = 0;
+		for (j = 0; j < 3; j++)
+		{
+			largest = fmaxf(largest, fabsf(cm->m[i][j]));
+			positive += fmaxf(cm->m[i][j], 0.0f);
+		}
+		largest = fmaxf(largest, positive);
+		largest = fmaxf(largest, 2 * fabsf(cm->bias[i]));
+	}
+	scale = largest <= 1.0f ? 1 : (largest <= 2.0f ? 2 : 4);
+	for (i = 0; i < 3; i++)
+	{
+		for (j = 0; j < 3; j++)
+			weight[i][j] = 0.5 + 0.5 * fminf(fmaxf(cm->m[i][j] / scale, -1.0f), 1.0f);
+		weight[i][3] = 1.0;
+		bias[i] = 0.5 + fminf(fmaxf(cm->bias[i] / scale, -0.5f), 0.5f);
+	}
+	bias[3] = 1.0;
+
+	glVertexPointer  (2, GL_FLOAT, sizeof(V2fT2f), &quad[0].x);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(V2fT2f), &quad[0].s);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB,      GL_INTERPOLATE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_RGB,         GL_TEXTURE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC1_RGB,         GL_CONSTANT);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC2_RGB,         GL_CONSTANT);
+	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA,    GL_REPLACE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_ALPHA,       GL_TEXTURE);
+	glTexEnvfv(GL_TEXTURE_ENV,GL_TEXTURE_ENV_COLOR, lerp);
+
+	// Note: we prefer to dot product with primary color, because
+	// the constant color is stored in limited precision on MBX
+	glActiveTexture(GL_TEXTURE1);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB,      GL_DOT3_RGB);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_RGB,         GL_PREVIOUS);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC1_RGB,         GL_PRIMARY_COLOR);
+	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA,    GL_REPLACE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_ALPHA,       GL_PREVIOUS);
+
+	// The dot product is the same in every channel, so one constant
+	// holds all three biases and the color mask picks one per pass
+	glActiveTexture(GL_TEXTURE2);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, Half.texID);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB,      GL_ADD_SIGNED);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_RGB,         GL_PREVIOUS);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC1_RGB,         GL_CONSTANT);
+	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA,    GL_REPLACE);
+	glTexEnvi(GL_TEXTURE_ENV, GL_SRC0_ALPHA,       GL_PREVIOUS);
+	glTexEnvi(GL_TEXTURE_ENV, GL_RGB_SCALE,        scale);
+	glTexEnvfv(GL_TEXTURE_ENV,GL_TEXTURE_ENV_COLOR, bias);
+
+	// Red channel
+	glColorMask(1,0,0,0);
+	glColor4f(weight[0][0], weight[0][1], weight[0][2], weight[0][3]);
+	validateTexEnv();
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	// Green channel
+	glColorMask(0,1,0,0);
+	glColor4f(weight[1][0], weight[1][1], weight[1][2], weight[1][3]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	// Blue channel
+	glColorMask(0,0,1,0);
+	glColor4f(weight[2][0], weight[2][1], weight[2][2], weight[2][3]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	// Restore state
+	glTexEnvi(GL_TEXTURE_ENV, GL_RGB_SCALE,        1);
+	glDisable(GL_TEXTURE_2D);
+	glActiveTexture(GL_TEXTURE1);
+	glDisable(GL_TEXTURE_2D);
+	glActiveTexture(GL_TEXTURE0);
+	glColorMask(1,1,1,1);
+}
+
+
 static void blur(V2fT2f *quad, float t)	// t = 1
 {
 	GLint tex;
@@ -730,6 +718,31 @@ void drawGL(int wide, int high, float val, int mode)
 }
 
 
+int drawChainGL(int wide, int high, const FilterStep *steps, int count)
+{
+	ColorMatrix cm;
+
+	// The whole chain must fold into one matrix, and the bias needs a third unit
+	if (renderer.maxTextureUnits < 3)
+		return 0;
+	if (compileFilterChain(&cm, steps, count) != count)
+		return 0;
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrthof(0, wide, 0, high, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glScalef(wide, high, 1);
+
+	glBindTexture(GL_TEXTURE_2D, Input.texID);
+	glViewport(0, 0, wide, high);
+	colormatrix(flipquad, &cm);
+	glCheckError();
+	return 1;
+}
+
+
 void initGL(void)
 {
 	int i;
@@ -740,6 +753,7 @@ void initGL(void)
 	renderer.extension[IMG_texture_format_BGRA8888] =
 		(0 != strstr((char *)glGetString(GL_EXTENSIONS), "GL_IMG_texture_format_BGRA8888"));
 	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &renderer.maxTextureSize);
+	glGetIntegerv(GL_MAX_TEXTURE_UNITS, &renderer.maxTextureUnits);
 
 	// Constant state for the lifetime of the app-- position and unit0 are always used
 	glEnableClientState(GL_VERTEX_ARRAY);
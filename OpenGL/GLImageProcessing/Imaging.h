@@ -51,6 +51,7 @@
 #include <OpenGLES/ES1/gl.h>
 #include <OpenGLES/ES1/glext.h>
 #include "Debug.h"
+#include "CPUImaging.h"
 
 #define MAX_FILTER_RADIUS 2
 
@@ -65,6 +66,7 @@ enum {
 typedef struct {
 	GLboolean extension[NUM_EXTENSIONS];
 	GLint     maxTextureSize;
+	GLint     maxTextureUnits;
 } RendererInfo;
 
 // A simple 2D image
@@ -83,4 +85,10 @@ typedef struct {
 void initGL(void);
 void drawGL(int wide, int high, float val, int mode);
 
+// Draw a chain of affine filters (any drawGL mode but sharpness) folded into one
+// color matrix, in the passes of a single filter. Returns 0, drawing nothing, if
+// a step is not affine or the renderer has fewer than three texture units (MBX).
+// The app's own view draws one filter at a time with drawGL and does not call this.
+int drawChainGL(int wide, int high, const FilterStep *steps, int count);
+
 #endif /* IMAGING_H */
@@ -0,0 +1,707 @@
+/*
+     File: cpuimaging_check.c
+ Abstract: Checks the CPU filters against a direct evaluation of the TexEnv math, and times them.
+
+ */
+
+//
+//  Each filter is evaluated here in double precision, straight from the description of
+//  its TexEnv passes in Imaging.c, and compared with CPUImaging on random images whose
+//  width leaves a partial vector at the end of every row. The vector kernels and the
+//  plain C ones must both be within one step of the reference, and in place must give
+//  the same result as out of place. Hue is checked against a rotation about the grey
+//  axis built with Rodrigues' formula rather than with cpuHueMatrix.
+//
+//  Chains of the affine filters are checked against the same steps evaluated one
+//  after another, and must cost about as much as a single filter.
+//
+//  The box blurs of CPUBlur are checked against boxes summed directly, one pass at a
+//  time, with radii up to larger than the image. Any number of threads, and the
+//  vector and plain C kernels, must all give the same bits.
+//
+//  Chains with gamma are baked into tables of each size, and the 8-bit and 16-bit
+//  results compared with the steps evaluated here in double precision. The 8-bit
+//  results must be within the error that cpuLUTError reports, plus rounding.
+//
+//  Then each filter is timed on one core, in Mpixel/s, the Gaussian and unsharp
+//  mask on a 24 megapixel image with one thread and with one per core, and the
+//  tables as they are baked and applied. Last, chains of one to eight passes are
+//  timed against the tables, to show where a table starts to pay and whether
+//  cpuLUTFaster agrees.
+//
+//  Build from this directory with:
+//
+//      cc -std=c99 -D_POSIX_C_SOURCE=200112L -O3 -march=native -pthread -I.. cpuimaging_check.c ../CPUImaging.c ../CPUBlur.c ../CPULut.c -lm -o cpuimaging_check
+//
+//  and run with no arguments. -march=native gives AVX2 on x86 and NEON on ARM.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "CPUBlur.h"
+#include "CPULut.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define NUM_MODES 5
+
+static const char *names[NUM_MODES] = { "brightness", "contrast", "saturation", "hue", "sharpness" };
+static const float values[] = { 0.0, 0.35, 1.0, 1.5, 2.0 };
+#define NUM_VALUES (int)(sizeof(values)/sizeof(values[0]))
+
+static int failures;
+
+
+static double clamp255(double v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+
+static const unsigned char *texel(const CPUImage *image, int x, int y)
+{
+	x = x < 0 ? 0 : (x >= image->wide ? image->wide-1 : x);
+	y = y < 0 ? 0 : (y >= image->high ? image->high-1 : y);
+	return image->data + y*image->rowbytes + 4*x;
+}
+
+
+// Bilinear sample between four texels, channel c, as GL_LINEAR does halfway between centers
+static double block(const CPUImage *image, int x, int y, int c)
+{
+	return (texel(image, x, y)[c] + texel(image, x+1, y)[c] + texel(image, x, y+1)[c] + texel(image, x+1, y+1)[c]) / 4.0;
+}
+
+
+static void hueRotation(double m[3][3], double t)
+{
+	// Rotation by a about k = (1,1,1)/sqrt(3): cos*I + sin*[k]x + (1-cos)*k*k'.
+	// cpuHueMatrix turns the other way, so a = -(t-1)*pi.
+	double a = (1-t)*M_PI, c = cos(a), s = sin(a), k = 1/sqrt(3.0);
+	double cross[3][3] = { { 0, -k, k }, { k, 0, -k }, { -k, k, 0 } };
+	int i, j;
+
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			m[i][j] = (i == j ? c : 0) + s*cross[i][j] + (1-c)*k*k;
+}
+
+
+// One of the affine filters, in 8-bit units, without the final clamp
+static void affine(double p[3], float t, int mode)
+{
+	double w[3] = { 2*(.646-0.5), 2*(.794-0.5), 2*(.557-0.5) };
+	double m[3][3], q[3], grey;
+	int c;
+
+	grey = w[0]*p[0] + w[1]*p[1] + w[2]*p[2];
+	hueRotation(m, t);
+	for (c = 0; c < 3; c++)
+	{
+		switch (mode)
+		{
+			case 0:  q[c] = p[c] + (t-1)*255; break;
+			case 1:  q[c] = p[c]*t + 127.5*(1-t); break;
+			case 2:  q[c] = p[c]*t + grey*(1-t); break;
+			default: q[c] = m[c][0]*p[0] + m[c][1]*p[1] + m[c][2]*p[2]; break;
+		}
+	}
+	for (c = 0; c < 3; c++)
+		p[c] = q[c];
+}
+
+
+static double reference(const CPUImage *src, int x, int y, int c, float t, int mode)
+{
+	const unsigned char *p = texel(src, x, y);
+	double rgb[3] = { p[0], p[1], p[2] }, blur;
+
+	if (c == 3)
+		return p[3];
+	switch (mode)
+	{
+		case 0:
+		case 1:
+		case 2:
+		case 3:
+			affine(rgb, t, mode);
+			return clamp255(rgb[c]);
+		default:
+			// The blurred degenerate image is held in an 8-bit texture
+			blur = (p[c] + block(src, x+1, y, c) + block(src, x-2, y-1, c) +
+			        block(src, x-1, y+1, c) + block(src, x, y-2, c)) / 5;
+			blur = floor(blur + 0.5);
+			return clamp255(p[c]*t + blur*(1-t));
+	}
+}
+
+
+static void randomImage(CPUImage *image)
+{
+	int x, y;
+
+	for (y = 0; y < image->high; y++)
+		for (x = 0; x < 4*image->wide; x++)
+			image->data[y*image->rowbytes + x] = rand() & 0xff;
+}
+
+
+static void check(int bOK, const char *what)
+{
+	printf("%s  %s\n", bOK ? "pass" : "FAIL", what);
+	if (!bOK)
+		failures++;
+}
+
+
+static void checkFilters(int simd)
+{
+	// 8*k+7 pixels wide, so every row ends in a partial vector
+	CPUImage src, dst, inplace;
+	char what[128];
+	int mode, v, x, y, c;
+
+	cpuSetSIMD(simd);
+	cpuImageCreate(&src, 8*13+7, 37);
+	cpuImageCreate(&dst, src.wide, src.high);
+	cpuImageCreate(&inplace, src.wide, src.high);
+	randomImage(&src);
+	for (mode = 0; mode < NUM_MODES; mode++)
+	{
+		double worst = 0;
+		int bSame = 1;
+		for (v = 0; v < NUM_VALUES; v++)
+		{
+			float t = values[v];
+			cpuFilter(&src, &dst, t, mode);
+			memcpy(inplace.data, src.data, src.rowbytes*src.high);
+			cpuFilter(&inplace, &inplace, t, mode);
+			for (y = 0; y < src.high; y++)
+			{
+				for (x = 0; x < src.wide; x++)
+				{
+					for (c = 0; c < 4; c++)
+					{
+						double d = fabs(dst.data[y*dst.rowbytes + 4*x + c] - reference(&src, x, y, c, t, mode));
+						worst = d > worst ? d : worst;
+					}
+				}
+				bSame = bSame && (mode == 4 || memcmp(dst.data + y*dst.rowbytes, inplace.data + y*inplace.rowbytes, 4*src.wide) == 0);
+			}
+		}
+		snprintf(what, sizeof(what), "%-10s %-6s  largest difference %.2f", names[mode], cpuImagingEngine(), worst);
+		check(worst <= 1.0, what);
+		if (mode != 4)
+		{
+			snprintf(what, sizeof(what), "%-10s %-6s  in place", names[mode], cpuImagingEngine());
+			check(bSame, what);
+		}
+	}
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+	cpuImageDestroy(&inplace);
+}
+
+
+static void checkChains(int simd)
+{
+	// Random chains of the affine filters, against the steps one after another
+	// with a single clamp at the end. Values stay near 1 so that the chain does
+	// not simply saturate.
+	CPUImage src, dst, steps;
+	FilterStep chain[6];
+	FilterStep mixed[3] = { { 1, 1.4 }, { 4, 1.6 }, { 3, 0.7 } };
+	char what[128];
+	double worst = 0;
+	int n, i, x, y, c, bSame = 1;
+
+	cpuSetSIMD(simd);
+	cpuImageCreate(&src, 8*13+7, 37);
+	cpuImageCreate(&dst, src.wide, src.high);
+	cpuImageCreate(&steps, src.wide, src.high);
+	randomImage(&src);
+	for (n = 0; n < 20; n++)
+	{
+		int count = 2 + n % 5;
+		for (i = 0; i < count; i++)
+		{
+			chain[i].mode = rand() % 4;
+			chain[i].val = 0.7 + 0.6 * rand() / RAND_MAX;
+		}
+		cpuFilterChain(&src, &dst, chain, count);
+		for (y = 0; y < src.high; y++)
+		{
+			for (x = 0; x < src.wide; x++)
+			{
+				const unsigned char *p = texel(&src, x, y);
+				double rgb[3] = { p[0], p[1], p[2] };
+				for (i = 0; i < count; i++)
+					affine(rgb, chain[i].val, chain[i].mode);
+				for (c = 0; c < 4; c++)
+				{
+					double d = fabs(dst.data[y*dst.rowbytes + 4*x + c] - (c < 3 ? clamp255(rgb[c]) : p[3]));
+					worst = d > worst ? d : worst;
+				}
+			}
+		}
+	}
+	snprintf(what, sizeof(what), "chains     %-6s  largest difference %.2f", cpuImagingEngine(), worst);
+	check(worst <= 1.0, what);
+
+	// Sharpness is not affine, so it splits the chain; the result is as if each ran alone
+	cpuFilterChain(&src, &dst, mixed, 3);
+	cpuContrast(&src, &steps, mixed[0].val);
+	cpuSharpness(&steps, &steps, mixed[1].val);
+	cpuHue(&steps, &steps, mixed[2].val);
+	for (y = 0; y < src.high; y++)
+		bSame = bSame && memcmp(dst.data + y*dst.rowbytes, steps.data + y*steps.rowbytes, 4*src.wide) == 0;
+	snprintf(what, sizeof(what), "chains     %-6s  split at sharpness", cpuImagingEngine());
+	check(bSame, what);
+
+	// Six affine steps are one pass; sharpness makes three, and rules out a table
+	snprintf(what, sizeof(what), "chains     %-6s  passes counted", cpuImagingEngine());
+	check(cpuFilterChainPasses(chain, 6) == 1 && cpuFilterChainPasses(mixed, 3) == 3 && !cpuLUTFaster(mixed, 3, 17), what);
+
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+	cpuImageDestroy(&steps);
+}
+
+
+// One box of radius r along the rows (or columns) of image, in place, rounding to nearest
+static void referenceBox(CPUImage *image, int r, int vertical)
+{
+	int n = vertical ? image->high : image->wide;
+	int lines = vertical ? image->wide : image->high;
+	unsigned char *line = malloc(4*n);
+	int l, i, k, c;
+
+	for (l = 0; l < lines; l++)
+	{
+		for (i = 0; i < n; i++)
+			memcpy(line + 4*i, vertical ? texel(image, l, i) : texel(image, i, l), 4);
+		for (i = 0; i < n; i++)
+		{
+			for (c = 0; c < 4; c++)
+			{
+				double sum = 0;
+				for (k = i-r; k <= i+r; k++)
+					sum += line[4*(k < 0 ? 0 : (k >= n ? n-1 : k)) + c];
+				(vertical ? (unsigned char *)texel(image, l, i) : (unsigned char *)texel(image, i, l))[c] = floor(sum / (2*r+1) + 0.5);
+			}
+		}
+	}
+	free(line);
+}
+
+
+static void checkBlur(int simd)
+{
+	static const int radii[][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 2, 3, 4 }, { 7, 7, 8 }, { 60, 1, 30 } };
+	static const float sigmas[] = { 0.8, 2.0, 5.0, 20.0, 100.0 };
+	CPUImage src, dst, ref, other;
+	char what[128];
+	double worst = 0;
+	int n, i, y, bSame = 1;
+
+	cpuSetSIMD(simd);
+	cpuImageCreate(&src, 8*13+7, 37);
+	cpuImageCreate(&dst, src.wide, src.high);
+	cpuImageCreate(&ref, src.wide, src.high);
+	cpuImageCreate(&other, src.wide, src.high);
+	randomImage(&src);
+	for (n = 0; n < (int)(sizeof(radii)/sizeof(radii[0])); n++)
+	{
+		cpuBoxBlur(&src, &dst, radii[n], 3, 1);
+		memcpy(ref.data, src.data, src.rowbytes*src.high);
+		for (i = 0; i < 3; i++)
+			referenceBox(&ref, radii[n][i], 0);
+		for (i = 0; i < 3; i++)
+			referenceBox(&ref, radii[n][i], 1);
+		for (i = 0; i < src.high*(int)src.rowbytes; i++)
+		{
+			double d = fabs((double)dst.data[i] - ref.data[i]);
+			worst = (i % src.rowbytes) < 4*(size_t)src.wide && d > worst ? d : worst;
+		}
+
+		// Threads, and in place
+		memcpy(other.data, src.data, src.rowbytes*src.high);
+		cpuBoxBlur(&other, &other, radii[n], 3, 5);
+		for (y = 0; y < src.high; y++)
+			bSame = bSame && memcmp(dst.data + y*dst.rowbytes, other.data + y*other.rowbytes, 4*src.wide) == 0;
+	}
+	snprintf(what, sizeof(what), "box blur   %-6s  largest difference %.2f", cpuImagingEngine(), worst);
+	check(worst <= 2.0, what);
+	snprintf(what, sizeof(what), "box blur   %-6s  threaded in place", cpuImagingEngine());
+	check(bSame, what);
+
+	// The three boxes for a Gaussian have its variance to within half a step: a box of
+	// radius r has r(r+1)/3, and one more on the radius adds 2(r+1)/3
+	for (n = 0; n < (int)(sizeof(sigmas)/sizeof(sigmas[0])); n++)
+	{
+		int r[3];
+		double variance = 0, want = sigmas[n]*sigmas[n];
+		gaussianBoxRadii(sigmas[n], r);
+		for (i = 0; i < 3; i++)
+			variance += r[i]*(r[i]+1) / 3.0;
+		snprintf(what, sizeof(what), "gaussian   sigma %5.1f  radii %d %d %d  sigma %.2f", sigmas[n], r[0], r[1], r[2], sqrt(variance));
+		check(fabs(variance - want) <= (r[0]+1) / 3.0 + 1e-6, what);
+	}
+
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+	cpuImageDestroy(&ref);
+	cpuImageDestroy(&other);
+}
+
+
+// The steps one after another on a color in [0..1], each clamped
+static void chainReference(double rgb[3], const FilterStep *steps, int count)
+{
+	int i, c;
+
+	for (i = 0; i < count; i++)
+	{
+		for (c = 0; c < 3; c++)
+			rgb[c] *= 255;
+		if (steps[i].mode == 5)
+			for (c = 0; c < 3; c++)
+				rgb[c] = 255*pow(rgb[c]/255, 1/steps[i].val);
+		else
+			affine(rgb, steps[i].val, steps[i].mode);
+		for (c = 0; c < 3; c++)
+			rgb[c] = clamp255(rgb[c]) / 255;
+	}
+}
+
+
+static void randomChain(FilterStep *chain, int count)
+{
+	static const int modes[5] = { 0, 1, 2, 3, 5 };
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		chain[i].mode = modes[rand() % 5];
+		chain[i].val = 0.6 + 0.8 * rand() / RAND_MAX;
+	}
+}
+
+
+static void checkLUT(int simd)
+{
+	static const int sizes[3] = { 17, 33, 65 };
+	CPUImage src, dst, inplace;
+	CPUImage16 src16, dst16;
+	ColorLUT lut, other;
+	FilterStep chain[6];
+	char what[128];
+	int n, i, x, y, c, count, bSame;
+
+	cpuSetSIMD(simd);
+	cpuImageCreate(&src, 8*13+7, 37);
+	cpuImageCreate(&dst, src.wide, src.high);
+	cpuImageCreate(&inplace, src.wide, src.high);
+	src16.wide = dst16.wide = src.wide;
+	src16.high = dst16.high = src.high;
+	src16.rowbytes = dst16.rowbytes = 8*src.wide + 8;
+	src16.data = malloc(src16.rowbytes*src16.high);
+	dst16.data = malloc(dst16.rowbytes*dst16.high);
+	for (i = 0; i < (int)(src16.rowbytes/2)*src16.high; i++)
+		src16.data[i] = rand() ^ (rand() << 8);
+
+	for (n = 0; n < 3; n++)
+	{
+		double worst = 0, worst16 = 0;
+		float bound = 0;
+		bSame = 1;
+		cpuLUTCreate(&lut, sizes[n]);
+		cpuLUTCreate(&other, sizes[n]);
+		for (i = 0; i < 4; i++)
+		{
+			float e;
+			count = 3 + i;
+			randomChain(chain, count);
+			randomImage(&src);
+			cpuBakeLUT(&lut, chain, count, 0);
+			cpuBakeLUT(&other, chain, count, 1);
+			bSame = bSame && memcmp(lut.table, other.table, 8*(size_t)lut.size*lut.size*lut.size) == 0;
+			e = cpuLUTError(&lut, chain, count, 0);
+			bound = e > bound ? e : bound;
+
+			cpuApplyLUT(&src, &dst, &lut);
+			memcpy(inplace.data, src.data, src.rowbytes*src.high);
+			cpuApplyLUT(&inplace, &inplace, &lut);
+			cpuApplyLUT16(&src16, &dst16, &lut);
+			for (y = 0; y < src.high; y++)
+			{
+				bSame = bSame && memcmp(dst.data + y*dst.rowbytes, inplace.data + y*inplace.rowbytes, 4*src.wide) == 0;
+				for (x = 0; x < src.wide; x++)
+				{
+					const unsigned char *p = texel(&src, x, y);
+					const unsigned short *p16 = (const unsigned short *)((unsigned char *)src16.data + y*src16.rowbytes) + 4*x;
+					const unsigned short *q16 = (const unsigned short *)((unsigned char *)dst16.data + y*dst16.rowbytes) + 4*x;
+					double rgb[3] = { p[0]/255.0, p[1]/255.0, p[2]/255.0 };
+					double rgb16[3] = { p16[0]/65535.0, p16[1]/65535.0, p16[2]/65535.0 };
+					chainReference(rgb, chain, count);
+					chainReference(rgb16, chain, count);
+					for (c = 0; c < 3; c++)
+					{
+						double d = fabs(dst.data[y*dst.rowbytes + 4*x + c] - 255*rgb[c]) - 255*e;
+						double d16 = fabs(q16[c] - 65535*rgb16[c]);
+						worst = d > worst ? d : worst;
+						worst16 = d16 > worst16 ? d16 : worst16;
+					}
+					bSame = bSame && dst.data[y*dst.rowbytes + 4*x + 3] == p[3] && q16[3] == p16[3];
+				}
+			}
+		}
+		snprintf(what, sizeof(what), "lut %2d     %-6s  error %.2f, beyond it %.2f, 16-bit %.0f", sizes[n], cpuImagingEngine(), 255*bound, worst, worst16);
+		check(worst <= 0.51, what);
+		snprintf(what, sizeof(what), "lut %2d     %-6s  threaded bake, in place, alpha", sizes[n], cpuImagingEngine());
+		check(bSame, what);
+		cpuLUTDestroy(&lut);
+		cpuLUTDestroy(&other);
+	}
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+	cpuImageDestroy(&inplace);
+	free(src16.data);
+	free(dst16.data);
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// The filter for mode, or for NUM_MODES all four affine filters as one chain
+static void runFilter(const CPUImage *src, CPUImage *dst, int mode)
+{
+	static const FilterStep chain[4] = { { 0, 1.1 }, { 1, 1.3 }, { 2, 1.5 }, { 3, 1.2 } };
+
+	if (mode < NUM_MODES)
+		cpuFilter(src, dst, 1.5, mode);
+	else
+		cpuFilterChain(src, dst, chain, 4);
+}
+
+
+static void timeFilters(int wide, int high)
+{
+	CPUImage src, dst;
+	int mode, i, runs;
+	double start, seconds;
+
+	cpuSetSIMD(1);
+	cpuImageCreate(&src, wide, high);
+	cpuImageCreate(&dst, wide, high);
+	randomImage(&src);
+	printf("%dx%d, %s:\n", wide, high, cpuImagingEngine());
+	for (mode = 0; mode <= NUM_MODES; mode++)
+	{
+		// at least half a second of work
+		runFilter(&src, &dst, mode);
+		runs = 0;
+		start = now();
+		do
+		{
+			for (i = 0; i < 4; i++)
+				runFilter(&src, &dst, mode);
+			runs += 4;
+			seconds = now() - start;
+		} while (seconds < 0.5);
+		printf("  %-10s %8.0f Mpixel/s\n", mode < NUM_MODES ? names[mode] : "4 chained", (double)wide*high*runs / seconds / 1e6);
+	}
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+}
+
+
+static void timeBlur(int wide, int high)
+{
+	static const float sigmas[] = { 2.0, 20.0 };
+	static const int threads[] = { 1, 0 };
+	CPUImage src, dst;
+	int s, t, runs;
+	double start, seconds;
+
+	cpuSetSIMD(1);
+	cpuImageCreate(&src, wide, high);
+	cpuImageCreate(&dst, wide, high);
+	randomImage(&src);
+	printf("%dx%d, %s:\n", wide, high, cpuImagingEngine());
+	for (s = 0; s < 3; s++)
+	{
+		for (t = 0; t < 2; t++)
+		{
+			runs = 0;
+			start = now();
+			do
+			{
+				if (s < 2)
+					cpuGaussianBlur(&src, &dst, sigmas[s], threads[t]);
+				else
+					cpuUnsharpMask(&src, &dst, 3.0, 0.8, threads[t]);
+				runs++;
+				seconds = now() - start;
+			} while (seconds < 0.5);
+			printf("  %-7s %4.0f  %-8s %8.0f Mpixel/s\n", s < 2 ? "gauss" : "unsharp", s < 2 ? sigmas[s] : 3.0,
+			       threads[t] ? "1 thread" : "per core", (double)wide*high*runs / seconds / 1e6);
+		}
+	}
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+}
+
+
+static void timeLUT(int wide, int high)
+{
+	static const FilterStep chain[6] = { { 0, 1.1 }, { 1, 1.3 }, { 2, 1.5 }, { 3, 1.2 }, { 5, 1.2 }, { 1, 0.9 } };
+	static const int sizes[3] = { 17, 33, 65 };
+	CPUImage src, dst;
+	CPUImage16 src16;
+	ColorLUT lut;
+	int n, i, runs, depth;
+	double start, seconds, bake;
+
+	cpuSetSIMD(1);
+	cpuImageCreate(&src, wide, high);
+	cpuImageCreate(&dst, wide, high);
+	randomImage(&src);
+	src16.wide = wide;
+	src16.high = high;
+	src16.rowbytes = 8*(size_t)wide;
+	src16.data = malloc(src16.rowbytes*high);
+	for (i = 0; i < 4*wide*high; i++)
+		src16.data[i] = rand() ^ (rand() << 8);
+	printf("%dx%d, %s, 6 steps with gamma:\n", wide, high, cpuImagingEngine());
+
+	runs = 0;
+	start = now();
+	do
+	{
+		cpuFilterChain(&src, &dst, chain, 6);
+		runs++;
+		seconds = now() - start;
+	} while (seconds < 0.5);
+	printf("  %-10s %8.0f Mpixel/s\n", "filters", (double)wide*high*runs / seconds / 1e6);
+
+	for (n = 0; n < 3; n++)
+	{
+		cpuLUTCreate(&lut, sizes[n]);
+		start = now();
+		cpuBakeLUT(&lut, chain, 6, 0);
+		bake = now() - start;
+		printf("  lut %-6d bake %.2f ms, error %.2f\n", sizes[n], 1000*bake, 255*cpuLUTError(&lut, chain, 6, 0));
+		for (depth = 8; depth <= 16; depth += 8)
+		{
+			runs = 0;
+			start = now();
+			do
+			{
+				if (depth == 8)
+					cpuApplyLUT(&src, &dst, &lut);
+				else
+					cpuApplyLUT16(&src16, &src16, &lut);
+				runs++;
+				seconds = now() - start;
+			} while (seconds < 0.5);
+			printf("  lut %-2d %2d-bit %8.0f Mpixel/s\n", sizes[n], depth, (double)wide*high*runs / seconds / 1e6);
+		}
+		cpuLUTDestroy(&lut);
+	}
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+	free(src16.data);
+}
+
+
+// Chains of one to eight passes, gamma and contrast in turn, against the 8-bit tables:
+// the crossover that cpuLUTFaster uses
+static void timeCrossover(int wide, int high)
+{
+	static const int sizes[3] = { 17, 33, 65 };
+	FilterStep chain[8];
+	CPUImage src, dst;
+	ColorLUT lut;
+	double lutRate[3], rate, start, seconds;
+	int n, passes, runs;
+
+	cpuSetSIMD(1);
+	cpuImageCreate(&src, wide, high);
+	cpuImageCreate(&dst, wide, high);
+	randomImage(&src);
+	for (n = 0; n < 8; n++)
+	{
+		chain[n].mode = (n & 1) ? 1 : 5;
+		chain[n].val = (n & 1) ? 1.1 : 1.05;
+	}
+	printf("%dx%d, %s, passes against 8-bit tables of 17, 33 and 65:\n", wide, high, cpuImagingEngine());
+	for (n = 0; n < 3; n++)
+	{
+		cpuLUTCreate(&lut, sizes[n]);
+		cpuBakeLUT(&lut, chain, 8, 0);
+		runs = 0;
+		start = now();
+		do
+		{
+			cpuApplyLUT(&src, &dst, &lut);
+			runs++;
+			seconds = now() - start;
+		} while (seconds < 0.5);
+		lutRate[n] = (double)wide*high*runs / seconds / 1e6;
+		cpuLUTDestroy(&lut);
+	}
+	printf("  tables   %8.0f %8.0f %8.0f Mpixel/s\n", lutRate[0], lutRate[1], lutRate[2]);
+	for (passes = 1; passes <= 8; passes++)
+	{
+		runs = 0;
+		start = now();
+		do
+		{
+			cpuFilterChain(&src, &dst, chain, passes);
+			runs++;
+			seconds = now() - start;
+		} while (seconds < 0.5);
+		rate = (double)wide*high*runs / seconds / 1e6;
+		printf("  %d passes %8.0f Mpixel/s, quicker here: %s%s%s, cpuLUTFaster: %s%s%s\n", passes, rate,
+		       lutRate[0] > rate ? "17 " : "", lutRate[1] > rate ? "33 " : "", lutRate[2] > rate ? "65" : "",
+		       cpuLUTFaster(chain, passes, 17) ? "17 " : "", cpuLUTFaster(chain, passes, 33) ? "33 " : "",
+		       cpuLUTFaster(chain, passes, 65) ? "65" : "");
+	}
+	cpuImageDestroy(&src);
+	cpuImageDestroy(&dst);
+}
+
+
+int main(void)
+{
+	srand(1);
+	checkFilters(0);
+	checkFilters(1);
+	checkChains(0);
+	checkChains(1);
+	checkBlur(0);
+	checkBlur(1);
+	checkLUT(0);
+	checkLUT(1);
+	timeFilters(1920, 1080);
+	timeFilters(4096, 2160);
+	timeBlur(6000, 4000);
+	timeLUT(1920, 1080);
+	timeLUT(4096, 2160);
+	timeCrossover(1920, 1080);
+	timeCrossover(4096, 2160);
+	printf("%s\n", failures == 0 ? "all passed" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
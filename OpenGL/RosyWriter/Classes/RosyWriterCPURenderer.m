@@ -8,14 +8,47 @@
  */
 
 #import "RosyWriterCPURenderer.h"
+#import "TileScheduler.h"
+#import "BGRAKernels.h"
+#import "RenderedPixelBufferPool.h"
+
+typedef struct {
+	BGRAImage source;
+	BGRAImage destination;
+} DeGreenContext;
+
+// BGRAKernels does the work a vector at a time; the scheduler hands each core its own tiles
+static void deGreenTile( void *context, const Tile *tile )
+{
+	const DeGreenContext *frames = context;
+	BGRAImage source = BGRAImageRegion( &frames->source, tile->x, tile->y, tile->wide, tile->high );
+	BGRAImage destination = BGRAImageRegion( &frames->destination, tile->x, tile->y, tile->wide, tile->high );
+	
+	BGRAZeroChannel( &source, &destination, 1 ); // De-green (second pixel in BGRA is green)
+}
+
+@interface RosyWriterCPURenderer ()
+{
+	TileScheduler *_scheduler;
+	RenderedPixelBufferPool *_outputPool;
+}
+
+@end
 
 @implementation RosyWriterCPURenderer
 
+#pragma mark API
+
+- (void)dealloc
+{
+	[self reset];
+}
+
 #pragma mark RosyWriterRenderer
 
 - (BOOL)operatesInPlace
 {
-	return YES;
+	return NO;
 }
 
 - (FourCharCode)inputPixelFormat
@@ -25,38 +58,60 @@
 
 - (void)prepareForInputWithFormatDescription:(CMFormatDescriptionRef)inputFormatDescription outputRetainedBufferCountHint:(size_t)outputRetainedBufferCountHint
 {
-	// nothing to do, we are stateless
+	// The frame is split into tiles and de-greened on every core
+	if ( ! _scheduler ) {
+		_scheduler = TileSchedulerCreate( 0 );
+	}
+	
+	if ( ! _outputPool ) {
+		_outputPool = [[RenderedPixelBufferPool alloc] initWithInputFormatDescription:inputFormatDescription retainedBufferCountHint:outputRetainedBufferCountHint];
+	}
 }
 
 - (void)reset
 {
-	// nothing to do, we are stateless
+	TileSchedulerDestroy( _scheduler );
+	_scheduler = NULL;
+	
+	_outputPool = nil;
+}
+
+- (CMFormatDescriptionRef)outputFormatDescription
+{
+	return _outputPool.outputFormatDescription;
 }
 
 - (CVPixelBufferRef)copyRenderedPixelBuffer:(CVPixelBufferRef)pixelBuffer
-{	
-	const int kBytesPerPixel = 4;
+{
+	const int kBytesPerPixel = 8; // four read and four written
+	
+	CVPixelBufferRef renderedPixelBuffer = [_outputPool copyPixelBuffer];
+	if ( ! renderedPixelBuffer ) {
+		return NULL;
+	}
 	
-	CVPixelBufferLockBaseAddress( pixelBuffer, 0 );
+	CVPixelBufferLockBaseAddress( pixelBuffer, kCVPixelBufferLock_ReadOnly );
+	CVPixelBufferLockBaseAddress( renderedPixelBuffer, 0 );
 	
 	int bufferWidth = (int)CVPixelBufferGetWidth( pixelBuffer );
 	int bufferHeight = (int)CVPixelBufferGetHeight( pixelBuffer );
-	size_t bytesPerRow = CVPixelBufferGetBytesPerRow( pixelBuffer );
-	uint8_t *baseAddress = CVPixelBufferGetBaseAddress( pixelBuffer );
-	
-	for ( int row = 0; row < bufferHeight; row++ )
-	{
-		uint8_t *pixel = baseAddress + row * bytesPerRow;
-		for ( int column = 0; column < bufferWidth; column++ )
-		{
-			pixel[1] = 0; // De-green (second pixel in BGRA is green)
-			pixel += kBytesPerPixel;
-		}
+	DeGreenContext frames = {
+		{ CVPixelBufferGetBaseAddress( pixelBuffer ), bufferWidth, bufferHeight, CVPixelBufferGetBytesPerRow( pixelBuffer ) },
+		{ CVPixelBufferGetBaseAddress( renderedPixelBuffer ), bufferWidth, bufferHeight, CVPixelBufferGetBytesPerRow( renderedPixelBuffer ) },
+	};
+	
+	if ( _scheduler ) {
+		TileSchedulerRun( _scheduler, bufferWidth, bufferHeight, kBytesPerPixel, 0, deGreenTile, &frames );
+	}
+	else {
+		Tile whole = { 0, 0, bufferWidth, bufferHeight, 0, 0, bufferWidth, bufferHeight, 0, 0 };
+		deGreenTile( &frames, &whole );
 	}
 	
-	CVPixelBufferUnlockBaseAddress( pixelBuffer, 0 );
+	CVPixelBufferUnlockBaseAddress( renderedPixelBuffer, 0 );
+	CVPixelBufferUnlockBaseAddress( pixelBuffer, kCVPixelBufferLock_ReadOnly );
 	
-	return (CVPixelBufferRef)CFRetain( pixelBuffer );
+	return renderedPixelBuffer;
 }
 
 @end
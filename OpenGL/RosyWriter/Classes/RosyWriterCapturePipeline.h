@@ -12,6 +12,22 @@
 
 @protocol RosyWriterCapturePipelineDelegate;
 
+// The bounded queues frames wait in between the stages of the pipeline
+typedef NS_ENUM( NSInteger, RosyWriterPipelineStage )
+{
+	RosyWriterPipelineStageRender = 0,	// frames from the camera, waiting to be rendered
+	RosyWriterPipelineStagePreview,		// rendered frames, waiting to be displayed
+	RosyWriterPipelineStageRecording,	// rendered frames, waiting for the movie recorder
+};
+
+// What a stage's queue does with a frame that arrives when it is full
+typedef NS_ENUM( NSInteger, RosyWriterDropPolicy )
+{
+	RosyWriterDropPolicyDropOldest = 0,	// the oldest waiting frame is dropped
+	RosyWriterDropPolicyDropNewest,		// the arriving frame is dropped
+	RosyWriterDropPolicyBlock,			// the stage before waits for room, for a bounded time, then drops the arriving frame
+};
+
 @interface RosyWriterCapturePipeline : NSObject 
 
 - (instancetype)initWithDelegate:(id<RosyWriterCapturePipelineDelegate>)delegate callbackQueue:(dispatch_queue_t)queue; // delegate is weak referenced
@@ -35,6 +51,17 @@
 @property(atomic, readonly) float videoFrameRate;
 @property(atomic, readonly) CMVideoDimensions videoDimensions;
 
+// Latency of each frame from capture through delivery, rendering, preview and recording, see FrameTimings.h.
+// Writes summary.txt, frames.csv and a percentile distribution for each stage into directory, which must exist.
+- (BOOL)writeFrameTimingsToDirectory:(NSString *)directory;
+
+// By default the render and preview stages drop their oldest frames and recording blocks. Frames are never lost anywhere else.
+- (void)setDropPolicy:(RosyWriterDropPolicy)dropPolicy forStage:(RosyWriterPipelineStage)stage;
+- (RosyWriterDropPolicy)dropPolicyForStage:(RosyWriterPipelineStage)stage;
+
+// Since the video pipeline started. Also counts frames the renderer had no buffer for (render), frames the preview gave up while recording was behind (preview), and frames the movie recorder refused (recording).
+- (uint64_t)droppedFrameCountForStage:(RosyWriterPipelineStage)stage;
+
 @end
 
 @protocol RosyWriterCapturePipelineDelegate <NSObject>
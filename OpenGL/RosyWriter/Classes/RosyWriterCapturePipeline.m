@@ -15,6 +15,8 @@
 #import "RosyWriterOpenCVRenderer.h"
 
 #import "MovieRecorder.h"
+#import "FrameTimings.h"
+#import "FrameQueue.h"
 
 #import <CoreMedia/CMBufferQueue.h>
 #import <CoreMedia/CMAudioClock.h>
@@ -35,10 +37,30 @@
 
 #define RETAINED_BUFFER_COUNT 6
 
+/*
+ Frames go from the camera to the renderer, and from the renderer to the preview and the movie recorder, through bounded queues (see FrameQueue.h) rather than straight onto dispatch queues.
+ When a stage falls behind, frames wait in its queue at most up to the queue's capacity, and beyond that its drop policy decides which frame is lost, so latency stays bounded and every lost frame is counted at the stage that lost it.
+ 
+ - Render: the newest frames from the camera are rendered. The video data output's callback only queues the frame, so the camera never discards frames behind our back.
+ - Preview: only the most recent rendered frame is worth displaying.
+ - Recording: the renderer waits, up to BLOCK_TIMEOUT_MS, for room rather than lose a frame from the movie. Meanwhile the render queue drops the oldest camera frames instead.
+ 
+ Recording comes first: while a frame is still waiting for the recorder, the preview gives up the next one, along with its pixel buffer.
+ RECORDING_APPENDS_IN_FLIGHT covers the 2 frames of latency allowed above for the movie recorder's dispatch_async and append, so that frames beyond them wait in the recording queue where the policy applies, not on the recorder's writing queue.
+ */
+
+#define RENDER_QUEUE_CAPACITY 2
+#define PREVIEW_QUEUE_CAPACITY 1
+#define RECORDING_QUEUE_CAPACITY 1
+#define RECORDING_APPENDS_IN_FLIGHT 2
+#define BLOCK_TIMEOUT_MS 30
+
 #define RECORD_AUDIO 0
 
 #define LOG_STATUS_TRANSITIONS 0
 
+#define LOG_FRAME_TIMINGS 0
+
 typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 {
 	RosyWriterRecordingStatusIdle = 0,
@@ -49,7 +71,14 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 
 @interface RosyWriterCapturePipeline () <AVCaptureAudioDataOutputSampleBufferDelegate, AVCaptureVideoDataOutputSampleBufferDelegate, MovieRecorderDelegate>
 {
-	NSMutableArray *_previousSecondTimestamps;
+	FrameTimings *_frameTimings;
+	FrameQueue *_renderFrames;
+	FrameQueue *_previewFrames;
+	FrameQueue *_recordingFrames;
+	uint64_t _framesOutOfBuffers;
+	uint64_t _framesYieldedToRecording;
+	uint64_t _framesRefusedByRecorder;
+	dispatch_semaphore_t _recordingAppendsInFlight;
 
 	AVCaptureSession *_captureSession;
 	AVCaptureDevice *_videoDevice;
@@ -64,6 +93,8 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 	
 	dispatch_queue_t _sessionQueue;
 	dispatch_queue_t _videoDataOutputQueue;
+	dispatch_queue_t _renderQueue;
+	dispatch_queue_t _recordingQueue;
 	
 	id<RosyWriterRenderer> _renderer;
 	BOOL _renderingEnabled;
@@ -83,12 +114,17 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 @property(atomic, readwrite) CMVideoDimensions videoDimensions;
 
 // Because we specify __attribute__((NSObject)) ARC will manage the lifetime of the backing ivars even though they are CF types.
-@property(nonatomic, strong) __attribute__((NSObject)) CVPixelBufferRef currentPreviewPixelBuffer;
 @property(nonatomic, strong) __attribute__((NSObject)) CMFormatDescriptionRef outputVideoFormatDescription;
 @property(nonatomic, strong) __attribute__((NSObject)) CMFormatDescriptionRef outputAudioFormatDescription;
 
 @end
 
+// Frames in the queues are retained CF objects
+static void releaseFrame( void *context, void *object )
+{
+	CFRelease( (CFTypeRef)object );
+}
+
 @implementation RosyWriterCapturePipeline
 
 - (instancetype)initWithDelegate:(id<RosyWriterCapturePipelineDelegate>)delegate callbackQueue:(dispatch_queue_t)queue // delegate is weak referenced
@@ -99,7 +135,7 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 	self = [super init];
 	if ( self )
 	{
-		_previousSecondTimestamps = [[NSMutableArray alloc] init];
+		_frameTimings = FrameTimingsCreate( 0 );
 		_recordingOrientation = AVCaptureVideoOrientationPortrait;
 		
 		_recordingURL = [[NSURL alloc] initFileURLWithPath:[NSString pathWithComponents:@[NSTemporaryDirectory(), @"Movie.MOV"]]];
@@ -113,6 +149,17 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 		_videoDataOutputQueue = dispatch_queue_create( "com.apple.sample.capturepipeline.video", DISPATCH_QUEUE_SERIAL );
 		dispatch_set_target_queue( _videoDataOutputQueue, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_HIGH, 0 ) );
 		
+		// Rendering keeps the priority the video data output had when it rendered on its own queue.
+		// The queues between the stages bound how many frames any of these dispatch queues has to work through.
+		_renderQueue = dispatch_queue_create( "com.apple.sample.capturepipeline.render", DISPATCH_QUEUE_SERIAL );
+		dispatch_set_target_queue( _renderQueue, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_HIGH, 0 ) );
+		_recordingQueue = dispatch_queue_create( "com.apple.sample.capturepipeline.recording", DISPATCH_QUEUE_SERIAL );
+		
+		_renderFrames = FrameQueueCreate( RENDER_QUEUE_CAPACITY, FrameQueueDropOldest, 0, releaseFrame, NULL );
+		_previewFrames = FrameQueueCreate( PREVIEW_QUEUE_CAPACITY, FrameQueueDropOldest, 0, releaseFrame, NULL );
+		_recordingFrames = FrameQueueCreate( RECORDING_QUEUE_CAPACITY, FrameQueueBlock, BLOCK_TIMEOUT_MS * NSEC_PER_MSEC, releaseFrame, NULL );
+		_recordingAppendsInFlight = dispatch_semaphore_create( RECORDING_APPENDS_IN_FLIGHT );
+		
 // USE_XXX_RENDERER is set in the project's build settings for each target
 #if USE_OPENGL_RENDERER
 		_renderer = [[RosyWriterOpenGLRenderer alloc] init];
@@ -134,6 +181,10 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 - (void)dealloc
 {
 	[self teardownCaptureSession];
+	FrameQueueDestroy( _renderFrames );
+	FrameQueueDestroy( _previewFrames );
+	FrameQueueDestroy( _recordingFrames );
+	FrameTimingsDestroy( _frameTimings );
 }
 
 #pragma mark Capture Session
@@ -224,6 +275,7 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 	// By setting alwaysDiscardsLateVideoFrames to NO we ensure that minor fluctuations in system load or in our processing time for a given frame won't cause framedrops.
 	// We do however need to ensure that on average we can process frames in realtime.
 	// If we were doing preview only we would probably want to set alwaysDiscardsLateVideoFrames to YES.
+	// Our callback only queues the frame for rendering, so when we can't keep up it is the render queue that drops frames, and counts them.
 	videoOut.alwaysDiscardsLateVideoFrames = NO;
 	
 	if ( [_captureSession canAddOutput:videoOut] ) {
@@ -396,6 +448,13 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 	[self videoPipelineWillStartRunning];
 	
 	self.videoDimensions = CMVideoFormatDescriptionGetDimensions( inputFormatDescription );
+	FrameTimingsReset( _frameTimings );
+	FrameQueueResetStatistics( _renderFrames );
+	FrameQueueResetStatistics( _previewFrames );
+	FrameQueueResetStatistics( _recordingFrames );
+	_framesOutOfBuffers = 0;
+	_framesYieldedToRecording = 0;
+	_framesRefusedByRecorder = 0;
 	[_renderer prepareForInputWithFormatDescription:inputFormatDescription outputRetainedBufferCountHint:RETAINED_BUFFER_COUNT];
 	
 	if ( ! _renderer.operatesInPlace && [_renderer respondsToSelector:@selector(outputFormatDescription)] ) {
@@ -422,9 +481,20 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 			return;
 		}
 		
-		self.outputVideoFormatDescription = NULL;
-		[_renderer reset];
-		self.currentPreviewPixelBuffer = NULL;
+		// Nothing more is queued for rendering now; drop what is waiting and let a frame being rendered finish.
+		// A render blocked on a full queue gives up after BLOCK_TIMEOUT_MS, so this can't wait on the preview for long.
+		FrameQueueFlush( _renderFrames );
+		dispatch_sync( _renderQueue, ^{
+			self.outputVideoFormatDescription = NULL;
+			[_renderer reset];
+		} );
+		FrameQueueFlush( _previewFrames );
+		
+#if LOG_FRAME_TIMINGS
+		FrameTimingsWriteSummary( _frameTimings, stderr );
+		NSLog( @"frames dropped: render %llu, preview %llu, recording %llu",
+			  [self droppedFrameCountForStage:RosyWriterPipelineStageRender], [self droppedFrameCountForStage:RosyWriterPipelineStagePreview], [self droppedFrameCountForStage:RosyWriterPipelineStageRecording] );
+#endif // LOG_FRAME_TIMINGS
 		
 		NSLog( @"-[%@ %@] finished teardown", [self class], NSStringFromSelector(_cmd) );
 		
@@ -490,7 +560,15 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 			[self setupVideoPipelineWithInputFormatDescription:formatDescription];
 		}
 		else {
-			[self renderVideoSampleBuffer:sampleBuffer];
+			uint64_t deliveredTime = FrameTimingsNow();
+			int64_t frame = FrameTimingsBeginFrame( _frameTimings, [self hostTimeNanosecondsFromTimestamp:CMSampleBufferGetPresentationTimeStamp( sampleBuffer )] );
+			FrameTimingsStamp( _frameTimings, frame, FrameStageDelivered, deliveredTime );
+			self.videoFrameRate = FrameTimingsFramesPerSecond( _frameTimings );
+			
+			CFRetain( sampleBuffer );
+			[self enqueueFrame:sampleBuffer number:frame onto:_renderFrames consumerQueue:_renderQueue drain:^{
+				[self renderQueuedFrames];
+			}];
 		}
 	}
 	else if ( connection == _audioConnection )
@@ -505,13 +583,38 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 	}
 }
 
-- (void)renderVideoSampleBuffer:(CMSampleBufferRef)sampleBuffer
+// Takes over the caller's reference to object.
+// The consumer is started on its queue only when it isn't already draining the frame queue, so the dispatch queue never holds more than one drain.
+- (void)enqueueFrame:(CFTypeRef)object number:(int64_t)frame onto:(FrameQueue *)frameQueue consumerQueue:(dispatch_queue_t)consumerQueue drain:(dispatch_block_t)drain
+{
+	FrameQueueItem item = { (void *)object, frame };
+	int startConsumer = 0;
+	
+	if ( FrameQueuePush( frameQueue, item, &startConsumer ) && startConsumer ) {
+		dispatch_async( consumerQueue, drain );
+	}
+}
+
+// runs on _renderQueue
+- (void)renderQueuedFrames
+{
+	FrameQueueItem item;
+	
+	do {
+		while ( FrameQueuePop( _renderFrames, &item ) ) {
+			@autoreleasepool {
+				[self renderVideoSampleBuffer:(CMSampleBufferRef)item.object frame:item.frame];
+			}
+			CFRelease( item.object );
+		}
+	} while ( ! FrameQueueConsumerDone( _renderFrames ) );
+}
+
+- (void)renderVideoSampleBuffer:(CMSampleBufferRef)sampleBuffer frame:(int64_t)frame
 {
 	CVPixelBufferRef renderedPixelBuffer = NULL;
 	CMTime timestamp = CMSampleBufferGetPresentationTimeStamp( sampleBuffer );
 	
-	[self calculateFramerateAtTimestamp:timestamp];
-	
 	// We must not use the GPU while running in the background.
 	// setRenderingEnabled: takes the same lock so the caller can guarantee no GPU usage once the setter returns.
 	@synchronized( _renderer )
@@ -527,47 +630,55 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 	
 	if ( renderedPixelBuffer )
 	{
-		@synchronized( self )
-		{
-			[self outputPreviewPixelBuffer:renderedPixelBuffer];
-			
-			if ( _recordingStatus == RosyWriterRecordingStatusRecording ) {
-				[_recorder appendVideoPixelBuffer:renderedPixelBuffer withPresentationTime:timestamp];
-			}
+		FrameTimingsStamp( _frameTimings, frame, FrameStageRendered, 0 );
+		
+		BOOL recording = NO;
+		@synchronized( self ) {
+			recording = ( _recordingStatus == RosyWriterRecordingStatusRecording );
+		}
+		
+		// Queued for recording outside the lock, as the recording queue may make us wait for room
+		BOOL recorderBehind = NO;
+		if ( recording ) {
+			recorderBehind = ( FrameQueueDepth( _recordingFrames ) > 0 );
+			[self recordPixelBuffer:renderedPixelBuffer withPresentationTime:timestamp frame:frame];
+		}
+		
+		if ( recorderBehind ) {
+			__atomic_fetch_add( &_framesYieldedToRecording, 1, __ATOMIC_RELAXED );
+		}
+		else {
+			CFRetain( renderedPixelBuffer );
+			[self enqueueFrame:renderedPixelBuffer number:frame onto:_previewFrames consumerQueue:_delegateCallbackQueue drain:^{
+				[self displayQueuedFrames];
+			}];
 		}
 		
 		CFRelease( renderedPixelBuffer );
 	}
 	else
 	{
+		__atomic_fetch_add( &_framesOutOfBuffers, 1, __ATOMIC_RELAXED );
 		[self videoPipelineDidRunOutOfBuffers];
 	}
 }
 
-// call under @synchronized( self )
-- (void)outputPreviewPixelBuffer:(CVPixelBufferRef)previewPixelBuffer
+// runs on _delegateCallbackQueue
+- (void)displayQueuedFrames
 {
-	// Keep preview latency low by dropping stale frames that have not been picked up by the delegate yet
-	// Note that access to currentPreviewPixelBuffer is protected by the @synchronized lock
-	self.currentPreviewPixelBuffer = previewPixelBuffer;
+	FrameQueueItem item;
 	
-	[self invokeDelegateCallbackAsync:^{
-		
-		CVPixelBufferRef currentPreviewPixelBuffer = NULL;
-		@synchronized( self )
-		{
-			currentPreviewPixelBuffer = self.currentPreviewPixelBuffer;
-			if ( currentPreviewPixelBuffer ) {
-				CFRetain( currentPreviewPixelBuffer );
-				self.currentPreviewPixelBuffer = NULL;
+	// The preview queue drops stale frames that have not been picked up by the delegate yet, which keeps preview latency low
+	do {
+		while ( FrameQueuePop( _previewFrames, &item ) ) {
+			@autoreleasepool {
+				[_delegate capturePipeline:self previewPixelBufferReadyForDisplay:(CVPixelBufferRef)item.object];
 			}
+			// The delegate draws synchronously, so this is when the frame was presented, short of the display's refresh
+			FrameTimingsStamp( _frameTimings, item.frame, FrameStageDisplayed, 0 );
+			CFRelease( item.object );
 		}
-		
-		if ( currentPreviewPixelBuffer ) {
-			[_delegate capturePipeline:self previewPixelBufferReadyForDisplay:currentPreviewPixelBuffer];
-			CFRelease( currentPreviewPixelBuffer );
-		}
-	}];
+	} while ( ! FrameQueueConsumerDone( _previewFrames ) );
 }
 
 #pragma mark Recording
@@ -610,7 +721,86 @@ typedef NS_ENUM( NSInteger, RosyWriterRecordingStatus )
 		[self transitionToRecordingStatus:RosyWriterRecordingStatusStoppingRecording error:nil];
 	}
 	
-	[_recorder finishRecording]; // asynchronous, will call us back with recorderDidFinishRecording: or recorder:didFailWithError: when done
+	// Frames queued before the stop still go into the movie.
+	// Once the frame being rendered is done nothing more is queued for recording, and then the recording queue appends what is left before finishing.
+	dispatch_async( _renderQueue, ^{
+		dispatch_async( _recordingQueue, ^{
+			FrameQueueItem item;
+			while ( FrameQueuePop( _recordingFrames, &item ) ) {
+				[self appendSampleBuffer:(CMSampleBufferRef)item.object frame:item.frame];
+				CFRelease( item.object );
+			}
+			
+			MovieRecorder *recorder = nil;
+			@synchronized( self ) {
+				recorder = _recorder;
+			}
+			[recorder finishRecording]; // asynchronous, will call us back with recorderDidFinishRecording: or recorder:didFailWithError: when done
+		} );
+	} );
+}
+
+// runs on _renderQueue
+- (void)recordPixelBuffer:(CVPixelBufferRef)pixelBuffer withPresentationTime:(CMTime)presentationTime frame:(int64_t)frame
+{
+	CMSampleBufferRef sampleBuffer = NULL;
+	
+	CMSampleTimingInfo timingInfo = {0,};
+	timingInfo.duration = kCMTimeInvalid;
+	timingInfo.decodeTimeStamp = kCMTimeInvalid;
+	timingInfo.presentationTimeStamp = presentationTime;
+	
+	OSStatus err = CMSampleBufferCreateForImageBuffer( kCFAllocatorDefault, pixelBuffer, true, NULL, NULL, self.outputVideoFormatDescription, &timingInfo, &sampleBuffer );
+	if ( ! sampleBuffer ) {
+		NSLog( @"sample buffer create failed (%i), dropping frame", (int)err );
+		__atomic_fetch_add( &_framesRefusedByRecorder, 1, __ATOMIC_RELAXED );
+		return;
+	}
+	
+	[self enqueueFrame:sampleBuffer number:frame onto:_recordingFrames consumerQueue:_recordingQueue drain:^{
+		[self recordQueuedFrames];
+	}];
+}
+
+// runs on _recordingQueue
+- (void)recordQueuedFrames
+{
+	FrameQueueItem item;
+	
+	do {
+		while ( FrameQueuePop( _recordingFrames, &item ) ) {
+			[self appendSampleBuffer:(CMSampleBufferRef)item.object frame:item.frame];
+			CFRelease( item.object );
+		}
+	} while ( ! FrameQueueConsumerDone( _recordingFrames ) );
+}
+
+// runs on _recordingQueue
+- (void)appendSampleBuffer:(CMSampleBufferRef)sampleBuffer frame:(int64_t)frame
+{
+	MovieRecorder *recorder = nil;
+	@synchronized( self ) {
+		recorder = _recorder;
+	}
+	
+	if ( ! recorder ) {
+		// The recorder failed after the frame was queued
+		__atomic_fetch_add( &_framesRefusedByRecorder, 1, __ATOMIC_RELAXED );
+		return;
+	}
+	
+	// While the recorder has as many appends in flight as we allow, the frames after wait in the recording queue
+	dispatch_semaphore_wait( _recordingAppendsInFlight, DISPATCH_TIME_FOREVER );
+	FrameTimingsStamp( _frameTimings, frame, FrameStageEnqueued, 0 );
+	[recorder appendVideoSampleBuffer:sampleBuffer appendedHandler:^( BOOL appended ) {
+		if ( appended ) {
+			FrameTimingsStamp( _frameTimings, frame, FrameStageWritten, 0 );
+		}
+		else {
+			__atomic_fetch_add( &_framesRefusedByRecorder, 1, __ATOMIC_RELAXED );
+		}
+		dispatch_semaphore_signal( _recordingAppendsInFlight );
+	}];
 }
 
 #pragma mark MovieRecorder Delegate
@@ -801,23 +991,129 @@ static CGFloat angleOffsetFromPortraitOrientationToOrientation(AVCaptureVideoOri
 	return angle;
 }
 
-- (void)calculateFramerateAtTimestamp:(CMTime)timestamp
+// Sample buffers are stamped on the session's clock, which is normally the host time clock, the one FrameTimings keeps
+- (uint64_t)hostTimeNanosecondsFromTimestamp:(CMTime)timestamp
+{
+	CMClockRef masterClock = _captureSession.masterClock;
+	if ( masterClock ) {
+		timestamp = CMSyncConvertTime( timestamp, masterClock, CMClockGetHostTimeClock() );
+	}
+	
+	if ( ! CMTIME_IS_NUMERIC( timestamp ) ) {
+		return 0; // FrameTimings takes the time of delivery instead
+	}
+	
+	CMTime nanoseconds = CMTimeConvertScale( timestamp, 1000000000, kCMTimeRoundingMethod_Default );
+	return ( nanoseconds.value > 0 ) ? (uint64_t)nanoseconds.value : 0;
+}
+
+#pragma mark Frame Queues
+
+- (FrameQueue *)frameQueueForStage:(RosyWriterPipelineStage)stage
+{
+	switch ( stage )
+	{
+		case RosyWriterPipelineStageRender:
+			return _renderFrames;
+		case RosyWriterPipelineStagePreview:
+			return _previewFrames;
+		case RosyWriterPipelineStageRecording:
+			return _recordingFrames;
+	}
+	
+	@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"Unknown pipeline stage" userInfo:nil];
+}
+
+- (void)setDropPolicy:(RosyWriterDropPolicy)dropPolicy forStage:(RosyWriterPipelineStage)stage
 {
-	[_previousSecondTimestamps addObject:[NSValue valueWithCMTime:timestamp]];
+	FrameQueuePolicy policy = FrameQueueDropOldest;
+	switch ( dropPolicy )
+	{
+		case RosyWriterDropPolicyDropOldest:
+			policy = FrameQueueDropOldest;
+			break;
+		case RosyWriterDropPolicyDropNewest:
+			policy = FrameQueueDropNewest;
+			break;
+		case RosyWriterDropPolicyBlock:
+			policy = FrameQueueBlock;
+			break;
+	}
 	
-	CMTime oneSecond = CMTimeMake( 1, 1 );
-	CMTime oneSecondAgo = CMTimeSubtract( timestamp, oneSecond );
+	FrameQueueSetPolicy( [self frameQueueForStage:stage], policy, BLOCK_TIMEOUT_MS * NSEC_PER_MSEC );
+}
+
+- (RosyWriterDropPolicy)dropPolicyForStage:(RosyWriterPipelineStage)stage
+{
+	switch ( FrameQueueGetPolicy( [self frameQueueForStage:stage] ) )
+	{
+		case FrameQueueDropOldest:
+			return RosyWriterDropPolicyDropOldest;
+		case FrameQueueDropNewest:
+			return RosyWriterDropPolicyDropNewest;
+		case FrameQueueBlock:
+			return RosyWriterDropPolicyBlock;
+	}
 	
-	while( CMTIME_COMPARE_INLINE( [_previousSecondTimestamps[0] CMTimeValue], <, oneSecondAgo ) ) {
-		[_previousSecondTimestamps removeObjectAtIndex:0];
+	return RosyWriterDropPolicyDropOldest;
+}
+
+- (uint64_t)droppedFrameCountForStage:(RosyWriterPipelineStage)stage
+{
+	FrameQueueStatistics statistics;
+	FrameQueueGetStatistics( [self frameQueueForStage:stage], &statistics );
+	uint64_t dropped = statistics.droppedOldest + statistics.droppedNewest;
+	
+	switch ( stage )
+	{
+		case RosyWriterPipelineStageRender:
+			return dropped + __atomic_load_n( &_framesOutOfBuffers, __ATOMIC_RELAXED );
+		case RosyWriterPipelineStagePreview:
+			return dropped + __atomic_load_n( &_framesYieldedToRecording, __ATOMIC_RELAXED );
+		case RosyWriterPipelineStageRecording:
+			return dropped + __atomic_load_n( &_framesRefusedByRecorder, __ATOMIC_RELAXED );
 	}
 	
-	if ( [_previousSecondTimestamps count] > 1 )
+	return dropped;
+}
+
+#pragma mark Frame Timings
+
+- (BOOL)writeFrameTimingsToDirectory:(NSString *)directory
+{
+	FILE *file = fopen( [[directory stringByAppendingPathComponent:@"summary.txt"] fileSystemRepresentation], "w" );
+	if ( ! file ) {
+		return NO;
+	}
+	FrameTimingsWriteSummary( _frameTimings, file );
+	fclose( file );
+	
+	file = fopen( [[directory stringByAppendingPathComponent:@"frames.csv"] fileSystemRepresentation], "w" );
+	if ( ! file ) {
+		return NO;
+	}
+	FrameTimingsWriteFrames( _frameTimings, file );
+	fclose( file );
+	
+	for ( int stage = FrameStageCaptured; stage < FrameStageCount; stage++ )
 	{
-		const Float64 duration = CMTimeGetSeconds( CMTimeSubtract( [[_previousSecondTimestamps lastObject] CMTimeValue], [_previousSecondTimestamps[0] CMTimeValue] ) );
-		const float newRate = (float)( [_previousSecondTimestamps count] - 1 ) / duration;
-		self.videoFrameRate = newRate;
+		for ( int span = FrameSpanStep; span <= FrameSpanTotal; span++ )
+		{
+			if ( stage == FrameStageCaptured && span == FrameSpanTotal ) {
+				continue;
+			}
+			
+			NSString *name = [NSString stringWithFormat:@"%s-%@.hgrm", FrameStageName( (FrameStage)stage ), ( span == FrameSpanStep ) ? @"step" : @"total"];
+			file = fopen( [[directory stringByAppendingPathComponent:name] fileSystemRepresentation], "w" );
+			if ( ! file ) {
+				return NO;
+			}
+			FrameTimingsWritePercentiles( _frameTimings, (FrameStage)stage, (FrameSpan)span, file );
+			fclose( file );
+		}
 	}
+	
+	return YES;
 }
 
 @end
@@ -14,14 +14,56 @@
 //	- Insert framework into project's Frameworks group
 //	- Make sure framework is included under the target's Build Phases -> Link Binary With Libraries.
 #import <opencv2/opencv.hpp>
+#import "TileScheduler.h"
+#import "BGRAKernels.h"
+#import "RenderedPixelBufferPool.h"
+
+// Each tile works on its own region of the frames, cv::Mat headers sharing the pixels.
+// Mat::at<> costs a bounds check and an address computation per pixel; BGRAKernels
+// clears green a vector at a time over the region's rows instead.
+typedef struct {
+	cv::Mat source;
+	cv::Mat destination;
+} DeGreenContext;
+
+static BGRAImage bgraImageFromMat( const cv::Mat &image )
+{
+	BGRAImage bgraImage = { image.data, image.cols, image.rows, image.step };
+	return bgraImage;
+}
+
+static void deGreenTile( void *context, const Tile *tile )
+{
+	const DeGreenContext *frames = (const DeGreenContext *)context;
+	cv::Rect rect( tile->x, tile->y, tile->wide, tile->high );
+	BGRAImage source = bgraImageFromMat( frames->source( rect ) );
+	BGRAImage destination = bgraImageFromMat( frames->destination( rect ) );
+	
+	BGRAZeroChannel( &source, &destination, 1 );
+}
+
+@interface RosyWriterOpenCVRenderer ()
+{
+	TileScheduler *_scheduler;
+	RenderedPixelBufferPool *_outputPool;
+}
+
+@end
 
 @implementation RosyWriterOpenCVRenderer
 
+#pragma mark API
+
+- (void)dealloc
+{
+	[self reset];
+}
+
 #pragma mark RosyWriterRenderer
 
 - (BOOL)operatesInPlace
 {
-	return YES;
+	return NO;
 }
 
 - (FourCharCode)inputPixelFormat
@@ -31,43 +73,72 @@
 
 - (void)prepareForInputWithFormatDescription:(CMFormatDescriptionRef)inputFormatDescription outputRetainedBufferCountHint:(size_t)outputRetainedBufferCountHint
 {
-	// nothing to do, we are stateless
+	// The frame is split into tiles and de-greened on every core
+	if ( ! _scheduler ) {
+		_scheduler = TileSchedulerCreate( 0 );
+	}
+	
+	if ( ! _outputPool ) {
+		_outputPool = [[RenderedPixelBufferPool alloc] initWithInputFormatDescription:inputFormatDescription retainedBufferCountHint:outputRetainedBufferCountHint];
+	}
 }
 
 - (void)reset
 {
-	// nothing to do, we are stateless
+	TileSchedulerDestroy( _scheduler );
+	_scheduler = NULL;
+	
+	_outputPool = nil;
 }
 
-- (CVPixelBufferRef)copyRenderedPixelBuffer:(CVPixelBufferRef)pixelBuffer
+- (CMFormatDescriptionRef)outputFormatDescription
+{
+	return _outputPool.outputFormatDescription;
+}
+
+// A Mat wrapping a locked pixel buffer's pixels
+static cv::Mat matFromPixelBuffer( CVPixelBufferRef pixelBuffer )
 {
-	CVPixelBufferLockBaseAddress( pixelBuffer, 0 );
-	
 	unsigned char *base = (unsigned char *)CVPixelBufferGetBaseAddress( pixelBuffer );
-	size_t width = CVPixelBufferGetWidth( pixelBuffer );
 	size_t height = CVPixelBufferGetHeight( pixelBuffer );
 	size_t stride = CVPixelBufferGetBytesPerRow( pixelBuffer );
 	size_t extendedWidth = stride / sizeof( uint32_t ); // each pixel is 4 bytes/32 bits
 	
-	// Since the OpenCV Mat is wrapping the CVPixelBuffer's pixel data, we must do all of our modifications while its base address is locked.
-	// If we want to operate on the buffer later, we'll have to do an expensive deep copy of the pixel data, using memcpy or Mat::clone().
-	
 	// Use extendedWidth instead of width to account for possible row extensions (sometimes used for memory alignment).
 	// We only need to work on columms from [0, width - 1] regardless.
+	return cv::Mat( (int)height, (int)extendedWidth, CV_8UC4, base );
+}
+
+- (CVPixelBufferRef)copyRenderedPixelBuffer:(CVPixelBufferRef)pixelBuffer
+{
+	CVPixelBufferRef renderedPixelBuffer = [_outputPool copyPixelBuffer];
+	if ( ! renderedPixelBuffer ) {
+		return NULL;
+	}
 	
-	cv::Mat bgraImage = cv::Mat( (int)height, (int)extendedWidth, CV_8UC4, base );
+	CVPixelBufferLockBaseAddress( pixelBuffer, kCVPixelBufferLock_ReadOnly );
+	CVPixelBufferLockBaseAddress( renderedPixelBuffer, 0 );
 	
-	for ( uint32_t y = 0; y < height; y++ )
-	{
-		for ( uint32_t x = 0; x < width; x++ )
-		{
-			bgraImage.at<cv::Vec<uint8_t,4> >(y,x)[1] = 0;
-		}
+	size_t width = CVPixelBufferGetWidth( pixelBuffer );
+	size_t height = CVPixelBufferGetHeight( pixelBuffer );
+	
+	// Since the OpenCV Mats are wrapping the CVPixelBuffers' pixel data, we must do all of our work while their base addresses are locked.
+	// If we want to operate on the buffers later, we'll have to do an expensive deep copy of the pixel data, using memcpy or Mat::clone().
+	
+	DeGreenContext frames = { matFromPixelBuffer( pixelBuffer ), matFromPixelBuffer( renderedPixelBuffer ) };
+	
+	if ( _scheduler ) {
+		TileSchedulerRun( _scheduler, (int)width, (int)height, 2 * (int)sizeof( uint32_t ), 0, deGreenTile, &frames );
+	}
+	else {
+		Tile whole = { 0, 0, (int)width, (int)height, 0, 0, (int)width, (int)height, 0, 0 };
+		deGreenTile( &frames, &whole );
 	}
 	
-	CVPixelBufferUnlockBaseAddress( pixelBuffer, 0 );
+	CVPixelBufferUnlockBaseAddress( renderedPixelBuffer, 0 );
+	CVPixelBufferUnlockBaseAddress( pixelBuffer, kCVPixelBufferLock_ReadOnly );
 	
-	return (CVPixelBufferRef)CFRetain( pixelBuffer );
+	return renderedPixelBuffer;
 }
 
 @end
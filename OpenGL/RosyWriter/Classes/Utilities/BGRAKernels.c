@@ -0,0 +1,331 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Vectorized per-pixel kernels for 32-bit BGRA frames
+ */
+
+#include <string.h>
+#include "BGRAKernels.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BGRA_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define BGRA_AVX2 1
+#endif
+
+// Vector kernels are used unless BGRAKernelsSetSIMD(0) has been called
+static int useSIMD = 1;
+
+// round(x / 255) for x in [0..65025], exactly
+static inline uint8_t div255(unsigned x)
+{
+	x += 128;
+	return (uint8_t)((x + (x >> 8)) >> 8);
+}
+
+// 255 * 65536 / alpha, so that color * 255 / alpha is (color * recip + 0x8000) >> 16
+static void unpremultiplyTable(uint32_t recip[256])
+{
+	recip[0] = 0;
+	for (unsigned a = 1; a < 256; a++)
+		recip[a] = (255 * 65536 + a / 2) / a;
+}
+
+
+static void maskRow(const uint8_t *s, uint8_t *d, int n, const uint8_t keep[4])
+{
+	uint32_t k;
+	int x = 0;
+
+	memcpy(&k, keep, 4);
+#if BGRA_NEON
+	if ( useSIMD )
+	{
+		uint8x16_t vk = vreinterpretq_u8_u32(vdupq_n_u32(k));
+		for (; x + 4 <= n; x += 4)
+			vst1q_u8(d + 4 * x, vandq_u8(vld1q_u8(s + 4 * x), vk));
+	}
+#elif BGRA_AVX2
+	if ( useSIMD )
+	{
+		__m256i vk = _mm256_set1_epi32((int)k);
+		for (; x + 8 <= n; x += 8)
+			_mm256_storeu_si256((__m256i *)(d + 4 * x), _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(s + 4 * x)), vk));
+	}
+#endif
+	for (; x < n; x++)
+	{
+		uint32_t p;
+		memcpy(&p, s + 4 * x, 4);
+		p &= k;
+		memcpy(d + 4 * x, &p, 4);
+	}
+}
+
+static void swizzleRow(const uint8_t *s, uint8_t *d, int n, const uint8_t order[4])
+{
+	int x = 0;
+
+#if BGRA_NEON || BGRA_AVX2
+	uint8_t control[32];
+	for (int i = 0; i < 32; i++)
+		control[i] = (uint8_t)((i & ~3 & 15) + order[i & 3]);	// within each 16 bytes
+#endif
+#if BGRA_NEON
+	if ( useSIMD )
+	{
+		uint8x16_t vc = vld1q_u8(control);
+		for (; x + 4 <= n; x += 4)
+			vst1q_u8(d + 4 * x, vqtbl1q_u8(vld1q_u8(s + 4 * x), vc));
+	}
+#elif BGRA_AVX2
+	if ( useSIMD )
+	{
+		__m256i vc = _mm256_loadu_si256((const __m256i *)control);
+		for (; x + 8 <= n; x += 8)
+			_mm256_storeu_si256((__m256i *)(d + 4 * x), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(s + 4 * x)), vc));
+	}
+#endif
+	for (; x < n; x++)
+	{
+		uint8_t p[4];
+		memcpy(p, s + 4 * x, 4);
+		d[4 * x + 0] = p[order[0]];
+		d[4 * x + 1] = p[order[1]];
+		d[4 * x + 2] = p[order[2]];
+		d[4 * x + 3] = p[order[3]];
+	}
+}
+
+#if BGRA_NEON
+// round(a * b / 255) in 16 lanes
+static inline uint8x16_t mulDiv255(uint8x16_t a, uint8x16_t b)
+{
+	uint16x8_t round = vdupq_n_u16(128);
+	uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(a), vget_low_u8(b)), round);
+	uint16x8_t hi = vaddq_u16(vmull_high_u8(a, b), round);
+	return vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)), vaddhn_u16(hi, vshrq_n_u16(hi, 8)));
+}
+#elif BGRA_AVX2
+// round(x / 255) in 16-bit lanes
+static inline __m256i div255x16(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+#endif
+
+static void premultiplyRow(const uint8_t *s, uint8_t *d, int n)
+{
+	int x = 0;
+
+#if BGRA_NEON
+	if ( useSIMD )
+	{
+		for (; x + 16 <= n; x += 16)
+		{
+			uint8x16x4_t p = vld4q_u8(s + 4 * x);
+			p.val[0] = mulDiv255(p.val[0], p.val[3]);
+			p.val[1] = mulDiv255(p.val[1], p.val[3]);
+			p.val[2] = mulDiv255(p.val[2], p.val[3]);
+			vst4q_u8(d + 4 * x, p);
+		}
+	}
+#elif BGRA_AVX2
+	if ( useSIMD )
+	{
+		// Each pixel's alpha spread over its color channels in 16 bits, and 255 for alpha itself
+		const __m256i spreadLo = _mm256_setr_epi8(3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1,
+		                                           3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1);
+		const __m256i spreadHi = _mm256_setr_epi8(11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1,
+		                                           11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1);
+		const __m256i keepAlpha = _mm256_set1_epi64x((long long)0x00FF000000000000ULL);
+		const __m256i zero = _mm256_setzero_si256();
+		for (; x + 8 <= n; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)(s + 4 * x));
+			__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero), _mm256_or_si256(_mm256_shuffle_epi8(p, spreadLo), keepAlpha));
+			__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero), _mm256_or_si256(_mm256_shuffle_epi8(p, spreadHi), keepAlpha));
+			_mm256_storeu_si256((__m256i *)(d + 4 * x), _mm256_packus_epi16(div255x16(lo), div255x16(hi)));
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		unsigned a = s[4 * x + 3];
+		d[4 * x + 0] = div255(s[4 * x + 0] * a);
+		d[4 * x + 1] = div255(s[4 * x + 1] * a);
+		d[4 * x + 2] = div255(s[4 * x + 2] * a);
+		d[4 * x + 3] = (uint8_t)a;
+	}
+}
+
+#if BGRA_NEON
+static inline uint8x16_t unpremultiplyChannel(uint8x16_t c, const uint32x4_t recip[4])
+{
+	const uint32x4_t round = vdupq_n_u32(0x8000), top = vdupq_n_u32(255);
+	uint16x8_t lo = vmovl_u8(vget_low_u8(c)), hi = vmovl_high_u8(c);
+	uint32x4_t q0 = vminq_u32(vshrq_n_u32(vmlaq_u32(round, vmovl_u16(vget_low_u16(lo)), recip[0]), 16), top);
+	uint32x4_t q1 = vminq_u32(vshrq_n_u32(vmlaq_u32(round, vmovl_high_u16(lo), recip[1]), 16), top);
+	uint32x4_t q2 = vminq_u32(vshrq_n_u32(vmlaq_u32(round, vmovl_u16(vget_low_u16(hi)), recip[2]), 16), top);
+	uint32x4_t q3 = vminq_u32(vshrq_n_u32(vmlaq_u32(round, vmovl_high_u16(hi), recip[3]), 16), top);
+	return vcombine_u8(vmovn_u16(vcombine_u16(vmovn_u32(q0), vmovn_u32(q1))),
+	                    vmovn_u16(vcombine_u16(vmovn_u32(q2), vmovn_u32(q3))));
+}
+#endif
+
+static void unpremultiplyRow(const uint8_t *s, uint8_t *d, int n, const uint32_t recip[256])
+{
+	int x = 0;
+
+#if BGRA_NEON
+	if ( useSIMD )
+	{
+		for (; x + 16 <= n; x += 16)
+		{
+			uint8x16x4_t p = vld4q_u8(s + 4 * x);
+			uint8_t alpha[16];
+			uint32_t r[16];
+			uint32x4_t vr[4];
+			vst1q_u8(alpha, p.val[3]);
+			for (int i = 0; i < 16; i++)
+				r[i] = recip[alpha[i]];
+			for (int i = 0; i < 4; i++)
+				vr[i] = vld1q_u32(r + 4 * i);
+			p.val[0] = unpremultiplyChannel(p.val[0], vr);
+			p.val[1] = unpremultiplyChannel(p.val[1], vr);
+			p.val[2] = unpremultiplyChannel(p.val[2], vr);
+			vst4q_u8(d + 4 * x, p);
+		}
+	}
+#elif BGRA_AVX2
+	if ( useSIMD )
+	{
+		const __m256i byte = _mm256_set1_epi32(0xFF), round = _mm256_set1_epi32(0x8000);
+		for (; x + 8 <= n; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)(s + 4 * x));
+			__m256i r = _mm256_i32gather_epi32((const int *)recip, _mm256_srli_epi32(p, 24), 4);
+			__m256i out = _mm256_andnot_si256(_mm256_set1_epi32(0x00FFFFFF), p);
+			for (int c = 0; c < 3; c++)
+			{
+				__m256i v = _mm256_and_si256(_mm256_srli_epi32(p, 8 * c), byte);
+				v = _mm256_min_epu32(_mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(v, r), round), 16), byte);
+				out = _mm256_or_si256(out, _mm256_slli_epi32(v, 8 * c));
+			}
+			_mm256_storeu_si256((__m256i *)(d + 4 * x), out);
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		uint32_t r = recip[s[4 * x + 3]];
+		for (int c = 0; c < 3; c++)
+		{
+			uint32_t v = (s[4 * x + c] * r + 0x8000) >> 16;
+			d[4 * x + c] = (uint8_t)(v > 255 ? 255 : v);
+		}
+		d[4 * x + 3] = s[4 * x + 3];
+	}
+}
+
+static void blendRow(const uint8_t *s, uint8_t *d, int n, uint8_t alpha)
+{
+	unsigned a = alpha, na = 255 - alpha;
+	int i = 0;
+
+#if BGRA_NEON
+	if ( useSIMD )
+	{
+		const uint8x16_t va = vdupq_n_u8(alpha), vna = vdupq_n_u8((uint8_t)na);
+		const uint16x8_t round = vdupq_n_u16(128);
+		for (; i + 16 <= 4 * n; i += 16)
+		{
+			uint8x16_t vs = vld1q_u8(s + i), vd = vld1q_u8(d + i);
+			uint16x8_t lo = vaddq_u16(vmlal_u8(vmull_u8(vget_low_u8(vs), vget_low_u8(va)), vget_low_u8(vd), vget_low_u8(vna)), round);
+			uint16x8_t hi = vaddq_u16(vmlal_high_u8(vmull_high_u8(vs, va), vd, vna), round);
+			vst1q_u8(d + i, vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)), vaddhn_u16(hi, vshrq_n_u16(hi, 8))));
+		}
+	}
+#elif BGRA_AVX2
+	if ( useSIMD )
+	{
+		const __m256i va = _mm256_set1_epi16((short)a), vna = _mm256_set1_epi16((short)na), zero = _mm256_setzero_si256();
+		for (; i + 32 <= 4 * n; i += 32)
+		{
+			__m256i vs = _mm256_loadu_si256((const __m256i *)(s + i)), vd = _mm256_loadu_si256((const __m256i *)(d + i));
+			__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(vs, zero), va), _mm256_mullo_epi16(_mm256_unpacklo_epi8(vd, zero), vna));
+			__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(vs, zero), va), _mm256_mullo_epi16(_mm256_unpackhi_epi8(vd, zero), vna));
+			_mm256_storeu_si256((__m256i *)(d + i), _mm256_packus_epi16(div255x16(lo), div255x16(hi)));
+		}
+	}
+#endif
+	for (; i < 4 * n; i++)
+		d[i] = div255(s[i] * a + d[i] * na);
+}
+
+
+BGRAImage BGRAImageRegion(const BGRAImage *image, int x, int y, int width, int height)
+{
+	BGRAImage region = { image->base + y * image->bytesPerRow + 4 * x, width, height, image->bytesPerRow };
+	return region;
+}
+
+void BGRAMask(const BGRAImage *src, const BGRAImage *dst, const uint8_t keep[4])
+{
+	for (int y = 0; y < src->height; y++)
+		maskRow(src->base + y * src->bytesPerRow, dst->base + y * dst->bytesPerRow, src->width, keep);
+}
+
+void BGRAZeroChannel(const BGRAImage *src, const BGRAImage *dst, int channel)
+{
+	uint8_t keep[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+	keep[channel & 3] = 0;
+	BGRAMask(src, dst, keep);
+}
+
+void BGRASwizzle(const BGRAImage *src, const BGRAImage *dst, const uint8_t order[4])
+{
+	for (int y = 0; y < src->height; y++)
+		swizzleRow(src->base + y * src->bytesPerRow, dst->base + y * dst->bytesPerRow, src->width, order);
+}
+
+void BGRAPremultiply(const BGRAImage *src, const BGRAImage *dst)
+{
+	for (int y = 0; y < src->height; y++)
+		premultiplyRow(src->base + y * src->bytesPerRow, dst->base + y * dst->bytesPerRow, src->width);
+}
+
+void BGRAUnpremultiply(const BGRAImage *src, const BGRAImage *dst)
+{
+	uint32_t recip[256];
+
+	unpremultiplyTable(recip);
+	for (int y = 0; y < src->height; y++)
+		unpremultiplyRow(src->base + y * src->bytesPerRow, dst->base + y * dst->bytesPerRow, src->width, recip);
+}
+
+void BGRABlend(const BGRAImage *src, const BGRAImage *dst, uint8_t alpha)
+{
+	for (int y = 0; y < src->height; y++)
+		blendRow(src->base + y * src->bytesPerRow, dst->base + y * dst->bytesPerRow, src->width, alpha);
+}
+
+const char *BGRAKernelsEngine(void)
+{
+#if BGRA_NEON
+	return useSIMD ? "neon" : "scalar";
+#elif BGRA_AVX2
+	return useSIMD ? "avx2" : "scalar";
+#else
+	return "scalar";
+#endif
+}
+
+void BGRAKernelsSetSIMD(int enable)
+{
+	useSIMD = enable;
+}
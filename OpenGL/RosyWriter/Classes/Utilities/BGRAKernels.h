@@ -0,0 +1,58 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Vectorized per-pixel kernels for 32-bit BGRA frames
+ */
+
+#ifndef RosyWriter_BGRAKernels_h
+#define RosyWriter_BGRAKernels_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pixels are 4 bytes, B G R A in memory, as kCVPixelFormatType_32BGRA. Rows are
+// bytesPerRow apart, which may include padding that the kernels leave alone. An
+// image may be a region of a larger one, such as a tile from TileScheduler.
+//
+// The kernels use NEON on ARM and AVX2 on x86 when the compiler targets them, and
+// plain C otherwise; the results are the same to the bit either way. Every kernel may
+// work in place (src == dst). Rounding is to nearest throughout.
+
+typedef struct {
+	uint8_t *base;
+	int width, height;
+	size_t bytesPerRow;
+} BGRAImage;
+
+// The region [x, x + width) x [y, y + height) of image
+BGRAImage BGRAImageRegion(const BGRAImage *image, int x, int y, int width, int height);
+
+// Each channel ANDed with keep[channel], in memory order: { 0xFF, 0, 0xFF, 0xFF } zeroes green
+void BGRAMask(const BGRAImage *src, const BGRAImage *dst, const uint8_t keep[4]);
+void BGRAZeroChannel(const BGRAImage *src, const BGRAImage *dst, int channel);
+
+// dst channel i = src channel order[i]: { 2, 1, 0, 3 } turns BGRA into RGBA and back
+void BGRASwizzle(const BGRAImage *src, const BGRAImage *dst, const uint8_t order[4]);
+
+// Color times alpha / 255, and back: color * 255 / alpha, at most 255, and 0 where alpha is 0
+void BGRAPremultiply(const BGRAImage *src, const BGRAImage *dst);
+void BGRAUnpremultiply(const BGRAImage *src, const BGRAImage *dst);
+
+// dst = (src * alpha + dst * (255 - alpha)) / 255, every channel, alpha in [0..255]
+void BGRABlend(const BGRAImage *src, const BGRAImage *dst, uint8_t alpha);
+
+// Which kernels are in use: "neon", "avx2" or "scalar". BGRAKernelsSetSIMD(0) forces the
+// plain C kernels, for testing them against the vector ones.
+const char *BGRAKernelsEngine(void);
+void BGRAKernelsSetSIMD(int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Recycling pool of aligned frame buffers, with reference counts and high-water statistics
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "FramePool.h"
+
+#define kMaxFrames 64
+#define kAlignment 64
+#define kPageBytes 4096
+
+typedef struct FrameSlot {
+	Frame frame;                // first, so that a Frame * is its FrameSlot *
+	FramePool *pool;
+	int references;
+	int allocated;
+	struct FrameSlot *next;     // on the ready list
+} FrameSlot;
+
+struct FramePool {
+	pthread_mutex_t lock;
+	int width, height;
+	size_t bytesPerRow;
+	int minimumCount, capacity;
+	FrameStorage storage;
+	int hasStorage;
+
+	FrameSlot *slots;
+	FrameSlot *ready;           // allocated and not in use, most recently returned first
+	int destroyed;
+	FramePoolStatistics statistics;
+};
+
+static void teardown(FramePool *pool);
+
+// A multiple of the alignment, and not of the page size
+static size_t paddedRowBytes(int width, int bytesPerPixel)
+{
+	size_t bytes = ((size_t)width * bytesPerPixel + kAlignment - 1) & ~(size_t)(kAlignment - 1);
+	return (bytes % kPageBytes == 0) ? bytes + kAlignment : bytes;
+}
+
+// Called with the lock held
+static int allocateFrame(FramePool *pool, FrameSlot *slot)
+{
+	Frame *frame = &slot->frame;
+	size_t bytes;
+
+	frame->width = pool->width;
+	frame->height = pool->height;
+	frame->bytesPerRow = pool->bytesPerRow;
+	frame->object = NULL;
+	frame->base = NULL;
+	if ( pool->hasStorage )
+	{
+		if ( pool->storage.create(pool->storage.context, frame) != 0 )
+			return FramePoolAllocationFailed;
+	}
+	else
+	{
+		void *base = NULL;
+		if ( posix_memalign(&base, kAlignment, pool->bytesPerRow * pool->height) != 0 )
+			return FramePoolAllocationFailed;
+		frame->base = base;
+	}
+
+	bytes = frame->bytesPerRow * frame->height;
+	slot->allocated = 1;
+	pool->statistics.frames++;
+	pool->statistics.bytes += bytes;
+	if ( pool->statistics.frames > pool->statistics.framesHighWater )
+		pool->statistics.framesHighWater = pool->statistics.frames;
+	if ( pool->statistics.bytes > pool->statistics.bytesHighWater )
+		pool->statistics.bytesHighWater = pool->statistics.bytes;
+	return FramePoolSuccess;
+}
+
+static void freeFrame(FramePool *pool, FrameSlot *slot)
+{
+	pool->statistics.frames--;
+	pool->statistics.bytes -= slot->frame.bytesPerRow * slot->frame.height;
+	if ( pool->hasStorage )
+		pool->storage.destroy(pool->storage.context, &slot->frame);
+	else
+		free(slot->frame.base);
+	slot->allocated = 0;
+}
+
+// Called with the lock held, when a frame's last reference has gone
+static void returnFrame(FramePool *pool, FrameSlot *slot)
+{
+	slot->next = pool->ready;
+	pool->ready = slot;
+	pool->statistics.inUse--;
+}
+
+
+FramePool *FramePoolCreate(int width, int height, int bytesPerPixel, int minimumCount, int allocationThreshold, const FrameStorage *storage)
+{
+	FramePool *pool;
+
+	if ( width <= 0 || height <= 0 || bytesPerPixel <= 0 )
+		return NULL;
+	pool = calloc(1, sizeof(FramePool));
+	if ( !pool )
+		return NULL;
+	pool->width = width;
+	pool->height = height;
+	pool->bytesPerRow = paddedRowBytes(width, bytesPerPixel);
+	pool->capacity = (allocationThreshold <= 0 || allocationThreshold > kMaxFrames) ? kMaxFrames : allocationThreshold;
+	pool->minimumCount = (minimumCount < 0) ? 0 : (minimumCount > pool->capacity ? pool->capacity : minimumCount);
+	if ( storage )
+	{
+		pool->storage = *storage;
+		pool->hasStorage = 1;
+	}
+	pool->slots = calloc(pool->capacity, sizeof(FrameSlot));
+	if ( !pool->slots )
+	{
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+
+	for (int i = 0; i < pool->capacity; i++)
+	{
+		pool->slots[i].pool = pool;
+		pool->slots[i].frame.index = i;
+	}
+	// Made up front, so that the first frames of a capture do not wait for the heap
+	for (int i = pool->minimumCount - 1; i >= 0; i--)
+	{
+		if ( allocateFrame(pool, &pool->slots[i]) != FramePoolSuccess )
+		{
+			teardown(pool);
+			return NULL;
+		}
+		pool->slots[i].next = pool->ready;
+		pool->ready = &pool->slots[i];
+	}
+	return pool;
+}
+
+static void teardown(FramePool *pool)
+{
+	for (int i = 0; i < pool->capacity; i++)
+		if ( pool->slots[i].allocated )
+			freeFrame(pool, &pool->slots[i]);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->slots);
+	free(pool);
+}
+
+void FramePoolDestroy(FramePool *pool)
+{
+	int bLast;
+
+	if ( !pool )
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->destroyed = 1;
+	bLast = (pool->statistics.inUse == 0);
+	pthread_mutex_unlock(&pool->lock);
+	if ( bLast )
+		teardown(pool);
+}
+
+int FramePoolAcquire(FramePool *pool, Frame **frame)
+{
+	FrameSlot *slot = NULL;
+	int err = FramePoolSuccess;
+
+	*frame = NULL;
+	pthread_mutex_lock(&pool->lock);
+	pool->statistics.acquires++;
+	if ( pool->ready )
+	{
+		slot = pool->ready;
+		pool->ready = slot->next;
+	}
+	else if ( pool->statistics.frames < pool->capacity )
+	{
+		for (int i = 0; i < pool->capacity; i++)
+			if ( !pool->slots[i].allocated )
+			{
+				slot = &pool->slots[i];
+				break;
+			}
+		err = allocateFrame(pool, slot);
+		if ( err == FramePoolSuccess )
+			pool->statistics.allocations++;
+		else
+			slot = NULL;
+	}
+	else
+	{
+		pool->statistics.thresholdMisses++;
+		err = FramePoolWouldExceedAllocationThreshold;
+	}
+
+	if ( slot )
+	{
+		slot->next = NULL;
+		slot->references = 1;
+		pool->statistics.inUse++;
+		if ( pool->statistics.inUse > pool->statistics.inUseHighWater )
+			pool->statistics.inUseHighWater = pool->statistics.inUse;
+		*frame = &slot->frame;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return err;
+}
+
+Frame *FrameRetain(Frame *frame)
+{
+	if ( frame )
+		__atomic_add_fetch(&((FrameSlot *)frame)->references, 1, __ATOMIC_RELAXED);
+	return frame;
+}
+
+void FrameRelease(Frame *frame)
+{
+	FrameSlot *slot = (FrameSlot *)frame;
+	FramePool *pool;
+	int bLast;
+
+	if ( !frame || __atomic_sub_fetch(&slot->references, 1, __ATOMIC_ACQ_REL) != 0 )
+		return;
+	pool = slot->pool;
+	pthread_mutex_lock(&pool->lock);
+	returnFrame(pool, slot);
+	bLast = pool->destroyed && pool->statistics.inUse == 0;
+	pthread_mutex_unlock(&pool->lock);
+	if ( bLast )
+		teardown(pool);
+}
+
+void FramePoolFlush(FramePool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while ( pool->ready && pool->statistics.frames > pool->minimumCount )
+	{
+		FrameSlot *slot = pool->ready;
+		pool->ready = slot->next;
+		freeFrame(pool, slot);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void FramePoolGetStatistics(FramePool *pool, FramePoolStatistics *statistics)
+{
+	pthread_mutex_lock(&pool->lock);
+	*statistics = pool->statistics;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void FramePoolResetHighWater(FramePool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->statistics.framesHighWater = pool->statistics.frames;
+	pool->statistics.inUseHighWater = pool->statistics.inUse;
+	pool->statistics.bytesHighWater = pool->statistics.bytes;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+#if defined(__APPLE__)
+
+static void pixelBufferReleased(void *releaseRefCon, const void *baseAddress)
+{
+	(void)baseAddress;
+	FrameRelease(releaseRefCon);
+}
+
+CVPixelBufferRef FrameCreatePixelBuffer(Frame *frame, OSType pixelFormat)
+{
+	CVPixelBufferRef pixelBuffer = NULL;
+
+	if ( !frame->base )
+		return NULL;
+	// The pixel buffer's reference, which pixelBufferReleased gives back when it is destroyed
+	FrameRetain(frame);
+	if ( CVPixelBufferCreateWithBytes(kCFAllocatorDefault, frame->width, frame->height, pixelFormat, frame->base, frame->bytesPerRow,
+	                                  pixelBufferReleased, frame, NULL, &pixelBuffer) != kCVReturnSuccess )
+	{
+		FrameRelease(frame);
+		return NULL;
+	}
+	return pixelBuffer;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Recycling pool of aligned frame buffers, with reference counts and high-water statistics
+ */
+
+#ifndef RosyWriter_FramePool_h
+#define RosyWriter_FramePool_h
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__APPLE__)
+#include <CoreVideo/CoreVideo.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A pool hands out frames of one size and takes them back when their last reference is
+// released, so that a pipeline in its steady state reuses the same few buffers and never
+// goes to the heap. As with CVPixelBufferPool, the pool keeps a minimum number of frames
+// ready, and may be given an allocation threshold: once that many frames are out,
+// FramePoolAcquire fails rather than allocate another, and the caller drops the frame.
+//
+// Frame memory starts on a 64-byte boundary and each row is a multiple of 64 bytes, so
+// vector loads never split a cache line. Rows that would be a multiple of 4096 bytes get
+// another 64, so that a column of pixels does not land in one cache set.
+//
+// The storage callbacks let frames be made of something other than plain memory. Code
+// that keeps a frame past the call it was handed in holds a reference of its own, and
+// gives it back through a release callback when it is done, as FrameCreatePixelBuffer
+// does for Core Video. Nothing is polled: a frame is back the moment its last holder
+// says so. Frames the preview's texture cache must draw need IOSurface backing, which
+// only CVPixelBufferPool gives; the renderers use RenderedPixelBufferPool for those.
+//
+// Every function is safe to call from any thread.
+
+typedef struct FramePool FramePool;
+
+typedef struct {
+	uint8_t *base;              // NULL for storage that must be locked to be read
+	int width, height;
+	size_t bytesPerRow;
+	void *object;               // the storage's, if any
+	int index;                  // [0..pool capacity), for per-frame state kept by the caller
+} Frame;
+
+typedef struct {
+	int (*create)(void *context, Frame *frame);            // fills in base, bytesPerRow and object, 0 on success
+	void (*destroy)(void *context, Frame *frame);
+	void *context;
+} FrameStorage;
+
+typedef struct {
+	int frames, framesHighWater;        // allocated, in use or ready
+	int inUse, inUseHighWater;          // acquired and not yet back
+	size_t bytes, bytesHighWater;       // of the allocated frames
+	uint64_t acquires;
+	uint64_t allocations;               // frames made after the pool was created
+	uint64_t thresholdMisses;           // acquires that failed at the allocation threshold
+} FramePoolStatistics;
+
+enum {
+	FramePoolSuccess = 0,
+	FramePoolWouldExceedAllocationThreshold = -1,	// as kCVReturnWouldExceedAllocationThreshold
+	FramePoolAllocationFailed = -2,
+};
+
+// minimumCount frames are made now. allocationThreshold 0 lets the pool grow to 64 frames.
+// storage NULL is 64-byte aligned heap memory.
+FramePool *FramePoolCreate(int width, int height, int bytesPerPixel, int minimumCount, int allocationThreshold, const FrameStorage *storage);
+
+// The pool goes when the last of its frames has been released
+void FramePoolDestroy(FramePool *pool);
+
+// A frame with one reference, the most recently returned first, while it may still be in cache
+int FramePoolAcquire(FramePool *pool, Frame **frame);
+
+Frame *FrameRetain(Frame *frame);
+void FrameRelease(Frame *frame);
+
+// Frees ready frames beyond the minimum count
+void FramePoolFlush(FramePool *pool);
+
+void FramePoolGetStatistics(FramePool *pool, FramePoolStatistics *statistics);
+void FramePoolResetHighWater(FramePool *pool);
+
+#if defined(__APPLE__)
+// A CVPixelBuffer over a frame's memory, for Core Video code such as the movie recorder's
+// writer input. The pixel buffer holds a reference to the frame, which its release callback
+// gives back when the last CFRelease frees it. NULL if the frame's memory is not its own
+// (storage with no base) or the pixel buffer could not be made.
+CVPixelBufferRef FrameCreatePixelBuffer(Frame *frame, OSType pixelFormat);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,300 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Bounded single-producer queue of frames between pipeline stages, with a drop policy
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "FrameQueue.h"
+
+#define kCacheLine 64
+#define kNanosecondsPerSecond 1000000000ull
+
+// head and tail count every frame ever popped and pushed, so the queue holds tail - head
+// and a count never comes round again. Only the producer moves tail. head moves by
+// compare and swap, by the consumer popping and by the producer dropping the oldest, and
+// whichever moves it past a slot owns that slot's frame.
+struct FrameQueue {
+	int capacity;
+	FrameQueueItem *slots;
+	FrameQueueRelease release;
+	void *context;
+	int policy;
+	uint64_t blockTimeout;
+	pthread_mutex_t lock;
+	pthread_cond_t room;
+	int producerWaiting;
+
+	char padHead[kCacheLine];
+	uint64_t head;
+	uint64_t popped;
+	uint64_t flushed;
+
+	char padTail[kCacheLine];
+	uint64_t tail;
+	int consumerScheduled;
+	int depthHighWater;
+	uint64_t pushed;
+	uint64_t droppedOldest, droppedNewest;
+	uint64_t blocks, blockedNanoseconds;
+	char padEnd[kCacheLine];
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * kNanosecondsPerSecond + (uint64_t)ts.tv_nsec;
+}
+
+static void count(uint64_t *counter, uint64_t amount)
+{
+	__atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+static void releaseItem(FrameQueue *queue, FrameQueueItem item)
+{
+	if ( queue->release && item.object )
+		queue->release(queue->context, item.object);
+}
+
+// Takes the oldest frame, from whichever thread
+static int takeOldest(FrameQueue *queue, FrameQueueItem *item)
+{
+	uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+	for ( ;; )
+	{
+		const FrameQueueItem *slot;
+		FrameQueueItem taken;
+
+		if ( head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) )
+			return 0;
+		slot = &queue->slots[head % queue->capacity];
+		taken.object = __atomic_load_n(&slot->object, __ATOMIC_RELAXED);
+		taken.frame = __atomic_load_n(&slot->frame, __ATOMIC_RELAXED);
+		// A failed swap has reloaded head; what was read from the slot may be stale, so read it again
+		if ( __atomic_compare_exchange_n(&queue->head, &head, head + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE) )
+		{
+			*item = taken;
+			return 1;
+		}
+	}
+}
+
+static int depth(FrameQueue *queue)
+{
+	uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST);
+	uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST);
+	return (int)(tail - head);
+}
+
+// Called by the producer with the queue full; 1 once there is room, 0 if the timeout passed first
+static int waitForRoom(FrameQueue *queue, uint64_t timeout)
+{
+	struct timespec deadline;
+	uint64_t start = now();
+	int timedOut = 0;
+
+	if ( timeout )
+	{
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += (time_t)(timeout / kNanosecondsPerSecond);
+		deadline.tv_nsec += (long)(timeout % kNanosecondsPerSecond);
+		if ( deadline.tv_nsec >= (long)kNanosecondsPerSecond )
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= (long)kNanosecondsPerSecond;
+		}
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	// A consumer that pops after this store sees it and signals; one that popped before, we see
+	__atomic_store_n(&queue->producerWaiting, 1, __ATOMIC_SEQ_CST);
+	while ( depth(queue) >= queue->capacity && ! timedOut )
+	{
+		if ( timeout )
+			timedOut = pthread_cond_timedwait(&queue->room, &queue->lock, &deadline) == ETIMEDOUT;
+		else
+			pthread_cond_wait(&queue->room, &queue->lock);
+	}
+	__atomic_store_n(&queue->producerWaiting, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&queue->lock);
+
+	count(&queue->blocks, 1);
+	count(&queue->blockedNanoseconds, now() - start);
+	return depth(queue) < queue->capacity;
+}
+
+FrameQueue *FrameQueueCreate(int capacity, FrameQueuePolicy policy, uint64_t blockTimeout, FrameQueueRelease release, void *context)
+{
+	FrameQueue *queue;
+
+	if ( capacity < 1 )
+		return NULL;
+	queue = calloc(1, sizeof(FrameQueue));
+	if ( ! queue )
+		return NULL;
+	queue->slots = calloc(capacity, sizeof(FrameQueueItem));
+	if ( ! queue->slots )
+	{
+		free(queue);
+		return NULL;
+	}
+	queue->capacity = capacity;
+	queue->policy = policy;
+	queue->blockTimeout = blockTimeout;
+	queue->release = release;
+	queue->context = context;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->room, NULL);
+	return queue;
+}
+
+void FrameQueueDestroy(FrameQueue *queue)
+{
+	if ( ! queue )
+		return;
+	FrameQueueFlush(queue);
+	pthread_cond_destroy(&queue->room);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->slots);
+	free(queue);
+}
+
+void FrameQueueSetPolicy(FrameQueue *queue, FrameQueuePolicy policy, uint64_t blockTimeout)
+{
+	__atomic_store_n(&queue->blockTimeout, blockTimeout, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->policy, (int)policy, __ATOMIC_RELAXED);
+}
+
+FrameQueuePolicy FrameQueueGetPolicy(FrameQueue *queue)
+{
+	return (FrameQueuePolicy)__atomic_load_n(&queue->policy, __ATOMIC_RELAXED);
+}
+
+int FrameQueuePush(FrameQueue *queue, FrameQueueItem item, int *startConsumer)
+{
+	FrameQueuePolicy policy = FrameQueueGetPolicy(queue);
+	uint64_t tail = queue->tail;
+	FrameQueueItem *slot;
+	int queued;
+
+	*startConsumer = 0;
+	count(&queue->pushed, 1);
+
+	if ( depth(queue) >= queue->capacity )
+	{
+		if ( policy == FrameQueueDropOldest )
+		{
+			FrameQueueItem oldest;
+
+			// The consumer may take the oldest first, which makes room just the same
+			while ( depth(queue) >= queue->capacity )
+			{
+				if ( takeOldest(queue, &oldest) )
+				{
+					releaseItem(queue, oldest);
+					count(&queue->droppedOldest, 1);
+				}
+			}
+		}
+		else if ( policy == FrameQueueDropNewest || ! waitForRoom(queue, __atomic_load_n(&queue->blockTimeout, __ATOMIC_RELAXED)) )
+		{
+			releaseItem(queue, item);
+			count(&queue->droppedNewest, 1);
+			return 0;
+		}
+	}
+
+	slot = &queue->slots[tail % queue->capacity];
+	__atomic_store_n(&slot->object, item.object, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->frame, item.frame, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+	queued = depth(queue);
+	if ( queued > queue->depthHighWater )
+		__atomic_store_n(&queue->depthHighWater, queued, __ATOMIC_RELAXED);
+
+	*startConsumer = ! __atomic_exchange_n(&queue->consumerScheduled, 1, __ATOMIC_SEQ_CST);
+	return 1;
+}
+
+int FrameQueuePop(FrameQueue *queue, FrameQueueItem *item)
+{
+	if ( ! takeOldest(queue, item) )
+		return 0;
+	count(&queue->popped, 1);
+	if ( __atomic_load_n(&queue->producerWaiting, __ATOMIC_SEQ_CST) )
+	{
+		pthread_mutex_lock(&queue->lock);
+		pthread_cond_signal(&queue->room);
+		pthread_mutex_unlock(&queue->lock);
+	}
+	return 1;
+}
+
+int FrameQueueConsumerDone(FrameQueue *queue)
+{
+	// A push after this store starts a new consumer; one before it, we see queued
+	__atomic_store_n(&queue->consumerScheduled, 0, __ATOMIC_SEQ_CST);
+	if ( depth(queue) == 0 )
+		return 1;
+	return __atomic_exchange_n(&queue->consumerScheduled, 1, __ATOMIC_SEQ_CST);
+}
+
+void FrameQueueFlush(FrameQueue *queue)
+{
+	FrameQueueItem item;
+
+	while ( takeOldest(queue, &item) )
+	{
+		releaseItem(queue, item);
+		count(&queue->flushed, 1);
+	}
+	if ( __atomic_load_n(&queue->producerWaiting, __ATOMIC_SEQ_CST) )
+	{
+		pthread_mutex_lock(&queue->lock);
+		pthread_cond_signal(&queue->room);
+		pthread_mutex_unlock(&queue->lock);
+	}
+}
+
+int FrameQueueDepth(FrameQueue *queue)
+{
+	return depth(queue);
+}
+
+int FrameQueueCapacity(FrameQueue *queue)
+{
+	return queue->capacity;
+}
+
+void FrameQueueGetStatistics(FrameQueue *queue, FrameQueueStatistics *statistics)
+{
+	statistics->pushed = __atomic_load_n(&queue->pushed, __ATOMIC_RELAXED);
+	statistics->popped = __atomic_load_n(&queue->popped, __ATOMIC_RELAXED);
+	statistics->droppedOldest = __atomic_load_n(&queue->droppedOldest, __ATOMIC_RELAXED);
+	statistics->droppedNewest = __atomic_load_n(&queue->droppedNewest, __ATOMIC_RELAXED);
+	statistics->blocks = __atomic_load_n(&queue->blocks, __ATOMIC_RELAXED);
+	statistics->blockedNanoseconds = __atomic_load_n(&queue->blockedNanoseconds, __ATOMIC_RELAXED);
+	statistics->flushed = __atomic_load_n(&queue->flushed, __ATOMIC_RELAXED);
+	statistics->depth = depth(queue);
+	statistics->depthHighWater = __atomic_load_n(&queue->depthHighWater, __ATOMIC_RELAXED);
+}
+
+void FrameQueueResetStatistics(FrameQueue *queue)
+{
+	__atomic_store_n(&queue->pushed, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->popped, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->droppedOldest, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->droppedNewest, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->blocks, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->blockedNanoseconds, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->flushed, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->depthHighWater, depth(queue), __ATOMIC_RELAXED);
+}
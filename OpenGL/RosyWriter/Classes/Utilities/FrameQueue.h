@@ -0,0 +1,103 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Bounded single-producer queue of frames between pipeline stages, with a drop policy
+ */
+
+#ifndef RosyWriter_FrameQueue_h
+#define RosyWriter_FrameQueue_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A queue holds at most capacity frames, so the latency it adds is bounded and a stage
+// that falls behind loses frames at its own queue, where they are counted, rather than
+// leaving them to pile up in dispatch queues. When a frame arrives and the queue is full,
+// the policy decides:
+//
+//     FrameQueueDropOldest    the oldest queued frame is dropped; the consumer sees the newest
+//     FrameQueueDropNewest    the arriving frame is dropped; the consumer sees every frame it kept
+//     FrameQueueBlock         the producer waits for room, up to the block timeout, and then
+//                             drops the arriving frame
+//
+// One thread at a time may push. Pops are lock free and may come from any thread, which
+// lets a queue be flushed from outside its consumer. A producer blocks on a mutex only
+// under FrameQueueBlock when the queue is full.
+//
+// The queue also tells a producer when to start its consumer, so that a consumer on a
+// dispatch queue is scheduled once for any number of frames rather than once for each:
+//
+//     if ( FrameQueuePush(queue, item, &startConsumer) && startConsumer )
+//         dispatch_async(consumerQueue, drain);
+//
+//     drain:
+//     do {
+//         while ( FrameQueuePop(queue, &item) )
+//             consume(item);
+//     } while ( ! FrameQueueConsumerDone(queue) );
+
+typedef struct FrameQueue FrameQueue;
+
+typedef enum {
+	FrameQueueDropOldest,
+	FrameQueueDropNewest,
+	FrameQueueBlock,
+} FrameQueuePolicy;
+
+typedef struct {
+	void *object;               // the queue's reference while queued, released if dropped
+	int64_t frame;              // the caller's, such as a FrameTimings frame number
+} FrameQueueItem;
+
+typedef void (*FrameQueueRelease)(void *context, void *object);
+
+typedef struct {
+	uint64_t pushed;                    // every frame that arrived
+	uint64_t popped;
+	uint64_t droppedOldest;             // pushed out by a newer frame
+	uint64_t droppedNewest;             // turned away, at once or when a block timed out
+	uint64_t blocks;                    // pushes that waited for room
+	uint64_t blockedNanoseconds;
+	uint64_t flushed;
+	int depth, depthHighWater;
+} FrameQueueStatistics;
+
+// blockTimeout is in nanoseconds, 0 to wait as long as it takes. release may be NULL.
+FrameQueue *FrameQueueCreate(int capacity, FrameQueuePolicy policy, uint64_t blockTimeout, FrameQueueRelease release, void *context);
+
+// Releases whatever is still queued
+void FrameQueueDestroy(FrameQueue *queue);
+
+// From any thread; takes effect from the next push
+void FrameQueueSetPolicy(FrameQueue *queue, FrameQueuePolicy policy, uint64_t blockTimeout);
+FrameQueuePolicy FrameQueueGetPolicy(FrameQueue *queue);
+
+// 1 if item was queued, 0 if it was dropped. *startConsumer is 1 when no consumer is
+// draining the queue and the caller must start one.
+int FrameQueuePush(FrameQueue *queue, FrameQueueItem item, int *startConsumer);
+
+// 1 and the oldest frame, now the caller's, or 0 when the queue is empty
+int FrameQueuePop(FrameQueue *queue, FrameQueueItem *item);
+
+// For a consumer that found the queue empty: 1 if it may stop, 0 if frames arrived
+// meanwhile and it must go on popping
+int FrameQueueConsumerDone(FrameQueue *queue);
+
+// Drops and releases everything queued
+void FrameQueueFlush(FrameQueue *queue);
+
+int FrameQueueDepth(FrameQueue *queue);
+int FrameQueueCapacity(FrameQueue *queue);
+
+void FrameQueueGetStatistics(FrameQueue *queue, FrameQueueStatistics *statistics);
+void FrameQueueResetStatistics(FrameQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Per-frame stage timestamps in a ring, with latency histograms and the frame rate
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+#include "FrameTimings.h"
+
+#define kDefaultCapacity 256
+#define kNanosecondsPerSecond 1000000000ull
+
+// Log-linear buckets: values below 128 have one each, and every power of two above that
+// is split into 64, up to 2^40 ns, about 18 minutes. Longer values count as the longest.
+#define kSubBuckets 64
+#define kLinearValues (2 * kSubBuckets)
+#define kLinearBits 7
+#define kMaximumBits 40
+#define kBucketCount (kLinearValues + (kMaximumBits - kLinearBits) * kSubBuckets)
+#define kMaximumValue ((1ull << kMaximumBits) - 1)
+
+typedef struct {
+	uint32_t counts[kBucketCount];
+	uint64_t count;
+	uint64_t minimum, maximum;
+	double sum, sumOfSquares;
+} Histogram;
+
+typedef struct {
+	int64_t frame;                          // -1 while empty
+	uint64_t stamps[FrameStageCount];       // 0 where not stamped
+} FrameRecord;
+
+struct FrameTimings {
+	pthread_mutex_t lock;
+	FrameRecord *ring;
+	int capacity;                           // a power of two
+	int64_t nextFrame;
+	int64_t firstFrame;                     // since the last reset
+	int64_t secondStart;                    // the oldest frame captured in the last second
+	float framesPerSecond;
+	uint64_t lateStamps;
+	Histogram histograms[FrameStageCount][2];
+};
+
+// The stage each one's step is measured from
+static const FrameStage kPreviousStage[FrameStageCount] = {
+	FrameStageCaptured,     // the frame before's capture
+	FrameStageCaptured,
+	FrameStageDelivered,
+	FrameStageRendered,
+	FrameStageRendered,
+	FrameStageEnqueued,
+};
+
+static const char *const kStageNames[FrameStageCount] = {
+	"captured", "delivered", "rendered", "displayed", "enqueued", "written",
+};
+
+static int bucketIndex(uint64_t value)
+{
+	int exponent, shift;
+
+	if ( value < kLinearValues )
+		return (int)value;
+	if ( value > kMaximumValue )
+		value = kMaximumValue;
+	exponent = 63 - __builtin_clzll(value);
+	shift = exponent - (kLinearBits - 1);
+	return kLinearValues + (exponent - kLinearBits) * kSubBuckets + (int)(value >> shift) - kSubBuckets;
+}
+
+// The largest value counted in a bucket, as HdrHistogram reports percentiles
+static uint64_t bucketHighestValue(int index)
+{
+	int exponent, shift;
+	uint64_t lowest;
+
+	if ( index < kLinearValues )
+		return (uint64_t)index;
+	index -= kLinearValues;
+	exponent = kLinearBits + index / kSubBuckets;
+	shift = exponent - (kLinearBits - 1);
+	lowest = (uint64_t)(kSubBuckets + index % kSubBuckets) << shift;
+	return lowest + (1ull << shift) - 1;
+}
+
+static void histogramRecord(Histogram *histogram, uint64_t value)
+{
+	histogram->counts[bucketIndex(value)]++;
+	if ( histogram->count == 0 || value < histogram->minimum )
+		histogram->minimum = value;
+	if ( value > histogram->maximum )
+		histogram->maximum = value;
+	histogram->count++;
+	histogram->sum += (double)value;
+	histogram->sumOfSquares += (double)value * value;
+}
+
+// The bucket holding the value at percentile, and how many values are in it and below
+static int histogramPercentileIndex(const Histogram *histogram, double percentile, uint64_t *countAtOrBelow)
+{
+	uint64_t target = (uint64_t)ceil(percentile / 100.0 * histogram->count);
+	uint64_t total = 0;
+
+	if ( target < 1 )
+		target = 1;
+	for ( int i = 0; i < kBucketCount; i++ )
+	{
+		total += histogram->counts[i];
+		if ( total >= target )
+		{
+			*countAtOrBelow = total;
+			return i;
+		}
+	}
+	*countAtOrBelow = total;
+	return kBucketCount - 1;
+}
+
+static uint64_t histogramValueAtPercentile(const Histogram *histogram, double percentile)
+{
+	uint64_t countAtOrBelow, value;
+
+	if ( histogram->count == 0 )
+		return 0;
+	if ( percentile <= 0.0 )
+		return histogram->minimum;
+	if ( percentile >= 100.0 )
+		return histogram->maximum;
+	value = bucketHighestValue(histogramPercentileIndex(histogram, percentile, &countAtOrBelow));
+	if ( value > histogram->maximum )
+		value = histogram->maximum;
+	if ( value < histogram->minimum )
+		value = histogram->minimum;
+	return value;
+}
+
+#if defined(__APPLE__)
+static mach_timebase_info_data_t timebase;
+static pthread_once_t timebaseOnce = PTHREAD_ONCE_INIT;
+
+static void readTimebase(void)
+{
+	mach_timebase_info(&timebase);
+}
+#endif
+
+uint64_t FrameTimingsNow(void)
+{
+#if defined(__APPLE__)
+	// The host time clock's units, mach_absolute_time, in nanoseconds
+	uint64_t ticks = mach_absolute_time();
+	pthread_once(&timebaseOnce, readTimebase);
+	return ticks / timebase.denom * timebase.numer + ticks % timebase.denom * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * kNanosecondsPerSecond + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+FrameTimings *FrameTimingsCreate(int capacity)
+{
+	FrameTimings *timings = calloc(1, sizeof(FrameTimings));
+	int size = 2;
+
+	if ( ! timings )
+		return NULL;
+	if ( capacity <= 0 )
+		capacity = kDefaultCapacity;
+	while ( size < capacity )
+		size *= 2;
+	timings->ring = malloc(size * sizeof(FrameRecord));
+	if ( ! timings->ring )
+	{
+		free(timings);
+		return NULL;
+	}
+	timings->capacity = size;
+	pthread_mutex_init(&timings->lock, NULL);
+	FrameTimingsReset(timings);
+	return timings;
+}
+
+void FrameTimingsDestroy(FrameTimings *timings)
+{
+	if ( ! timings )
+		return;
+	pthread_mutex_destroy(&timings->lock);
+	free(timings->ring);
+	free(timings);
+}
+
+void FrameTimingsReset(FrameTimings *timings)
+{
+	pthread_mutex_lock(&timings->lock);
+	// Frame numbers carry on, so that stamps for frames from before the reset are late
+	for ( int i = 0; i < timings->capacity; i++ )
+		timings->ring[i].frame = -1;
+	timings->firstFrame = timings->nextFrame;
+	timings->secondStart = timings->nextFrame;
+	timings->framesPerSecond = 0;
+	timings->lateStamps = 0;
+	memset(timings->histograms, 0, sizeof(timings->histograms));
+	pthread_mutex_unlock(&timings->lock);
+}
+
+int64_t FrameTimingsBeginFrame(FrameTimings *timings, uint64_t time)
+{
+	int64_t frame, oldest;
+	FrameRecord *record, *previous, *start;
+	int64_t mask = timings->capacity - 1;
+
+	if ( time == 0 )
+		time = FrameTimingsNow();
+
+	pthread_mutex_lock(&timings->lock);
+	frame = timings->nextFrame++;
+	record = &timings->ring[frame & mask];
+	memset(record->stamps, 0, sizeof(record->stamps));
+	record->frame = frame;
+	record->stamps[FrameStageCaptured] = time;
+
+	previous = &timings->ring[(frame - 1) & mask];
+	if ( frame > timings->firstFrame && previous->frame == frame - 1 && previous->stamps[FrameStageCaptured] <= time )
+		histogramRecord(&timings->histograms[FrameStageCaptured][FrameSpanStep], time - previous->stamps[FrameStageCaptured]);
+
+	// The frame rate is over the frames captured in the last second, as many as the ring holds
+	oldest = frame - timings->capacity + 1;
+	if ( timings->secondStart < oldest )
+		timings->secondStart = oldest;
+	if ( timings->secondStart < timings->firstFrame )
+		timings->secondStart = timings->firstFrame;
+	start = &timings->ring[timings->secondStart & mask];
+	while ( timings->secondStart < frame && start->stamps[FrameStageCaptured] + kNanosecondsPerSecond < time )
+	{
+		timings->secondStart++;
+		start = &timings->ring[timings->secondStart & mask];
+	}
+	if ( timings->secondStart < frame && start->stamps[FrameStageCaptured] < time )
+		timings->framesPerSecond = (float)((double)(frame - timings->secondStart) * kNanosecondsPerSecond / (time - start->stamps[FrameStageCaptured]));
+	pthread_mutex_unlock(&timings->lock);
+	return frame;
+}
+
+void FrameTimingsStamp(FrameTimings *timings, int64_t frame, FrameStage stage, uint64_t time)
+{
+	FrameRecord *record;
+	uint64_t since;
+
+	if ( stage <= FrameStageCaptured || stage >= FrameStageCount )
+		return;
+	if ( time == 0 )
+		time = FrameTimingsNow();
+
+	pthread_mutex_lock(&timings->lock);
+	record = &timings->ring[frame & (timings->capacity - 1)];
+	if ( record->frame != frame || frame < timings->firstFrame )
+	{
+		timings->lateStamps++;
+		pthread_mutex_unlock(&timings->lock);
+		return;
+	}
+	record->stamps[stage] = time;
+
+	since = record->stamps[kPreviousStage[stage]];
+	if ( since && since <= time )
+		histogramRecord(&timings->histograms[stage][FrameSpanStep], time - since);
+	since = record->stamps[FrameStageCaptured];
+	if ( since <= time )
+		histogramRecord(&timings->histograms[stage][FrameSpanTotal], time - since);
+	pthread_mutex_unlock(&timings->lock);
+}
+
+uint64_t FrameTimingsLateStamps(FrameTimings *timings)
+{
+	uint64_t lateStamps;
+
+	pthread_mutex_lock(&timings->lock);
+	lateStamps = timings->lateStamps;
+	pthread_mutex_unlock(&timings->lock);
+	return lateStamps;
+}
+
+float FrameTimingsFramesPerSecond(FrameTimings *timings)
+{
+	float framesPerSecond;
+
+	pthread_mutex_lock(&timings->lock);
+	framesPerSecond = timings->framesPerSecond;
+	pthread_mutex_unlock(&timings->lock);
+	return framesPerSecond;
+}
+
+uint64_t FrameTimingsValueAtPercentile(FrameTimings *timings, FrameStage stage, FrameSpan span, double percentile)
+{
+	uint64_t value;
+
+	pthread_mutex_lock(&timings->lock);
+	value = histogramValueAtPercentile(&timings->histograms[stage][span], percentile);
+	pthread_mutex_unlock(&timings->lock);
+	return value;
+}
+
+// Called with the lock held
+static void summarize(const Histogram *histogram, FrameTimingsSummary *summary)
+{
+	summary->count = histogram->count;
+	summary->minimum = histogram->minimum;
+	summary->maximum = histogram->maximum;
+	summary->mean = histogram->count ? histogram->sum / histogram->count : 0;
+	summary->p50 = histogramValueAtPercentile(histogram, 50);
+	summary->p90 = histogramValueAtPercentile(histogram, 90);
+	summary->p99 = histogramValueAtPercentile(histogram, 99);
+	summary->p999 = histogramValueAtPercentile(histogram, 99.9);
+}
+
+void FrameTimingsGetSummary(FrameTimings *timings, FrameStage stage, FrameSpan span, FrameTimingsSummary *summary)
+{
+	pthread_mutex_lock(&timings->lock);
+	summarize(&timings->histograms[stage][span], summary);
+	pthread_mutex_unlock(&timings->lock);
+}
+
+void FrameTimingsWriteSummary(FrameTimings *timings, FILE *file)
+{
+	const double ms = 1e-6;
+
+	pthread_mutex_lock(&timings->lock);
+	fprintf(file, "%.2f fps, %lld frames, %llu late stamps\n", timings->framesPerSecond,
+	        (long long)(timings->nextFrame - timings->firstFrame), (unsigned long long)timings->lateStamps);
+	fprintf(file, "%-10s %-6s %8s %9s %9s %9s %9s %9s %9s %9s  (ms)\n",
+	        "stage", "span", "count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for ( int stage = 0; stage < FrameStageCount; stage++ )
+	{
+		for ( int span = FrameSpanStep; span <= FrameSpanTotal; span++ )
+		{
+			FrameTimingsSummary s;
+
+			if ( stage == FrameStageCaptured && span == FrameSpanTotal )
+				continue;
+			summarize(&timings->histograms[stage][span], &s);
+			fprintf(file, "%-10s %-6s %8llu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+			        kStageNames[stage], stage == FrameStageCaptured ? "frame" : span == FrameSpanStep ? "step" : "total",
+			        (unsigned long long)s.count, s.minimum * ms, s.mean * ms, s.p50 * ms, s.p90 * ms, s.p99 * ms, s.p999 * ms, s.maximum * ms);
+		}
+	}
+	pthread_mutex_unlock(&timings->lock);
+}
+
+void FrameTimingsWriteFrames(FrameTimings *timings, FILE *file)
+{
+	int64_t first;
+	uint64_t base = 0;
+	int haveBase = 0;
+
+	pthread_mutex_lock(&timings->lock);
+	first = timings->nextFrame - timings->capacity;
+	if ( first < timings->firstFrame )
+		first = timings->firstFrame;
+
+	fprintf(file, "frame");
+	for ( int stage = 0; stage < FrameStageCount; stage++ )
+		fprintf(file, ",%s", kStageNames[stage]);
+	fprintf(file, "\n");
+	for ( int64_t frame = first; frame < timings->nextFrame; frame++ )
+	{
+		const FrameRecord *record = &timings->ring[frame & (timings->capacity - 1)];
+
+		if ( record->frame != frame )
+			continue;
+		if ( ! haveBase )
+		{
+			base = record->stamps[FrameStageCaptured];
+			haveBase = 1;
+		}
+		fprintf(file, "%lld", (long long)frame);
+		for ( int stage = 0; stage < FrameStageCount; stage++ )
+		{
+			if ( record->stamps[stage] )
+				fprintf(file, ",%lld", (long long)(record->stamps[stage] - base));
+			else
+				fprintf(file, ",");
+		}
+		fprintf(file, "\n");
+	}
+	pthread_mutex_unlock(&timings->lock);
+}
+
+void FrameTimingsWritePercentiles(FrameTimings *timings, FrameStage stage, FrameSpan span, FILE *file)
+{
+	const int ticksPerHalfDistance = 5;
+	const double ms = 1e-6;
+	const Histogram *histogram;
+	double percentile = 0;
+	uint64_t countAtOrBelow;
+	double mean, deviation;
+
+	pthread_mutex_lock(&timings->lock);
+	histogram = &timings->histograms[stage][span];
+	fprintf(file, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+	if ( histogram->count )
+	{
+		// As HdrHistogram's outputPercentileDistribution: the steps halve as the remaining distance to 100% does
+		for ( ;; )
+		{
+			int index = histogramPercentileIndex(histogram, percentile, &countAtOrBelow);
+			uint64_t value = bucketHighestValue(index);
+			double reached = 100.0 * countAtOrBelow / histogram->count;
+			double halvings;
+
+			if ( value > histogram->maximum )
+				value = histogram->maximum;
+			if ( reached >= 100.0 )
+				break;
+			fprintf(file, "%12.3f %2.12f %10llu %14.2f\n", value * ms, reached / 100.0, (unsigned long long)countAtOrBelow, 1.0 / (1.0 - reached / 100.0));
+			halvings = floor(log2(100.0 / (100.0 - reached))) + 1;
+			percentile = reached + 100.0 / (ticksPerHalfDistance * pow(2.0, halvings));
+		}
+		fprintf(file, "%12.3f %2.12f %10llu\n", histogram->maximum * ms, 1.0, (unsigned long long)histogram->count);
+		mean = histogram->sum / histogram->count;
+		deviation = sqrt(fmax(0.0, histogram->sumOfSquares / histogram->count - mean * mean));
+		fprintf(file, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean * ms, deviation * ms);
+		fprintf(file, "#[Max     = %12.3f, Total count    = %12llu]\n", histogram->maximum * ms, (unsigned long long)histogram->count);
+		fprintf(file, "#[Buckets = %12d, SubBuckets     = %12d]\n", kMaximumBits - kLinearBits + 1, kLinearValues);
+	}
+	pthread_mutex_unlock(&timings->lock);
+}
+
+const char *FrameStageName(FrameStage stage)
+{
+	return ( stage >= 0 && stage < FrameStageCount ) ? kStageNames[stage] : "unknown";
+}
@@ -0,0 +1,97 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Per-frame stage timestamps in a ring, with latency histograms and the frame rate
+ */
+
+#ifndef RosyWriter_FrameTimings_h
+#define RosyWriter_FrameTimings_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Each frame is stamped as it crosses each stage boundary of the capture pipeline. The
+// stamps go into a ring of the most recent frames, and every stamp also adds to two
+// histograms for its stage: the time since the stage before it, and the time since the
+// frame was captured. The ring gives the frame rate and a per-frame dump; the histograms
+// cover everything since the last reset.
+//
+// Times are nanoseconds of a monotonic clock, FrameTimingsNow(). On Apple platforms that
+// is the host time clock, so a presentation time stamp on CMClockGetHostTimeClock() can be
+// converted to nanoseconds and given as the capture time.
+//
+// The histograms are log-linear, as HdrHistogram's: exact below 128 ns, and above that
+// every value is counted in a bucket no wider than 1/64 of it, so percentiles are within
+// 1.6%. The minimum, maximum and mean are exact.
+//
+// Every function is safe to call from any thread.
+
+typedef struct FrameTimings FrameTimings;
+
+typedef enum {
+	FrameStageCaptured,         // the camera's presentation time; its histogram is the frame interval
+	FrameStageDelivered,        // the video data output hands the frame over
+	FrameStageRendered,         // the renderer returns the output frame
+	FrameStageDisplayed,        // the preview has drawn it
+	FrameStageEnqueued,         // handed to the movie recorder
+	FrameStageWritten,          // appended to the asset writer's input
+	FrameStageCount
+} FrameStage;
+
+typedef enum {
+	FrameSpanStep,              // since the stage before: Displayed and Enqueued follow Rendered
+	FrameSpanTotal,             // since the frame was captured
+} FrameSpan;
+
+typedef struct {
+	uint64_t count;
+	uint64_t minimum, maximum;  // nanoseconds
+	double mean;
+	uint64_t p50, p90, p99, p999;
+} FrameTimingsSummary;
+
+// capacity frames are kept in the ring, rounded up to a power of two; 0 is 256, several
+// seconds at camera rates. The frame rate needs a second of frames to be exact.
+FrameTimings *FrameTimingsCreate(int capacity);
+void FrameTimingsDestroy(FrameTimings *timings);
+
+// Empties the ring and the histograms
+void FrameTimingsReset(FrameTimings *timings);
+
+uint64_t FrameTimingsNow(void);
+
+// Starts a frame captured at time, 0 for now, and returns its number for the other stamps.
+// Frames must begin in capture order.
+int64_t FrameTimingsBeginFrame(FrameTimings *timings, uint64_t time);
+
+// A frame that has left the ring is not counted; FrameTimingsLateStamps says how many were not
+void FrameTimingsStamp(FrameTimings *timings, int64_t frame, FrameStage stage, uint64_t time);
+uint64_t FrameTimingsLateStamps(FrameTimings *timings);
+
+// Over the last second of captures in the ring, 0 until there are two
+float FrameTimingsFramesPerSecond(FrameTimings *timings);
+
+// percentile in [0..100], nanoseconds
+uint64_t FrameTimingsValueAtPercentile(FrameTimings *timings, FrameStage stage, FrameSpan span, double percentile);
+void FrameTimingsGetSummary(FrameTimings *timings, FrameStage stage, FrameSpan span, FrameTimingsSummary *summary);
+
+// For offline analysis. The summary is a table of every stage's spans in milliseconds. The
+// frames are CSV, one line per frame in the ring, nanoseconds since the first capture in
+// the ring, empty where a stage was not stamped. The percentiles are HdrHistogram's
+// percentile distribution format, in milliseconds, which its plotter reads.
+void FrameTimingsWriteSummary(FrameTimings *timings, FILE *file);
+void FrameTimingsWriteFrames(FrameTimings *timings, FILE *file);
+void FrameTimingsWritePercentiles(FrameTimings *timings, FrameStage stage, FrameSpan span, FILE *file);
+
+const char *FrameStageName(FrameStage stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,7 @@
 - (void)prepareToRecord;
 
 - (void)appendVideoSampleBuffer:(CMSampleBufferRef)sampleBuffer;
+- (void)appendVideoSampleBuffer:(CMSampleBufferRef)sampleBuffer appendedHandler:(void (^)(BOOL appended))handler; // handler is called on the writing queue once the frame has gone to the asset writer, or been dropped
 - (void)appendVideoPixelBuffer:(CVPixelBufferRef)pixelBuffer withPresentationTime:(CMTime)presentationTime;
 - (void)appendAudioSampleBuffer:(CMSampleBufferRef)sampleBuffer;
 
@@ -179,7 +179,12 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 
 - (void)appendVideoSampleBuffer:(CMSampleBufferRef)sampleBuffer
 {
-	[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeVideo];
+	[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeVideo appendedHandler:nil];
+}
+
+- (void)appendVideoSampleBuffer:(CMSampleBufferRef)sampleBuffer appendedHandler:(void (^)(BOOL appended))handler
+{
+	[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeVideo appendedHandler:handler];
 }
 
 - (void)appendVideoPixelBuffer:(CVPixelBufferRef)pixelBuffer withPresentationTime:(CMTime)presentationTime
@@ -193,7 +198,7 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 	
 	OSStatus err = CMSampleBufferCreateForImageBuffer( kCFAllocatorDefault, pixelBuffer, true, NULL, NULL, _videoTrackSourceFormatDescription, &timingInfo, &sampleBuffer );
 	if ( sampleBuffer ) {
-		[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeVideo];
+		[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeVideo appendedHandler:nil];
 		CFRelease( sampleBuffer );
 	}
 	else {
@@ -204,7 +209,7 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 
 - (void)appendAudioSampleBuffer:(CMSampleBufferRef)sampleBuffer
 {
-	[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeAudio];
+	[self appendSampleBuffer:sampleBuffer ofMediaType:AVMediaTypeAudio appendedHandler:nil];
 }
 
 - (void)finishRecording
@@ -285,7 +290,7 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 #pragma mark -
 #pragma mark Internal
 
-- (void)appendSampleBuffer:(CMSampleBufferRef)sampleBuffer ofMediaType:(NSString *)mediaType
+- (void)appendSampleBuffer:(CMSampleBufferRef)sampleBuffer ofMediaType:(NSString *)mediaType appendedHandler:(void (^)(BOOL appended))handler
 {
 	if ( sampleBuffer == NULL ) {
 		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"NULL sample buffer" userInfo:nil];
@@ -311,6 +316,9 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 				// Instead of throwing an exception we just release the sample buffers and return.
 				if ( _status > MovieRecorderStatusFinishingRecordingPart1 ) {
 					CFRelease( sampleBuffer );
+					if ( handler ) {
+						handler( NO );
+					}
 					return;
 				}
 			}
@@ -321,10 +329,11 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 			}
 			
 			AVAssetWriterInput *input = ( mediaType == AVMediaTypeVideo ) ? _videoInput : _audioInput;
+			BOOL success = NO;
 			
 			if ( input.readyForMoreMediaData )
 			{
-				BOOL success = [input appendSampleBuffer:sampleBuffer];
+				success = [input appendSampleBuffer:sampleBuffer];
 				if ( ! success ) {
 					NSError *error = _assetWriter.error;
 					@synchronized( self ) {
@@ -337,6 +346,10 @@ typedef NS_ENUM( NSInteger, MovieRecorderStatus ) {
 				NSLog( @"%@ input not ready for more media data, dropping buffer", mediaType );
 			}
 			CFRelease( sampleBuffer );
+			
+			if ( handler ) {
+				handler( success );
+			}
 		}
 	} );
 }
@@ -0,0 +1,31 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Output pixel buffers for the CPU renderers, from a CVPixelBufferPool with an allocation threshold
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreMedia/CoreMedia.h>
+#import <CoreVideo/CoreVideo.h>
+
+// A renderer that writes out of place takes its output buffers from here. They are
+// IOSurface-backed 32BGRA buffers with rows aligned to 64 bytes, so the preview's texture
+// cache and the movie recorder take them as they are and the vector kernels never split a
+// cache line. The pool is sized from the pipeline's retained buffer count hint, every
+// buffer is made up front, and it never grows past that: when every buffer is still held
+// downstream, copyPixelBuffer fails and the frame is dropped. A buffer is back in the pool
+// when its last CFRelease lets it go.
+
+@interface RenderedPixelBufferPool : NSObject
+
+// nil if the pool or its first buffer could not be made
+- (instancetype)initWithInputFormatDescription:(CMFormatDescriptionRef)inputFormatDescription retainedBufferCountHint:(size_t)retainedBufferCountHint;
+
+// Of the buffers copyPixelBuffer returns
+@property(nonatomic, readonly) CMFormatDescriptionRef outputFormatDescription;
+
+// A buffer the caller owns, or NULL if every buffer is still out
+- (CVPixelBufferRef)copyPixelBuffer CF_RETURNS_RETAINED;
+
+@end
@@ -0,0 +1,97 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Output pixel buffers for the CPU renderers, from a CVPixelBufferPool with an allocation threshold
+ */
+
+#import "RenderedPixelBufferPool.h"
+
+@interface RenderedPixelBufferPool ()
+{
+	CVPixelBufferPoolRef _bufferPool;
+	CFDictionaryRef _bufferPoolAuxAttributes;
+	CMFormatDescriptionRef _outputFormatDescription;
+}
+
+@end
+
+@implementation RenderedPixelBufferPool
+
+- (instancetype)initWithInputFormatDescription:(CMFormatDescriptionRef)inputFormatDescription retainedBufferCountHint:(size_t)retainedBufferCountHint
+{
+	self = [super init];
+	if ( self )
+	{
+		CMVideoDimensions dimensions = CMVideoFormatDescriptionGetDimensions( inputFormatDescription );
+		int32_t maxBufferCount = (int32_t)retainedBufferCountHint;
+		
+		NSDictionary *pixelBufferOptions = @{ (id)kCVPixelBufferPixelFormatTypeKey : @(kCVPixelFormatType_32BGRA),
+											  (id)kCVPixelBufferWidthKey : @(dimensions.width),
+											  (id)kCVPixelBufferHeightKey : @(dimensions.height),
+											  (id)kCVPixelBufferBytesPerRowAlignmentKey : @(64),
+											  (id)kCVPixelFormatOpenGLESCompatibility : @(YES),
+											  (id)kCVPixelBufferIOSurfacePropertiesKey : @{ /*empty dictionary*/ } };
+		NSDictionary *pixelBufferPoolOptions = @{ (id)kCVPixelBufferPoolMinimumBufferCountKey : @(maxBufferCount) };
+		CVPixelBufferPoolCreate( kCFAllocatorDefault, (__bridge CFDictionaryRef)pixelBufferPoolOptions, (__bridge CFDictionaryRef)pixelBufferOptions, &_bufferPool );
+		if ( ! _bufferPool ) {
+			NSLog( @"Problem initializing a buffer pool." );
+			return nil;
+		}
+		
+		// CVPixelBufferPoolCreatePixelBufferWithAuxAttributes() will return kCVReturnWouldExceedAllocationThreshold if we have already vended the max number of buffers
+		_bufferPoolAuxAttributes = CFBridgingRetain( @{ (id)kCVPixelBufferPoolAllocationThresholdKey : @(maxBufferCount) } );
+		
+		// Preallocate buffers in the pool, since this is for real-time display/capture
+		NSMutableArray *pixelBuffers = [[NSMutableArray alloc] init];
+		while ( 1 )
+		{
+			CVPixelBufferRef pixelBuffer = NULL;
+			CVReturn err = CVPixelBufferPoolCreatePixelBufferWithAuxAttributes( kCFAllocatorDefault, _bufferPool, _bufferPoolAuxAttributes, &pixelBuffer );
+			if ( err != kCVReturnSuccess ) {
+				break;
+			}
+			[pixelBuffers addObject:CFBridgingRelease( pixelBuffer )];
+		}
+		if ( pixelBuffers.count == 0 ) {
+			NSLog( @"Problem creating a pixel buffer." );
+			return nil;
+		}
+		CMVideoFormatDescriptionCreateForImageBuffer( kCFAllocatorDefault, (__bridge CVPixelBufferRef)pixelBuffers[0], &_outputFormatDescription );
+		[pixelBuffers removeAllObjects];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if ( _bufferPool ) {
+		CFRelease( _bufferPool );
+	}
+	if ( _bufferPoolAuxAttributes ) {
+		CFRelease( _bufferPoolAuxAttributes );
+	}
+	if ( _outputFormatDescription ) {
+		CFRelease( _outputFormatDescription );
+	}
+}
+
+- (CMFormatDescriptionRef)outputFormatDescription
+{
+	return _outputFormatDescription;
+}
+
+- (CVPixelBufferRef)copyPixelBuffer
+{
+	CVPixelBufferRef pixelBuffer = NULL;
+	CVReturn err = CVPixelBufferPoolCreatePixelBufferWithAuxAttributes( kCFAllocatorDefault, _bufferPool, _bufferPoolAuxAttributes, &pixelBuffer );
+	if ( err == kCVReturnWouldExceedAllocationThreshold ) {
+		NSLog( @"Pool is out of buffers, dropping frame" );
+	}
+	else if ( err ) {
+		NSLog( @"Error at CVPixelBufferPoolCreatePixelBuffer %d", err );
+	}
+	return pixelBuffer;
+}
+
+@end
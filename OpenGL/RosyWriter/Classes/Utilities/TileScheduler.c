@@ -0,0 +1,339 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Work-stealing thread pool that runs CPU image kernels over cache-sized tiles
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#include "TileScheduler.h"
+
+#define kMaxThreads 64
+#define kTilesPerThread 4		// tiles per thread at least, so there is something to steal
+#define kMinTileRows 8
+#define kDefaultCacheBytes (256 * 1024)
+
+// A thread's run of tiles [begin, end), packed into one word so that the owner taking
+// from the front and thieves taking from the back agree through a single compare and swap.
+// Each is on its own cache line.
+typedef struct {
+	volatile uint64_t range;
+	char pad[64 - sizeof(uint64_t)];
+} TileRange;
+
+struct TileScheduler {
+	int threads;
+	size_t cacheBytes;
+	pthread_t workers[kMaxThreads];
+	int workerCount;
+	TileRange *ranges;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	unsigned generation;
+	int busy;
+	int quit;
+
+	// The run in progress
+	TileKernel kernel;
+	void *context;
+	int wide, high, tileWide, tileHigh, halo, columns;
+};
+
+typedef struct {
+	TileScheduler *scheduler;
+	int thread;
+} WorkerArgs;
+
+static inline uint64_t packRange(uint32_t begin, uint32_t end)
+{
+	return ((uint64_t)end << 32) | begin;
+}
+
+static int cpuCount(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (n > kMaxThreads ? kMaxThreads : (int)n);
+}
+
+// The cache a tile should fit in: the L2, which on most cores is per core or per pair
+static size_t cacheSize(void)
+{
+	size_t bytes = 0;
+#if defined(__APPLE__)
+	uint64_t value = 0;
+	size_t length = sizeof(value);
+	if ( sysctlbyname("hw.perflevel0.l2cachesize", &value, &length, NULL, 0) == 0 || sysctlbyname("hw.l2cachesize", &value, &length, NULL, 0) == 0 )
+		bytes = (size_t)value;
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+	long value = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	bytes = value > 0 ? (size_t)value : 0;
+#endif
+	return bytes > 0 ? bytes : kDefaultCacheBytes;
+}
+
+
+static void runTile(TileScheduler *s, int index, int thread)
+{
+	Tile tile;
+	int right, bottom;
+
+	tile.index = index;
+	tile.thread = thread;
+	tile.x = (index % s->columns) * s->tileWide;
+	tile.y = (index / s->columns) * s->tileHigh;
+	tile.wide = (tile.x + s->tileWide > s->wide) ? s->wide - tile.x : s->tileWide;
+	tile.high = (tile.y + s->tileHigh > s->high) ? s->high - tile.y : s->tileHigh;
+
+	tile.haloX = (tile.x - s->halo < 0) ? 0 : tile.x - s->halo;
+	tile.haloY = (tile.y - s->halo < 0) ? 0 : tile.y - s->halo;
+	right = (tile.x + tile.wide + s->halo > s->wide) ? s->wide : tile.x + tile.wide + s->halo;
+	bottom = (tile.y + tile.high + s->halo > s->high) ? s->high : tile.y + tile.high + s->halo;
+	tile.haloWide = right - tile.haloX;
+	tile.haloHigh = bottom - tile.haloY;
+
+	s->kernel(s->context, &tile);
+}
+
+// The next tile from the front of this thread's own run, or -1
+static int takeOwn(TileScheduler *s, int thread)
+{
+	volatile uint64_t *range = &s->ranges[thread].range;
+	uint64_t old = __atomic_load_n(range, __ATOMIC_ACQUIRE);
+
+	for (;;)
+	{
+		uint32_t begin = (uint32_t)old, end = (uint32_t)(old >> 32);
+		if ( begin >= end )
+			return -1;
+		if ( __atomic_compare_exchange_n(range, &old, packRange(begin + 1, end), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+			return (int)begin;
+	}
+}
+
+// Half of what is left of the longest other run, taken from its back. The first of those
+// tiles is returned and the rest become this thread's run. -1 if every run is empty.
+static int steal(TileScheduler *s, int thread)
+{
+	for (;;)
+	{
+		int victim = -1, i;
+		uint32_t most = 0;
+		uint64_t old = 0;
+
+		for (i = 0; i < s->threads; i++)
+		{
+			uint64_t r = __atomic_load_n(&s->ranges[i].range, __ATOMIC_ACQUIRE);
+			uint32_t left = (uint32_t)(r >> 32) - (uint32_t)r;
+			if ( i != thread && (uint32_t)r < (uint32_t)(r >> 32) && left > most )
+			{
+				most = left;
+				victim = i;
+				old = r;
+			}
+		}
+		if ( victim < 0 )
+			return -1;
+
+		uint32_t begin = (uint32_t)old, end = (uint32_t)(old >> 32);
+		uint32_t take = (end - begin + 1) / 2;
+		if ( __atomic_compare_exchange_n(&s->ranges[victim].range, &old, packRange(begin, end - take), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+		{
+			// Our own run is empty, and only we add to it
+			__atomic_store_n(&s->ranges[thread].range, packRange(end - take + 1, end), __ATOMIC_RELEASE);
+			return (int)(end - take);
+		}
+		// Someone else got there first; look again
+	}
+}
+
+static void work(TileScheduler *s, int thread)
+{
+	int index;
+
+	while ( (index = takeOwn(s, thread)) >= 0 || (index = steal(s, thread)) >= 0 )
+		runTile(s, index, thread);
+}
+
+static void *workerMain(void *arg)
+{
+	WorkerArgs args = *(WorkerArgs *)arg;
+	TileScheduler *s = args.scheduler;
+	unsigned seen = 0;
+
+	free(arg);
+	for (;;)
+	{
+		pthread_mutex_lock(&s->lock);
+		while ( s->generation == seen && !s->quit )
+			pthread_cond_wait(&s->wake, &s->lock);
+		seen = s->generation;
+		if ( s->quit )
+		{
+			pthread_mutex_unlock(&s->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		work(s, args.thread);
+
+		pthread_mutex_lock(&s->lock);
+		if ( --s->busy == 0 )
+			pthread_cond_signal(&s->idle);
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+
+TileScheduler *TileSchedulerCreate(int threads)
+{
+	TileScheduler *s = calloc(1, sizeof(TileScheduler));
+	void *ranges = NULL;
+	int i;
+
+	if ( !s )
+		return NULL;
+	s->threads = (threads <= 0) ? cpuCount() : (threads > kMaxThreads ? kMaxThreads : threads);
+	s->cacheBytes = cacheSize();
+	if ( posix_memalign(&ranges, 64, sizeof(TileRange) * s->threads) != 0 )
+	{
+		free(s);
+		return NULL;
+	}
+	s->ranges = ranges;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	pthread_cond_init(&s->idle, NULL);
+
+	// The caller of a run is thread 0; if a worker cannot be started, the others steal its share
+	for (i = 1; i < s->threads; i++)
+	{
+		WorkerArgs *args = malloc(sizeof(WorkerArgs));
+		if ( !args )
+			break;
+		args->scheduler = s;
+		args->thread = i;
+		if ( pthread_create(&s->workers[s->workerCount], NULL, workerMain, args) != 0 )
+		{
+			free(args);
+			break;
+		}
+		s->workerCount++;
+	}
+	return s;
+}
+
+void TileSchedulerDestroy(TileScheduler *s)
+{
+	int i;
+
+	if ( !s )
+		return;
+	pthread_mutex_lock(&s->lock);
+	s->quit = 1;
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	for (i = 0; i < s->workerCount; i++)
+		pthread_join(s->workers[i], NULL);
+	pthread_cond_destroy(&s->idle);
+	pthread_cond_destroy(&s->wake);
+	pthread_mutex_destroy(&s->lock);
+	free(s->ranges);
+	free(s);
+}
+
+int TileSchedulerThreadCount(const TileScheduler *s)
+{
+	return s->threads;
+}
+
+void TileSchedulerTileSize(const TileScheduler *s, int wide, int high, int bytesPerPixel, int halo, int *tileWide, int *tileHigh)
+{
+	// Half the cache for the tile and its halo, the rest for whatever else the kernel uses
+	size_t budget = s->cacheBytes / 2;
+	size_t rowBytes = (size_t)(wide + 2 * halo) * (bytesPerPixel > 0 ? bytesPerPixel : 4);
+	int rows = (int)(budget / rowBytes) - 2 * halo;
+	int fair = (high + kTilesPerThread * s->threads - 1) / (kTilesPerThread * s->threads);
+
+	if ( rows >= kMinTileRows )
+	{
+		// Whole rows: the kernel streams through memory as the prefetcher likes best
+		*tileWide = wide;
+		*tileHigh = rows < fair ? rows : fair;
+	}
+	else
+	{
+		// Rows too long for the cache: columns of a multiple of 16 pixels, kMinTileRows * 4 high
+		int columnRows = kMinTileRows * 4;
+		int columns = (int)(budget / ((size_t)(columnRows + 2 * halo) * (bytesPerPixel > 0 ? bytesPerPixel : 4))) - 2 * halo;
+		*tileWide = columns < 16 ? 16 : columns & ~15;
+		*tileHigh = columnRows;
+	}
+	if ( *tileHigh < 1 )
+		*tileHigh = 1;
+}
+
+void TileSchedulerRun(TileScheduler *s, int wide, int high, int bytesPerPixel, int halo, TileKernel kernel, void *context)
+{
+	int tileWide, tileHigh;
+
+	TileSchedulerTileSize(s, wide, high, bytesPerPixel, halo, &tileWide, &tileHigh);
+	TileSchedulerRunTiles(s, wide, high, tileWide, tileHigh, halo, kernel, context);
+}
+
+void TileSchedulerRunTiles(TileScheduler *s, int wide, int high, int tileWide, int tileHigh, int halo, TileKernel kernel, void *context)
+{
+	int rows, tiles, i;
+
+	if ( wide <= 0 || high <= 0 )
+		return;
+	tileWide = (tileWide <= 0 || tileWide > wide) ? wide : tileWide;
+	tileHigh = (tileHigh <= 0 || tileHigh > high) ? high : tileHigh;
+
+	s->kernel = kernel;
+	s->context = context;
+	s->wide = wide;
+	s->high = high;
+	s->tileWide = tileWide;
+	s->tileHigh = tileHigh;
+	s->halo = halo;
+	s->columns = (wide + tileWide - 1) / tileWide;
+	rows = (high + tileHigh - 1) / tileHigh;
+	tiles = s->columns * rows;
+
+	// Neighbouring tiles to each thread, so that a thread's halo reads are mostly pixels
+	// it has touched already
+	for (i = 0; i < s->threads; i++)
+	{
+		uint32_t begin = (uint32_t)((int64_t)tiles * i / s->threads);
+		uint32_t end = (uint32_t)((int64_t)tiles * (i + 1) / s->threads);
+		__atomic_store_n(&s->ranges[i].range, packRange(begin, end), __ATOMIC_RELAXED);
+	}
+
+	// Alone, this thread steals every run in turn
+	if ( s->workerCount == 0 || tiles == 1 )
+	{
+		work(s, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->busy = s->workerCount;
+	s->generation++;
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+
+	work(s, 0);
+
+	pthread_mutex_lock(&s->lock);
+	while ( s->busy > 0 )
+		pthread_cond_wait(&s->idle, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+}
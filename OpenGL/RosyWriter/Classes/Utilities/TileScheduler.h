@@ -0,0 +1,63 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Work-stealing thread pool that runs CPU image kernels over cache-sized tiles
+ */
+
+#ifndef RosyWriter_TileScheduler_h
+#define RosyWriter_TileScheduler_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The scheduler splits an image into tiles, small enough that a tile's pixels stay in
+// the core's cache while a kernel works on them, and runs the kernel on every tile
+// from a pool of threads, one per core. Each thread starts with its own run of
+// neighbouring tiles; a thread that runs out steals half of what is left of the
+// busiest other run, so the cores stay busy when some tiles cost more than others.
+//
+// Neighbourhood filters read beyond the pixels they write. A tile carries the
+// rectangle the kernel may read as well: the tile grown by the halo on every side,
+// clipped to the image. Kernels must not write outside the tile.
+//
+// The thread that calls TileSchedulerRun takes part, and the call returns when every
+// tile has been done. Runs on one scheduler must not overlap.
+
+typedef struct TileScheduler TileScheduler;
+
+typedef struct {
+	int x, y, wide, high;                   // pixels the kernel produces
+	int haloX, haloY, haloWide, haloHigh;   // pixels the kernel may read
+	int index;                              // of the tile, in row order
+	int thread;                             // [0..threads), for per-thread scratch
+} Tile;
+
+typedef void (*TileKernel)(void *context, const Tile *tile);
+
+// threads 0 is one per core
+TileScheduler *TileSchedulerCreate(int threads);
+void TileSchedulerDestroy(TileScheduler *scheduler);
+int TileSchedulerThreadCount(const TileScheduler *scheduler);
+
+// Tiles sized for a kernel that touches bytesPerPixel for each pixel, counting every
+// plane it reads and writes
+void TileSchedulerRun(TileScheduler *scheduler, int wide, int high, int bytesPerPixel, int halo,
+                      TileKernel kernel, void *context);
+
+// Tiles of a given size, the last in each row and column clipped to the image
+void TileSchedulerRunTiles(TileScheduler *scheduler, int wide, int high, int tileWide, int tileHigh, int halo,
+                           TileKernel kernel, void *context);
+
+// The tile size TileSchedulerRun would use
+void TileSchedulerTileSize(const TileScheduler *scheduler, int wide, int high, int bytesPerPixel, int halo,
+                           int *tileWide, int *tileHigh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,485 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Conversion between 4:2:0 YCbCr frames, biplanar and planar, and 32-bit BGRA
+ */
+
+#include <math.h>
+#include "YUVConvert.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YUV_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define YUV_AVX2 1
+#endif
+
+#define kShift 16			// fractional bits of the coefficients
+#define kHalf (1 << (kShift - 1))
+#define kChromaShift (kShift + 2)	// chroma is made from the sum of a 2x2 block
+#define kChromaHalf (1 << (kChromaShift - 1))
+
+// Vector kernels are used unless YUVConvertSetSIMD(0) has been called
+static int useSIMD = 1;
+
+typedef struct {
+	// To BGRA: Y' = (Y - yOffset) yScale, G subtracts its chroma terms
+	int yOffset, yScale;
+	int rCr, gCb, gCr, bCb;
+	// To YCbCr
+	int yR, yG, yB;
+	int cbR, cbG, cbB, crR, crG, crB;
+} Coefficients;
+
+static Coefficients coefficients(YUVMatrix matrix, YUVRange range)
+{
+	const double one = 1 << kShift;
+	double kr = (matrix == YUVMatrixBT709) ? 0.2126 : 0.299;
+	double kb = (matrix == YUVMatrixBT709) ? 0.0722 : 0.114;
+	double kg = 1 - kr - kb;
+	double yScale = (range == YUVRangeVideo) ? 255.0 / 219 : 1;
+	double cScale = (range == YUVRangeVideo) ? 255.0 / 224 : 1;
+	int luma = (int)lround(one / yScale);
+	Coefficients k;
+
+	k.yOffset = (range == YUVRangeVideo) ? 16 : 0;
+	k.yScale = (int)lround(yScale * one);
+	k.rCr = (int)lround(2 * (1 - kr) * cScale * one);
+	k.gCb = (int)lround(2 * kb * (1 - kb) / kg * cScale * one);
+	k.gCr = (int)lround(2 * kr * (1 - kr) / kg * cScale * one);
+	k.bCb = (int)lround(2 * (1 - kb) * cScale * one);
+
+	// The weights of each sum to what white needs, so that grays map to grays exactly
+	k.yR = (int)lround(kr / yScale * one);
+	k.yB = (int)lround(kb / yScale * one);
+	k.yG = luma - k.yR - k.yB;
+	k.cbR = (int)lround(-kr / (2 * (1 - kb)) / cScale * one);
+	k.cbB = (int)lround(0.5 / cScale * one);
+	k.cbG = -k.cbR - k.cbB;
+	k.crR = k.cbB;
+	k.crB = (int)lround(-kb / (2 * (1 - kr)) / cScale * one);
+	k.crG = -k.crR - k.crB;
+	return k;
+}
+
+static inline uint8_t clamp255(int v)
+{
+	// Without branches, which random-looking chroma would mispredict
+	v &= ~(v >> 31);
+	return (uint8_t)(v | ((255 - v) >> 31));
+}
+
+
+// Two rows of BGRA from a row of luma each and the chroma row they share, from column x
+// on. y1 and d1 are NULL for the last row of an odd height. Chroma samples are chromaStep
+// bytes apart: 2 in an NV12 plane of pairs, 1 in an I420 plane.
+static inline void writePixel(uint8_t *d, int y, int rc, int gc, int bc, const Coefficients *k)
+{
+	int yy = k->yScale * (y - k->yOffset) + kHalf;
+	d[0] = clamp255((yy + bc) >> kShift);
+	d[1] = clamp255((yy - gc) >> kShift);
+	d[2] = clamp255((yy + rc) >> kShift);
+	d[3] = 255;
+}
+
+static void toBGRAScalar(const uint8_t *y0, const uint8_t *y1, const uint8_t *cb, const uint8_t *cr, int chromaStep,
+                         uint8_t *d0, uint8_t *d1, int x, int width, const Coefficients *k)
+{
+	for (; x < width; x += 2)
+	{
+		int u = cb[x / 2 * chromaStep] - 128, v = cr[x / 2 * chromaStep] - 128;
+		int rc = k->rCr * v, gc = k->gCb * u + k->gCr * v, bc = k->bCb * u;
+		int pair = (x + 1 < width);
+
+		writePixel(d0 + 4 * x, y0[x], rc, gc, bc, k);
+		if ( pair )
+			writePixel(d0 + 4 * x + 4, y0[x + 1], rc, gc, bc, k);
+		if ( d1 )
+		{
+			writePixel(d1 + 4 * x, y1[x], rc, gc, bc, k);
+			if ( pair )
+				writePixel(d1 + 4 * x + 4, y1[x + 1], rc, gc, bc, k);
+		}
+	}
+}
+
+// Two rows of luma and their row of chroma, from column x on. s1 and y1 are NULL for the
+// last row of an odd height; missing pixels of a 2x2 block are copies of their neighbours.
+static void fromBGRAScalar(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *cb, uint8_t *cr, int chromaStep,
+                           int x, int width, const Coefficients *k)
+{
+	if ( !s1 )
+		s1 = s0;
+	for (; x < width; x += 2)
+	{
+		const uint8_t *p[4] = { s0 + 4 * x, s0 + 4 * x + 4, s1 + 4 * x, s1 + 4 * x + 4 };
+		int sumB = 0, sumG = 0, sumR = 0;
+		if ( x + 1 >= width )
+		{
+			p[1] = p[0];
+			p[3] = p[2];
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			uint8_t *yRow = (i < 2) ? y0 : y1;
+			int yy = (k->yR * p[i][2] + k->yG * p[i][1] + k->yB * p[i][0] + kHalf) >> kShift;
+			if ( yRow && (i & 1) + x < width )
+				yRow[x + (i & 1)] = clamp255(yy + k->yOffset);
+			sumB += p[i][0];
+			sumG += p[i][1];
+			sumR += p[i][2];
+		}
+		cb[x / 2 * chromaStep] = clamp255(((k->cbR * sumR + k->cbG * sumG + k->cbB * sumB + kChromaHalf) >> kChromaShift) + 128);
+		cr[x / 2 * chromaStep] = clamp255(((k->crR * sumR + k->crG * sumG + k->crB * sumB + kChromaHalf) >> kChromaShift) + 128);
+	}
+}
+
+#if YUV_NEON
+
+// Eight fixed-point values rounded down to bytes, clamped
+static inline uint8x8_t narrowPixels(int32x4_t a, int32x4_t b)
+{
+	return vqmovn_u16(vcombine_u16(vqmovun_s32(vshrq_n_s32(a, kShift)), vqmovun_s32(vshrq_n_s32(b, kShift))));
+}
+
+static inline uint8x8_t narrowChroma(int32x4_t a, int32x4_t b)
+{
+	return vqmovn_u16(vcombine_u16(vqmovun_s32(vshrq_n_s32(a, kChromaShift)), vqmovun_s32(vshrq_n_s32(b, kChromaShift))));
+}
+
+static int toBGRAVector(const uint8_t *y0, const uint8_t *y1, const uint8_t *cb, const uint8_t *cr, int chromaStep,
+                        uint8_t *d0, uint8_t *d1, int width, const Coefficients *k)
+{
+	const uint8x8_t v128 = vdup_n_u8(128), yOffset = vdup_n_u8((uint8_t)k->yOffset);
+	const int32x4_t half = vdupq_n_s32(kHalf);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		int16x8_t u, v;
+		if ( chromaStep == 2 )
+		{
+			uint8x8x2_t c = vld2_u8(cb + x);
+			u = vreinterpretq_s16_u16(vsubl_u8(c.val[0], v128));
+			v = vreinterpretq_s16_u16(vsubl_u8(c.val[1], v128));
+		}
+		else
+		{
+			u = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(cb + x / 2), v128));
+			v = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(cr + x / 2), v128));
+		}
+
+		// Chroma terms for samples 0-3 and 4-7, then each doubled for the two pixels it covers
+		int32x4_t u0 = vmovl_s16(vget_low_s16(u)), u1 = vmovl_high_s16(u);
+		int32x4_t v0 = vmovl_s16(vget_low_s16(v)), v1 = vmovl_high_s16(v);
+		int32x4_t rc[2] = { vmulq_n_s32(v0, k->rCr), vmulq_n_s32(v1, k->rCr) };
+		int32x4_t gc[2] = { vmlaq_n_s32(vmulq_n_s32(u0, k->gCb), v0, k->gCr), vmlaq_n_s32(vmulq_n_s32(u1, k->gCb), v1, k->gCr) };
+		int32x4_t bc[2] = { vmulq_n_s32(u0, k->bCb), vmulq_n_s32(u1, k->bCb) };
+		int32x4_t r4[4], g4[4], b4[4];
+		for (int i = 0; i < 2; i++)
+		{
+			r4[2 * i] = vzip1q_s32(rc[i], rc[i]);
+			r4[2 * i + 1] = vzip2q_s32(rc[i], rc[i]);
+			g4[2 * i] = vzip1q_s32(gc[i], gc[i]);
+			g4[2 * i + 1] = vzip2q_s32(gc[i], gc[i]);
+			b4[2 * i] = vzip1q_s32(bc[i], bc[i]);
+			b4[2 * i + 1] = vzip2q_s32(bc[i], bc[i]);
+		}
+
+		for (int row = 0; row < 2; row++)
+		{
+			uint8x16_t luma = vld1q_u8((row ? y1 : y0) + x);
+			uint8_t *d = (row ? d1 : d0) + 4 * x;
+			int16x8_t lo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(luma), yOffset));
+			int16x8_t hi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(luma), yOffset));
+			int32x4_t yy[4] = {
+				vmlaq_n_s32(half, vmovl_s16(vget_low_s16(lo)), k->yScale), vmlaq_n_s32(half, vmovl_high_s16(lo), k->yScale),
+				vmlaq_n_s32(half, vmovl_s16(vget_low_s16(hi)), k->yScale), vmlaq_n_s32(half, vmovl_high_s16(hi), k->yScale),
+			};
+			for (int i = 0; i < 4; i += 2)
+			{
+				uint8x8x4_t out;
+				out.val[0] = narrowPixels(vaddq_s32(yy[i], b4[i]), vaddq_s32(yy[i + 1], b4[i + 1]));
+				out.val[1] = narrowPixels(vsubq_s32(yy[i], g4[i]), vsubq_s32(yy[i + 1], g4[i + 1]));
+				out.val[2] = narrowPixels(vaddq_s32(yy[i], r4[i]), vaddq_s32(yy[i + 1], r4[i + 1]));
+				out.val[3] = vdup_n_u8(255);
+				vst4_u8(d + 16 * i, out);
+			}
+		}
+	}
+	return x;
+}
+
+// Luma of four pixels, with the offset folded into the rounding
+static inline uint32x4_t luma4(uint16x4_t r, uint16x4_t g, uint16x4_t b, const Coefficients *k)
+{
+	uint32x4_t acc = vdupq_n_u32(kHalf + ((uint32_t)k->yOffset << kShift));
+	acc = vmlaq_n_u32(acc, vmovl_u16(r), (uint32_t)k->yR);
+	acc = vmlaq_n_u32(acc, vmovl_u16(g), (uint32_t)k->yG);
+	return vmlaq_n_u32(acc, vmovl_u16(b), (uint32_t)k->yB);
+}
+
+static inline int32x4_t chroma4(uint32x4_t r, uint32x4_t g, uint32x4_t b, int cr, int cg, int cb)
+{
+	int32x4_t acc = vdupq_n_s32(kChromaHalf + (128 << kChromaShift));
+	acc = vmlaq_n_s32(acc, vreinterpretq_s32_u32(r), cr);
+	acc = vmlaq_n_s32(acc, vreinterpretq_s32_u32(g), cg);
+	return vmlaq_n_s32(acc, vreinterpretq_s32_u32(b), cb);
+}
+
+static int fromBGRAVector(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *cb, uint8_t *cr, int chromaStep,
+                          int width, const Coefficients *k)
+{
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8x16x4_t p[2] = { vld4q_u8(s0 + 4 * x), vld4q_u8(s1 + 4 * x) };
+		for (int row = 0; row < 2; row++)
+		{
+			uint16x8_t b = vmovl_u8(vget_low_u8(p[row].val[0])), g = vmovl_u8(vget_low_u8(p[row].val[1])), r = vmovl_u8(vget_low_u8(p[row].val[2]));
+			uint16x8_t b1 = vmovl_high_u8(p[row].val[0]), g1 = vmovl_high_u8(p[row].val[1]), r1 = vmovl_high_u8(p[row].val[2]);
+			uint16x8_t lo = vcombine_u16(vqshrn_n_u32(luma4(vget_low_u16(r), vget_low_u16(g), vget_low_u16(b), k), kShift),
+			                             vqshrn_n_u32(luma4(vget_high_u16(r), vget_high_u16(g), vget_high_u16(b), k), kShift));
+			uint16x8_t hi = vcombine_u16(vqshrn_n_u32(luma4(vget_low_u16(r1), vget_low_u16(g1), vget_low_u16(b1), k), kShift),
+			                             vqshrn_n_u32(luma4(vget_high_u16(r1), vget_high_u16(g1), vget_high_u16(b1), k), kShift));
+			vst1q_u8((row ? y1 : y0) + x, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+		}
+
+		// Sums of each 2x2 block: the two rows, then neighbouring pixels
+		uint16x8_t b = vaddl_u8(vget_low_u8(p[0].val[0]), vget_low_u8(p[1].val[0])), b1 = vaddl_high_u8(p[0].val[0], p[1].val[0]);
+		uint16x8_t g = vaddl_u8(vget_low_u8(p[0].val[1]), vget_low_u8(p[1].val[1])), g1 = vaddl_high_u8(p[0].val[1], p[1].val[1]);
+		uint16x8_t r = vaddl_u8(vget_low_u8(p[0].val[2]), vget_low_u8(p[1].val[2])), r1 = vaddl_high_u8(p[0].val[2], p[1].val[2]);
+		uint32x4_t sb = vpaddlq_u16(b), sb1 = vpaddlq_u16(b1);
+		uint32x4_t sg = vpaddlq_u16(g), sg1 = vpaddlq_u16(g1);
+		uint32x4_t sr = vpaddlq_u16(r), sr1 = vpaddlq_u16(r1);
+		uint8x8_t outCb = narrowChroma(chroma4(sr, sg, sb, k->cbR, k->cbG, k->cbB), chroma4(sr1, sg1, sb1, k->cbR, k->cbG, k->cbB));
+		uint8x8_t outCr = narrowChroma(chroma4(sr, sg, sb, k->crR, k->crG, k->crB), chroma4(sr1, sg1, sb1, k->crR, k->crG, k->crB));
+		if ( chromaStep == 2 )
+		{
+			uint8x8x2_t pairs = { { outCb, outCr } };
+			vst2_u8(cb + x, pairs);
+		}
+		else
+		{
+			vst1_u8(cb + x / 2, outCb);
+			vst1_u8(cr + x / 2, outCr);
+		}
+	}
+	return x;
+}
+
+#elif YUV_AVX2
+
+// Eight pixels from their B, G and R, clamped, alpha 255
+static inline __m256i packPixels(__m256i b, __m256i g, __m256i r)
+{
+	const __m256i zero = _mm256_setzero_si256(), top = _mm256_set1_epi32(255);
+	b = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(b, kShift), zero), top);
+	g = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(g, kShift), zero), top);
+	r = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(r, kShift), zero), top);
+	return _mm256_or_si256(_mm256_or_si256(b, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(r, 16), _mm256_set1_epi32((int)0xFF000000)));
+}
+
+static int toBGRAVector(const uint8_t *y0, const uint8_t *y1, const uint8_t *cb, const uint8_t *cr, int chromaStep,
+                        uint8_t *d0, uint8_t *d1, int width, const Coefficients *k)
+{
+	const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+	const __m256i dupLo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3), dupHi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	const __m256i v128 = _mm256_set1_epi32(128), yOffset = _mm256_set1_epi32(k->yOffset), half = _mm256_set1_epi32(kHalf);
+	const __m256i yScale = _mm256_set1_epi32(k->yScale), rCr = _mm256_set1_epi32(k->rCr);
+	const __m256i gCb = _mm256_set1_epi32(k->gCb), gCr = _mm256_set1_epi32(k->gCr), bCb = _mm256_set1_epi32(k->bCb);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i u, v;
+		if ( chromaStep == 2 )
+		{
+			__m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(cb + x)), deinterleave);
+			u = _mm256_cvtepu8_epi32(c);
+			v = _mm256_cvtepu8_epi32(_mm_srli_si128(c, 8));
+		}
+		else
+		{
+			u = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(cb + x / 2)));
+			v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(cr + x / 2)));
+		}
+		u = _mm256_sub_epi32(u, v128);
+		v = _mm256_sub_epi32(v, v128);
+
+		// Chroma terms for the eight samples, then each doubled for the two pixels it covers
+		__m256i rc = _mm256_mullo_epi32(v, rCr);
+		__m256i gc = _mm256_add_epi32(_mm256_mullo_epi32(u, gCb), _mm256_mullo_epi32(v, gCr));
+		__m256i bc = _mm256_mullo_epi32(u, bCb);
+		__m256i r8[2] = { _mm256_permutevar8x32_epi32(rc, dupLo), _mm256_permutevar8x32_epi32(rc, dupHi) };
+		__m256i g8[2] = { _mm256_permutevar8x32_epi32(gc, dupLo), _mm256_permutevar8x32_epi32(gc, dupHi) };
+		__m256i b8[2] = { _mm256_permutevar8x32_epi32(bc, dupLo), _mm256_permutevar8x32_epi32(bc, dupHi) };
+
+		for (int row = 0; row < 2; row++)
+		{
+			__m128i luma = _mm_loadu_si128((const __m128i *)((row ? y1 : y0) + x));
+			uint8_t *d = (row ? d1 : d0) + 4 * x;
+			__m256i yy[2] = { _mm256_cvtepu8_epi32(luma), _mm256_cvtepu8_epi32(_mm_srli_si128(luma, 8)) };
+			for (int i = 0; i < 2; i++)
+			{
+				__m256i l = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(yy[i], yOffset), yScale), half);
+				__m256i out = packPixels(_mm256_add_epi32(l, b8[i]), _mm256_sub_epi32(l, g8[i]), _mm256_add_epi32(l, r8[i]));
+				_mm256_storeu_si256((__m256i *)(d + 32 * i), out);
+			}
+		}
+	}
+	return x;
+}
+
+static int fromBGRAVector(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *cb, uint8_t *cr, int chromaStep,
+                          int width, const Coefficients *k)
+{
+	const __m256i byte = _mm256_set1_epi32(0xFF);
+	const __m256i yR = _mm256_set1_epi32(k->yR), yG = _mm256_set1_epi32(k->yG), yB = _mm256_set1_epi32(k->yB);
+	const __m256i cbR = _mm256_set1_epi32(k->cbR), cbG = _mm256_set1_epi32(k->cbG), cbB = _mm256_set1_epi32(k->cbB);
+	const __m256i crR = _mm256_set1_epi32(k->crR), crG = _mm256_set1_epi32(k->crG), crB = _mm256_set1_epi32(k->crB);
+	const __m256i lumaRound = _mm256_set1_epi32(kHalf + (k->yOffset << kShift));
+	const __m256i chromaRound = _mm256_set1_epi32(kChromaHalf + (128 << kChromaShift));
+	const __m256i inOrder = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7), planes = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i sumB[2], sumG[2], sumR[2];
+		for (int row = 0; row < 2; row++)
+		{
+			const uint8_t *s = (row ? s1 : s0) + 4 * x;
+			__m256i luma[2];
+			for (int i = 0; i < 2; i++)
+			{
+				__m256i p = _mm256_loadu_si256((const __m256i *)(s + 32 * i));
+				__m256i b = _mm256_and_si256(p, byte);
+				__m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 8), byte);
+				__m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 16), byte);
+				luma[i] = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(r, yR), _mm256_mullo_epi32(g, yG)),
+				                           _mm256_add_epi32(_mm256_mullo_epi32(b, yB), lumaRound));
+				luma[i] = _mm256_srai_epi32(luma[i], kShift);
+				sumB[i] = row ? _mm256_add_epi32(sumB[i], b) : b;
+				sumG[i] = row ? _mm256_add_epi32(sumG[i], g) : g;
+				sumR[i] = row ? _mm256_add_epi32(sumR[i], r) : r;
+			}
+			// 32 to 16 bits works within 128-bit lanes; put the halves back in order before 16 to 8
+			__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(luma[0], luma[1]), 0xD8);
+			_mm_storeu_si128((__m128i *)((row ? y1 : y0) + x), _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+		}
+
+		// Neighbouring pixels added leave the blocks in the order 0 1 4 5 2 3 6 7
+		__m256i sb = _mm256_hadd_epi32(sumB[0], sumB[1]), sg = _mm256_hadd_epi32(sumG[0], sumG[1]), sr = _mm256_hadd_epi32(sumR[0], sumR[1]);
+		__m256i outCb = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(sr, cbR), _mm256_mullo_epi32(sg, cbG)),
+		                                  _mm256_add_epi32(_mm256_mullo_epi32(sb, cbB), chromaRound));
+		__m256i outCr = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(sr, crR), _mm256_mullo_epi32(sg, crG)),
+		                                  _mm256_add_epi32(_mm256_mullo_epi32(sb, crB), chromaRound));
+		outCb = _mm256_permutevar8x32_epi32(_mm256_srai_epi32(outCb, kChromaShift), inOrder);
+		outCr = _mm256_permutevar8x32_epi32(_mm256_srai_epi32(outCr, kChromaShift), inOrder);
+
+		// Eight Cb bytes then eight Cr bytes
+		__m256i bytes = _mm256_packus_epi32(outCb, outCr);
+		bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(bytes, bytes), planes);
+		__m128i both = _mm256_castsi256_si128(bytes);
+		if ( chromaStep == 2 )
+		{
+			_mm_storeu_si128((__m128i *)(cb + x), _mm_unpacklo_epi8(both, _mm_srli_si128(both, 8)));
+		}
+		else
+		{
+			_mm_storel_epi64((__m128i *)(cb + x / 2), both);
+			_mm_storel_epi64((__m128i *)(cr + x / 2), _mm_srli_si128(both, 8));
+		}
+	}
+	return x;
+}
+
+#endif
+
+
+// Pairs of rows, each pair sharing a row of chroma. The vector kernels take as many
+// columns as they can, 16 at a time, and the plain C ones the rest.
+static void toBGRA(const uint8_t *yPlane, size_t yBytesPerRow, const uint8_t *cbPlane, size_t cbBytesPerRow,
+                   const uint8_t *crPlane, size_t crBytesPerRow, int chromaStep, int width, int height,
+                   const BGRAImage *dst, YUVMatrix matrix, YUVRange range)
+{
+	Coefficients k = coefficients(matrix, range);
+
+	for (int row = 0; row < height; row += 2)
+	{
+		const uint8_t *y0 = yPlane + row * yBytesPerRow;
+		const uint8_t *y1 = (row + 1 < height) ? y0 + yBytesPerRow : NULL;
+		const uint8_t *cb = cbPlane + row / 2 * cbBytesPerRow, *cr = crPlane + row / 2 * crBytesPerRow;
+		uint8_t *d0 = dst->base + row * dst->bytesPerRow;
+		uint8_t *d1 = y1 ? d0 + dst->bytesPerRow : NULL;
+		int x = 0;
+#if YUV_NEON || YUV_AVX2
+		if ( useSIMD && y1 )
+			x = toBGRAVector(y0, y1, cb, cr, chromaStep, d0, d1, width, &k);
+#endif
+		toBGRAScalar(y0, y1, cb, cr, chromaStep, d0, d1, x, width, &k);
+	}
+}
+
+static void fromBGRA(const BGRAImage *src, uint8_t *yPlane, size_t yBytesPerRow, uint8_t *cbPlane, size_t cbBytesPerRow,
+                     uint8_t *crPlane, size_t crBytesPerRow, int chromaStep, YUVMatrix matrix, YUVRange range)
+{
+	Coefficients k = coefficients(matrix, range);
+
+	for (int row = 0; row < src->height; row += 2)
+	{
+		const uint8_t *s0 = src->base + row * src->bytesPerRow;
+		const uint8_t *s1 = (row + 1 < src->height) ? s0 + src->bytesPerRow : NULL;
+		uint8_t *y0 = yPlane + row * yBytesPerRow;
+		uint8_t *y1 = s1 ? y0 + yBytesPerRow : NULL;
+		uint8_t *cb = cbPlane + row / 2 * cbBytesPerRow, *cr = crPlane + row / 2 * crBytesPerRow;
+		int x = 0;
+#if YUV_NEON || YUV_AVX2
+		if ( useSIMD && s1 )
+			x = fromBGRAVector(s0, s1, y0, y1, cb, cr, chromaStep, src->width, &k);
+#endif
+		fromBGRAScalar(s0, s1, y0, y1, cb, cr, chromaStep, x, src->width, &k);
+	}
+}
+
+
+void YUVConvertNV12ToBGRA(const NV12Image *src, const BGRAImage *dst, YUVMatrix matrix, YUVRange range)
+{
+	toBGRA(src->y, src->yBytesPerRow, src->cbcr, src->cbcrBytesPerRow, src->cbcr + 1, src->cbcrBytesPerRow, 2,
+	       src->width, src->height, dst, matrix, range);
+}
+
+void YUVConvertI420ToBGRA(const I420Image *src, const BGRAImage *dst, YUVMatrix matrix, YUVRange range)
+{
+	toBGRA(src->y, src->yBytesPerRow, src->cb, src->cbBytesPerRow, src->cr, src->crBytesPerRow, 1,
+	       src->width, src->height, dst, matrix, range);
+}
+
+void YUVConvertBGRAToNV12(const BGRAImage *src, const NV12Image *dst, YUVMatrix matrix, YUVRange range)
+{
+	fromBGRA(src, dst->y, dst->yBytesPerRow, dst->cbcr, dst->cbcrBytesPerRow, dst->cbcr + 1, dst->cbcrBytesPerRow, 2, matrix, range);
+}
+
+void YUVConvertBGRAToI420(const BGRAImage *src, const I420Image *dst, YUVMatrix matrix, YUVRange range)
+{
+	fromBGRA(src, dst->y, dst->yBytesPerRow, dst->cb, dst->cbBytesPerRow, dst->cr, dst->crBytesPerRow, 1, matrix, range);
+}
+
+const char *YUVConvertEngine(void)
+{
+#if YUV_NEON
+	return useSIMD ? "neon" : "scalar";
+#elif YUV_AVX2
+	return useSIMD ? "avx2" : "scalar";
+#else
+	return "scalar";
+#endif
+}
+
+void YUVConvertSetSIMD(int enable)
+{
+	useSIMD = enable;
+}
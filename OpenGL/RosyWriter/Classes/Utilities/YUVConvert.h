@@ -0,0 +1,82 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Conversion between 4:2:0 YCbCr frames, biplanar and planar, and 32-bit BGRA
+ */
+
+#ifndef RosyWriter_YUVConvert_h
+#define RosyWriter_YUVConvert_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "BGRAKernels.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// NV12 is the camera's and the encoder's own layout, '420v' (video range) and '420f'
+// (full range) in Core Video: a plane of Y, then a plane of Cb Cr pairs at half the
+// width and height. I420 keeps Cb and Cr in planes of their own. Fill the planes from a
+// locked CVPixelBuffer with CVPixelBufferGetBaseAddressOfPlane and
+// CVPixelBufferGetBytesPerRowOfPlane.
+//
+// Chroma is sited between each 2x2 block of luma, as the camera delivers it. Odd widths
+// and heights are allowed: the last chroma column or row covers one pixel, and on the
+// way to 4:2:0 that pixel stands in for the missing ones.
+//
+// The arithmetic is fixed point, with coefficients of 16 fractional bits: each is
+// round(c * 65536) of the exact value below, except that on the way to YCbCr the weights
+// for G are adjusted so that grays stay exactly gray. Results are rounded to nearest
+// and clamped, and are the same to the bit whether the NEON, AVX2 or plain C kernels do
+// the work. Against the exact formulas they are never more than 1 away.
+//
+//     R = Y' + 2 (1 - Kr) Cr'            Y' = (Y - 16) 255 / 219   video range
+//     G = Y' - 2 Kb (1 - Kb) / Kg Cb'          Y                   full range
+//            - 2 Kr (1 - Kr) / Kg Cr'    C' = (C - 128) 255 / 224  video range
+//     B = Y' + 2 (1 - Kb) Cb'                 C - 128              full range
+//
+// with Kr, Kb 0.299, 0.114 for BT.601 and 0.2126, 0.0722 for BT.709, Kg = 1 - Kr - Kb.
+// Alpha is 255 on the way to BGRA and ignored on the way back.
+
+typedef enum {
+	YUVMatrixBT601,		// standard definition
+	YUVMatrixBT709,		// high definition
+} YUVMatrix;
+
+typedef enum {
+	YUVRangeVideo,		// Y in [16..235], Cb and Cr in [16..240]
+	YUVRangeFull,		// everything in [0..255]
+} YUVRange;
+
+typedef struct {
+	int width, height;				// of the luma plane
+	uint8_t *y;
+	size_t yBytesPerRow;
+	uint8_t *cbcr;					// Cb Cr pairs
+	size_t cbcrBytesPerRow;
+} NV12Image;
+
+typedef struct {
+	int width, height;				// of the luma plane
+	uint8_t *y, *cb, *cr;
+	size_t yBytesPerRow, cbBytesPerRow, crBytesPerRow;
+} I420Image;
+
+// dst must be as large as src
+void YUVConvertNV12ToBGRA(const NV12Image *src, const BGRAImage *dst, YUVMatrix matrix, YUVRange range);
+void YUVConvertI420ToBGRA(const I420Image *src, const BGRAImage *dst, YUVMatrix matrix, YUVRange range);
+void YUVConvertBGRAToNV12(const BGRAImage *src, const NV12Image *dst, YUVMatrix matrix, YUVRange range);
+void YUVConvertBGRAToI420(const BGRAImage *src, const I420Image *dst, YUVMatrix matrix, YUVRange range);
+
+// Which kernels are in use: "neon", "avx2" or "scalar". YUVConvertSetSIMD(0) forces the
+// plain C kernels, for testing them against the vector ones.
+const char *YUVConvertEngine(void);
+void YUVConvertSetSIMD(int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Checks FramePool and measures recycled frames against a fresh allocation for every frame
+ */
+
+//
+//  The checks cover alignment and row padding, the allocation threshold, reference
+//  counts, reuse order, storage callbacks, frames held by a wrapper that gives them
+//  back from its release callback, flushing, destroying a pool whose frames are still
+//  out, and threads acquiring and releasing at once.
+//
+//  Then a capture of 1000 frames is simulated at 1080p and 4K, with a render stage
+//  writing every frame, a preview that keeps the latest, and a recorder that keeps up
+//  to three. It runs once with frames from a pool and once with malloc and free per
+//  frame, and reports ms a frame, heap allocations after the first second and the
+//  high-water marks.
+//
+//  Build from this directory with:
+//
+//      cc -std=c99 -D_POSIX_C_SOURCE=200809L -O3 -pthread -I../Classes/Utilities framepool_bench.c ../Classes/Utilities/FramePool.c -o framepool_bench
+//
+//  and run with no arguments.
+//
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FramePool.h"
+
+static int failures;
+
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check( int bOK, const char *what )
+{
+	printf( "%s  %s\n", bOK ? "pass" : "FAIL", what );
+	if ( ! bOK )
+		failures++;
+}
+
+// Storage whose objects are plain memory, counted as they are made and freed
+typedef struct {
+	int created, destroyed;
+} FakeStorage;
+
+static int fakeCreate( void *context, Frame *frame )
+{
+	frame->base = malloc( frame->bytesPerRow * frame->height );
+	frame->object = frame->base;
+	((FakeStorage *)context)->created++;
+	return frame->base ? 0 : -1;
+}
+
+static void fakeDestroy( void *context, Frame *frame )
+{
+	free( frame->object );
+	((FakeStorage *)context)->destroyed++;
+}
+
+// A reference-counted wrapper over a frame's memory with a release callback, standing in
+// for the pixel buffer FrameCreatePixelBuffer makes with CVPixelBufferCreateWithBytes
+typedef struct {
+	int references;
+	void (*releaseCallback)( void *releaseRefCon, const void *baseAddress );
+	void *releaseRefCon;
+	const void *baseAddress;
+} FakeBuffer;
+
+static void fakeBufferReleased( void *releaseRefCon, const void *baseAddress )
+{
+	(void)baseAddress;
+	FrameRelease( releaseRefCon );
+}
+
+static FakeBuffer *fakeWrap( Frame *frame )
+{
+	FakeBuffer *buffer = malloc( sizeof(FakeBuffer) );
+	buffer->references = 1;
+	buffer->releaseCallback = fakeBufferReleased;
+	buffer->releaseRefCon = FrameRetain( frame );
+	buffer->baseAddress = frame->base;
+	return buffer;
+}
+
+static void fakeRelease( FakeBuffer *buffer )
+{
+	if ( --buffer->references == 0 )
+	{
+		buffer->releaseCallback( buffer->releaseRefCon, buffer->baseAddress );
+		free( buffer );
+	}
+}
+
+static void checkBasics( void )
+{
+	FramePool *pool = FramePoolCreate( 1024, 8, 4, 2, 4, NULL );
+	Frame *frames[5];
+	FramePoolStatistics stats;
+	int bOK;
+
+	bOK = 1;
+	for ( int i = 0; i < 4; i++ )
+	{
+		bOK = bOK && FramePoolAcquire( pool, &frames[i] ) == FramePoolSuccess;
+		bOK = bOK && ((uintptr_t)frames[i]->base & 63) == 0 && frames[i]->bytesPerRow % 64 == 0 && frames[i]->bytesPerRow % 4096 != 0;
+		bOK = bOK && frames[i]->bytesPerRow >= 4096 && frames[i]->width == 1024 && frames[i]->height == 8;
+	}
+	check( bOK, "64-byte aligned frames, rows padded off a multiple of 4096" );
+
+	bOK = FramePoolAcquire( pool, &frames[4] ) == FramePoolWouldExceedAllocationThreshold && frames[4] == NULL;
+	FramePoolGetStatistics( pool, &stats );
+	check( bOK && stats.thresholdMisses == 1 && stats.inUse == 4 && stats.frames == 4 && stats.allocations == 2,
+	       "allocation threshold: the fifth acquire fails, two frames made past the minimum" );
+
+	FrameRetain( frames[1] );
+	FrameRelease( frames[1] );
+	bOK = FramePoolAcquire( pool, &frames[4] ) != FramePoolSuccess;
+	FrameRelease( frames[1] );
+	bOK = bOK && FramePoolAcquire( pool, &frames[4] ) == FramePoolSuccess && frames[4] == frames[1];
+	check( bOK, "a retained frame comes back on its last release, and is reused first" );
+
+	FrameRelease( frames[0] );
+	FrameRelease( frames[2] );
+	FrameRelease( frames[3] );
+	FrameRelease( frames[4] );
+	FramePoolFlush( pool );
+	FramePoolGetStatistics( pool, &stats );
+	check( stats.frames == 2 && stats.inUse == 0 && stats.framesHighWater == 4 && stats.inUseHighWater == 4 &&
+	       stats.bytesHighWater == 4 * stats.bytes / 2,
+	       "flush frees down to the minimum; high-water marks stay" );
+	FramePoolResetHighWater( pool );
+	FramePoolGetStatistics( pool, &stats );
+	check( stats.framesHighWater == 2 && stats.inUseHighWater == 0, "high-water marks reset to now" );
+	FramePoolDestroy( pool );
+}
+
+static void checkReleaseCallback( void )
+{
+	FakeStorage counts = { 0, 0 };
+	FrameStorage storage = { fakeCreate, fakeDestroy, &counts };
+	FramePool *pool = FramePoolCreate( 64, 64, 4, 0, 2, &storage );
+	Frame *a, *b, *c;
+	FakeBuffer *downstream;
+	int bOK;
+
+	// Wrap a and let go of it, with the wrapper held downstream, as the pipeline holds
+	// a rendered pixel buffer
+	FramePoolAcquire( pool, &a );
+	downstream = fakeWrap( a );
+	FrameRelease( a );
+	downstream->references++;
+	FramePoolAcquire( pool, &b );
+	bOK = FramePoolAcquire( pool, &c ) == FramePoolWouldExceedAllocationThreshold;
+	fakeRelease( downstream );
+	bOK = bOK && FramePoolAcquire( pool, &c ) == FramePoolWouldExceedAllocationThreshold;
+	fakeRelease( downstream );
+	bOK = bOK && FramePoolAcquire( pool, &c ) == FramePoolSuccess && c == a;
+	check( bOK, "a wrapped frame comes back when the wrapper's last release calls back, not before" );
+
+	// Destroyed with frames out: the pool goes with the last of them, wrapped ones included
+	downstream = fakeWrap( c );
+	FrameRelease( c );
+	FramePoolDestroy( pool );
+	bOK = counts.destroyed == 0;
+	FrameRelease( b );
+	bOK = bOK && counts.destroyed == 0;
+	fakeRelease( downstream );
+	bOK = bOK && counts.destroyed == 2 && counts.created == 2;
+	check( bOK, "destroyed with frames out, the pool lasts until the last is released" );
+}
+
+typedef struct {
+	FramePool *pool;
+	int iterations;
+	int failures;
+} StressArgs;
+
+static void *stress( void *arg )
+{
+	StressArgs *args = arg;
+	unsigned seed = (unsigned)(uintptr_t)arg;
+	Frame *held[4] = { NULL, NULL, NULL, NULL };
+
+	for ( int i = 0; i < args->iterations; i++ )
+	{
+		int k = rand_r( &seed ) % 4;
+		if ( held[k] )
+		{
+			FrameRelease( held[k] );
+			held[k] = NULL;
+		}
+		else if ( FramePoolAcquire( args->pool, &held[k] ) == FramePoolSuccess )
+		{
+			// Each holder writes its own frame; another thread's mark here means it was handed out twice
+			memset( held[k]->base, k + 1, 64 );
+			FrameRetain( held[k] );
+			if ( held[k]->base[0] != k + 1 || held[k]->base[63] != k + 1 )
+				args->failures++;
+			FrameRelease( held[k] );
+		}
+	}
+	for ( int k = 0; k < 4; k++ )
+		FrameRelease( held[k] );
+	return NULL;
+}
+
+static void checkThreads( void )
+{
+	FramePool *pool = FramePoolCreate( 16, 16, 4, 0, 12, NULL );
+	pthread_t threads[4];
+	StressArgs args[4];
+	FramePoolStatistics stats;
+	int bOK = 1;
+
+	for ( int t = 0; t < 4; t++ )
+	{
+		args[t].pool = pool;
+		args[t].iterations = 200000;
+		args[t].failures = 0;
+		pthread_create( &threads[t], NULL, stress, &args[t] );
+	}
+	for ( int t = 0; t < 4; t++ )
+	{
+		pthread_join( threads[t], NULL );
+		bOK = bOK && args[t].failures == 0;
+	}
+	FramePoolGetStatistics( pool, &stats );
+	check( bOK && stats.inUse == 0 && stats.frames <= 12 && stats.inUseHighWater <= 12,
+	       "4 threads acquiring and releasing: every frame back, threshold kept" );
+	FramePoolDestroy( pool );
+}
+
+// The capture pipeline: render writes each frame, preview keeps the latest, the recorder the last three
+typedef struct {
+	FramePool *pool;			// NULL for malloc and free
+	Frame *preview, *recorder[3];
+	uint8_t *mallocRecorder[3];
+	size_t bytes;
+	long heapAllocations;
+} Pipeline;
+
+static void pipelineFrame( Pipeline *p, int n )
+{
+	if ( p->pool )
+	{
+		Frame *frame;
+		if ( FramePoolAcquire( p->pool, &frame ) != FramePoolSuccess )
+			return;
+		memset( frame->base, n, p->bytes );
+		FrameRelease( p->preview );
+		p->preview = FrameRetain( frame );
+		FrameRelease( p->recorder[n % 3] );
+		p->recorder[n % 3] = frame;
+	}
+	else
+	{
+		// The newest frame is the preview's and the recorder's; the one the recorder lets go is freed
+		uint8_t *frame = malloc( p->bytes );
+		p->heapAllocations++;
+		memset( frame, n, p->bytes );
+		free( p->mallocRecorder[n % 3] );
+		p->mallocRecorder[n % 3] = frame;
+	}
+}
+
+static void timeCapture( int width, int height )
+{
+	Pipeline pooled = { FramePoolCreate( width, height, 4, 6, 6, NULL ), NULL, { NULL }, { NULL }, 0, 0 };
+	Pipeline heap = { NULL, NULL, { NULL }, { NULL }, 0, 0 };
+	FramePoolStatistics stats, warm;
+	double start, pooledMs, heapMs;
+
+	pooled.bytes = heap.bytes = (size_t)width * 4 * height;
+	for ( int n = 0; n < 30; n++ )
+		pipelineFrame( &pooled, n );
+	FramePoolGetStatistics( pooled.pool, &warm );
+	start = now();
+	for ( int n = 30; n < 1000; n++ )
+		pipelineFrame( &pooled, n );
+	pooledMs = 1000 * (now() - start) / 970;
+	FramePoolGetStatistics( pooled.pool, &stats );
+
+	for ( int n = 0; n < 30; n++ )
+		pipelineFrame( &heap, n );
+	heap.heapAllocations = 0;
+	start = now();
+	for ( int n = 30; n < 1000; n++ )
+		pipelineFrame( &heap, n );
+	heapMs = 1000 * (now() - start) / 970;
+
+	printf( "%dx%d capture, 1000 frames:\n", width, height );
+	printf( "  pool         %6.2f ms a frame  %ld frames allocated after the first 30  %d in use at most, %d frames, %.1f MB\n",
+	        pooledMs, (long)(stats.allocations - warm.allocations), stats.inUseHighWater, stats.framesHighWater, stats.bytesHighWater / 1048576.0 );
+	printf( "  malloc/free  %6.2f ms a frame  %ld frames allocated after the first 30\n", heapMs, heap.heapAllocations );
+	check( stats.allocations == warm.allocations && stats.thresholdMisses == 0, "steady-state capture makes no allocations and drops no frames" );
+
+	FrameRelease( pooled.preview );
+	for ( int i = 0; i < 3; i++ )
+	{
+		FrameRelease( pooled.recorder[i] );
+		free( heap.mallocRecorder[i] );
+	}
+	FramePoolDestroy( pooled.pool );
+}
+
+int main( void )
+{
+	checkBasics();
+	checkReleaseCallback();
+	checkThreads();
+	timeCapture( 1920, 1080 );
+	timeCapture( 3840, 2160 );
+	printf( "%s\n", failures == 0 ? "all passed" : "FAILED" );
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Checks FrameQueue's drop policies and hand-offs, and shows the latency of a stage that falls behind
+ */
+
+//
+//  The checks cover each policy on a full queue, the block timeout, flushing a queue a
+//  producer is blocked on, and then a producer and a consumer thread passing 200000
+//  frames under each policy: every frame must be consumed or released exactly once,
+//  consumed ones in order, and the consumer must be started once for each time it
+//  stopped.
+//
+//  Then a camera at 1000 frames a second feeds a stage that needs 1.5 ms a frame, once
+//  through a queue that keeps everything, as a dispatch queue does, and once through a
+//  bounded queue of 2 under each policy. It reports the latency from capture to the end
+//  of the stage and which frames were lost.
+//
+//  Build from this directory with:
+//
+//      cc -std=c99 -D_POSIX_C_SOURCE=200809L -O3 -pthread -I../Classes/Utilities framequeue_bench.c ../Classes/Utilities/FrameQueue.c -o framequeue_bench
+//
+//  and run with no arguments.
+//
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FrameQueue.h"
+
+#define kMs 1000000ull
+
+static int failures;
+
+static uint64_t now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleepNanoseconds( uint64_t nanoseconds )
+{
+	struct timespec ts = { (time_t)( nanoseconds / 1000000000ull ), (long)( nanoseconds % 1000000000ull ) };
+	nanosleep( &ts, NULL );
+}
+
+// Sleeps most of the way, as a stage waiting on the GPU or the encoder would, so that the
+// threads share a single core fairly
+static void waitUntil( uint64_t time )
+{
+	uint64_t t = now();
+	if ( t + 100000 < time )
+		sleepNanoseconds( time - t - 100000 );
+	while ( now() < time )
+		;
+}
+
+static void check( int bOK, const char *what )
+{
+	printf( "%s  %s\n", bOK ? "pass" : "FAIL", what );
+	if ( ! bOK )
+		failures++;
+}
+
+// Objects are 1 + indexes into a table of how often each was released, as NULL is never released
+typedef struct {
+	int *released;
+} Releases;
+
+static void releaseObject( void *context, void *object )
+{
+	__atomic_fetch_add( &((Releases *)context)->released[(intptr_t)object - 1], 1, __ATOMIC_RELAXED );
+}
+
+static FrameQueueItem item( int64_t n )
+{
+	FrameQueueItem i = { (void *)(intptr_t)( n + 1 ), n };
+	return i;
+}
+
+static void checkPolicies( void )
+{
+	int released[16] = { 0 };
+	Releases releases = { released };
+	FrameQueue *queue = FrameQueueCreate( 3, FrameQueueDropOldest, 0, releaseObject, &releases );
+	FrameQueueStatistics stats;
+	FrameQueueItem popped;
+	int start, starts = 0, bOK;
+	uint64_t t;
+
+	for ( int n = 1; n <= 5; n++ )
+	{
+		FrameQueuePush( queue, item( n ), &start );
+		starts += start;
+	}
+	FrameQueueGetStatistics( queue, &stats );
+	bOK = FrameQueuePop( queue, &popped ) && popped.frame == 3 && released[1] == 1 && released[2] == 1;
+	check( bOK && stats.droppedOldest == 2 && stats.depth == 3 && starts == 1,
+	       "drop oldest: the two oldest released, the consumer started once" );
+
+	FrameQueueSetPolicy( queue, FrameQueueDropNewest, 0 );
+	bOK = FrameQueuePush( queue, item( 6 ), &start ) && start == 0;
+	bOK = bOK && ! FrameQueuePush( queue, item( 7 ), &start ) && released[7] == 1;
+	bOK = bOK && FrameQueuePop( queue, &popped ) && popped.frame == 4;
+	check( bOK, "drop newest: the arriving frame released, the queue as it was" );
+
+	FrameQueueSetPolicy( queue, FrameQueueBlock, 20 * kMs );
+	FrameQueuePush( queue, item( 8 ), &start );
+	t = now();
+	bOK = ! FrameQueuePush( queue, item( 9 ), &start ) && released[9] == 1;
+	t = now() - t;
+	FrameQueueGetStatistics( queue, &stats );
+	check( bOK && t >= 20 * kMs && t < 200 * kMs && stats.blocks == 1 && stats.droppedNewest == 2,
+	       "block: waits out the timeout, then drops the arriving frame" );
+
+	bOK = FrameQueueConsumerDone( queue ) == 0;
+	while ( FrameQueuePop( queue, &popped ) )
+		;
+	bOK = bOK && FrameQueueConsumerDone( queue ) == 1;
+	FrameQueuePush( queue, item( 10 ), &start );
+	check( bOK && start == 1, "a consumer that finds frames left goes on; one that stopped is started again" );
+
+	FrameQueuePush( queue, item( 11 ), &start );
+	FrameQueuePush( queue, item( 12 ), &start );
+	FrameQueueResetStatistics( queue );
+	FrameQueueDestroy( queue );
+	bOK = 1;
+	for ( int n = 10; n <= 12; n++ )
+		bOK = bOK && released[n] == 1;
+	check( bOK, "destroy releases what is queued" );
+}
+
+typedef struct {
+	FrameQueue *queue;
+	int64_t frames;
+	int *released;
+	int *consumed;
+	int outOfOrder;
+	int scheduled;              // the stand-in for a dispatch_async to the consumer's queue
+	int finished;
+	int starts, drains;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	uint64_t consumeNanoseconds;
+} Handoff;
+
+static void *consumer( void *arg )
+{
+	Handoff *h = arg;
+	int64_t last = -1;
+
+	for ( ;; )
+	{
+		FrameQueueItem popped;
+
+		pthread_mutex_lock( &h->lock );
+		while ( ! h->scheduled && ! h->finished )
+			pthread_cond_wait( &h->wake, &h->lock );
+		if ( ! h->scheduled && h->finished )
+		{
+			pthread_mutex_unlock( &h->lock );
+			break;
+		}
+		h->scheduled--;
+		pthread_mutex_unlock( &h->lock );
+
+		h->drains++;
+		do {
+			while ( FrameQueuePop( h->queue, &popped ) )
+			{
+				if ( popped.frame <= last )
+					h->outOfOrder++;
+				last = popped.frame;
+				h->consumed[popped.frame]++;
+				if ( h->consumeNanoseconds )
+					waitUntil( now() + h->consumeNanoseconds );
+			}
+		} while ( ! FrameQueueConsumerDone( h->queue ) );
+	}
+	return NULL;
+}
+
+static void checkHandoff( FrameQueuePolicy policy, const char *name )
+{
+	Handoff h;
+	pthread_t thread;
+	Releases releases;
+	FrameQueueStatistics stats;
+	int bOK = 1;
+	char what[128];
+
+	memset( &h, 0, sizeof(h) );
+	h.frames = 200000;
+	h.released = calloc( h.frames, sizeof(int) );
+	h.consumed = calloc( h.frames, sizeof(int) );
+	releases.released = h.released;
+	h.queue = FrameQueueCreate( 4, policy, 0, releaseObject, &releases );
+	pthread_mutex_init( &h.lock, NULL );
+	pthread_cond_init( &h.wake, NULL );
+	pthread_create( &thread, NULL, consumer, &h );
+
+	for ( int64_t n = 0; n < h.frames; n++ )
+	{
+		int start;
+		if ( FrameQueuePush( h.queue, item( n ), &start ) && start )
+		{
+			pthread_mutex_lock( &h.lock );
+			h.scheduled++;
+			h.starts++;
+			pthread_cond_signal( &h.wake );
+			pthread_mutex_unlock( &h.lock );
+		}
+	}
+	pthread_mutex_lock( &h.lock );
+	h.finished = 1;
+	pthread_cond_signal( &h.wake );
+	pthread_mutex_unlock( &h.lock );
+	pthread_join( thread, NULL );
+
+	FrameQueueGetStatistics( h.queue, &stats );
+	for ( int64_t n = 0; n < h.frames; n++ )
+		bOK = bOK && h.consumed[n] + h.released[n] == 1;
+	bOK = bOK && h.outOfOrder == 0 && stats.depth == 0 && h.starts == h.drains;
+	bOK = bOK && stats.popped + stats.droppedOldest + stats.droppedNewest == (uint64_t)h.frames;
+	snprintf( what, sizeof(what), "%s, two threads: every frame consumed or released once, in order (%llu dropped, %d starts)",
+	          name, (unsigned long long)( stats.droppedOldest + stats.droppedNewest ), h.starts );
+	check( bOK, what );
+
+	FrameQueueDestroy( h.queue );
+	free( h.released );
+	free( h.consumed );
+}
+
+// Flushing wakes a producer blocked on a full queue
+static void *blockedProducer( void *arg )
+{
+	int start;
+	return (void *)(intptr_t)FrameQueuePush( arg, item( 3 ), &start );
+}
+
+static void checkFlushWakes( void )
+{
+	int released[4] = { 0 };
+	Releases releases = { released };
+	FrameQueue *queue = FrameQueueCreate( 2, FrameQueueBlock, 0, releaseObject, &releases );
+	pthread_t thread;
+	void *queued;
+	int start;
+
+	FrameQueuePush( queue, item( 1 ), &start );
+	FrameQueuePush( queue, item( 2 ), &start );
+	pthread_create( &thread, NULL, blockedProducer, queue );
+	sleepNanoseconds( 20 * kMs );
+	FrameQueueFlush( queue );
+	pthread_join( thread, &queued );
+	check( queued == (void *)1 && released[1] == 1 && released[2] == 1 && FrameQueueDepth( queue ) == 1,
+	       "a flush makes room for a blocked producer" );
+	FrameQueueDestroy( queue );
+}
+
+// A camera at a fixed rate into a stage that cannot keep up
+typedef struct {
+	FrameQueue *queue;
+	uint64_t *captured;
+	uint64_t period, service;
+	int frames;
+	int done;
+	uint64_t maxLatency, sumLatency;
+	int consumed;
+	int64_t lastFrame;
+	int longestGap;             // of frames lost in a row
+} Overload;
+
+static void *overloadedStage( void *arg )
+{
+	Overload *o = arg;
+	FrameQueueItem popped;
+
+	o->lastFrame = -1;
+	while ( ! __atomic_load_n( &o->done, __ATOMIC_ACQUIRE ) || FrameQueueDepth( o->queue ) )
+	{
+		if ( ! FrameQueuePop( o->queue, &popped ) )
+		{
+			sleepNanoseconds( 50000 );
+			continue;
+		}
+		waitUntil( now() + o->service );
+		uint64_t latency = now() - o->captured[popped.frame];
+		if ( latency > o->maxLatency )
+			o->maxLatency = latency;
+		o->sumLatency += latency;
+		o->consumed++;
+		if ( popped.frame - o->lastFrame - 1 > o->longestGap )
+			o->longestGap = (int)( popped.frame - o->lastFrame - 1 );
+		o->lastFrame = popped.frame;
+	}
+	return NULL;
+}
+
+static void timeOverload( int capacity, FrameQueuePolicy policy, uint64_t blockTimeout, const char *name )
+{
+	Overload o;
+	pthread_t thread;
+	FrameQueueStatistics stats;
+	uint64_t start;
+
+	memset( &o, 0, sizeof(o) );
+	o.frames = 2000;
+	o.period = 1 * kMs;
+	o.service = 3 * kMs / 2;
+	o.captured = calloc( o.frames, sizeof(uint64_t) );
+	o.queue = FrameQueueCreate( capacity, policy, blockTimeout, NULL, NULL );
+	pthread_create( &thread, NULL, overloadedStage, &o );
+
+	start = now();
+	for ( int n = 0; n < o.frames; n++ )
+	{
+		int startConsumer;
+		waitUntil( start + n * o.period );
+		o.captured[n] = now();
+		FrameQueuePush( o.queue, item( n ), &startConsumer );
+	}
+	__atomic_store_n( &o.done, 1, __ATOMIC_RELEASE );
+	pthread_join( thread, NULL );
+	FrameQueueGetStatistics( o.queue, &stats );
+
+	printf( "  %-26s latency mean %7.1f ms  max %7.1f ms   %4d of %d frames lost, %llu blocks, at most %d in a row\n",
+	        name, o.sumLatency / (double)o.consumed / kMs, o.maxLatency / (double)kMs, o.frames - o.consumed, o.frames,
+	        (unsigned long long)stats.blocks, o.longestGap );
+	FrameQueueDestroy( o.queue );
+	free( o.captured );
+}
+
+int main( void )
+{
+	checkPolicies();
+	checkFlushWakes();
+	checkHandoff( FrameQueueDropOldest, "drop oldest" );
+	checkHandoff( FrameQueueDropNewest, "drop newest" );
+	checkHandoff( FrameQueueBlock, "block" );
+
+	printf( "1000 frames a second into a stage needing 1.5 ms a frame:\n" );
+	timeOverload( 1 << 20, FrameQueueDropNewest, 0, "unbounded" );
+	timeOverload( 2, FrameQueueDropOldest, 0, "2, drop oldest" );
+	timeOverload( 2, FrameQueueDropNewest, 0, "2, drop newest" );
+	timeOverload( 2, FrameQueueBlock, 1 * kMs, "2, block up to 1 ms" );
+
+	printf( "%s\n", failures == 0 ? "all passed" : "FAILED" );
+	return failures == 0 ? 0 : 1;
+}
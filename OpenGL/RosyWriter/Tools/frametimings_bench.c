@@ -0,0 +1,245 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Checks FrameTimings against exact statistics and measures the cost of a stamp
+ */
+
+//
+//  The checks record random latencies, from nanoseconds to seconds, and compare the
+//  histogram's percentiles with the sorted values; then a simulated 30 fps capture with
+//  known stage latencies checks the frame rate, the per-stage steps and totals, late
+//  stamps and the dumps.
+//
+//  Then the time of a stamp is measured from one thread, and from three at once as the
+//  video data output, main and movie writing queues stamp in the app.
+//
+//  Build from this directory with:
+//
+//      cc -std=c99 -D_POSIX_C_SOURCE=200809L -O3 -pthread -I../Classes/Utilities frametimings_bench.c ../Classes/Utilities/FrameTimings.c -lm -o frametimings_bench
+//
+//  and run with no arguments; give a directory to also leave the dumps there.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FrameTimings.h"
+
+#define kMs 1000000ull
+
+static int failures;
+
+static void check( int bOK, const char *what )
+{
+	printf( "%s  %s\n", bOK ? "pass" : "FAIL", what );
+	if ( ! bOK )
+		failures++;
+}
+
+static int compareValues( const void *a, const void *b )
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return ( x > y ) - ( x < y );
+}
+
+static uint64_t nextRandom( uint64_t *state )
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// The histograms of a stage see every value stamped for it, so feed one through Rendered's step
+static void checkPercentiles( void )
+{
+	enum { kCount = 200000 };
+	FrameTimings *timings = FrameTimingsCreate( 4 );
+	uint64_t *values = malloc( kCount * sizeof(uint64_t) );
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	const double percentiles[] = { 0, 1, 25, 50, 90, 99, 99.9, 99.99, 100 };
+	double worst = 0;
+	FrameTimingsSummary summary;
+	double sum = 0;
+
+	for ( int i = 0; i < kCount; i++ )
+	{
+		// Log-uniform from 1 ns to about 4 s
+		int bits = (int)( nextRandom( &state ) % 32 );
+		uint64_t value = ( nextRandom( &state ) & ( ( 1ull << bits ) - 1 ) ) | ( 1ull << bits );
+		int64_t frame = FrameTimingsBeginFrame( timings, 1000 );
+
+		FrameTimingsStamp( timings, frame, FrameStageDelivered, 1000 );
+		FrameTimingsStamp( timings, frame, FrameStageRendered, 1000 + value );
+		values[i] = value;
+		sum += value;
+	}
+	qsort( values, kCount, sizeof(uint64_t), compareValues );
+
+	for ( size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++ )
+	{
+		size_t rank = (size_t)ceil( percentiles[p] / 100 * kCount );
+		uint64_t exact = values[rank ? rank - 1 : 0];
+		uint64_t value = FrameTimingsValueAtPercentile( timings, FrameStageRendered, FrameSpanStep, percentiles[p] );
+		double error = fabs( (double)value - (double)exact ) / exact;
+		if ( error > worst )
+			worst = error;
+	}
+	printf( "      worst percentile error %.3f%%\n", 100 * worst );
+	check( worst <= 1.0 / 64, "percentiles within 1/64 of the sorted values, 1 ns to 4 s" );
+
+	FrameTimingsGetSummary( timings, FrameStageRendered, FrameSpanStep, &summary );
+	check( summary.count == kCount && summary.minimum == values[0] && summary.maximum == values[kCount - 1] &&
+	       fabs( summary.mean - sum / kCount ) < 1e-6 * summary.mean,
+	       "count, minimum, maximum and mean exact" );
+	FrameTimingsDestroy( timings );
+	free( values );
+}
+
+// 30 fps with each stage a known time after the one before; every fourth preview is dropped
+static void checkCapture( const char *directory )
+{
+	FrameTimings *timings = FrameTimingsCreate( 64 );
+	const uint64_t interval = 1000000000ull / 30;
+	uint64_t start = 5000 * kMs;
+	FrameTimingsSummary summary;
+	int64_t frame = 0, firstFrame = 0;
+	int bOK;
+
+	for ( int n = 0; n < 300; n++ )
+	{
+		uint64_t captured = start + n * interval;
+
+		frame = FrameTimingsBeginFrame( timings, captured );
+		if ( n == 0 )
+			firstFrame = frame;
+		FrameTimingsStamp( timings, frame, FrameStageDelivered, captured + 4 * kMs );
+		FrameTimingsStamp( timings, frame, FrameStageRendered, captured + 10 * kMs );
+		if ( n % 4 != 3 )
+			FrameTimingsStamp( timings, frame, FrameStageDisplayed, captured + 22 * kMs );
+		FrameTimingsStamp( timings, frame, FrameStageEnqueued, captured + 11 * kMs );
+		FrameTimingsStamp( timings, frame, FrameStageWritten, captured + 40 * kMs );
+	}
+	check( fabsf( FrameTimingsFramesPerSecond( timings ) - 30.0f ) < 0.01f, "30 fps from the ring" );
+
+	FrameTimingsGetSummary( timings, FrameStageCaptured, FrameSpanStep, &summary );
+	bOK = summary.count == 299 && summary.minimum == interval && summary.maximum == interval;
+	FrameTimingsGetSummary( timings, FrameStageRendered, FrameSpanStep, &summary );
+	bOK = bOK && summary.count == 300 && summary.p50 >= 6 * kMs && summary.p50 <= 6 * kMs * 65 / 64;
+	FrameTimingsGetSummary( timings, FrameStageDisplayed, FrameSpanStep, &summary );
+	bOK = bOK && summary.count == 225 && summary.maximum == 12 * kMs;
+	FrameTimingsGetSummary( timings, FrameStageWritten, FrameSpanStep, &summary );
+	bOK = bOK && summary.maximum == 29 * kMs;
+	FrameTimingsGetSummary( timings, FrameStageWritten, FrameSpanTotal, &summary );
+	bOK = bOK && summary.count == 300 && summary.minimum == 40 * kMs;
+	check( bOK, "frame interval, steps from the stage before and totals from capture" );
+
+	FrameTimingsStamp( timings, firstFrame, FrameStageDisplayed, 0 );
+	FrameTimingsStamp( timings, frame, FrameStageDisplayed, start + 299 * interval + 50 * kMs );
+	FrameTimingsGetSummary( timings, FrameStageDisplayed, FrameSpanStep, &summary );
+	check( FrameTimingsLateStamps( timings ) == 1 && summary.count == 226, "a stamp for a frame gone from the ring is late" );
+
+	if ( directory )
+	{
+		char path[1024];
+		FILE *file;
+
+		snprintf( path, sizeof(path), "%s/frames.csv", directory );
+		if ( ( file = fopen( path, "w" ) ) )
+		{
+			FrameTimingsWriteFrames( timings, file );
+			fclose( file );
+		}
+		snprintf( path, sizeof(path), "%s/written.hgrm", directory );
+		if ( ( file = fopen( path, "w" ) ) )
+		{
+			FrameTimingsWritePercentiles( timings, FrameStageWritten, FrameSpanTotal, file );
+			fclose( file );
+		}
+	}
+
+	{
+		char *text = NULL;
+		size_t length = 0;
+		FILE *file = open_memstream( &text, &length );
+		int lines = 0;
+
+		FrameTimingsWriteFrames( timings, file );
+		fclose( file );
+		for ( size_t i = 0; i < length; i++ )
+			lines += text[i] == '\n';
+		check( lines == 65 && strstr( text, "frame,captured,delivered" ) == text && strstr( text, ",0,4000000,10000000," ),
+		       "frames dump: a header and the 64 frames in the ring" );
+		free( text );
+	}
+
+	FrameTimingsWriteSummary( timings, stdout );
+
+	FrameTimingsReset( timings );
+	FrameTimingsStamp( timings, frame, FrameStageWritten, 0 );
+	FrameTimingsGetSummary( timings, FrameStageWritten, FrameSpanStep, &summary );
+	check( summary.count == 0 && FrameTimingsLateStamps( timings ) == 1 && FrameTimingsFramesPerSecond( timings ) == 0,
+	       "reset empties the histograms; stamps for frames from before it are late" );
+	FrameTimingsDestroy( timings );
+}
+
+typedef struct {
+	FrameTimings *timings;
+	FrameStage stage;
+	int stamps;
+	volatile int64_t *frame;
+} StamperArgs;
+
+static void *stamper( void *arg )
+{
+	StamperArgs *args = arg;
+
+	for ( int i = 0; i < args->stamps; i++ )
+		FrameTimingsStamp( args->timings, *args->frame, args->stage, 0 );
+	return NULL;
+}
+
+static void timeStamps( void )
+{
+	enum { kStamps = 1000000 };
+	FrameTimings *timings = FrameTimingsCreate( 0 );
+	volatile int64_t frame = FrameTimingsBeginFrame( timings, 0 );
+	StamperArgs args[3];
+	pthread_t threads[3];
+	uint64_t start;
+	double single, contended;
+
+	start = FrameTimingsNow();
+	for ( int i = 0; i < kStamps; i++ )
+		FrameTimingsStamp( timings, frame, FrameStageRendered, 0 );
+	single = (double)( FrameTimingsNow() - start ) / kStamps;
+
+	start = FrameTimingsNow();
+	for ( int t = 0; t < 3; t++ )
+	{
+		args[t].timings = timings;
+		args[t].stage = (FrameStage)( FrameStageRendered + t );
+		args[t].stamps = kStamps;
+		args[t].frame = &frame;
+		pthread_create( &threads[t], NULL, stamper, &args[t] );
+	}
+	for ( int t = 0; t < 3; t++ )
+		pthread_join( threads[t], NULL );
+	contended = (double)( FrameTimingsNow() - start ) / ( 3.0 * kStamps );
+
+	printf( "stamp: %.1f ns from one thread, %.1f ns each from three at once\n", single, contended );
+	FrameTimingsDestroy( timings );
+}
+
+int main( int argc, char *argv[] )
+{
+	checkPercentiles();
+	checkCapture( argc > 1 ? argv[1] : NULL );
+	timeStamps();
+	printf( "%s\n", failures == 0 ? "all passed" : "FAILED" );
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Checks TileScheduler and measures how its kernels scale from one core to all of them
+ */
+
+//
+//  Three kernels are run over frames split by TileScheduler: the CPU renderer's
+//  de-green, in place; a 3x3 box filter, which reads a halo of one pixel around each
+//  tile; and saturation from the CPU port of GLImageProcessing's Imaging.c. Each must
+//  give the same bytes as one serial pass over the whole frame, and every pixel must
+//  be written by exactly one tile, with more threads than cores so that tiles are
+//  stolen. Then each is timed at 1080p and 4K with 1, 2, ... N threads, N the
+//  number of cores, in Mpixel/s.
+//
+//  Build from this directory with:
+//
+//      cc -std=c99 -D_POSIX_C_SOURCE=200809L -O3 -march=native -pthread -I../Classes/Utilities -I../../GLImageProcessing tilescheduler_bench.c ../Classes/Utilities/TileScheduler.c ../../GLImageProcessing/CPUImaging.c -lm -o tilescheduler_bench
+//
+//  and run with no arguments.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "TileScheduler.h"
+#include "CPUImaging.h"
+
+typedef struct {
+	uint8_t *src, *dst;
+	size_t bytesPerRow;
+	int wide, high;
+	uint8_t *written;	// per pixel, for the coverage check
+} Frame;
+
+static int failures;
+
+static void deGreenTile( void *context, const Tile *tile )
+{
+	const Frame *f = context;
+	for ( int row = tile->y; row < tile->y + tile->high; row++ )
+	{
+		uint8_t *pixel = f->dst + row * f->bytesPerRow + tile->x * 4;
+		for ( int column = 0; column < tile->wide; column++ )
+		{
+			pixel[1] = 0;
+			pixel += 4;
+		}
+	}
+}
+
+// Mean of the 3x3 neighbourhood, edges clamped to the halo the scheduler gives
+static void boxTile( void *context, const Tile *tile )
+{
+	const Frame *f = context;
+	for ( int y = tile->y; y < tile->y + tile->high; y++ )
+	{
+		int y0 = (y - 1 < tile->haloY) ? tile->haloY : y - 1;
+		int y2 = (y + 1 >= tile->haloY + tile->haloHigh) ? tile->haloY + tile->haloHigh - 1 : y + 1;
+		const uint8_t *rows[3] = { f->src + y0 * f->bytesPerRow, f->src + y * f->bytesPerRow, f->src + y2 * f->bytesPerRow };
+		uint8_t *d = f->dst + y * f->bytesPerRow;
+		for ( int x = tile->x; x < tile->x + tile->wide; x++ )
+		{
+			int x0 = (x - 1 < tile->haloX) ? tile->haloX : x - 1;
+			int x2 = (x + 1 >= tile->haloX + tile->haloWide) ? tile->haloX + tile->haloWide - 1 : x + 1;
+			for ( int c = 0; c < 4; c++ )
+			{
+				int sum = 0;
+				for ( int k = 0; k < 3; k++ )
+					sum += rows[k][4 * x0 + c] + rows[k][4 * x + c] + rows[k][4 * x2 + c];
+				d[4 * x + c] = (uint8_t)((sum * 7282 + 32768) >> 16);	// sum / 9
+			}
+		}
+	}
+}
+
+static void saturationTile( void *context, const Tile *tile )
+{
+	const Frame *f = context;
+	CPUImage src = { f->src + tile->y * f->bytesPerRow + 4 * tile->x, tile->wide, tile->high, f->bytesPerRow };
+	CPUImage dst = { f->dst + tile->y * f->bytesPerRow + 4 * tile->x, tile->wide, tile->high, f->bytesPerRow };
+	cpuSaturation( &src, &dst, 1.6f );
+}
+
+static void coverageTile( void *context, const Tile *tile )
+{
+	const Frame *f = context;
+	int bOK = tile->haloX <= tile->x && tile->haloY <= tile->y &&
+	          tile->haloX + tile->haloWide >= tile->x + tile->wide && tile->haloY + tile->haloHigh >= tile->y + tile->high &&
+	          tile->haloX >= 0 && tile->haloY >= 0 && tile->haloX + tile->haloWide <= f->wide && tile->haloY + tile->haloHigh <= f->high;
+	for ( int y = tile->y; y < tile->y + tile->high; y++ )
+		for ( int x = tile->x; x < tile->x + tile->wide; x++ )
+			__atomic_add_fetch( &f->written[y * f->wide + x], bOK ? 1 : 100, __ATOMIC_RELAXED );
+}
+
+static const struct {
+	const char *name;
+	TileKernel kernel;
+	int bytesPerPixel, halo;
+} kernels[] = {
+	{ "de-green", deGreenTile, 4, 0 },
+	{ "box 3x3", boxTile, 8, 1 },
+	{ "saturation", saturationTile, 8, 0 },
+};
+#define kKernelCount (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check( int bOK, const char *what )
+{
+	printf( "%s  %s\n", bOK ? "pass" : "FAIL", what );
+	if ( ! bOK )
+		failures++;
+}
+
+static void frameCreate( Frame *f, int wide, int high )
+{
+	f->wide = wide;
+	f->high = high;
+	f->bytesPerRow = ((size_t)wide * 4 + 63) & ~(size_t)63;
+	f->src = malloc( f->bytesPerRow * high );
+	f->dst = malloc( f->bytesPerRow * high );
+	f->written = calloc( (size_t)wide * high, 1 );
+	for ( size_t i = 0; i < f->bytesPerRow * high; i++ )
+		f->src[i] = (uint8_t)rand();
+}
+
+static void frameDestroy( Frame *f )
+{
+	free( f->src );
+	free( f->dst );
+	free( f->written );
+}
+
+static void checkKernels( int wide, int high, int threads )
+{
+	TileScheduler *scheduler = TileSchedulerCreate( threads );
+	Frame f, serial;
+	char what[128];
+
+	frameCreate( &f, wide, high );
+	serial = f;
+	serial.dst = malloc( f.bytesPerRow * high );
+	for ( int k = 0; k < kKernelCount; k++ )
+	{
+		Tile whole = { 0, 0, wide, high, 0, 0, wide, high, 0, 0 };
+		int bSame = 1;
+		memcpy( f.dst, f.src, f.bytesPerRow * high );
+		memcpy( serial.dst, f.src, f.bytesPerRow * high );
+		kernels[k].kernel( &serial, &whole );
+		TileSchedulerRun( scheduler, wide, high, kernels[k].bytesPerPixel, kernels[k].halo, kernels[k].kernel, &f );
+		for ( int y = 0; y < high; y++ )
+			bSame = bSame && memcmp( f.dst + y * f.bytesPerRow, serial.dst + y * f.bytesPerRow, 4 * (size_t)wide ) == 0;
+		snprintf( what, sizeof(what), "%-10s %4dx%-4d %2d threads  same as serial", kernels[k].name, wide, high, threads );
+		check( bSame, what );
+	}
+
+	// Small tiles, so that there are many to steal
+	int bOnce = 1;
+	TileSchedulerRunTiles( scheduler, wide, high, 37, 5, 3, coverageTile, &f );
+	for ( int i = 0; i < wide * high; i++ )
+		bOnce = bOnce && f.written[i] == 1;
+	snprintf( what, sizeof(what), "coverage   %4dx%-4d %2d threads  every pixel once, halo in bounds", wide, high, threads );
+	check( bOnce, what );
+
+	free( serial.dst );
+	frameDestroy( &f );
+	TileSchedulerDestroy( scheduler );
+}
+
+static void timeKernels( int wide, int high )
+{
+	long cores = sysconf( _SC_NPROCESSORS_ONLN );
+	Frame f;
+
+	frameCreate( &f, wide, high );
+	memcpy( f.dst, f.src, f.bytesPerRow * high );
+	printf( "%dx%d, %ld cores:\n", wide, high, cores );
+	for ( int k = 0; k < kKernelCount; k++ )
+	{
+		double single = 0;
+		for ( int threads = 1; threads <= cores; threads++ )
+		{
+			TileScheduler *scheduler = TileSchedulerCreate( threads );
+			int tileWide, tileHigh, runs = 0;
+			double start, seconds, rate;
+
+			TileSchedulerTileSize( scheduler, wide, high, kernels[k].bytesPerPixel, kernels[k].halo, &tileWide, &tileHigh );
+			TileSchedulerRun( scheduler, wide, high, kernels[k].bytesPerPixel, kernels[k].halo, kernels[k].kernel, &f );
+			start = now();
+			do
+			{
+				TileSchedulerRun( scheduler, wide, high, kernels[k].bytesPerPixel, kernels[k].halo, kernels[k].kernel, &f );
+				runs++;
+				seconds = now() - start;
+			} while ( seconds < 0.5 );
+			rate = (double)wide * high * runs / seconds / 1e6;
+			single = (threads == 1) ? rate : single;
+			printf( "  %-10s %2d threads  %8.0f Mpixel/s  x%.2f  tiles %dx%d, %.2f ms a frame\n",
+			        kernels[k].name, threads, rate, rate / single, tileWide, tileHigh, 1000 * seconds / runs );
+			TileSchedulerDestroy( scheduler );
+		}
+	}
+	frameDestroy( &f );
+}
+
+int main( void )
+{
+	srand( 1 );
+	checkKernels( 1920, 1080, 1 );
+	checkKernels( 1920, 1080, 4 );
+	checkKernels( 333, 97, 7 );
+	checkKernels( 8000, 41, 3 );
+	checkKernels( 40000, 33, 3 );
+	timeKernels( 1920, 1080 );
+	timeKernels( 3840, 2160 );
+	printf( "%s\n", failures == 0 ? "all passed" : "FAILED" );
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,396 @@
+/*
+ See LICENSE.txt for this sample’s licensing information
+
+ Abstract:
+ Checks YUVConvert against floating-point references and measures it
+ */
+
+//
+//  Two references, both in double precision. The first works from the 16-bit
+//  fraction coefficients YUVConvert.h describes, rebuilt here from the matrix
+//  definitions, and every conversion must match it to the bit: the vector kernels
+//  and the plain C ones, NV12 and I420, all four matrix and range pairs. To BGRA,
+//  every Y, Cb and Cr is covered; to YCbCr, every R, G and B. Frames of odd widths
+//  and heights and padded rows check the edges. The second reference uses the exact
+//  BT.601 and BT.709 formulas, and nothing may be more than 1 away from it.
+//
+//  Then each conversion is timed at 1080p and 4K, vector and plain C, in ms a frame.
+//
+//  Build from this directory with:
+//
+//      cc -std=c99 -D_POSIX_C_SOURCE=200809L -O3 -march=native -I../Classes/Utilities yuv_bench.c ../Classes/Utilities/YUVConvert.c -lm -o yuv_bench
+//
+//  and run with no arguments. Without -march=native only the plain C kernels are built.
+//
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "YUVConvert.h"
+
+static int failures;
+
+static const char *matrixNames[] = { "601", "709" };
+static const char *rangeNames[] = { "video", "full" };
+
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check( int bOK, const char *what )
+{
+	printf( "%s  %s\n", bOK ? "pass" : "FAIL", what );
+	if ( ! bOK )
+		failures++;
+}
+
+static int clamp255( double v )
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : (int)v);
+}
+
+// The conversion, with either exact coefficients or ones rounded to 16 fractional bits
+typedef struct {
+	double yOffset, yScale, rCr, gCb, gCr, bCb;
+	double yR, yG, yB, cbR, cbG, cbB, crR, crG, crB;
+	int bFixed;
+} Reference;
+
+static Reference reference( YUVMatrix matrix, YUVRange range, int bFixed )
+{
+	double kr = matrix == YUVMatrixBT709 ? 0.2126 : 0.299, kb = matrix == YUVMatrixBT709 ? 0.0722 : 0.114, kg = 1 - kr - kb;
+	double ys = range == YUVRangeVideo ? 255.0 / 219 : 1, cs = range == YUVRangeVideo ? 255.0 / 224 : 1;
+	Reference r = { range == YUVRangeVideo ? 16 : 0, ys, 2 * (1 - kr) * cs, 2 * kb * (1 - kb) / kg * cs, 2 * kr * (1 - kr) / kg * cs, 2 * (1 - kb) * cs,
+	                kr / ys, kg / ys, kb / ys, -kr / (2 * (1 - kb)) / cs, -kg / (2 * (1 - kb)) / cs, 0.5 / cs,
+	                0.5 / cs, -kg / (2 * (1 - kr)) / cs, -kb / (2 * (1 - kr)) / cs, bFixed };
+	if ( bFixed )
+	{
+		double *c[] = { &r.yScale, &r.rCr, &r.gCb, &r.gCr, &r.bCb, &r.yR, &r.yB, &r.cbR, &r.cbB, &r.crR, &r.crB };
+		for ( size_t i = 0; i < sizeof(c) / sizeof(c[0]); i++ )
+			*c[i] = round( *c[i] * 65536 ) / 65536;
+		r.yG = round( 65536 / ys ) / 65536 - r.yR - r.yB;
+		r.cbG = -r.cbR - r.cbB;
+		r.crG = -r.crR - r.crB;
+	}
+	return r;
+}
+
+static int roundHalfUp( double v )
+{
+	return (int)floor( v + 0.5 );
+}
+
+static void referenceToBGRA( const Reference *r, int y, int cb, int cr, int bgr[3] )
+{
+	double l = (y - r->yOffset) * r->yScale, u = cb - 128, v = cr - 128;
+	bgr[0] = clamp255( roundHalfUp( l + r->bCb * u ) );
+	bgr[1] = clamp255( roundHalfUp( l - r->gCb * u - r->gCr * v ) );
+	bgr[2] = clamp255( roundHalfUp( l + r->rCr * v ) );
+}
+
+static int referenceLuma( const Reference *r, const uint8_t *p )
+{
+	return clamp255( roundHalfUp( r->yR * p[2] + r->yG * p[1] + r->yB * p[0] ) + r->yOffset );
+}
+
+// Chroma of a 2x2 block, the average of its pixels
+static void referenceChroma( const Reference *r, const uint8_t *p[4], int *cb, int *cr )
+{
+	double sb = 0, sg = 0, sr = 0;
+	for ( int i = 0; i < 4; i++ )
+	{
+		sb += p[i][0];
+		sg += p[i][1];
+		sr += p[i][2];
+	}
+	*cb = clamp255( roundHalfUp( (r->cbR * sr + r->cbG * sg + r->cbB * sb) / 4 ) + 128 );
+	*cr = clamp255( roundHalfUp( (r->crR * sr + r->crG * sg + r->crB * sb) / 4 ) + 128 );
+}
+
+typedef struct {
+	int width, height;
+	uint8_t *y, *cb, *cr;
+	size_t yBytesPerRow, cBytesPerRow;
+	int chromaStep;			// 2 for NV12, with cr = cb + 1
+} Planes;
+
+static Planes planesCreate( int width, int height, int chromaStep, int pad )
+{
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	Planes p = { width, height, NULL, NULL, NULL, (size_t)width + pad, (size_t)cw * chromaStep + pad, chromaStep };
+	p.y = malloc( p.yBytesPerRow * height );
+	p.cb = malloc( p.cBytesPerRow * ch * (chromaStep == 2 ? 1 : 2) );
+	p.cr = chromaStep == 2 ? p.cb + 1 : p.cb + p.cBytesPerRow * ch;
+	for ( size_t i = 0; i < p.yBytesPerRow * height; i++ )
+		p.y[i] = (uint8_t)rand();
+	for ( size_t i = 0; i < p.cBytesPerRow * ch * (chromaStep == 2 ? 1 : 2); i++ )
+		p.cb[i] = (uint8_t)rand();
+	return p;
+}
+
+static NV12Image asNV12( const Planes *p )
+{
+	NV12Image image = { p->width, p->height, p->y, p->yBytesPerRow, p->cb, p->cBytesPerRow };
+	return image;
+}
+
+static I420Image asI420( const Planes *p )
+{
+	I420Image image = { p->width, p->height, p->y, p->cb, p->cr, p->yBytesPerRow, p->cBytesPerRow, p->cBytesPerRow };
+	return image;
+}
+
+static uint8_t *chromaAt( const Planes *p, uint8_t *plane, int x, int y )
+{
+	return plane + (y / 2) * p->cBytesPerRow + (x / 2) * p->chromaStep;
+}
+
+static BGRAImage bgraCreate( int width, int height, int pad )
+{
+	BGRAImage image = { NULL, width, height, (size_t)width * 4 + pad };
+	image.base = malloc( image.bytesPerRow * height );
+	for ( size_t i = 0; i < image.bytesPerRow * height; i++ )
+		image.base[i] = (uint8_t)rand();
+	return image;
+}
+
+static void toBGRA( const Planes *p, const BGRAImage *dst, YUVMatrix matrix, YUVRange range )
+{
+	if ( p->chromaStep == 2 )
+	{
+		NV12Image src = asNV12( p );
+		YUVConvertNV12ToBGRA( &src, dst, matrix, range );
+	}
+	else
+	{
+		I420Image src = asI420( p );
+		YUVConvertI420ToBGRA( &src, dst, matrix, range );
+	}
+}
+
+static void fromBGRA( const BGRAImage *src, const Planes *p, YUVMatrix matrix, YUVRange range )
+{
+	if ( p->chromaStep == 2 )
+	{
+		NV12Image dst = asNV12( p );
+		YUVConvertBGRAToNV12( src, &dst, matrix, range );
+	}
+	else
+	{
+		I420Image dst = asI420( p );
+		YUVConvertBGRAToI420( src, &dst, matrix, range );
+	}
+}
+
+// Largest difference of the BGRA from the reference, or 1000 if alpha or padding is wrong
+static int compareBGRA( const Planes *p, const BGRAImage *image, const uint8_t *padding, const Reference *r )
+{
+	int worst = 0;
+	for ( int y = 0; y < p->height; y++ )
+	{
+		const uint8_t *row = image->base + y * image->bytesPerRow;
+		for ( int x = 0; x < p->width; x++ )
+		{
+			int bgr[3];
+			referenceToBGRA( r, p->y[y * p->yBytesPerRow + x], *chromaAt( p, p->cb, x, y ), *chromaAt( p, p->cr, x, y ), bgr );
+			for ( int c = 0; c < 3; c++ )
+				worst = fmax( worst, abs( row[4 * x + c] - bgr[c] ) );
+			if ( row[4 * x + 3] != 255 )
+				worst = 1000;
+		}
+		if ( padding && memcmp( row + 4 * p->width, padding + y * image->bytesPerRow + 4 * p->width, image->bytesPerRow - 4 * p->width ) != 0 )
+			worst = 1000;
+	}
+	return worst;
+}
+
+static int compareYCbCr( const BGRAImage *image, const Planes *p, const Reference *r )
+{
+	int worst = 0;
+	for ( int y = 0; y < p->height; y++ )
+		for ( int x = 0; x < p->width; x++ )
+		{
+			const uint8_t *pixel = image->base + y * image->bytesPerRow + 4 * x;
+			worst = fmax( worst, abs( p->y[y * p->yBytesPerRow + x] - referenceLuma( r, pixel ) ) );
+			if ( (x & 1) == 0 && (y & 1) == 0 )
+			{
+				// Missing pixels of an edge block are copies of their neighbours
+				int x1 = x + 1 < p->width ? x + 1 : x, y1 = y + 1 < p->height ? y + 1 : y;
+				const uint8_t *block[4] = { pixel, pixel + 4 * (x1 - x), pixel + (y1 - y) * image->bytesPerRow, pixel + (y1 - y) * image->bytesPerRow + 4 * (x1 - x) };
+				int cb, cr;
+				referenceChroma( r, block, &cb, &cr );
+				worst = fmax( worst, abs( *chromaAt( p, p->cb, x, y ) - cb ) );
+				worst = fmax( worst, abs( *chromaAt( p, p->cr, x, y ) - cr ) );
+			}
+		}
+	return worst;
+}
+
+// Every Y, Cb and Cr, in 64 frames of 512x512: chroma 256x256, each sample over 4 lumas
+static void checkEveryYCbCr( YUVMatrix matrix, YUVRange range )
+{
+	Reference fixed = reference( matrix, range, 1 ), exact = reference( matrix, range, 0 );
+	Planes p = planesCreate( 512, 512, 2, 0 );
+	BGRAImage image = bgraCreate( 512, 512, 0 );
+	int worstFixed[2] = { 0, 0 }, worstExact = 0;
+	char what[128];
+
+	for ( int i = 0; i < 256 * 256; i++ )
+	{
+		p.cb[2 * i] = (uint8_t)i;
+		p.cb[2 * i + 1] = (uint8_t)(i >> 8);
+	}
+	for ( int frame = 0; frame < 64; frame++ )
+	{
+		for ( int y = 0; y < 512; y++ )
+			for ( int x = 0; x < 512; x++ )
+				p.y[y * 512 + x] = (uint8_t)(frame * 4 + (y & 1) * 2 + (x & 1));
+		for ( int simd = 0; simd < 2; simd++ )
+		{
+			YUVConvertSetSIMD( simd );
+			toBGRA( &p, &image, matrix, range );
+			worstFixed[simd] = fmax( worstFixed[simd], compareBGRA( &p, &image, NULL, &fixed ) );
+		}
+		worstExact = fmax( worstExact, compareBGRA( &p, &image, NULL, &exact ) );
+	}
+	YUVConvertSetSIMD( 1 );
+
+	snprintf( what, sizeof(what), "to BGRA   %s %-5s every YCbCr  %s and scalar same as fixed-point reference", matrixNames[matrix], rangeNames[range], YUVConvertEngine() );
+	check( worstFixed[0] == 0 && worstFixed[1] == 0, what );
+	snprintf( what, sizeof(what), "to BGRA   %s %-5s every YCbCr  within 1 of exact, worst %d", matrixNames[matrix], rangeNames[range], worstExact );
+	check( worstExact <= 1, what );
+	free( p.y );
+	free( p.cb );
+	free( image.base );
+}
+
+// Every R, G and B, in a 4096x4096 frame
+static void checkEveryRGB( YUVMatrix matrix, YUVRange range )
+{
+	Reference fixed = reference( matrix, range, 1 ), exact = reference( matrix, range, 0 );
+	BGRAImage image = bgraCreate( 4096, 4096, 0 );
+	Planes p = planesCreate( 4096, 4096, 2, 0 );
+	int worstFixed[2], worstExact;
+	char what[128];
+
+	for ( int i = 0; i < 4096 * 4096; i++ )
+	{
+		// Neighbours differ in every channel, so that the 2x2 blocks mix colors
+		uint32_t c = (uint32_t)i * 2654435761u >> 8;
+		image.base[4 * i + 0] = (uint8_t)c;
+		image.base[4 * i + 1] = (uint8_t)(c >> 8);
+		image.base[4 * i + 2] = (uint8_t)(c >> 16);
+	}
+	for ( int simd = 0; simd < 2; simd++ )
+	{
+		YUVConvertSetSIMD( simd );
+		fromBGRA( &image, &p, matrix, range );
+		worstFixed[simd] = compareYCbCr( &image, &p, &fixed );
+	}
+	YUVConvertSetSIMD( 1 );
+	worstExact = compareYCbCr( &image, &p, &exact );
+
+	snprintf( what, sizeof(what), "to YCbCr  %s %-5s every RGB    %s and scalar same as fixed-point reference", matrixNames[matrix], rangeNames[range], YUVConvertEngine() );
+	check( worstFixed[0] == 0 && worstFixed[1] == 0, what );
+	snprintf( what, sizeof(what), "to YCbCr  %s %-5s every RGB    within 1 of exact, worst %d", matrixNames[matrix], rangeNames[range], worstExact );
+	check( worstExact <= 1, what );
+	free( image.base );
+	free( p.y );
+	free( p.cb );
+}
+
+// Odd sizes and padded rows, NV12 and I420, vector and plain C
+static void checkEdges( int width, int height )
+{
+	Reference fixed = reference( YUVMatrixBT709, YUVRangeVideo, 1 );
+	int bOK = 1;
+	char what[128];
+
+	for ( int chromaStep = 1; chromaStep <= 2; chromaStep++ )
+		for ( int simd = 0; simd < 2; simd++ )
+		{
+			Planes p = planesCreate( width, height, chromaStep, 5 );
+			BGRAImage image = bgraCreate( width, height, 12 );
+			uint8_t *padding = malloc( image.bytesPerRow * height );
+
+			YUVConvertSetSIMD( simd );
+			memcpy( padding, image.base, image.bytesPerRow * height );
+			toBGRA( &p, &image, YUVMatrixBT709, YUVRangeVideo );
+			bOK = bOK && compareBGRA( &p, &image, padding, &fixed ) == 0;
+			fromBGRA( &image, &p, YUVMatrixBT709, YUVRangeVideo );
+			bOK = bOK && compareYCbCr( &image, &p, &fixed ) == 0;
+
+			free( padding );
+			free( image.base );
+			free( p.y );
+			free( p.cb );
+		}
+	YUVConvertSetSIMD( 1 );
+	snprintf( what, sizeof(what), "edges     %4dx%-4d  NV12 and I420, both ways, padding untouched", width, height );
+	check( bOK, what );
+}
+
+static void timeConversions( int width, int height )
+{
+	Planes nv12 = planesCreate( width, height, 2, 0 ), i420 = planesCreate( width, height, 1, 0 );
+	BGRAImage image = bgraCreate( width, height, 0 );
+	static const char *names[] = { "NV12 to BGRA", "I420 to BGRA", "BGRA to NV12", "BGRA to I420" };
+
+	printf( "%dx%d, BT.709 video range, ms a frame:\n", width, height );
+	for ( int c = 0; c < 4; c++ )
+	{
+		double ms[2];
+		for ( int simd = 1; simd >= 0; simd-- )
+		{
+			const Planes *p = (c & 1) ? &i420 : &nv12;
+			double start, seconds;
+			int runs = 0;
+			YUVConvertSetSIMD( simd );
+			start = now();
+			do
+			{
+				if ( c < 2 )
+					toBGRA( p, &image, YUVMatrixBT709, YUVRangeVideo );
+				else
+					fromBGRA( &image, p, YUVMatrixBT709, YUVRangeVideo );
+				runs++;
+				seconds = now() - start;
+			} while ( seconds < 0.3 );
+			ms[simd] = 1000 * seconds / runs;
+		}
+		YUVConvertSetSIMD( 1 );
+		printf( "  %s  %s %6.2f  scalar %6.2f  x%.1f\n", names[c], YUVConvertEngine(), ms[1], ms[0], ms[0] / ms[1] );
+	}
+	free( nv12.y );
+	free( nv12.cb );
+	free( i420.y );
+	free( i420.cb );
+	free( image.base );
+}
+
+int main( void )
+{
+	srand( 1 );
+	for ( int m = 0; m < 2; m++ )
+		for ( int r = 0; r < 2; r++ )
+		{
+			checkEveryYCbCr( (YUVMatrix)m, (YUVRange)r );
+			checkEveryRGB( (YUVMatrix)m, (YUVRange)r );
+		}
+	checkEdges( 1, 1 );
+	checkEdges( 3, 5 );
+	checkEdges( 17, 9 );
+	checkEdges( 33, 2 );
+	checkEdges( 1283, 7 );
+	checkEdges( 1920, 1080 );
+	timeConversions( 1920, 1080 );
+	timeConversions( 3840, 2160 );
+	printf( "%s\n", failures == 0 ? "all passed" : "FAILED" );
+	return failures == 0 ? 0 : 1;
+}